@@ -0,0 +1,122 @@
+#ifndef __AUDIO_DSP_H__
+#define __AUDIO_DSP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sample format conversion, channel mixing and resampling for PCM audio.
+ * Float samples are in [-1, 1); S16 is converted with a scale of 32768,
+ * and float to S16 rounds to nearest and saturates. Interleaved buffers
+ * hold frames of channels samples; planar buffers are one pointer per
+ * channel. Input and output must not overlap.
+ */
+
+void audio_s16_to_f32(const int16_t* in, float* out, size_t samples);
+void audio_f32_to_s16(const float* in, int16_t* out, size_t samples);
+
+// Between interleaved S16 and planar float, as used by AAC encoders
+void audio_s16_to_f32_planar(const int16_t* in, float* const* out, size_t frames, unsigned int channels);
+void audio_f32_planar_to_s16(const float* const* in, int16_t* out, size_t frames, unsigned int channels);
+
+// Between planar and interleaved S16
+void audio_s16_interleave(const int16_t* const* in, int16_t* out, size_t frames, unsigned int channels);
+void audio_s16_deinterleave(const int16_t* in, int16_t* const* out, size_t frames, unsigned int channels);
+
+/*
+ * Channel up- and downmix of interleaved frames. Mono is copied to every
+ * output channel, and any layout is averaged down to mono. Otherwise the
+ * first channels are copied, and output channels the input lacks get the
+ * average of the input.
+ */
+void audio_mix_s16(const int16_t* in, unsigned int in_channels, int16_t* out, unsigned int out_channels, size_t frames);
+void audio_mix_f32(const float* in, unsigned int in_channels, float* out, unsigned int out_channels, size_t frames);
+
+/*
+ * Polyphase resampler between any two of the usual rates, e.g. 8000,
+ * 16000, 44100 and 48000 Hz. The filter bank is designed once when the
+ * resampler is created; processing works in place in the resampler's own
+ * buffers and never allocates.
+ */
+typedef struct audio_resampler audio_resampler_t;
+
+audio_resampler_t* audio_resampler_create(unsigned int in_rate, unsigned int out_rate, unsigned int channels);
+void audio_resampler_destroy(audio_resampler_t* rs);
+
+// Forgets buffered input, as at the start of a new stream
+void audio_resampler_reset(audio_resampler_t* rs);
+
+// Upper bound of the output frames for in_frames of input, unless an
+// earlier call ran out of output room and left frames pending
+size_t audio_resampler_max_out(const audio_resampler_t* rs, size_t in_frames);
+
+// Filter delay, in output frames
+unsigned int audio_resampler_delay(const audio_resampler_t* rs);
+
+/*
+ * Resample interleaved frames. On entry *in_frames and *out_frames give
+ * the sizes of the buffers; on return they hold the frames consumed and
+ * produced. All input is consumed unless the output fills up first;
+ * frames that did not fit come out of the next call, which may pass no
+ * input to collect them.
+ */
+void audio_resampler_process_f32(audio_resampler_t* rs, const float* in, size_t* in_frames, float* out, size_t* out_frames);
+void audio_resampler_process_s16(audio_resampler_t* rs, const int16_t* in, size_t* in_frames, int16_t* out, size_t* out_frames);
+
+/*
+ * Real FFT of a power-of-two length n, in single precision and without
+ * scaling. The output is the n / 2 + 1 bins from DC to the Nyquist
+ * frequency, as interleaved real and imaginary parts, so n + 2 floats.
+ * A plan holds its own work buffers and is used by one thread at a time.
+ */
+typedef struct audio_fft audio_fft_t;
+
+audio_fft_t* audio_fft_create(unsigned int n);
+void audio_fft_destroy(audio_fft_t* fft);
+unsigned int audio_fft_size(const audio_fft_t* fft);
+void audio_fft_real(audio_fft_t* fft, const float* in, float* out);
+
+/*
+ * Log-mel spectrogram, computed as audio arrives: each window of mono
+ * S16 samples is Hann windowed, transformed once, and reduced to mels
+ * values of log(mel energy + log_offset), with S16 full scale as 1. The
+ * defaults are those of the VGGish and YAMNet front ends, 25 ms windows
+ * every 10 ms at 16 kHz into 64 bands from 125 to 7500 Hz.
+ */
+typedef struct audio_mel_config {
+    unsigned int rate;
+    unsigned int window;   // Samples per window
+    unsigned int hop;      // Samples between windows, at most window
+    unsigned int fft_size; // Power of two, at least window
+    unsigned int mels;
+    float fmin;            // Band edges, in Hz
+    float fmax;
+    float log_offset;
+    int power;             // Sum power rather than magnitude into the bands
+} audio_mel_config_t;
+
+typedef struct audio_mel audio_mel_t;
+
+void audio_mel_default_config(audio_mel_config_t* config);
+audio_mel_t* audio_mel_create(const audio_mel_config_t* config);
+void audio_mel_destroy(audio_mel_t* mel);
+
+// Forgets the partial window, as at the start of a new stream
+void audio_mel_reset(audio_mel_t* mel);
+
+// Upper bound of the frames produced by samples more samples
+size_t audio_mel_max_frames(const audio_mel_t* mel, size_t samples);
+
+// Consumes all the samples; writes the frames completed, mels values each,
+// and returns their number
+size_t audio_mel_process_s16(audio_mel_t* mel, const int16_t* in, size_t samples, float* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __AUDIO_DSP_H__
@@ -0,0 +1,97 @@
+#ifndef __AUDIO_DSP_INTERNAL_H__
+#define __AUDIO_DSP_INTERNAL_H__
+
+#include <string.h>
+
+#include "audio_dsp.h"
+
+/*
+ * The kernels use GCC vector types rather than target intrinsics. They
+ * lower to SSE2 or NEON on a host, and to the C906 vector unit with the
+ * toolchain's -march=rv64gcv0p7. Define AUDIO_DSP_SCALAR, or build with
+ * another compiler, to get the plain loops instead.
+ */
+#if defined(__GNUC__) && !defined(AUDIO_DSP_SCALAR)
+#define AUDIO_DSP_VECTOR 1
+
+typedef float v4f __attribute__((vector_size(16)));
+typedef int32_t v4i __attribute__((vector_size(16)));
+typedef int16_t v8s __attribute__((vector_size(16)));
+
+#if defined(__clang__)
+#define shuffle_v8s(a, b, ...) __builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+#define shuffle_v8s(a, b, ...) __builtin_shuffle(a, b, (v8s) { __VA_ARGS__ })
+#endif
+
+static inline v4f load_v4f(const float* p)
+{
+    v4f v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_v4f(float* p, v4f v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline v8s load_v8s(const int16_t* p)
+{
+    v8s v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_v8s(int16_t* p, v8s v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+// Widening all eight lanes at once lets the compiler use unpacks
+static inline void s16_to_f32_v8(float* out, v8s x)
+{
+    typedef float v8f __attribute__((vector_size(32)));
+    v8f f = __builtin_convertvector(x, v8f) * (1.0f / 32768.0f);
+
+    memcpy(out, &f, sizeof(f));
+}
+
+// Scale, saturate and round four floats, into 32-bit lanes
+static inline v4i f32_to_s16_v4(v4f x)
+{
+    const v4f hi = { 32767.0f, 32767.0f, 32767.0f, 32767.0f };
+    const v4f lo = { -32768.0f, -32768.0f, -32768.0f, -32768.0f };
+    v4i above, below;
+
+    x = x * 32768.0f;
+    above = x > hi;
+    below = x < lo;
+    x = (v4f)((above & (v4i)hi) | (below & (v4i)lo) | (~(above | below) & (v4i)x));
+    // Conversion truncates; offsetting to positive values makes it round
+    return __builtin_convertvector(x + 32768.5f, v4i) - 32768;
+}
+
+static inline v8s f32_to_s16_v8(const float* in)
+{
+    v4i words[2] = { f32_to_s16_v4(load_v4f(in)), f32_to_s16_v4(load_v4f(in + 4)) };
+    v8s half[2];
+
+    // The low halves of the words, as a shuffle since not every target
+    // has a truncating narrow (little endian)
+    memcpy(half, words, sizeof(words));
+    return shuffle_v8s(half[0], half[1], 0, 2, 4, 6, 8, 10, 12, 14);
+}
+#endif
+
+static inline int16_t f32_to_s16(float x)
+{
+    x = x * 32768.0f;
+    if (x >= 32767.0f)
+        return 32767;
+    if (x <= -32768.0f)
+        return -32768;
+    return (int16_t)((int32_t)(x + 32768.5f) - 32768);
+}
+
+#endif // __AUDIO_DSP_INTERNAL_H__
@@ -0,0 +1,125 @@
+#include "audio_dsp_internal.h"
+
+void audio_s16_to_f32(const int16_t* in, float* out, size_t samples)
+{
+    size_t i = 0;
+
+#ifdef AUDIO_DSP_VECTOR
+    for (; i + 8 <= samples; i += 8)
+        s16_to_f32_v8(out + i, load_v8s(in + i));
+#endif
+    for (; i < samples; i++)
+        out[i] = in[i] * (1.0f / 32768.0f);
+}
+
+void audio_f32_to_s16(const float* in, int16_t* out, size_t samples)
+{
+    size_t i = 0;
+
+#ifdef AUDIO_DSP_VECTOR
+    for (; i + 8 <= samples; i += 8)
+        store_v8s(out + i, f32_to_s16_v8(in + i));
+#endif
+    for (; i < samples; i++)
+        out[i] = f32_to_s16(in[i]);
+}
+
+void audio_s16_to_f32_planar(const int16_t* in, float* const* out, size_t frames, unsigned int channels)
+{
+    size_t i = 0;
+
+    if (channels == 1) {
+        audio_s16_to_f32(in, out[0], frames);
+        return;
+    }
+
+#ifdef AUDIO_DSP_VECTOR
+    if (channels == 2) {
+        for (; i + 8 <= frames; i += 8) {
+            v8s a = load_v8s(in + i * 2);
+            v8s b = load_v8s(in + i * 2 + 8);
+            s16_to_f32_v8(out[0] + i, shuffle_v8s(a, b, 0, 2, 4, 6, 8, 10, 12, 14));
+            s16_to_f32_v8(out[1] + i, shuffle_v8s(a, b, 1, 3, 5, 7, 9, 11, 13, 15));
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (unsigned int c = 0; c < channels; c++)
+            out[c][i] = in[i * channels + c] * (1.0f / 32768.0f);
+    }
+}
+
+void audio_f32_planar_to_s16(const float* const* in, int16_t* out, size_t frames, unsigned int channels)
+{
+    size_t i = 0;
+
+    if (channels == 1) {
+        audio_f32_to_s16(in[0], out, frames);
+        return;
+    }
+
+#ifdef AUDIO_DSP_VECTOR
+    if (channels == 2) {
+        for (; i + 8 <= frames; i += 8) {
+            v8s l = f32_to_s16_v8(in[0] + i);
+            v8s r = f32_to_s16_v8(in[1] + i);
+            store_v8s(out + i * 2, shuffle_v8s(l, r, 0, 8, 1, 9, 2, 10, 3, 11));
+            store_v8s(out + i * 2 + 8, shuffle_v8s(l, r, 4, 12, 5, 13, 6, 14, 7, 15));
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (unsigned int c = 0; c < channels; c++)
+            out[i * channels + c] = f32_to_s16(in[c][i]);
+    }
+}
+
+void audio_s16_interleave(const int16_t* const* in, int16_t* out, size_t frames, unsigned int channels)
+{
+    size_t i = 0;
+
+    if (channels == 1) {
+        memcpy(out, in[0], frames * sizeof(*out));
+        return;
+    }
+
+#ifdef AUDIO_DSP_VECTOR
+    if (channels == 2) {
+        for (; i + 8 <= frames; i += 8) {
+            v8s l = load_v8s(in[0] + i);
+            v8s r = load_v8s(in[1] + i);
+            store_v8s(out + i * 2, shuffle_v8s(l, r, 0, 8, 1, 9, 2, 10, 3, 11));
+            store_v8s(out + i * 2 + 8, shuffle_v8s(l, r, 4, 12, 5, 13, 6, 14, 7, 15));
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (unsigned int c = 0; c < channels; c++)
+            out[i * channels + c] = in[c][i];
+    }
+}
+
+void audio_s16_deinterleave(const int16_t* in, int16_t* const* out, size_t frames, unsigned int channels)
+{
+    size_t i = 0;
+
+    if (channels == 1) {
+        memcpy(out[0], in, frames * sizeof(*in));
+        return;
+    }
+
+#ifdef AUDIO_DSP_VECTOR
+    if (channels == 2) {
+        for (; i + 8 <= frames; i += 8) {
+            v8s a = load_v8s(in + i * 2);
+            v8s b = load_v8s(in + i * 2 + 8);
+            store_v8s(out[0] + i, shuffle_v8s(a, b, 0, 2, 4, 6, 8, 10, 12, 14));
+            store_v8s(out[1] + i, shuffle_v8s(a, b, 1, 3, 5, 7, 9, 11, 13, 15));
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (unsigned int c = 0; c < channels; c++)
+            out[c][i] = in[i * channels + c];
+    }
+}
@@ -0,0 +1,207 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "audio_dsp_internal.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * A real FFT of n points is a complex FFT of m = n / 2 points on the even
+ * and odd samples as real and imaginary parts, followed by a pass that
+ * separates the two spectra. The complex FFT is an iterative radix-2
+ * decimation in time on split real and imaginary arrays, so that from the
+ * third stage on four butterflies are one vector operation, with the
+ * twiddle factors of each stage stored contiguously.
+ */
+struct audio_fft {
+    unsigned int n;
+    unsigned int m;
+    unsigned int* reverse; // Bit reversal of m
+    float* twiddle_re;     // Stage with half length h starts at h - 1
+    float* twiddle_im;
+    float* post_re;        // exp(-2 pi i k / n), k < m
+    float* post_im;
+    float* re;
+    float* im;
+};
+
+audio_fft_t* audio_fft_create(unsigned int n)
+{
+    audio_fft_t* fft;
+    unsigned int m = n / 2, bits = 0;
+
+    if (n < 4 || (n & (n - 1)))
+        return NULL;
+
+    fft = calloc(1, sizeof(*fft));
+    if (!fft)
+        return NULL;
+
+    fft->n = n;
+    fft->m = m;
+    fft->reverse = malloc(m * sizeof(*fft->reverse));
+    fft->twiddle_re = malloc(m * sizeof(float));
+    fft->twiddle_im = malloc(m * sizeof(float));
+    fft->post_re = malloc(m * sizeof(float));
+    fft->post_im = malloc(m * sizeof(float));
+    fft->re = malloc(m * sizeof(float));
+    fft->im = malloc(m * sizeof(float));
+    if (!fft->reverse || !fft->twiddle_re || !fft->twiddle_im || !fft->post_re || !fft->post_im || !fft->re
+        || !fft->im) {
+        audio_fft_destroy(fft);
+        return NULL;
+    }
+
+    while ((1u << bits) < m)
+        bits++;
+    for (unsigned int i = 0; i < m; i++) {
+        unsigned int r = 0;
+
+        for (unsigned int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        fft->reverse[i] = r;
+    }
+
+    for (unsigned int h = 1; h < m; h <<= 1) {
+        for (unsigned int k = 0; k < h; k++) {
+            double a = -M_PI * k / h;
+
+            fft->twiddle_re[h - 1 + k] = (float)cos(a);
+            fft->twiddle_im[h - 1 + k] = (float)sin(a);
+        }
+    }
+    for (unsigned int k = 0; k < m; k++) {
+        double a = -2.0 * M_PI * k / n;
+
+        fft->post_re[k] = (float)cos(a);
+        fft->post_im[k] = (float)sin(a);
+    }
+
+    return fft;
+}
+
+void audio_fft_destroy(audio_fft_t* fft)
+{
+    if (!fft)
+        return;
+
+    free(fft->reverse);
+    free(fft->twiddle_re);
+    free(fft->twiddle_im);
+    free(fft->post_re);
+    free(fft->post_im);
+    free(fft->re);
+    free(fft->im);
+    free(fft);
+}
+
+unsigned int audio_fft_size(const audio_fft_t* fft)
+{
+    return fft->n;
+}
+
+// The first two stages together, as radix-4 butterflies without multiplies
+static void first_stages(float* re, float* im, unsigned int m)
+{
+    if (m == 2) {
+        float r = re[1], i = im[1];
+
+        re[1] = re[0] - r;
+        im[1] = im[0] - i;
+        re[0] += r;
+        im[0] += i;
+        return;
+    }
+
+    for (unsigned int b = 0; b < m; b += 4) {
+        float ar = re[b] + re[b + 1], ai = im[b] + im[b + 1];
+        float br = re[b] - re[b + 1], bi = im[b] - im[b + 1];
+        float cr = re[b + 2] + re[b + 3], ci = im[b + 2] + im[b + 3];
+        float dr = re[b + 2] - re[b + 3], di = im[b + 2] - im[b + 3];
+
+        // d is multiplied by -i, the twiddle factor of the second stage
+        re[b] = ar + cr;
+        im[b] = ai + ci;
+        re[b + 2] = ar - cr;
+        im[b + 2] = ai - ci;
+        re[b + 1] = br + di;
+        im[b + 1] = bi - dr;
+        re[b + 3] = br - di;
+        im[b + 3] = bi + dr;
+    }
+}
+
+static void stage(const audio_fft_t* fft, float* re, float* im, unsigned int h)
+{
+    const float* wr = fft->twiddle_re + h - 1;
+    const float* wi = fft->twiddle_im + h - 1;
+
+    for (unsigned int b = 0; b < fft->m; b += 2 * h) {
+        float* ur = re + b;
+        float* ui = im + b;
+        float* vr = ur + h;
+        float* vi = ui + h;
+        unsigned int k = 0;
+
+#ifdef AUDIO_DSP_VECTOR
+        for (; k + 4 <= h; k += 4) {
+            v4f xr = load_v4f(vr + k), xi = load_v4f(vi + k);
+            v4f cr = load_v4f(wr + k), ci = load_v4f(wi + k);
+            v4f tr = xr * cr - xi * ci;
+            v4f ti = xr * ci + xi * cr;
+            v4f yr = load_v4f(ur + k), yi = load_v4f(ui + k);
+
+            store_v4f(ur + k, yr + tr);
+            store_v4f(ui + k, yi + ti);
+            store_v4f(vr + k, yr - tr);
+            store_v4f(vi + k, yi - ti);
+        }
+#endif
+        for (; k < h; k++) {
+            float tr = vr[k] * wr[k] - vi[k] * wi[k];
+            float ti = vr[k] * wi[k] + vi[k] * wr[k];
+
+            vr[k] = ur[k] - tr;
+            vi[k] = ui[k] - ti;
+            ur[k] += tr;
+            ui[k] += ti;
+        }
+    }
+}
+
+void audio_fft_real(audio_fft_t* fft, const float* in, float* out)
+{
+    unsigned int m = fft->m;
+    float* re = fft->re;
+    float* im = fft->im;
+
+    for (unsigned int j = 0; j < m; j++) {
+        re[fft->reverse[j]] = in[2 * j];
+        im[fft->reverse[j]] = in[2 * j + 1];
+    }
+
+    first_stages(re, im, m);
+    for (unsigned int h = 4; h < m; h <<= 1)
+        stage(fft, re, im, h);
+
+    /*
+     * With Z the transform of the packed samples, the even and odd halves
+     * are E = (Z[k] + conj(Z[m - k])) / 2 and O = -i (Z[k] - conj(Z[m - k])) / 2,
+     * and X[k] = E + exp(-2 pi i k / n) O.
+     */
+    out[0] = re[0] + im[0];
+    out[1] = 0.0f;
+    out[2 * m] = re[0] - im[0];
+    out[2 * m + 1] = 0.0f;
+    for (unsigned int k = 1; k < m; k++) {
+        float er = 0.5f * (re[k] + re[m - k]);
+        float ei = 0.5f * (im[k] - im[m - k]);
+        float odd_r = 0.5f * (im[k] + im[m - k]);
+        float odd_i = -0.5f * (re[k] - re[m - k]);
+
+        out[2 * k] = er + fft->post_re[k] * odd_r - fft->post_im[k] * odd_i;
+        out[2 * k + 1] = ei + fft->post_re[k] * odd_i + fft->post_im[k] * odd_r;
+    }
+}
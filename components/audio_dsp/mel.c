@@ -0,0 +1,238 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "audio_dsp_internal.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct audio_mel {
+    audio_mel_config_t config;
+    unsigned int bins;     // fft_size / 2 + 1
+    audio_fft_t* fft;
+    float* window;         // Hann, scaled for S16 input
+    float* frame;          // fft_size, zero padded after the window
+    float* spectrum;       // Interleaved, bins pairs
+    float* magnitude;      // bins
+    float* weights;        // Nonzero weights of each filter, one after the other
+    unsigned int* first;   // First bin of each filter
+    unsigned int* count;   // Bins of each filter
+    int16_t* history;      // The window so far
+    size_t fill;
+};
+
+// The HTK mel scale, as in the VGGish and YAMNet front ends
+static double hz_to_mel(double hz)
+{
+    return 1127.0 * log(1.0 + hz / 700.0);
+}
+
+void audio_mel_default_config(audio_mel_config_t* config)
+{
+    memset(config, 0, sizeof(*config));
+    config->rate = 16000;
+    config->window = 400;
+    config->hop = 160;
+    config->fft_size = 512;
+    config->mels = 64;
+    config->fmin = 125.0f;
+    config->fmax = 7500.0f;
+    config->log_offset = 0.001f;
+}
+
+/*
+ * Triangular filters with edges evenly spaced in mel between fmin and
+ * fmax, weighted by where each bin's frequency falls in mel, as done by
+ * tf.signal.linear_to_mel_weight_matrix. Only the nonzero weights are kept.
+ */
+static int design(audio_mel_t* mel)
+{
+    const audio_mel_config_t* c = &mel->config;
+    double lo = hz_to_mel(c->fmin);
+    double step = (hz_to_mel(c->fmax) - lo) / (c->mels + 1);
+    size_t total = 0;
+
+    // The weights are counted, then stored
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        total = 0;
+        for (unsigned int f = 0; f < c->mels; f++) {
+            double left = lo + f * step;
+            double center = left + step;
+            double right = center + step;
+            unsigned int n = 0;
+
+            mel->first[f] = 0;
+            for (unsigned int b = 1; b < mel->bins; b++) {
+                double m = hz_to_mel((double)b * c->rate / c->fft_size);
+                double w = m <= center ? (m - left) / step : (right - m) / step;
+
+                if (w <= 0.0) {
+                    if (n)
+                        break;
+                    continue;
+                }
+                if (!n)
+                    mel->first[f] = b;
+                if (pass)
+                    mel->weights[total + n] = (float)w;
+                n++;
+            }
+            mel->count[f] = n;
+            total += n;
+        }
+
+        if (!pass) {
+            mel->weights = malloc((total ? total : 1) * sizeof(*mel->weights));
+            if (!mel->weights)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+audio_mel_t* audio_mel_create(const audio_mel_config_t* config)
+{
+    audio_mel_t* mel;
+    unsigned int n = config->fft_size;
+
+    if (config->rate == 0 || config->window == 0 || config->hop == 0 || config->hop > config->window
+        || config->window > n || config->mels == 0 || config->fmin < 0.0f || config->fmin >= config->fmax
+        || config->fmax > config->rate / 2.0f || config->log_offset <= 0.0f)
+        return NULL;
+
+    mel = calloc(1, sizeof(*mel));
+    if (!mel)
+        return NULL;
+
+    mel->config = *config;
+    mel->bins = n / 2 + 1;
+    mel->fft = audio_fft_create(n);
+    mel->window = malloc(config->window * sizeof(float));
+    mel->frame = calloc(n, sizeof(float));
+    mel->spectrum = malloc((n + 2) * sizeof(float));
+    mel->magnitude = malloc(mel->bins * sizeof(float));
+    mel->first = malloc(config->mels * sizeof(*mel->first));
+    mel->count = malloc(config->mels * sizeof(*mel->count));
+    mel->history = malloc(config->window * sizeof(*mel->history));
+    if (!mel->fft || !mel->window || !mel->frame || !mel->spectrum || !mel->magnitude || !mel->first || !mel->count
+        || !mel->history || design(mel)) {
+        audio_mel_destroy(mel);
+        return NULL;
+    }
+
+    // Periodic Hann, which overlaps-adds to a constant at the usual hops
+    for (unsigned int i = 0; i < config->window; i++)
+        mel->window[i] = (float)((0.5 - 0.5 * cos(2.0 * M_PI * i / config->window)) / 32768.0);
+
+    return mel;
+}
+
+void audio_mel_destroy(audio_mel_t* mel)
+{
+    if (!mel)
+        return;
+
+    audio_fft_destroy(mel->fft);
+    free(mel->window);
+    free(mel->frame);
+    free(mel->spectrum);
+    free(mel->magnitude);
+    free(mel->weights);
+    free(mel->first);
+    free(mel->count);
+    free(mel->history);
+    free(mel);
+}
+
+void audio_mel_reset(audio_mel_t* mel)
+{
+    mel->fill = 0;
+}
+
+size_t audio_mel_max_frames(const audio_mel_t* mel, size_t samples)
+{
+    size_t total = mel->fill + samples;
+
+    if (total < mel->config.window)
+        return 0;
+    return (total - mel->config.window) / mel->config.hop + 1;
+}
+
+static void apply_window(audio_mel_t* mel)
+{
+    const int16_t* x = mel->history;
+    const float* w = mel->window;
+    float* out = mel->frame;
+    unsigned int n = mel->config.window;
+    unsigned int i = 0;
+
+#ifdef AUDIO_DSP_VECTOR
+    typedef float v8f __attribute__((vector_size(32)));
+
+    for (; i + 8 <= n; i += 8) {
+        v8f f = __builtin_convertvector(load_v8s(x + i), v8f);
+        v8f c;
+
+        memcpy(&c, w + i, sizeof(c));
+        f *= c;
+        memcpy(out + i, &f, sizeof(f));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = x[i] * w[i];
+}
+
+static void mel_frame(audio_mel_t* mel, float* out)
+{
+    const audio_mel_config_t* c = &mel->config;
+    const float* s = mel->spectrum;
+    const float* w = mel->weights;
+
+    apply_window(mel);
+    audio_fft_real(mel->fft, mel->frame, mel->spectrum);
+
+    for (unsigned int b = 0; b < mel->bins; b++) {
+        float p = s[2 * b] * s[2 * b] + s[2 * b + 1] * s[2 * b + 1];
+
+        mel->magnitude[b] = c->power ? p : sqrtf(p);
+    }
+
+    for (unsigned int f = 0; f < c->mels; f++) {
+        const float* m = mel->magnitude + mel->first[f];
+        float sum = 0.0f;
+
+        for (unsigned int i = 0; i < mel->count[f]; i++)
+            sum += m[i] * w[i];
+        w += mel->count[f];
+        out[f] = logf(sum + c->log_offset);
+    }
+}
+
+size_t audio_mel_process_s16(audio_mel_t* mel, const int16_t* in, size_t samples, float* out)
+{
+    unsigned int size = mel->config.window;
+    unsigned int hop = mel->config.hop;
+    size_t frames = 0;
+
+    while (samples) {
+        size_t n = size - mel->fill;
+
+        if (n > samples)
+            n = samples;
+        memcpy(mel->history + mel->fill, in, n * sizeof(*in));
+        mel->fill += n;
+        in += n;
+        samples -= n;
+
+        if (mel->fill == size) {
+            mel_frame(mel, out + frames * mel->config.mels);
+            frames++;
+
+            // Keep the overlap for the next window; no window is transformed twice
+            memmove(mel->history, mel->history + hop, (size - hop) * sizeof(*mel->history));
+            mel->fill = size - hop;
+        }
+    }
+    return frames;
+}
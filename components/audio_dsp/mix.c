@@ -0,0 +1,117 @@
+#include "audio_dsp_internal.h"
+
+static inline int16_t average_s16(const int16_t* frame, unsigned int channels)
+{
+    int32_t sum = 0;
+
+    for (unsigned int c = 0; c < channels; c++)
+        sum += frame[c];
+    // Rounds towards minus infinity, like the shifts in the stereo case
+    return (int16_t)(sum >= 0 ? sum / (int32_t)channels : -((-sum + (int32_t)channels - 1) / (int32_t)channels));
+}
+
+void audio_mix_s16(const int16_t* in, unsigned int in_channels, int16_t* out, unsigned int out_channels, size_t frames)
+{
+    size_t i = 0;
+
+    if (in_channels == out_channels) {
+        memcpy(out, in, frames * in_channels * sizeof(*in));
+        return;
+    }
+
+    if (out_channels == 1) {
+#ifdef AUDIO_DSP_VECTOR
+        if (in_channels == 2) {
+            for (; i + 8 <= frames; i += 8) {
+                v8s a = load_v8s(in + i * 2);
+                v8s b = load_v8s(in + i * 2 + 8);
+                v8s l = shuffle_v8s(a, b, 0, 2, 4, 6, 8, 10, 12, 14);
+                v8s r = shuffle_v8s(a, b, 1, 3, 5, 7, 9, 11, 13, 15);
+                // (l + r) / 2 without leaving 16 bits
+                store_v8s(out + i, (l >> 1) + (r >> 1) + (l & r & 1));
+            }
+        }
+#endif
+        for (; i < frames; i++)
+            out[i] = average_s16(in + i * in_channels, in_channels);
+        return;
+    }
+
+    if (in_channels == 1) {
+#ifdef AUDIO_DSP_VECTOR
+        if (out_channels == 2) {
+            for (; i + 8 <= frames; i += 8) {
+                v8s x = load_v8s(in + i);
+                store_v8s(out + i * 2, shuffle_v8s(x, x, 0, 0, 1, 1, 2, 2, 3, 3));
+                store_v8s(out + i * 2 + 8, shuffle_v8s(x, x, 4, 4, 5, 5, 6, 6, 7, 7));
+            }
+        }
+#endif
+        for (; i < frames; i++) {
+            for (unsigned int c = 0; c < out_channels; c++)
+                out[i * out_channels + c] = in[i];
+        }
+        return;
+    }
+
+    for (; i < frames; i++) {
+        const int16_t* frame = in + i * in_channels;
+        unsigned int c;
+
+        for (c = 0; c < out_channels && c < in_channels; c++)
+            out[i * out_channels + c] = frame[c];
+        if (c < out_channels) {
+            int16_t mid = average_s16(frame, in_channels);
+            for (; c < out_channels; c++)
+                out[i * out_channels + c] = mid;
+        }
+    }
+}
+
+void audio_mix_f32(const float* in, unsigned int in_channels, float* out, unsigned int out_channels, size_t frames)
+{
+    const float scale = 1.0f / in_channels;
+
+    if (in_channels == out_channels) {
+        memcpy(out, in, frames * in_channels * sizeof(*in));
+        return;
+    }
+
+    if (out_channels == 1) {
+        if (in_channels == 2) {
+            for (size_t i = 0; i < frames; i++)
+                out[i] = (in[i * 2] + in[i * 2 + 1]) * 0.5f;
+        } else {
+            for (size_t i = 0; i < frames; i++) {
+                float sum = 0.0f;
+                for (unsigned int c = 0; c < in_channels; c++)
+                    sum += in[i * in_channels + c];
+                out[i] = sum * scale;
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        const float* frame = in + i * in_channels;
+        unsigned int c;
+        float mid;
+
+        if (in_channels == 1) {
+            for (c = 0; c < out_channels; c++)
+                out[i * out_channels + c] = frame[0];
+            continue;
+        }
+
+        for (c = 0; c < out_channels && c < in_channels; c++)
+            out[i * out_channels + c] = frame[c];
+        if (c < out_channels) {
+            mid = 0.0f;
+            for (unsigned int k = 0; k < in_channels; k++)
+                mid += frame[k];
+            mid *= scale;
+            for (; c < out_channels; c++)
+                out[i * out_channels + c] = mid;
+        }
+    }
+}
@@ -0,0 +1,293 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "audio_dsp_internal.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Taps per phase when not decimating; a multiple of the vector width
+#define BASE_TAPS 64
+
+// Kaiser window shape, for about 90 dB of stopband attenuation
+#define KAISER_BETA 9.0
+
+// Cutoff relative to the lower Nyquist frequency. It is the middle of the
+// transition band, which ends at about that Nyquist frequency, so that
+// little above it aliases and the passband reaches about 0.82 of it.
+#define CUTOFF 0.91
+
+// Input frames taken into the history per pass
+#define BLOCK_FRAMES 256
+
+// Largest filter bank, in coefficients
+#define MAX_COEFFS (1 << 18)
+
+struct audio_resampler {
+    unsigned int in_rate;
+    unsigned int out_rate;
+    unsigned int channels;
+    unsigned int up; // Interpolation factor, the number of phases
+    unsigned int down; // Decimation factor
+    unsigned int taps; // Per phase
+
+    float* coeffs; // up phases of taps, each reversed to run forwards
+    float* history; // Planar, stride frames per channel
+    size_t stride;
+    size_t fill; // Frames in the history
+    size_t pos; // History frame that the next output ends at
+    unsigned int phase;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+/*
+ * Windowed-sinc prototype at up times the input rate, split into phases.
+ * Phase p holds prototype taps p, p + up, p + 2 up, ... in reverse, so
+ * that it lines up with the oldest to newest input frames. Each phase is
+ * normalised to unity gain at DC.
+ */
+static void design(audio_resampler_t* rs)
+{
+    size_t length = (size_t)rs->up * rs->taps;
+    double center = (length - 1) / 2.0;
+    double fc = CUTOFF * 0.5 / (rs->up > rs->down ? rs->up : rs->down);
+    double norm = bessel_i0(KAISER_BETA);
+
+    for (unsigned int p = 0; p < rs->up; p++) {
+        float* phase = rs->coeffs + (size_t)p * rs->taps;
+        double sum = 0.0;
+
+        for (unsigned int k = 0; k < rs->taps; k++) {
+            size_t n = (size_t)k * rs->up + p;
+            double t = n - center;
+            double r = t / (center + 1);
+            double h = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+
+            h *= bessel_i0(KAISER_BETA * sqrt(1 - r * r)) / norm;
+            phase[rs->taps - 1 - k] = (float)h;
+            sum += h;
+        }
+        for (unsigned int k = 0; k < rs->taps; k++)
+            phase[k] = (float)(phase[k] / sum);
+    }
+}
+
+audio_resampler_t* audio_resampler_create(unsigned int in_rate, unsigned int out_rate, unsigned int channels)
+{
+    audio_resampler_t* rs;
+    unsigned int g;
+
+    if (!in_rate || !out_rate || !channels)
+        return NULL;
+
+    rs = calloc(1, sizeof(*rs));
+    if (!rs)
+        return NULL;
+
+    g = gcd(in_rate, out_rate);
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->channels = channels;
+    rs->up = out_rate / g;
+    rs->down = in_rate / g;
+
+    // When decimating the cutoff is lower, and the filter longer in
+    // input frames for the same transition band
+    rs->taps = BASE_TAPS;
+    if (rs->down > rs->up)
+        rs->taps = (unsigned int)(((uint64_t)BASE_TAPS * rs->down / rs->up + 7) & ~7u);
+
+    if ((uint64_t)rs->up * rs->taps > MAX_COEFFS) {
+        free(rs);
+        return NULL;
+    }
+
+    rs->stride = rs->taps - 1 + BLOCK_FRAMES;
+    rs->coeffs = malloc((size_t)rs->up * rs->taps * sizeof(float));
+    rs->history = malloc(rs->stride * channels * sizeof(float));
+    if (!rs->coeffs || !rs->history) {
+        audio_resampler_destroy(rs);
+        return NULL;
+    }
+
+    design(rs);
+    audio_resampler_reset(rs);
+
+    return rs;
+}
+
+void audio_resampler_destroy(audio_resampler_t* rs)
+{
+    if (!rs)
+        return;
+    free(rs->coeffs);
+    free(rs->history);
+    free(rs);
+}
+
+void audio_resampler_reset(audio_resampler_t* rs)
+{
+    // The stream starts after a run of silence as long as the filter
+    memset(rs->history, 0, rs->stride * rs->channels * sizeof(float));
+    rs->fill = rs->taps - 1;
+    rs->pos = rs->taps - 1;
+    rs->phase = 0;
+}
+
+size_t audio_resampler_max_out(const audio_resampler_t* rs, size_t in_frames)
+{
+    // Buffered frames yield at most one output more than a whole ratio
+    return (size_t)(((uint64_t)in_frames * rs->up + rs->down - 1) / rs->down) + 1;
+}
+
+unsigned int audio_resampler_delay(const audio_resampler_t* rs)
+{
+    return (unsigned int)(((uint64_t)rs->up * rs->taps - 1) / 2 / rs->down);
+}
+
+static inline float dot(const float* a, const float* b, unsigned int n)
+{
+#ifdef AUDIO_DSP_VECTOR
+    // Two accumulators keep the adds of consecutive steps independent
+    v4f acc0 = { 0 }, acc1 = { 0 }, x, y;
+
+    for (unsigned int k = 0; k < n; k += 8) {
+        memcpy(&x, a + k, sizeof(x));
+        memcpy(&y, b + k, sizeof(y));
+        acc0 += x * y;
+        memcpy(&x, a + k + 4, sizeof(x));
+        memcpy(&y, b + k + 4, sizeof(y));
+        acc1 += x * y;
+    }
+    acc0 += acc1;
+    return acc0[0] + acc0[1] + acc0[2] + acc0[3];
+#else
+    float sum = 0.0f;
+
+    for (unsigned int k = 0; k < n; k++)
+        sum += a[k] * b[k];
+    return sum;
+#endif
+}
+
+/*
+ * Runs the filter over the history, and keeps the frames still needed.
+ * Returns the number of output frames written to out_f32 or out_s16.
+ */
+static size_t produce(audio_resampler_t* rs, float* out_f32, int16_t* out_s16, size_t out_frames)
+{
+    const unsigned int channels = rs->channels;
+    size_t done = 0, keep;
+
+    while (rs->pos < rs->fill && done < out_frames) {
+        const float* h = rs->coeffs + (size_t)rs->phase * rs->taps;
+        size_t start = rs->pos + 1 - rs->taps;
+
+        for (unsigned int c = 0; c < channels; c++) {
+            float y = dot(h, rs->history + c * rs->stride + start, rs->taps);
+
+            if (out_f32)
+                out_f32[done * channels + c] = y;
+            else
+                out_s16[done * channels + c] = f32_to_s16(y);
+        }
+        done++;
+
+        rs->phase += rs->down;
+        rs->pos += rs->phase / rs->up;
+        rs->phase %= rs->up;
+    }
+
+    // Drop the frames that no later output reaches back to
+    keep = rs->pos + 1 - rs->taps;
+    if (keep > rs->fill)
+        keep = rs->fill;
+    if (keep) {
+        for (unsigned int c = 0; c < channels; c++) {
+            float* history = rs->history + c * rs->stride;
+            memmove(history, history + keep, (rs->fill - keep) * sizeof(float));
+        }
+        rs->fill -= keep;
+        rs->pos -= keep;
+    }
+
+    return done;
+}
+
+static void process(audio_resampler_t* rs, const float* in_f32, const int16_t* in_s16, size_t* in_frames,
+    float* out_f32, int16_t* out_s16, size_t* out_frames)
+{
+    const unsigned int channels = rs->channels;
+    size_t in_done = 0, out_done = 0;
+
+    for (;;) {
+        size_t n = rs->stride - rs->fill;
+
+        if (n > *in_frames - in_done)
+            n = *in_frames - in_done;
+
+        // Deinterleave into the history, converting S16 on the way
+        for (unsigned int c = 0; c < channels; c++) {
+            float* history = rs->history + c * rs->stride + rs->fill;
+
+            if (in_f32) {
+                const float* src = in_f32 + in_done * channels + c;
+                for (size_t i = 0; i < n; i++)
+                    history[i] = src[i * channels];
+            } else if (channels == 1) {
+                audio_s16_to_f32(in_s16 + in_done, history, n);
+            } else {
+                const int16_t* src = in_s16 + in_done * channels + c;
+                for (size_t i = 0; i < n; i++)
+                    history[i] = src[i * channels] * (1.0f / 32768.0f);
+            }
+        }
+        rs->fill += n;
+        in_done += n;
+
+        out_done += produce(rs, out_f32 ? out_f32 + out_done * channels : NULL,
+            out_s16 ? out_s16 + out_done * channels : NULL, *out_frames - out_done);
+
+        // Stop when the input is used up, or the output is full and the
+        // history has no room left
+        if (in_done == *in_frames || (out_done == *out_frames && rs->fill == rs->stride))
+            break;
+    }
+
+    *in_frames = in_done;
+    *out_frames = out_done;
+}
+
+void audio_resampler_process_f32(audio_resampler_t* rs, const float* in, size_t* in_frames, float* out, size_t* out_frames)
+{
+    process(rs, in, NULL, in_frames, out, NULL, out_frames);
+}
+
+void audio_resampler_process_s16(audio_resampler_t* rs, const int16_t* in, size_t* in_frames, int16_t* out, size_t* out_frames)
+{
+    process(rs, NULL, in, in_frames, NULL, out, out_frames);
+}
@@ -124,184 +124,27 @@ static void perspective_unmap(const quirc_float_t *c,
 }
 
 /************************************************************************
- * Span-based floodfill routine
+ * Adaptive thresholding
  */
 
-typedef void (*span_func_t)(void *user_data, int y, int left, int right);
-
-static void flood_fill_line(struct quirc *q, int x, int y,
-			    int from, int to,
-			    span_func_t func, void *user_data,
-			    int *leftp, int *rightp)
-{
-	quirc_pixel_t *row;
-	int left;
-	int right;
-	int i;
-
-	row = q->pixels + y * q->w;
-	QUIRC_ASSERT(row[x] == from);
-
-	left = x;
-	right = x;
-
-	while (left > 0 && row[left - 1] == from)
-		left--;
-
-	while (right < q->w - 1 && row[right + 1] == from)
-		right++;
-
-	/* Fill the extent */
-	for (i = left; i <= right; i++)
-		row[i] = to;
-
-	/* Return the processed range */
-	*leftp = left;
-	*rightp = right;
-
-	if (func)
-		func(user_data, y, left, right);
-}
-
-static struct quirc_flood_fill_vars *flood_fill_call_next(
-			struct quirc *q,
-			quirc_pixel_t *row,
-			int from, int to,
-			span_func_t func, void *user_data,
-			struct quirc_flood_fill_vars *vars,
-			int direction)
+/* Accumulate the histogram of rows y0 to y1 - 1 of the rectangle */
+static void histogram_rows(const struct quirc *q, const struct quirc_rect *rect,
+			   int y0, int y1, unsigned int *histogram)
 {
-	int *leftp;
-
-	if (direction < 0) {
-		leftp = &vars->left_up;
-	} else {
-		leftp = &vars->left_down;
-	}
-
-	while (*leftp <= vars->right) {
-		if (row[*leftp] == from) {
-			struct quirc_flood_fill_vars *next_vars;
-			int next_left;
-
-			/* Set up the next context */
-			next_vars = vars + 1;
-			next_vars->y = vars->y + direction;
-
-			/* Fill the extent */
-			flood_fill_line(q,
-					*leftp,
-					next_vars->y,
-					from, to,
-					func, user_data,
-					&next_left,
-					&next_vars->right);
-			next_vars->left_down = next_left;
-			next_vars->left_up = next_left;
-
-			return next_vars;
-		}
-		(*leftp)++;
-	}
-	return NULL;
-}
-
-static void flood_fill_seed(struct quirc *q,
-			    int x0, int y0,
-			    int from, int to,
-			    span_func_t func, void *user_data)
-{
-	struct quirc_flood_fill_vars *const stack = q->flood_fill_vars;
-	const size_t stack_size = q->num_flood_fill_vars;
-	const struct quirc_flood_fill_vars *const last_vars =
-	    &stack[stack_size - 1];
-
-	QUIRC_ASSERT(from != to);
-	QUIRC_ASSERT(q->pixels[y0 * q->w + x0] == from);
-
-	struct quirc_flood_fill_vars *next_vars;
-	int next_left;
-
-	/* Set up the first context  */
-	next_vars = stack;
-	next_vars->y = y0;
-
-	/* Fill the extent */
-	flood_fill_line(q, x0, next_vars->y, from, to,
-			func, user_data,
-			&next_left, &next_vars->right);
-	next_vars->left_down = next_left;
-	next_vars->left_up = next_left;
-
-	while (true) {
-		struct quirc_flood_fill_vars * const vars = next_vars;
-		quirc_pixel_t *row;
-
-		if (vars == last_vars) {
-			/*
-			 * "Stack overflow".
-			 * Just stop and return.
-			 * This can be caused by very complex shapes in
-			 * the image, which is not likely a part of
-			 * a valid QR code anyway.
-			 */
-			break;
-		}
-
-		/* Seed new flood-fills */
-		if (vars->y > 0) {
-			row = q->pixels + (vars->y - 1) * q->w;
-
-			next_vars = flood_fill_call_next(q, row,
-							 from, to,
-							 func, user_data,
-							 vars, -1);
-			if (next_vars != NULL) {
-				continue;
-			}
-		}
-
-		if (vars->y < q->h - 1) {
-			row = q->pixels + (vars->y + 1) * q->w;
-
-			next_vars = flood_fill_call_next(q, row,
-							 from, to,
-							 func, user_data,
-							 vars, 1);
-			if (next_vars != NULL) {
-				continue;
-			}
-		}
-
-		if (vars > stack) {
-			/* Restore the previous context */
-			next_vars = vars - 1;
-			continue;
+	int y;
+	for (y = y0; y < y1; y++) {
+		const uint8_t* ptr = q->src + y * q->src_stride + rect->x0;
+		int length = rect->x1 - rect->x0;
+		while (length--) {
+			uint8_t value = *ptr++;
+			histogram[value]++;
 		}
-
-		/* We've done. */
-		break;
 	}
 }
 
-/************************************************************************
- * Adaptive thresholding
- */
-
-static uint8_t otsu(const struct quirc *q)
+static uint8_t otsu_threshold(const unsigned int *histogram,
+			      unsigned int numPixels)
 {
-	unsigned int numPixels = q->w * q->h;
-
-	// Calculate histogram
-	unsigned int histogram[UINT8_MAX + 1];
-	(void)memset(histogram, 0, sizeof(histogram));
-	uint8_t* ptr = q->image;
-	unsigned int length = numPixels;
-	while (length--) {
-		uint8_t value = *ptr++;
-		histogram[value]++;
-	}
-
 	// Calculate weighted sum of histogram values
 	quirc_float_t sum = (quirc_float_t)0;
 	unsigned int i = 0;
@@ -339,43 +182,568 @@ static uint8_t otsu(const struct quirc *q)
 	return threshold;
 }
 
-static void area_count(void *user_data, int y, int left, int right)
+static uint8_t otsu(const struct quirc *q, const struct quirc_rect *rect)
+{
+	unsigned int numPixels = (rect->x1 - rect->x0) * (rect->y1 - rect->y0);
+
+	// Calculate histogram
+	unsigned int histogram[UINT8_MAX + 1];
+	(void)memset(histogram, 0, sizeof(histogram));
+	histogram_rows(q, rect, rect->y0, rect->y1, histogram);
+
+	return otsu_threshold(histogram, numPixels);
+}
+
+/* Bradley's local thresholding with a square window of side
+ * (2 * adapt_radius + 1), clipped at the borders of the scanned
+ * rectangle. The window sum is kept incrementally: column sums slide
+ * down one row at a time and the row sum slides across, so each pixel
+ * costs a constant number of operations and the only state is one row
+ * of column sums. The result is packed into q->bitmap.
+ *
+ * Rows y0 to y1 - 1 of the rectangle are thresholded. The column sums
+ * are primed from the rows above y0 as well as below, so a band of
+ * rows gives the same result as thresholding the whole rectangle. The
+ * priming includes row (y0 - r - 1), which the first step retires.
+ */
+static void adaptive_threshold_rows(struct quirc *q,
+				    const struct quirc_rect *rect,
+				    int y0, int y1, uint32_t *col_sum)
+{
+	const int r = q->adapt_radius;
+	const int rx0 = rect->x0;
+	const int rx1 = rect->x1;
+	int x, y;
+
+	memset(col_sum + rx0, 0, (rx1 - rx0) * sizeof(*col_sum));
+	for (y = y0 - r - 1 > rect->y0 ? y0 - r - 1 : rect->y0;
+	     y < y0 + r && y < rect->y1; y++) {
+		const uint8_t *src = q->src + y * q->src_stride;
+
+		for (x = rx0; x < rx1; x++)
+			col_sum[x] += src[x];
+	}
+
+	for (y = y0; y < y1; y++) {
+		const uint8_t *src = q->src + y * q->src_stride;
+		uint64_t *bits = q->bitmap + y * q->bitmap_stride;
+		int wy0 = y - r < rect->y0 ? rect->y0 : y - r;
+		int wy1 = y + r >= rect->y1 ? rect->y1 - 1 : y + r;
+		uint32_t rows = wy1 - wy0 + 1;
+		uint32_t row_sum = 0;
+
+		/* Slide the window down: admit row (y + r), retire row
+		 * (y - r - 1).
+		 */
+		if (y + r < rect->y1) {
+			const uint8_t *add = q->src + (y + r) * q->src_stride;
+
+			for (x = rx0; x < rx1; x++)
+				col_sum[x] += add[x];
+		}
+
+		if (y - r - 1 >= rect->y0) {
+			const uint8_t *sub = q->src + (y - r - 1) * q->src_stride;
+
+			for (x = rx0; x < rx1; x++)
+				col_sum[x] -= sub[x];
+		}
+
+		memset(bits + (rx0 >> 6), 0,
+		       (((rx1 + 63) >> 6) - (rx0 >> 6)) * sizeof(*bits));
+
+		for (x = rx0; x < rx0 + r && x < rx1; x++)
+			row_sum += col_sum[x];
+
+		for (x = rx0; x < rx1; x++) {
+			int x0 = x - r < rx0 ? rx0 : x - r;
+			int x1 = x + r >= rx1 ? rx1 - 1 : x + r;
+			uint64_t count = (uint64_t)rows * (x1 - x0 + 1);
+
+			if (x + r < rx1)
+				row_sum += col_sum[x + r];
+			if (x - r - 1 >= rx0)
+				row_sum -= col_sum[x - r - 1];
+
+			if ((uint64_t)src[x] * count * 100 <
+			    (uint64_t)row_sum * (100 - QUIRC_ADAPTIVE_T))
+				bits[x >> 6] |= (uint64_t)1 << (x & 63);
+		}
+	}
+}
+
+static void adaptive_threshold(struct quirc *q, const struct quirc_rect *rect)
+{
+	adaptive_threshold_rows(q, rect, rect->y0, rect->y1, q->adapt_col_sum);
+}
+
+/************************************************************************
+ * Packed row binarisation
+ *
+ * The frame is binarised into rows packed one bit per pixel (bit i of
+ * word k is pixel 64 * k + i, set for black). Runs can then be measured
+ * a word at a time with count-trailing-zeros rather than pixel by
+ * pixel, and the binarised frame takes an eighth of the image size.
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define QUIRC_SWAR_ROW	1
+#else
+#define QUIRC_SWAR_ROW	0
+#endif
+
+/* Return a byte with bit j set if byte j of v is less than the
+ * corresponding byte of t. Each lane is compared unsigned without
+ * borrows crossing lanes, and the eight lane flags are gathered into
+ * the low byte with a single multiply.
+ */
+static inline uint8_t swar_less8(uint64_t v, uint64_t t)
+{
+	const uint64_t H = 0x8080808080808080ULL;
+	uint64_t low_ge = (v | H) - (t & ~H);
+	uint64_t lt = ((~v & t) | (~(v ^ t) & ~low_ge)) & H;
+
+	return (uint8_t)(((lt >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+/* Pack a row of the source image, black where value < threshold. */
+static void row_bits_threshold(const uint8_t *src, int w, uint8_t threshold,
+			       uint64_t *bits)
+{
+	int x = 0;
+
+#if QUIRC_SWAR_ROW
+	const uint64_t t = 0x0101010101010101ULL * threshold;
+
+	for (; x + 64 <= w; x += 64) {
+		uint64_t word = 0;
+		int i;
+
+		for (i = 0; i < 8; i++) {
+			uint64_t v;
+
+			memcpy(&v, src + x + i * 8, sizeof(v));
+			word |= (uint64_t)swar_less8(v, t) << (i * 8);
+		}
+
+		bits[x >> 6] = word;
+	}
+#endif
+
+	for (; x < w; x += 64) {
+		uint64_t word = 0;
+		int i;
+
+		for (i = 0; i < 64 && x + i < w; i++)
+			if (src[x + i] < threshold)
+				word |= (uint64_t)1 << i;
+
+		bits[x >> 6] = word;
+	}
+}
+
+static inline int pixel_black(const struct quirc *q, int x, int y)
+{
+	return (q->bitmap[y * q->bitmap_stride + (x >> 6)] >> (x & 63)) & 1;
+}
+
+/* Return the position of the first pixel at or after x whose colour
+ * differs from the given one, or w if the run extends to the end.
+ */
+static int next_transition(const uint64_t *bits, int w, int x, int color)
+{
+	const uint64_t flip = color ? ~(uint64_t)0 : 0;
+	int k = x >> 6;
+	uint64_t word = (bits[k] ^ flip) & (~(uint64_t)0 << (x & 63));
+
+	while (!word) {
+		k++;
+		if (k << 6 >= w)
+			return w;
+		word = bits[k] ^ flip;
+	}
+
+	x = (k << 6) + __builtin_ctzll(word);
+	return x < w ? x : w;
+}
+
+/************************************************************************
+ * Run-length connected component labelling
+ *
+ * Each row's black runs are appended to q->runs as the row is
+ * binarised, and joined to overlapping runs in the row above with a
+ * union-find forest (4-connectivity, matching the span semantics of a
+ * scanline flood fill). Roots carry the region's pixel count, so area
+ * queries are O(1). Region traversals walk the runs in the order of
+ * the flood fill that this replaces. Unlike the flood fill, which ran
+ * out of 8-bit region codes after 254 regions, the number of regions
+ * is not limited, so cluttered frames are searched in full.
+ */
+
+static int run_find(struct quirc *q, int i)
+{
+	struct quirc_run *runs = q->runs;
+
+	while (runs[i].parent != i) {
+		runs[i].parent = runs[runs[i].parent].parent;
+		i = runs[i].parent;
+	}
+
+	return i;
+}
+
+static void run_union(struct quirc *q, int a, int b)
+{
+	struct quirc_run *runs = q->runs;
+	int swap;
+
+	a = run_find(q, a);
+	b = run_find(q, b);
+	if (a == b)
+		return;
+
+	/* Attach the smaller region below the larger one */
+	if (runs[a].count < runs[b].count) {
+		swap = a;
+		a = b;
+		b = swap;
+	}
+
+	runs[b].parent = a;
+	runs[a].count += runs[b].count;
+}
+
+static int runs_reserve(struct quirc *q, int extra)
+{
+	struct quirc_run *runs;
+	int max_runs;
+
+	if (q->num_runs + extra <= q->max_runs)
+		return 0;
+
+	max_runs = q->max_runs ? q->max_runs : 1024;
+	while (max_runs < q->num_runs + extra) {
+		if (max_runs > INT_MAX / 2)
+			return -1;
+		max_runs *= 2;
+	}
+
+	runs = realloc(q->runs, (size_t)max_runs * sizeof(*runs));
+	if (!runs)
+		return -1;
+
+	q->runs = runs;
+	q->max_runs = max_runs;
+	return 0;
+}
+
+static void run_init(struct quirc *q, int i, int x0, int x1, int y)
+{
+	struct quirc_run *run = &q->runs[i];
+
+	run->x0 = x0;
+	run->x1 = x1 - 1;
+	run->y = y;
+	run->parent = i;
+	run->visit = 0;
+	run->count = x1 - x0;
+	run->region = -1;
+}
+
+/* Join the runs of row y to those of the row above */
+static void join_rows(struct quirc *q, int y)
+{
+	int start = q->row_runs[y];
+	int end = q->row_runs[y + 1];
+	int i, j;
+
+	/* Both rows are sorted by x, so overlaps are found in one sweep */
+	i = q->row_runs[y - 1];
+	j = start;
+	while (i < start && j < end) {
+		const struct quirc_run *a = &q->runs[i];
+		const struct quirc_run *b = &q->runs[j];
+
+		if (a->x1 < b->x0) {
+			i++;
+		} else if (b->x1 < a->x0) {
+			j++;
+		} else {
+			run_union(q, i, j);
+			if (a->x1 < b->x1)
+				i++;
+			else
+				j++;
+		}
+	}
+}
+
+/* Extract the black runs of a packed row and merge them with the
+ * previous row. If the run table cannot grow, the row and all later
+ * rows are left unlabelled: their pixels still read as black but
+ * belong to no region, so no capstones are found there.
+ */
+static void label_row(struct quirc *q, int y)
+{
+	const uint64_t *bits = q->bitmap + y * q->bitmap_stride;
+	int start = q->num_runs;
+	int x = 0;
+
+	q->row_runs[y] = start;
+	q->row_runs[y + 1] = start;
+
+	if (q->runs_exhausted)
+		return;
+
+	while (x < q->w) {
+		int x1;
+
+		x = next_transition(bits, q->w, x, 0);
+		if (x >= q->w)
+			break;
+		x1 = next_transition(bits, q->w, x, 1);
+
+		if (runs_reserve(q, 1) < 0) {
+			q->runs_exhausted = 1;
+			break;
+		}
+
+		run_init(q, q->num_runs++, x, x1, y);
+		x = x1;
+	}
+
+	q->row_runs[y + 1] = q->num_runs;
+
+	if (y)
+		join_rows(q, y);
+}
+
+/* Count the black runs of a packed row: one for each black pixel
+ * whose left neighbour is white.
+ */
+static int count_row_runs(const uint64_t *bits, int stride)
+{
+	uint64_t carry = 0;
+	int count = 0;
+	int k;
+
+	for (k = 0; k < stride; k++) {
+		uint64_t word = bits[k];
+
+		count += __builtin_popcountll(word & ~((word << 1) | carry));
+		carry = word >> 63;
+	}
+
+	return count;
+}
+
+/* Write the runs of row y to their slots, which start at row_runs[y] */
+static void extract_row_runs(struct quirc *q, int y)
+{
+	const uint64_t *bits = q->bitmap + y * q->bitmap_stride;
+	int i = q->row_runs[y];
+	int x = 0;
+
+	while (x < q->w) {
+		int x1;
+
+		x = next_transition(bits, q->w, x, 0);
+		if (x >= q->w)
+			break;
+		x1 = next_transition(bits, q->w, x, 1);
+
+		run_init(q, i++, x, x1, y);
+		x = x1;
+	}
+}
+
+/* Return the index of the run covering (x, y), or -1 if the pixel is
+ * white or unlabelled.
+ */
+static int run_at(const struct quirc *q, int x, int y)
+{
+	int lo = q->row_runs[y];
+	int hi = q->row_runs[y + 1] - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) >> 1;
+		const struct quirc_run *run = &q->runs[mid];
+
+		if (x < run->x0)
+			hi = mid - 1;
+		else if (x > run->x1)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
+}
+
+/* Return the index of the first run of row y that ends at or after x */
+static int row_first_run_from(const struct quirc *q, int y, int x)
+{
+	int lo = q->row_runs[y];
+	int hi = q->row_runs[y + 1];
+
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+
+		if (q->runs[mid].x1 < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int run_stack_reserve(struct quirc *q, int depth)
+{
+	struct quirc_run_frame *stack;
+	int max = q->max_run_stack ? q->max_run_stack : 64;
+
+	if (depth < q->max_run_stack)
+		return 0;
+
+	while (max <= depth) {
+		if (max > INT_MAX / 2)
+			return -1;
+		max *= 2;
+	}
+
+	stack = realloc(q->run_stack, (size_t)max * sizeof(*stack));
+	if (!stack)
+		return -1;
+
+	q->run_stack = stack;
+	q->max_run_stack = max;
+	return 0;
+}
+
+typedef void (*span_func_t)(void *user_data, int y, int left, int right);
+
+/* Mark run i as reached by the walk, pass it to func and set up its
+ * frame on the walk's stack
+ */
+static void run_walk_enter(struct quirc *q, struct quirc_run_frame *f,
+			   int i, span_func_t func, void *user_data)
+{
+	struct quirc_run *run = &q->runs[i];
+
+	run->visit = q->run_visit;
+	func(user_data, run->y, run->x0, run->x1);
+
+	f->run = i;
+	f->up = run->y > 0 ?
+		row_first_run_from(q, run->y - 1, run->x0) : q->row_runs[0];
+	f->down = run->y + 1 < q->h ?
+		row_first_run_from(q, run->y + 1, run->x0) : q->row_runs[q->h];
+}
+
+/* Return the next run of the walk in the row after y + dir from the
+ * cursor, or -1 if none is left there
+ */
+static int run_walk_next(const struct quirc *q, int *cursor,
+			 const struct quirc_run *run, int dir)
+{
+	int y = run->y + dir;
+	int end = y >= 0 && y < q->h ? q->row_runs[y + 1] : *cursor;
+
+	for (; *cursor < end && q->runs[*cursor].x0 <= run->x1; (*cursor)++)
+		if (q->runs[*cursor].visit != q->run_visit)
+			return *cursor;
+
+	return -1;
+}
+
+/* Call func for each run of a region, in the order in which a scanline
+ * flood fill from the region's seed would fill them: depth first,
+ * trying the row above before the row below, each from left to right.
+ * The corner searches keep the first of equally good points, so this
+ * gives the same corners as the flood fill did. If the walk's stack
+ * cannot grow, the rest of the region is skipped, as the flood fill
+ * did when its stack was full.
+ */
+static void region_for_each_run(struct quirc *q, int rcode,
+				span_func_t func, void *user_data)
 {
-	((struct quirc_region *)user_data)->count += right - left + 1;
+	const struct quirc_region *reg = &q->regions[rcode];
+	int seed = run_at(q, reg->seed.x, reg->seed.y);
+	int depth = 0;
+
+	if (seed < 0 || run_stack_reserve(q, 0) < 0)
+		return;
+
+	/* Runs of earlier walks, and new runs, hold other numbers */
+	if (!++q->run_visit)
+		q->run_visit = 1;
+
+	run_walk_enter(q, &q->run_stack[0], seed, func, user_data);
+
+	while (depth >= 0) {
+		struct quirc_run_frame *f = &q->run_stack[depth];
+		const struct quirc_run *run = &q->runs[f->run];
+		int next = run_walk_next(q, &f->up, run, -1);
+
+		if (next < 0)
+			next = run_walk_next(q, &f->down, run, 1);
+
+		if (next < 0) {
+			depth--;
+			continue;
+		}
+
+		if (run_stack_reserve(q, depth + 1) < 0)
+			return;
+
+		depth++;
+		run_walk_enter(q, &q->run_stack[depth], next,
+			       func, user_data);
+	}
 }
 
 static int region_code(struct quirc *q, int x, int y)
 {
-	int pixel;
 	struct quirc_region *box;
-	int region;
+	int run;
 
 	if (x < 0 || y < 0 || x >= q->w || y >= q->h)
 		return -1;
 
-	pixel = q->pixels[y * q->w + x];
+	run = run_at(q, x, y);
+	if (run < 0)
+		return -1;
+
+	run = run_find(q, run);
+	if (q->runs[run].region >= 0)
+		return q->runs[run].region;
 
-	if (pixel >= QUIRC_PIXEL_REGION)
-		return pixel;
+	if (q->num_regions >= q->max_regions) {
+		int max_regions = q->max_regions ? q->max_regions * 2 : 256;
+		struct quirc_region *regions;
 
-	if (pixel == QUIRC_PIXEL_WHITE)
-		return -1;
+		regions = realloc(q->regions,
+				  (size_t)max_regions * sizeof(*regions));
+		if (!regions)
+			return -1;
 
-	if (q->num_regions >= QUIRC_MAX_REGIONS)
-		return -1;
+		q->regions = regions;
+		q->max_regions = max_regions;
+	}
 
-	region = q->num_regions;
-	box = &q->regions[q->num_regions++];
+	box = &q->regions[q->num_regions];
 
 	memset(box, 0, sizeof(*box));
 
 	box->seed.x = x;
 	box->seed.y = y;
+	box->count = q->runs[run].count;
 	box->capstone = -1;
+	box->run = run;
 
-	flood_fill_seed(q, x, y, pixel, region, area_count, box);
-
-	return region;
+	q->runs[run].region = q->num_regions;
+	return q->num_regions++;
 }
 
 struct polygon_score_data {
@@ -441,9 +809,7 @@ static void find_region_corners(struct quirc *q,
 
 	memcpy(&psd.ref, ref, sizeof(psd.ref));
 	psd.scores[0] = -1;
-	flood_fill_seed(q, region->seed.x, region->seed.y,
-			rcode, QUIRC_PIXEL_BLACK,
-			find_one_corner, &psd);
+	region_for_each_run(q, rcode, find_one_corner, &psd);
 
 	psd.ref.x = psd.corners[0].x - psd.ref.x;
 	psd.ref.y = psd.corners[0].y - psd.ref.y;
@@ -459,9 +825,7 @@ static void find_region_corners(struct quirc *q,
 	psd.scores[1] = i;
 	psd.scores[3] = -i;
 
-	flood_fill_seed(q, region->seed.x, region->seed.y,
-			QUIRC_PIXEL_BLACK, rcode,
-			find_other_corners, &psd);
+	region_for_each_run(q, rcode, find_other_corners, &psd);
 }
 
 static void record_capstone(struct quirc *q, int ring, int stone)
@@ -494,7 +858,7 @@ static void record_capstone(struct quirc *q, int ring, int stone)
 }
 
 static void test_capstone(struct quirc *q, unsigned int x, unsigned int y,
-			  unsigned int *pb)
+			  const unsigned int *pb)
 {
 	int ring_right = region_code(q, x - pb[4], y);
 	int stone = region_code(q, x - pb[4] - pb[3] - pb[2], y);
@@ -531,50 +895,68 @@ static void test_capstone(struct quirc *q, unsigned int x, unsigned int y,
 	record_capstone(q, ring_left, stone);
 }
 
-static void finder_scan(struct quirc *q, unsigned int y)
+typedef void (*finder_func_t)(void *user_data, int x, int y,
+			      const unsigned int *pb);
+
+/* Scan a packed row for the 1:1:3:1:1 ratio of a capstone
+ * cross-section. Runs are measured a word at a time, and the ratio is
+ * tested once per run rather than once per pixel.
+ */
+static void finder_scan_row(const struct quirc *q, int y,
+			    finder_func_t func, void *user_data)
 {
-	quirc_pixel_t *row = q->pixels + y * q->w;
-	unsigned int x;
-	int last_color = 0;
-	unsigned int run_length = 0;
+	const uint64_t *bits = q->bitmap + y * q->bitmap_stride;
+	int x;
+	int color;
 	unsigned int run_count = 0;
 	unsigned int pb[5];
 
 	memset(pb, 0, sizeof(pb));
-	for (x = 0; x < q->w; x++) {
-		int color = row[x] ? 1 : 0;
-
-		if (x && color != last_color) {
-			memmove(pb, pb + 1, sizeof(pb[0]) * 4);
-			pb[4] = run_length;
-			run_length = 0;
-			run_count++;
-
-			if (!color && run_count >= 5) {
-				const int scale = 16;
-				static const unsigned int check[5] = {1, 1, 3, 1, 1};
-				unsigned int avg, err;
-				unsigned int i;
-				int ok = 1;
-
-				avg = (pb[0] + pb[1] + pb[3] + pb[4]) * scale / 4;
-				err = avg * 3 / 4;
-
-				for (i = 0; i < 5; i++)
-					if (pb[i] * scale < check[i] * avg - err ||
-					    pb[i] * scale > check[i] * avg + err)
-						ok = 0;
-
-				if (ok)
-					test_capstone(q, x, y, pb);
-			}
-		}
+	color = bits[0] & 1;
+	x = 0;
+	while (x < q->w) {
+		int next = next_transition(bits, q->w, x, color);
+
+		if (next >= q->w)
+			break;
 
-		run_length++;
-		last_color = color;
+		memmove(pb, pb + 1, sizeof(pb[0]) * 4);
+		pb[4] = next - x;
+		run_count++;
+		color = !color;
+		x = next;
+
+		if (!color && run_count >= 5) {
+			const int scale = 16;
+			static const unsigned int check[5] = {1, 1, 3, 1, 1};
+			unsigned int avg, err;
+			unsigned int i;
+			int ok = 1;
+
+			avg = (pb[0] + pb[1] + pb[3] + pb[4]) * scale / 4;
+			err = avg * 3 / 4;
+
+			for (i = 0; i < 5; i++)
+				if (pb[i] * scale < check[i] * avg - err ||
+				    pb[i] * scale > check[i] * avg + err)
+					ok = 0;
+
+			if (ok)
+				func(user_data, x, y, pb);
+		}
 	}
 }
 
+static void finder_test(void *user_data, int x, int y, const unsigned int *pb)
+{
+	test_capstone((struct quirc *)user_data, x, y, pb);
+}
+
+static void finder_scan(struct quirc *q, unsigned int y)
+{
+	finder_scan_row(q, y, finder_test, q);
+}
+
 static void find_alignment_pattern(struct quirc *q, int index)
 {
 	struct quirc_grid *qr = &q->grids[index];
@@ -683,142 +1065,613 @@ static void measure_grid_size(struct quirc *q, int index)
 	qr->grid_size =  4*ver + 17;
 }
 
-/* Read a cell from a grid using the currently set perspective
- * transform. Returns +/- 1 for black/white, 0 for cells which are
- * out of image bounds.
+/************************************************************************
+ * Fixed-point grid sampling
+ *
+ * Cells are always sampled at (x + o, y + o') for whole x and y and a
+ * few fixed offsets o, so each term of the transform's numerators and
+ * denominator takes only a few values per row and column. These are
+ * tabulated in fixed point by forward differencing, and a sample then
+ * costs three additions per coordinate and one integer division.
+ *
+ * The tables carry a small error, so a coordinate whose rounding is
+ * in doubt (within QUIRC_SAMPLE_GUARD of a half pixel) is recomputed
+ * by perspective_map(). Sampled pixels are therefore exactly those of
+ * the floating-point path.
+ */
+
+/* Sample offsets within a cell; read_cell() uses the middle one */
+static const quirc_float_t sample_offsets[QUIRC_SAMPLE_OFFSETS] = {
+	0.3, 0.5, 0.7
+};
+
+/* Numerators are tabulated with QUIRC_SAMPLE_NUM_BITS fractional
+ * bits, and the denominator, which is close to 1, with
+ * QUIRC_SAMPLE_DEN_BITS. Quotients have 16 fractional bits.
+ */
+#define QUIRC_SAMPLE_NUM_BITS	30
+#define QUIRC_SAMPLE_DEN_BITS	44
+#define QUIRC_SAMPLE_NUM_LIMIT	((int64_t)1 << 44)
+
+/* The guard band covers the table error, in 1/65536 pixel, and the
+ * rounding error of the floating-point path itself.
+ */
+#ifdef QUIRC_FLOAT_TYPE
+#define QUIRC_SAMPLE_GUARD	1024
+#else
+#define QUIRC_SAMPLE_GUARD	64
+#endif
+
+struct grid_sampler {
+	const struct quirc	*q;
+	const quirc_float_t	*c;
+	int			size;
+	int			fixed;
+
+	/* Term tables: terms[j][o][k] is c[j] * (k + sample_offsets[o]),
+	 * for the coefficients of u and v, in the grid's slot of
+	 * q->sample_terms. The constants c[2] and c[5] are held on their
+	 * own.
+	 */
+	int64_t			(*terms)[QUIRC_SAMPLE_OFFSETS]
+					[QUIRC_MAX_GRID_SIZE];
+	int64_t			x0;
+	int64_t			y0;
+};
+
+/* Tabulate coefficient j. Returns 0 if it is too large for the
+ * tables, in which case all samples fall back to floating point.
  */
-static int read_cell(const struct quirc *q, int index, int x, int y)
+static int sampler_tabulate(struct grid_sampler *s, int j)
+{
+	const int bits = j >= 6 ? QUIRC_SAMPLE_DEN_BITS : QUIRC_SAMPLE_NUM_BITS;
+	const double scale = (double)((int64_t)1 << bits);
+	const double cj = s->c[j];
+	int64_t step;
+	int o, k;
+
+	if (!(fabs(cj) * (s->size + 1) * scale <
+	      (double)QUIRC_SAMPLE_NUM_LIMIT * 16))
+		return 0;
+
+	if (j == 2 || j == 5) {
+		int64_t v = (int64_t)rint(cj * scale);
+
+		if (j == 2)
+			s->x0 = v;
+		else
+			s->y0 = v;
+		return 1;
+	}
+
+	step = (int64_t)rint(cj * scale);
+	for (o = 0; o < QUIRC_SAMPLE_OFFSETS; o++) {
+		int64_t *t = s->terms[j][o];
+
+		t[0] = (int64_t)rint(cj * (double)sample_offsets[o] * scale);
+		for (k = 1; k < s->size; k++)
+			t[k] = t[k - 1] + step;
+	}
+
+	return 1;
+}
+
+static void sampler_update(struct grid_sampler *s, int j)
+{
+	if (s->fixed)
+		s->fixed = sampler_tabulate(s, j);
+}
+
+static void sampler_init(struct grid_sampler *s, const struct quirc *q,
+			 int index)
 {
 	const struct quirc_grid *qr = &q->grids[index];
-	struct quirc_point p;
+	int j;
+
+	s->q = q;
+	s->c = qr->c;
+	s->size = qr->grid_size;
+	s->terms = NULL;
+	if (!q->float_sampling && index < q->max_sample_terms)
+		s->terms = q->sample_terms[index].terms;
+	s->fixed = s->terms && s->size > 0 && s->size <= QUIRC_MAX_GRID_SIZE;
+
+	for (j = 0; j < QUIRC_PERSPECTIVE_PARAMS && s->fixed; j++)
+		s->fixed = sampler_tabulate(s, j);
+}
 
-	perspective_map(qr->c, x + (quirc_float_t)0.5, y + (quirc_float_t)0.5, &p);
-	if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
+/* The denominator at the centre of a cell and its reciprocal. Each
+ * sample in the cell divides by multiplying with a reciprocal derived
+ * from this one.
+ */
+struct cell_den {
+	int64_t			den;	/* Q32 */
+	int64_t			recip;	/* Q30 */
+};
+
+/* Returns 0 if the cell cannot be sampled in fixed point */
+static int cell_den_init(const struct grid_sampler *s, int x, int y,
+			 struct cell_den *cd)
+{
+	int64_t den;
+
+	if (!s->fixed || x < 0 || x >= s->size || y < 0 || y >= s->size)
+		return 0;
+
+	den = s->terms[6][1][x] + s->terms[7][1][y] +
+		((int64_t)1 << QUIRC_SAMPLE_DEN_BITS);
+
+	/* Keep den > 1/4, so that the reciprocal is below 4 */
+	if (den <= (int64_t)1 << (QUIRC_SAMPLE_DEN_BITS - 2))
 		return 0;
 
-	return q->pixels[p.y * q->w + p.x] ? 1 : -1;
+	cd->den = den >> (QUIRC_SAMPLE_DEN_BITS - 32);
+	cd->recip = ((int64_t)1 << 62) / cd->den;
+	return 1;
 }
 
-static int fitness_cell(const struct quirc *q, int index, int x, int y)
+/* Return the reciprocal of the denominator at a sample point in Q30,
+ * corrected to second order from that of its cell, or 0 if the sample
+ * must be taken in floating point.
+ */
+static uint32_t sample_recip(const struct grid_sampler *s,
+			     const struct cell_den *cd,
+			     int x, int ox, int y, int oy)
 {
-	const struct quirc_grid *qr = &q->grids[index];
-	int score = 0;
-	int u, v;
+	int64_t den = (s->terms[6][ox][x] + s->terms[7][oy][y] +
+		       ((int64_t)1 << QUIRC_SAMPLE_DEN_BITS)) >>
+		(QUIRC_SAMPLE_DEN_BITS - 32);
+	int64_t e = den - cd->den;
+	int64_t eps, eps2, recip;
+
+	/* The relative change must be below 2^-10 for the second-order
+	 * correction to be exact to within the guard band.
+	 */
+	if (e <= -((int64_t)1 << 20) || e >= (int64_t)1 << 20)
+		return 0;
 
-	for (v = 0; v < 3; v++)
-		for (u = 0; u < 3; u++) {
-			static const quirc_float_t offsets[] = {0.3, 0.5, 0.7};
-			struct quirc_point p;
+	eps = (e * cd->recip) >> 32;
+	eps2 = (eps * eps) >> 30;
+	recip = cd->recip - ((cd->recip * eps) >> 30) +
+		((cd->recip * eps2) >> 30);
 
-			perspective_map(qr->c, x + offsets[u],
-					       y + offsets[v], &p);
-			if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
-				continue;
+	if (recip <= 0 || recip > UINT32_MAX)
+		return 0;
 
-			if (q->pixels[p.y * q->w + p.x])
-				score++;
-			else
-				score--;
-		}
+	return recip;
+}
+
+static inline int64_t sample_nx(const struct grid_sampler *s,
+				int x, int ox, int y, int oy)
+{
+	return s->terms[0][ox][x] + s->terms[1][oy][y] + s->x0;
+}
+
+static inline int64_t sample_ny(const struct grid_sampler *s,
+				int x, int ox, int y, int oy)
+{
+	return s->terms[3][ox][x] + s->terms[4][oy][y] + s->y0;
+}
+
+/* Divide a numerator by a sample's denominator and round it to a
+ * pixel coordinate as perspective_map() would, setting *ret to -1 if
+ * that is outside [0, limit). Returns 0 if the rounding is in doubt.
+ */
+static int sample_coord(int64_t num, uint32_t recip, int limit, int *ret)
+{
+	int64_t v;
+
+	if (num <= -QUIRC_SAMPLE_NUM_LIMIT || num >= QUIRC_SAMPLE_NUM_LIMIT)
+		return 0;
+
+	v = ((num >> (QUIRC_SAMPLE_NUM_BITS - 16)) * (int64_t)recip) >> 30;
+	if ((v & 0xffff) > 0x8000 - QUIRC_SAMPLE_GUARD &&
+	    (v & 0xffff) < 0x8000 + QUIRC_SAMPLE_GUARD)
+		return 0;
+
+	/* Negative quotients round towards minus infinity here, which
+	 * the guard band also covers.
+	 */
+	v = (v + 0x8000) >> 16;
+	*ret = v < 0 || v >= limit ? -1 : (int)v;
+	return 1;
+}
+
+/* Returns +/- 1 for black/white, 0 for points outside the image */
+static inline int sample_pixel(const struct quirc *q, int x, int y)
+{
+	if (y < 0 || y >= q->h || x < 0 || x >= q->w)
+		return 0;
+
+	return pixel_black(q, x, y) ? 1 : -1;
+}
+
+/* Sample the cell at (x, y) with offsets ox and oy, using the cell's
+ * denominator if cd is not NULL. Returns +/- 1 for black/white, 0 for
+ * points which are out of image bounds.
+ */
+static int sample_cell(const struct grid_sampler *s, const struct cell_den *cd,
+		       int x, int ox, int y, int oy)
+{
+	struct quirc_point p;
+	uint32_t recip;
+
+	if (cd) {
+		recip = sample_recip(s, cd, x, ox, y, oy);
+		if (recip &&
+		    sample_coord(sample_nx(s, x, ox, y, oy), recip,
+				 s->q->w, &p.x) &&
+		    sample_coord(sample_ny(s, x, ox, y, oy), recip,
+				 s->q->h, &p.y))
+			return sample_pixel(s->q, p.x, p.y);
+	}
+
+	perspective_map(s->c, x + sample_offsets[ox],
+			y + sample_offsets[oy], &p);
+	return sample_pixel(s->q, p.x, p.y);
+}
+
+/* Read a cell from a grid using the currently set perspective
+ * transform. Returns +/- 1 for black/white, 0 for cells which are
+ * out of image bounds.
+ */
+static int read_cell(const struct grid_sampler *s, int x, int y)
+{
+	struct cell_den cd;
+
+	return sample_cell(s, cell_den_init(s, x, y, &cd) ? &cd : NULL,
+			   x, 1, y, 1);
+}
+
+static int fitness_cell(const struct grid_sampler *s, int x, int y)
+{
+	struct cell_den cd;
+	const struct cell_den *cdp = cell_den_init(s, x, y, &cd) ? &cd : NULL;
+	int score = 0;
+	int u, v;
+
+	for (v = 0; v < QUIRC_SAMPLE_OFFSETS; v++)
+		for (u = 0; u < QUIRC_SAMPLE_OFFSETS; u++)
+			score += sample_cell(s, cdp, x, u, y, v);
 
 	return score;
 }
 
-static int fitness_ring(const struct quirc *q, int index, int cx, int cy,
-			int radius)
+/************************************************************************
+ * Grid fitness
+ *
+ * The fitness of a transform is a weighted sum over the cells of the
+ * features we expect to find by scanning the grid: the timing
+ * patterns, capstones and alignment patterns.
+ */
+
+typedef void (*fitness_func_t)(void *user_data, int x, int y, int weight);
+
+static void fitness_ring(int cx, int cy, int radius, int weight,
+			 fitness_func_t func, void *user_data)
 {
 	int i;
-	int score = 0;
 
 	for (i = 0; i < radius * 2; i++) {
-		score += fitness_cell(q, index, cx - radius + i, cy - radius);
-		score += fitness_cell(q, index, cx - radius, cy + radius - i);
-		score += fitness_cell(q, index, cx + radius, cy - radius + i);
-		score += fitness_cell(q, index, cx + radius - i, cy + radius);
+		func(user_data, cx - radius + i, cy - radius, weight);
+		func(user_data, cx - radius, cy + radius - i, weight);
+		func(user_data, cx + radius, cy - radius + i, weight);
+		func(user_data, cx + radius - i, cy + radius, weight);
 	}
-
-	return score;
 }
 
-static int fitness_apat(const struct quirc *q, int index, int cx, int cy)
+static void fitness_apat(int cx, int cy, fitness_func_t func, void *user_data)
 {
-	return fitness_cell(q, index, cx, cy) -
-		fitness_ring(q, index, cx, cy, 1) +
-		fitness_ring(q, index, cx, cy, 2);
+	func(user_data, cx, cy, 1);
+	fitness_ring(cx, cy, 1, -1, func, user_data);
+	fitness_ring(cx, cy, 2, 1, func, user_data);
 }
 
-static int fitness_capstone(const struct quirc *q, int index, int x, int y)
+static void fitness_capstone(int x, int y, fitness_func_t func,
+			     void *user_data)
 {
 	x += 3;
 	y += 3;
 
-	return fitness_cell(q, index, x, y) +
-		fitness_ring(q, index, x, y, 1) -
-		fitness_ring(q, index, x, y, 2) +
-		fitness_ring(q, index, x, y, 3);
+	func(user_data, x, y, 1);
+	fitness_ring(x, y, 1, 1, func, user_data);
+	fitness_ring(x, y, 2, -1, func, user_data);
+	fitness_ring(x, y, 3, 1, func, user_data);
 }
 
-/* Compute a fitness score for the currently configured perspective
- * transform, using the features we expect to find by scanning the
- * grid.
- */
-static int fitness_all(const struct quirc *q, int index)
+/* Call func for each scored cell of a grid of the given size */
+static void fitness_pattern(int size, fitness_func_t func, void *user_data)
 {
-	const struct quirc_grid *qr = &q->grids[index];
-	int version = (qr->grid_size - 17) / 4;
-	const struct quirc_version_info *info = &quirc_version_db[version];
-	int score = 0;
+	int version = (size - 17) / 4;
+	const struct quirc_version_info *info;
 	int i, j;
 	int ap_count;
 
 	/* Check the timing pattern */
-	for (i = 0; i < qr->grid_size - 14; i++) {
+	for (i = 0; i < size - 14; i++) {
 		int expect = (i & 1) ? 1 : -1;
 
-		score += fitness_cell(q, index, i + 7, 6) * expect;
-		score += fitness_cell(q, index, 6, i + 7) * expect;
+		func(user_data, i + 7, 6, expect);
+		func(user_data, 6, i + 7, expect);
 	}
 
 	/* Check capstones */
-	score += fitness_capstone(q, index, 0, 0);
-	score += fitness_capstone(q, index, qr->grid_size - 7, 0);
-	score += fitness_capstone(q, index, 0, qr->grid_size - 7);
+	fitness_capstone(0, 0, func, user_data);
+	fitness_capstone(size - 7, 0, func, user_data);
+	fitness_capstone(0, size - 7, func, user_data);
 
 	if (version < 0 || version > QUIRC_MAX_VERSION)
-		return score;
+		return;
 
 	/* Check alignment patterns */
+	info = &quirc_version_db[version];
 	ap_count = 0;
 	while ((ap_count < QUIRC_MAX_ALIGNMENT) && info->apat[ap_count])
 		ap_count++;
 
 	for (i = 1; i + 1 < ap_count; i++) {
-		score += fitness_apat(q, index, 6, info->apat[i]);
-		score += fitness_apat(q, index, info->apat[i], 6);
+		fitness_apat(6, info->apat[i], func, user_data);
+		fitness_apat(info->apat[i], 6, func, user_data);
 	}
 
 	for (i = 1; i < ap_count; i++)
 		for (j = 1; j < ap_count; j++)
-			score += fitness_apat(q, index,
-					info->apat[i], info->apat[j]);
+			fitness_apat(info->apat[i], info->apat[j],
+				     func, user_data);
+}
+
+struct fitness_sum {
+	const struct grid_sampler	*s;
+	int				score;
+};
+
+static void fitness_add_cell(void *user_data, int x, int y, int weight)
+{
+	struct fitness_sum *sum = (struct fitness_sum *)user_data;
+
+	sum->score += weight * fitness_cell(sum->s, x, y);
+}
+
+/* Compute a fitness score for the currently configured perspective
+ * transform.
+ */
+static int fitness_all(const struct grid_sampler *s)
+{
+	struct fitness_sum sum;
+
+	sum.s = s;
+	sum.score = 0;
+	fitness_pattern(s->size, fitness_add_cell, &sum);
+
+	return sum.score;
+}
+
+/* The fitness pattern's sample points, kept across the trials of
+ * jiggle_perspective(). A trial changes one coefficient: c[0..2] move
+ * only the x coordinate of each sample, c[3..5] only y, and c[6..7]
+ * both along with the denominator. Only what a trial changes is
+ * recomputed, into the spare arrays, which become current if the
+ * trial is kept.
+ */
+#define FITNESS_X	1
+#define FITNESS_Y	2
+#define FITNESS_XY	(FITNESS_X | FITNESS_Y)
+
+struct fitness_term {
+	int			x;
+	int			y;
+	int			weight;
+};
+
+struct fitness_cache {
+	const struct grid_sampler	*s;
+	int				num_terms;
+	struct fitness_term		*terms;
+
+	/* Per sample, QUIRC_SAMPLE_OFFSETS^2 per term: the rounded
+	 * coordinates (-1 outside the image), and the reciprocal of the
+	 * denominator (0 for samples taken in floating point).
+	 */
+	int16_t				*px;
+	int16_t				*py;
+	uint32_t			*recip;
+	int16_t				*new_px;
+	int16_t				*new_py;
+	uint32_t			*new_recip;
+};
+
+static void fitness_count_term(void *user_data, int x, int y, int weight)
+{
+	(void)x;
+	(void)y;
+	(void)weight;
+	(*(int *)user_data)++;
+}
+
+static void fitness_add_term(void *user_data, int x, int y, int weight)
+{
+	struct fitness_cache *fc = (struct fitness_cache *)user_data;
+	struct fitness_term *t = &fc->terms[fc->num_terms++];
+
+	t->x = x;
+	t->y = y;
+	t->weight = weight;
+}
+
+static int fitness_cache_init(struct fitness_cache *fc,
+			      const struct grid_sampler *s)
+{
+	const int per_term = QUIRC_SAMPLE_OFFSETS * QUIRC_SAMPLE_OFFSETS;
+	size_t n;
+	int count = 0;
+	char *mem;
+
+	if (!s->fixed || s->q->w > INT16_MAX || s->q->h > INT16_MAX)
+		return -1;
+
+	fitness_pattern(s->size, fitness_count_term, &count);
+	n = (size_t)count * per_term;
+
+	mem = malloc(count * sizeof(*fc->terms) +
+		     2 * n * (2 * sizeof(*fc->px) + sizeof(*fc->recip)));
+	if (!mem)
+		return -1;
+
+	fc->s = s;
+	fc->num_terms = 0;
+	fc->terms = (struct fitness_term *)mem;
+	fc->recip = (uint32_t *)(fc->terms + count);
+	fc->new_recip = fc->recip + n;
+	fc->px = (int16_t *)(fc->new_recip + n);
+	fc->py = fc->px + n;
+	fc->new_px = fc->py + n;
+	fc->new_py = fc->new_px + n;
+
+	fitness_pattern(s->size, fitness_add_term, fc);
+	return 0;
+}
+
+static void fitness_cache_free(struct fitness_cache *fc)
+{
+	free(fc->terms);
+}
+
+/* Resample the coordinates given by which into the spare arrays, and
+ * return the resulting fitness score. Always called with a constant
+ * which, so that each kind of trial gets its own loop.
+ */
+static inline int fitness_cache_scan(struct fitness_cache *fc, const int which)
+{
+	const struct grid_sampler *s = fc->s;
+	const struct quirc *q = s->q;
+	int16_t *px = (which & FITNESS_X) ? fc->new_px : fc->px;
+	int16_t *py = (which & FITNESS_Y) ? fc->new_py : fc->py;
+	uint32_t *recip = which == FITNESS_XY ? fc->new_recip : fc->recip;
+	const int fixed = s->fixed;
+	int score = 0;
+	int i = 0;
+	int t;
+
+	for (t = 0; t < fc->num_terms; t++) {
+		const struct fitness_term *term = &fc->terms[t];
+		struct cell_den cd;
+		int have_cd = 0;
+		int cell = 0;
+		int u, v;
+
+		if (which == FITNESS_XY)
+			have_cd = cell_den_init(s, term->x, term->y, &cd);
+
+		for (v = 0; v < QUIRC_SAMPLE_OFFSETS; v++)
+			for (u = 0; u < QUIRC_SAMPLE_OFFSETS; u++, i++) {
+				int ok;
+				int x = 0, y = 0;
+
+				if (which == FITNESS_XY)
+					recip[i] = have_cd ?
+						sample_recip(s, &cd, term->x, u,
+							     term->y, v) : 0;
+
+				ok = fixed && recip[i];
+				if (ok && (which & FITNESS_X))
+					ok = sample_coord(sample_nx(s, term->x,
+							u, term->y, v),
+							recip[i], q->w, &x);
+				if (ok && (which & FITNESS_Y))
+					ok = sample_coord(sample_ny(s, term->x,
+							u, term->y, v),
+							recip[i], q->h, &y);
+
+				if (!ok) {
+					struct quirc_point p;
+
+					perspective_map(s->c,
+						term->x + sample_offsets[u],
+						term->y + sample_offsets[v], &p);
+					x = p.x < 0 || p.x >= q->w ? -1 : p.x;
+					y = p.y < 0 || p.y >= q->h ? -1 : p.y;
+				}
+
+				if (which & FITNESS_X)
+					px[i] = x;
+				if (which & FITNESS_Y)
+					py[i] = y;
+
+				cell += sample_pixel(q, px[i], py[i]);
+			}
+
+		score += term->weight * cell;
+	}
 
 	return score;
 }
 
+static int fitness_cache_eval(struct fitness_cache *fc, int which)
+{
+	switch (which) {
+	case FITNESS_X:
+		return fitness_cache_scan(fc, FITNESS_X);
+	case FITNESS_Y:
+		return fitness_cache_scan(fc, FITNESS_Y);
+	default:
+		return fitness_cache_scan(fc, FITNESS_XY);
+	}
+}
+
+/* Make the arrays resampled by the last fitness_cache_eval() current */
+static void fitness_cache_keep(struct fitness_cache *fc, int which)
+{
+	int16_t *c;
+	uint32_t *r;
+
+	if (which & FITNESS_X) {
+		c = fc->px;
+		fc->px = fc->new_px;
+		fc->new_px = c;
+	}
+
+	if (which & FITNESS_Y) {
+		c = fc->py;
+		fc->py = fc->new_py;
+		fc->new_py = c;
+	}
+
+	if (which == FITNESS_XY) {
+		r = fc->recip;
+		fc->recip = fc->new_recip;
+		fc->new_recip = r;
+	}
+}
+
 static void jiggle_perspective(struct quirc *q, int index)
 {
 	struct quirc_grid *qr = &q->grids[index];
-	int best = fitness_all(q, index);
+	struct grid_sampler s;
+	struct fitness_cache fc;
+	int cached;
+	int best;
 	int pass;
 	quirc_float_t adjustments[8];
 	int i;
 
+	sampler_init(&s, q, index);
+	cached = !fitness_cache_init(&fc, &s);
+
+	if (cached) {
+		best = fitness_cache_eval(&fc, FITNESS_XY);
+		fitness_cache_keep(&fc, FITNESS_XY);
+	} else {
+		best = fitness_all(&s);
+	}
+
 	for (i = 0; i < 8; i++)
 		adjustments[i] = qr->c[i] * (quirc_float_t)0.02;
 
 	for (pass = 0; pass < 5; pass++) {
 		for (i = 0; i < 16; i++) {
 			int j = i >> 1;
+			int which = j < 3 ? FITNESS_X :
+				j < 6 ? FITNESS_Y : FITNESS_XY;
 			int test;
 			quirc_float_t old = qr->c[j];
 			quirc_float_t step = adjustments[j];
@@ -830,17 +1683,26 @@ static void jiggle_perspective(struct quirc *q, int index)
 				new = old - step;
 
 			qr->c[j] = new;
-			test = fitness_all(q, index);
+			sampler_update(&s, j);
+			test = cached ? fitness_cache_eval(&fc, which) :
+				fitness_all(&s);
 
-			if (test > best)
+			if (test > best) {
 				best = test;
-			else
+				if (cached)
+					fitness_cache_keep(&fc, which);
+			} else {
 				qr->c[j] = old;
+				sampler_update(&s, j);
+			}
 		}
 
 		for (i = 0; i < 8; i++)
 			adjustments[i] *= 0.5;
 	}
+
+	if (cached)
+		fitness_cache_free(&fc);
 }
 
 /* Once the capstones are in place and an alignment point has been
@@ -862,7 +1724,12 @@ static void setup_qr_perspective(struct quirc *q, int index)
 	       sizeof(rect[0]));
 	perspective_setup(qr->c, rect, qr->grid_size - 7, qr->grid_size - 7);
 
-	jiggle_perspective(q, index);
+	/* With a pool, grids are refined together once grouping is done.
+	 * Nothing in grouping reads a grid's transform, so the result is
+	 * the same.
+	 */
+	if (!q->pool)
+		jiggle_perspective(q, index);
 }
 
 /* Rotate the capstone with so that corner 0 is the leftmost with respect
@@ -924,6 +1791,22 @@ static void record_qr_grid(struct quirc *q, int a, int b, int c)
 		hd.y = -hd.y;
 	}
 
+	/* Give the grid its sampling tables. Without them it is sampled
+	 * in floating point, so a failure here is not fatal.
+	 */
+	if (q->num_grids >= q->max_sample_terms && !q->float_sampling) {
+		int max = q->max_sample_terms ? q->max_sample_terms * 2 : 4;
+		struct quirc_sample_terms *terms;
+
+		if (max > QUIRC_MAX_GRIDS)
+			max = QUIRC_MAX_GRIDS;
+		terms = realloc(q->sample_terms, max * sizeof(*terms));
+		if (terms) {
+			q->sample_terms = terms;
+			q->max_sample_terms = max;
+		}
+	}
+
 	/* Record the grid and its components */
 	qr_index = q->num_grids;
 	qr = &q->grids[q->num_grids++];
@@ -979,12 +1862,8 @@ static void record_qr_grid(struct quirc *q, int a, int b, int c)
 			psd.scores[0] = -hd.y * qr->align.x +
 				hd.x * qr->align.y;
 
-			flood_fill_seed(q, reg->seed.x, reg->seed.y,
-					qr->align_region, QUIRC_PIXEL_BLACK,
-					NULL, NULL);
-			flood_fill_seed(q, reg->seed.x, reg->seed.y,
-					QUIRC_PIXEL_BLACK, qr->align_region,
-					find_leftmost_to_line, &psd);
+			region_for_each_run(q, qr->align_region,
+					    find_leftmost_to_line, &psd);
 		}
 	}
 
@@ -1072,24 +1951,9 @@ static void test_grouping(struct quirc *q, unsigned int i)
 	test_neighbours(q, i, &hlist, &vlist);
 }
 
-static void pixels_setup(struct quirc *q, uint8_t threshold)
-{
-	if (QUIRC_PIXEL_ALIAS_IMAGE) {
-		q->pixels = (quirc_pixel_t *)q->image;
-	}
-
-	uint8_t* source = q->image;
-	quirc_pixel_t* dest = q->pixels;
-	int length = q->w * q->h;
-	while (length--) {
-		uint8_t value = *source++;
-		*dest++ = (value < threshold) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
-	}
-}
-
 uint8_t *quirc_begin(struct quirc *q, int *w, int *h)
 {
-	q->num_regions = QUIRC_PIXEL_REGION;
+	q->num_regions = 0;
 	q->num_capstones = 0;
 	q->num_grids = 0;
 
@@ -1098,27 +1962,615 @@ uint8_t *quirc_begin(struct quirc *q, int *w, int *h)
 	if (h)
 		*h = q->h;
 
+	/* The buffer is released when quirc_set_image() changes the size */
+	if (!q->image)
+		q->image = calloc(q->w ? q->w : 1, q->h ? q->h : 1);
+
+	q->src = q->image;
+	q->src_stride = q->w;
+
 	return q->image;
 }
 
-void quirc_end(struct quirc *q)
+int quirc_set_image(struct quirc *q, const uint8_t *luma, int w, int h,
+		    int stride)
+{
+	if (!luma || w < 0 || h < 0 || stride < w)
+		return -1;
+
+	if (w != q->w || h != q->h) {
+		if (quirc_resize_work(q, w, h) < 0)
+			return -1;
+
+		free(q->image);
+		q->image = NULL;
+	}
+
+	q->num_regions = 0;
+	q->num_capstones = 0;
+	q->num_grids = 0;
+
+	q->src = luma;
+	q->src_stride = stride;
+
+	return 0;
+}
+
+/************************************************************************
+ * Banded scanning
+ *
+ * With a worker pool, the per-row stages of a scan run on bands of
+ * rows in parallel. The stages that depend on order (joining runs
+ * across rows, and testing capstone candidates, which numbers regions
+ * and capstones) then run on the caller's thread in row order, so the
+ * union-find forest and all numbering come out exactly as they do in
+ * a single-threaded scan.
+ */
+
+struct band_job {
+	struct quirc		*q;
+	const struct quirc_rect	*rect;
+	uint8_t			threshold;
+};
+
+/* Split rows y0 to y1 - 1 evenly into bands */
+static void band_rows(const struct quirc *q, int band, int y0, int y1,
+		      int *b0, int *b1)
+{
+	long long n = y1 - y0;
+
+	*b0 = y0 + (int)(n * band / q->num_bands);
+	*b1 = y0 + (int)(n * (band + 1) / q->num_bands);
+}
+
+static void band_histogram(void *arg, int band)
+{
+	struct band_job *job = (struct band_job *)arg;
+	struct quirc_band *b = &job->q->bands[band];
+	int y0, y1;
+
+	band_rows(job->q, band, job->rect->y0, job->rect->y1, &y0, &y1);
+	memset(b->histogram, 0, sizeof(b->histogram));
+	histogram_rows(job->q, job->rect, y0, y1, b->histogram);
+}
+
+static void band_threshold(void *arg, int band)
+{
+	struct band_job *job = (struct band_job *)arg;
+	struct quirc *q = job->q;
+	const struct quirc_rect *rect = job->rect;
+	int y0, y1, y;
+
+	band_rows(q, band, rect->y0, rect->y1, &y0, &y1);
+
+	if (q->threshold_mode == QUIRC_THRESHOLD_ADAPTIVE) {
+		adaptive_threshold_rows(q, rect, y0, y1,
+					q->adapt_col_sum + band * q->w);
+		return;
+	}
+
+	for (y = y0; y < y1; y++)
+		row_bits_threshold(q->src + y * q->src_stride + rect->x0,
+				   rect->x1 - rect->x0, job->threshold,
+				   q->bitmap + y * q->bitmap_stride +
+				   (rect->x0 >> 6));
+}
+
+/* Store the number of runs in row y at row_runs[y + 1] */
+static void band_count_runs(void *arg, int band)
+{
+	struct quirc *q = ((struct band_job *)arg)->q;
+	int y0, y1, y;
+
+	band_rows(q, band, 0, q->h, &y0, &y1);
+	for (y = y0; y < y1; y++)
+		q->row_runs[y + 1] =
+			count_row_runs(q->bitmap + y * q->bitmap_stride,
+				       q->bitmap_stride);
+}
+
+static void band_extract_runs(void *arg, int band)
+{
+	struct quirc *q = ((struct band_job *)arg)->q;
+	int y0, y1, y;
+
+	band_rows(q, band, 0, q->h, &y0, &y1);
+	for (y = y0; y < y1; y++)
+		extract_row_runs(q, y);
+}
+
+static void band_record_hit(void *user_data, int x, int y,
+			    const unsigned int *pb)
+{
+	struct quirc_band *b = (struct quirc_band *)user_data;
+	struct quirc_finder_hit *hit;
+
+	if (b->hits_exhausted)
+		return;
+
+	if (b->num_hits >= b->max_hits) {
+		int max_hits = b->max_hits ? b->max_hits * 2 : 64;
+		struct quirc_finder_hit *hits;
+
+		hits = realloc(b->hits, (size_t)max_hits * sizeof(*hits));
+		if (!hits) {
+			b->hits_exhausted = 1;
+			return;
+		}
+
+		b->hits = hits;
+		b->max_hits = max_hits;
+	}
+
+	hit = &b->hits[b->num_hits++];
+	hit->x = x;
+	hit->y = y;
+	memcpy(hit->pb, pb, sizeof(hit->pb));
+}
+
+static void band_finder_scan(void *arg, int band)
+{
+	struct band_job *job = (struct band_job *)arg;
+	struct quirc_band *b = &job->q->bands[band];
+	int y0, y1, y;
+
+	b->num_hits = 0;
+	b->hits_exhausted = 0;
+
+	band_rows(job->q, band, job->rect->y0, job->rect->y1, &y0, &y1);
+	for (y = y0; y < y1; y++)
+		finder_scan_row(job->q, y, band_record_hit, b);
+}
+
+static void find_capstones_banded(struct quirc *q,
+				  const struct quirc_rect *rect)
+{
+	struct band_job job;
+	int total = 0;
+	int i, j, y;
+
+	job.q = q;
+	job.rect = rect;
+	job.threshold = 0;
+
+	if (q->threshold_mode != QUIRC_THRESHOLD_ADAPTIVE) {
+		unsigned int histogram[UINT8_MAX + 1];
+
+		quirc_pool_run(q->pool, q->num_bands, band_histogram, &job);
+
+		memset(histogram, 0, sizeof(histogram));
+		for (i = 0; i < q->num_bands; i++)
+			for (j = 0; j <= UINT8_MAX; j++)
+				histogram[j] += q->bands[i].histogram[j];
+
+		job.threshold = otsu_threshold(histogram,
+			(rect->x1 - rect->x0) * (rect->y1 - rect->y0));
+	}
+
+	quirc_pool_run(q->pool, q->num_bands, band_threshold, &job);
+
+	/* Count each row's runs to lay out the run table, then fill it
+	 * in parallel and join the rows in order.
+	 */
+	quirc_pool_run(q->pool, q->num_bands, band_count_runs, &job);
+
+	q->row_runs[0] = 0;
+	for (y = 0; y < q->h; y++) {
+		total += q->row_runs[y + 1];
+		q->row_runs[y + 1] = total;
+	}
+
+	if (runs_reserve(q, total) < 0) {
+		/* Label as far as the table can grow, as a single-threaded
+		 * scan does.
+		 */
+		for (y = 0; y < q->h; y++)
+			label_row(q, y);
+	} else {
+		q->num_runs = total;
+		quirc_pool_run(q->pool, q->num_bands, band_extract_runs, &job);
+
+		for (y = 1; y < q->h; y++)
+			join_rows(q, y);
+	}
+
+	quirc_pool_run(q->pool, q->num_bands, band_finder_scan, &job);
+
+	for (i = 0; i < q->num_bands; i++) {
+		const struct quirc_band *b = &q->bands[i];
+
+		if (b->hits_exhausted) {
+			int y0, y1;
+
+			band_rows(q, i, rect->y0, rect->y1, &y0, &y1);
+			for (y = y0; y < y1; y++)
+				finder_scan(q, y);
+			continue;
+		}
+
+		for (j = 0; j < b->num_hits; j++)
+			test_capstone(q, b->hits[j].x, b->hits[j].y,
+				      b->hits[j].pb);
+	}
+}
+
+/* Binarise and label one rectangle of the frame, and locate the
+ * capstones within it. The rectangle's left edge must be word-aligned
+ * in the bitmap, and its right edge word-aligned or at the image edge.
+ */
+static void find_capstones(struct quirc *q, const struct quirc_rect *rect)
 {
 	int i;
 
-	uint8_t threshold = otsu(q);
-	pixels_setup(q, threshold);
+	q->num_regions = 0;
+	q->num_capstones = 0;
+	q->num_grids = 0;
+	q->num_runs = 0;
+	q->runs_exhausted = 0;
+
+	if (rect->x0 > 0 || rect->y0 > 0 ||
+	    rect->x1 < q->w || rect->y1 < q->h)
+		memset(q->bitmap, 0,
+		       (size_t)q->bitmap_stride * q->h * sizeof(*q->bitmap));
+
+	if (q->pool) {
+		find_capstones_banded(q, rect);
+		return;
+	}
+
+	if (q->threshold_mode == QUIRC_THRESHOLD_ADAPTIVE) {
+		adaptive_threshold(q, rect);
+	} else {
+		uint8_t threshold = otsu(q, rect);
+
+		for (i = rect->y0; i < rect->y1; i++)
+			row_bits_threshold(q->src + i * q->src_stride + rect->x0,
+					   rect->x1 - rect->x0, threshold,
+					   q->bitmap + i * q->bitmap_stride +
+					   (rect->x0 >> 6));
+	}
 
+	/* Rows outside the rectangle are blank, which costs one word
+	 * test per 64 pixels to label and scan.
+	 */
 	for (i = 0; i < q->h; i++)
+		label_row(q, i);
+
+	for (i = rect->y0; i < rect->y1; i++)
 		finder_scan(q, i);
+}
+
+static void grid_jiggle(void *arg, int index)
+{
+	jiggle_perspective((struct quirc *)arg, index);
+}
+
+/* Search one rectangle of the frame for codes */
+static void scan_rect(struct quirc *q, const struct quirc_rect *rect)
+{
+	int i;
+
+	find_capstones(q, rect);
 
 	for (i = 0; i < q->num_capstones; i++)
 		test_grouping(q, i);
+
+	if (q->pool)
+		quirc_pool_run(q->pool, q->num_grids, grid_jiggle, q);
+}
+
+/* Remember a padded bounding box around the codes just found, for
+ * the next frame to try first.
+ */
+static void track_update(struct quirc *q)
+{
+	int x0 = q->w, y0 = q->h, x1 = 0, y1 = 0;
+	int pad;
+	int i, j;
+
+	q->track_grids = q->num_grids;
+	if (!q->num_grids)
+		return;
+
+	for (i = 0; i < q->num_grids; i++) {
+		const struct quirc_grid *qr = &q->grids[i];
+		static const int uv[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+
+		for (j = 0; j < 4; j++) {
+			struct quirc_point p;
+
+			perspective_map(qr->c, uv[j][0] * qr->grid_size,
+					uv[j][1] * qr->grid_size, &p);
+			if (p.x < x0) x0 = p.x;
+			if (p.y < y0) y0 = p.y;
+			if (p.x > x1) x1 = p.x;
+			if (p.y > y1) y1 = p.y;
+		}
+	}
+
+	pad = (x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0) *
+		QUIRC_TRACK_PAD_PERCENT / 100;
+
+	x0 -= pad;
+	y0 -= pad;
+	x1 += pad + 1;
+	y1 += pad + 1;
+
+	q->track_rect.x0 = x0 < 0 ? 0 : (x0 & ~63);
+	q->track_rect.y0 = y0 < 0 ? 0 : y0;
+	q->track_rect.x1 = x1 >= q->w ? q->w : ((x1 + 63) & ~63);
+	q->track_rect.y1 = y1 >= q->h ? q->h : y1;
+	if (q->track_rect.x1 > q->w)
+		q->track_rect.x1 = q->w;
+
+	/* Codes mapped entirely outside the image can't be tracked */
+	if (q->track_rect.x0 >= q->track_rect.x1 ||
+	    q->track_rect.y0 >= q->track_rect.y1)
+		q->track_grids = 0;
+}
+
+/* Average factor x factor blocks of src into one output row. Called
+ * with a constant factor so that the inner loops unroll.
+ */
+static inline void downscale_row(const uint8_t *src, int stride,
+				 uint8_t *dst, int w, const int factor)
+{
+	const int area = factor * factor;
+	int x, i, j;
+
+	for (x = 0; x < w; x++) {
+		unsigned int sum = area / 2;
+
+		for (j = 0; j < factor; j++)
+			for (i = 0; i < factor; i++)
+				sum += src[j * stride + i];
+
+		dst[x] = sum / area;
+		src += factor;
+	}
+}
+
+/* Box-filter the source plane down by the pyramid factor into the
+ * coarse recognizer's own image buffer.
+ */
+static void pyramid_downscale(const struct quirc *q, struct quirc *coarse,
+			      int factor)
+{
+	uint8_t *dst = quirc_begin(coarse, NULL, NULL);
+	int y;
+
+	for (y = 0; y < coarse->h; y++) {
+		const uint8_t *src = q->src + y * factor * q->src_stride;
+
+		if (factor == 2)
+			downscale_row(src, q->src_stride, dst, coarse->w, 2);
+		else
+			downscale_row(src, q->src_stride, dst, coarse->w, 4);
+
+		dst += coarse->w;
+	}
+}
+
+static void rect_include(struct quirc_rect *r, int x, int y)
+{
+	if (x < r->x0) r->x0 = x;
+	if (y < r->y0) r->y0 = y;
+	if (x + 1 > r->x1) r->x1 = x + 1;
+	if (y + 1 > r->y1) r->y1 = y + 1;
+}
+
+/* Include a capstone's corners in r, moved by (dx, dy) and padded by
+ * its size
+ */
+static void rect_include_capstone(struct quirc_rect *r,
+				  const struct quirc_capstone *cap,
+				  int dx, int dy)
+{
+	struct quirc_rect cr = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+	int pad;
+	int j;
+
+	for (j = 0; j < 4; j++)
+		rect_include(&cr, cap->corners[j].x + dx,
+			     cap->corners[j].y + dy);
+
+	pad = cr.x1 - cr.x0 > cr.y1 - cr.y0 ?
+		cr.x1 - cr.x0 : cr.y1 - cr.y0;
+	rect_include(r, cr.x0 - pad, cr.y0 - pad);
+	rect_include(r, cr.x1 + pad, cr.y1 + pad);
+}
+
+/* Include the fourth corner of each code that capstone b may be the
+ * corner capstone of. Capstone corners are too coarse at this level
+ * for test_grouping(), so the other two capstones are paired by their
+ * centres alone: at about the same distance from b, and at about a
+ * right angle. The code's fourth corner is then opposite b, at
+ * a + c - b, and gets a copy of b.
+ */
+static void pyramid_include_groups(const struct quirc *q, int b,
+				   struct quirc_rect *r)
+{
+	const struct quirc_point *pb = &q->capstones[b].center;
+	int a, c;
+
+	for (a = 0; a < q->num_capstones; a++) {
+		const struct quirc_point *pa = &q->capstones[a].center;
+		int ux = pa->x - pb->x;
+		int uy = pa->y - pb->y;
+		quirc_float_t lu = sqrt((quirc_float_t)ux * ux + uy * uy);
+
+		if (a == b)
+			continue;
+
+		for (c = a + 1; c < q->num_capstones; c++) {
+			const struct quirc_point *pc = &q->capstones[c].center;
+			int vx = pc->x - pb->x;
+			int vy = pc->y - pb->y;
+			quirc_float_t lv = sqrt((quirc_float_t)vx * vx + vy * vy);
+
+			if (c == b || !lu || !lv)
+				continue;
+
+			if (fabs(1 - lu / lv) < (quirc_float_t)0.3 &&
+			    fabs((ux * vx + uy * vy) / (lu * lv)) <
+			    (quirc_float_t)0.3)
+				rect_include_capstone(r, &q->capstones[b],
+						      ux + vx, uy + vy);
+		}
+	}
+}
+
+/* Find capstones on a downscaled copy of the frame, and return the
+ * full-resolution rectangle that must be scanned to decode them.
+ * Returns 0 if nothing was found, 1 if the rectangle is valid, or -1
+ * if the coarse level could not be set up.
+ */
+static int pyramid_locate(struct quirc *q, int factor,
+			  struct quirc_rect *roi)
+{
+	struct quirc *coarse = q->coarse;
+	struct quirc_rect box = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+	struct quirc_rect all;
+	int i;
+
+	if (!coarse) {
+		coarse = quirc_new();
+		if (!coarse)
+			return -1;
+		q->coarse = coarse;
+	}
+
+	if (coarse->w != q->w / factor || coarse->h != q->h / factor ||
+	    !coarse->image) {
+		if (quirc_resize(coarse, q->w / factor, q->h / factor) < 0)
+			return -1;
+	}
+
+	coarse->threshold_mode = q->threshold_mode;
+	pyramid_downscale(q, coarse, factor);
+
+	all.x0 = 0;
+	all.y0 = 0;
+	all.x1 = coarse->w;
+	all.y1 = coarse->h;
+	find_capstones(coarse, &all);
+
+	if (!coarse->num_capstones)
+		return 0;
+
+	/* Each capstone is padded by its own size, which covers the
+	 * quiet zone and the edges of a code next to it. A rotated code's
+	 * fourth corner can lie well outside the box of its capstones, so
+	 * each group of three that may be a code also adds that corner.
+	 */
+	for (i = 0; i < coarse->num_capstones; i++)
+		rect_include_capstone(&box, &coarse->capstones[i], 0, 0);
+
+	for (i = 0; i < coarse->num_capstones; i++)
+		pyramid_include_groups(coarse, i, &box);
+
+	/* Scale up, allowing for the cells lost to downscaling */
+	box.x0 = (box.x0 - 1) * factor;
+	box.y0 = (box.y0 - 1) * factor;
+	box.x1 = (box.x1 + 1) * factor;
+	box.y1 = (box.y1 + 1) * factor;
+
+	roi->x0 = box.x0 < 0 ? 0 : (box.x0 & ~63);
+	roi->y0 = box.y0 < 0 ? 0 : box.y0;
+	roi->x1 = box.x1 >= q->w ? q->w : ((box.x1 + 63) & ~63);
+	roi->y1 = box.y1 >= q->h ? q->h : box.y1;
+	if (roi->x1 > q->w)
+		roi->x1 = q->w;
+
+	return roi->x0 < roi->x1 && roi->y0 < roi->y1;
+}
+
+/* Scan the whole frame, directly or coarse-to-fine */
+static void scan_frame(struct quirc *q)
+{
+	struct quirc_rect rect;
+	int factor = q->pyramid_factor;
+
+	/* The coarse level must still resolve the smallest module size
+	 * the caller cares about.
+	 */
+	while (factor > 1 &&
+	       q->pyramid_min_module < QUIRC_PYRAMID_COARSE_MODULE * factor)
+		factor /= 2;
+
+	if (factor > 1 && q->w >= factor * 64 && q->h >= factor * 64) {
+		int found = pyramid_locate(q, factor, &rect);
+
+		if (found == 0) {
+			q->num_regions = 0;
+			q->num_capstones = 0;
+			q->num_grids = 0;
+			return;
+		}
+
+		if (found > 0) {
+			scan_rect(q, &rect);
+			return;
+		}
+	}
+
+	rect.x0 = 0;
+	rect.y0 = 0;
+	rect.x1 = q->w;
+	rect.y1 = q->h;
+	scan_rect(q, &rect);
+}
+
+void quirc_end(struct quirc *q)
+{
+	if (q->track_interval > 0 && q->track_grids > 0 &&
+	    q->track_countdown > 0) {
+		q->track_countdown--;
+		scan_rect(q, &q->track_rect);
+
+		/* Accept the tracked result only if nothing was lost */
+		if (q->num_grids >= q->track_grids) {
+			track_update(q);
+			return;
+		}
+	}
+
+	scan_frame(q);
+
+	if (q->track_interval > 0) {
+		q->track_countdown = q->track_interval - 1;
+		track_update(q);
+	}
+}
+
+int quirc_set_pyramid(struct quirc *q, int factor, int min_module)
+{
+	if ((factor != 1 && factor != 2 && factor != 4) || min_module < 1)
+		return -1;
+
+	q->pyramid_factor = factor;
+	q->pyramid_min_module = min_module;
+
+	return 0;
+}
+
+int quirc_set_tracking(struct quirc *q, int full_scan_interval)
+{
+	if (full_scan_interval < 0)
+		return -1;
+
+	q->track_interval = full_scan_interval;
+	q->track_countdown = 0;
+	q->track_grids = 0;
+
+	return 0;
 }
 
 void quirc_extract(const struct quirc *q, int index,
 		   struct quirc_code *code)
 {
 	const struct quirc_grid *qr = &q->grids[index];
+	struct grid_sampler sampler;
 	int y;
 	int i = 0;
 
@@ -1141,10 +2593,11 @@ void quirc_extract(const struct quirc *q, int index,
 	if (code->size > QUIRC_MAX_GRID_SIZE)
 		return;
 
+	sampler_init(&sampler, q, index);
 	for (y = 0; y < qr->grid_size; y++) {
 		int x;
 		for (x = 0; x < qr->grid_size; x++) {
-			if (read_cell(q, index, x, y) > 0) {
+			if (read_cell(&sampler, x, y) > 0) {
 				code->cell_bitmap[i >> 3] |= (1 << (i & 7));
 			}
 			i++;
@@ -0,0 +1,185 @@
+/* quirc - QR-code recognition library
+ * Copyright (C) 2010-2012 Daniel Beer <dlbeer@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "quirc_internal.h"
+
+/* A fixed set of worker threads which sleep between jobs. A job is a
+ * function applied to task indices 0 to count - 1; tasks are handed
+ * out one at a time, and the calling thread takes its share too.
+ */
+struct quirc_pool {
+	pthread_mutex_t		lock;
+	pthread_cond_t		start;
+	pthread_cond_t		done;
+
+	pthread_t		*threads;
+	int			num_workers;
+	int			shutdown;
+
+	/* The current job. generation changes each time one is posted,
+	 * and busy counts the workers that have yet to leave it.
+	 */
+	unsigned int		generation;
+	quirc_task_func_t	func;
+	void			*arg;
+	int			count;
+	int			next;
+	int			busy;
+};
+
+/* Run tasks of the current job until none are left. Called and
+ * returns with the lock held.
+ */
+static void pool_drain(struct quirc_pool *pool)
+{
+	quirc_task_func_t func = pool->func;
+	void *arg = pool->arg;
+
+	while (pool->next < pool->count) {
+		int task = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+		func(arg, task);
+		pthread_mutex_lock(&pool->lock);
+	}
+}
+
+static void *pool_worker(void *user_data)
+{
+	struct quirc_pool *pool = (struct quirc_pool *)user_data;
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->shutdown && pool->generation == seen)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->shutdown)
+			break;
+
+		seen = pool->generation;
+		pool->busy++;
+		pool_drain(pool);
+		if (!--pool->busy)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct quirc_pool *quirc_pool_new(int num_threads)
+{
+	struct quirc_pool *pool;
+	int i;
+
+	if (num_threads < 2)
+		return NULL;
+
+	pool = malloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->threads = calloc(num_threads - 1, sizeof(*pool->threads));
+	if (!pool->threads)
+		goto fail_threads;
+
+	if (pthread_mutex_init(&pool->lock, NULL))
+		goto fail_lock;
+	if (pthread_cond_init(&pool->start, NULL))
+		goto fail_start;
+	if (pthread_cond_init(&pool->done, NULL))
+		goto fail_done;
+
+	/* The caller's thread makes up the number */
+	for (i = 0; i < num_threads - 1; i++) {
+		if (pthread_create(&pool->threads[i], NULL, pool_worker, pool))
+			break;
+		pool->num_workers++;
+	}
+
+	if (pool->num_workers < num_threads - 1) {
+		quirc_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+
+fail_done:
+	pthread_cond_destroy(&pool->start);
+fail_start:
+	pthread_mutex_destroy(&pool->lock);
+fail_lock:
+	free(pool->threads);
+fail_threads:
+	free(pool);
+	return NULL;
+}
+
+void quirc_pool_destroy(struct quirc_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->num_workers; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+void quirc_pool_run(struct quirc_pool *pool, int count,
+		    quirc_task_func_t func, void *arg)
+{
+	int i;
+
+	if (!pool || count < 2) {
+		for (i = 0; i < count; i++)
+			func(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->count = count;
+	pool->next = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	pool_drain(pool);
+
+	/* Workers that wake after the last task was taken leave at once,
+	 * so once busy drops to zero nothing can still touch arg.
+	 */
+	while (pool->busy)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
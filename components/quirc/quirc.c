@@ -31,27 +31,109 @@ struct quirc *quirc_new(void)
 		return NULL;
 
 	memset(q, 0, sizeof(*q));
+	q->pyramid_factor = 1;
+	q->pyramid_min_module = 1;
 	return q;
 }
 
+static void free_bands(struct quirc_band *bands, int num_bands)
+{
+	int i;
+
+	if (!bands)
+		return;
+
+	for (i = 0; i < num_bands; i++)
+		free(bands[i].hits);
+	free(bands);
+}
+
 void quirc_destroy(struct quirc *q)
 {
+	quirc_pool_destroy(q->pool);
+	free_bands(q->bands, q->num_bands);
+	if (q->coarse)
+		quirc_destroy(q->coarse);
 	free(q->image);
-	/* q->pixels may alias q->image when their type representation is of the
-	   same size, so we need to be careful here to avoid a double free */
-	if (!QUIRC_PIXEL_ALIAS_IMAGE)
-		free(q->pixels);
-	free(q->flood_fill_vars);
+	free(q->bitmap);
+	free(q->runs);
+	free(q->row_runs);
+	free(q->run_stack);
+	free(q->regions);
+	free(q->sample_terms);
+	free(q->adapt_col_sum);
 	free(q);
 }
 
+int quirc_resize_work(struct quirc *q, int w, int h)
+{
+	uint64_t	*bitmap = NULL;
+	int		*row_runs = NULL;
+	int		stride;
+	int		adapt_radius;
+	uint32_t	*col_sum = NULL;
+
+	if (w < 0 || h < 0)
+		goto fail;
+
+	/*
+	 * alloc the packed bitmap of the binarised frame. Rows are padded
+	 * to whole words, plus one spare word so that a zero-width image
+	 * still has a readable row.
+	 */
+	stride = (w + 63) / 64;
+	bitmap = calloc((size_t)stride * h + 1, sizeof(*bitmap));
+	if (!bitmap)
+		goto fail;
+
+	/*
+	 * alloc the per-row index into the run table. The run table itself
+	 * depends on image content and grows on demand in quirc_end().
+	 */
+	row_runs = calloc((size_t)h + 1, sizeof(*row_runs));
+	if (!row_runs)
+		goto fail;
+
+	/*
+	 * alloc the adaptive thresholding buffer: one column sum per pixel
+	 * across, for each band.
+	 */
+	adapt_radius = w / (QUIRC_ADAPTIVE_WINDOW_DEN * 2);
+	if (adapt_radius < 1)
+		adapt_radius = 1;
+
+	col_sum = calloc((size_t)(w ? w : 1) *
+			 (q->num_bands ? q->num_bands : 1), sizeof(*col_sum));
+	if (!col_sum)
+		goto fail;
+
+	/* alloc succeeded, update `q` with the new size and buffers */
+	q->w = w;
+	q->h = h;
+	free(q->bitmap);
+	q->bitmap = bitmap;
+	q->bitmap_stride = stride;
+	free(q->row_runs);
+	q->row_runs = row_runs;
+	q->num_runs = 0;
+	free(q->adapt_col_sum);
+	q->adapt_col_sum = col_sum;
+	q->adapt_radius = adapt_radius;
+	q->track_grids = 0;
+
+	return 0;
+	/* NOTREACHED */
+fail:
+	free(bitmap);
+	free(row_runs);
+	free(col_sum);
+
+	return -1;
+}
+
 int quirc_resize(struct quirc *q, int w, int h)
 {
 	uint8_t		*image  = NULL;
-	quirc_pixel_t	*pixels = NULL;
-	size_t num_vars;
-	size_t vars_byte_size;
-	struct quirc_flood_fill_vars *vars = NULL;
 
 	/*
 	 * XXX: w and h should be size_t (or at least unsigned) as negatives
@@ -72,7 +154,7 @@ int quirc_resize(struct quirc *q, int w, int h)
 
 	/* compute the "old" (i.e. currently allocated) and the "new"
 	   (i.e. requested) image dimensions */
-	size_t olddim = q->w * q->h;
+	size_t olddim = q->image ? q->w * q->h : 0;
 	size_t newdim = w * h;
 	size_t min = (olddim < newdim ? olddim : newdim);
 
@@ -81,61 +163,75 @@ int quirc_resize(struct quirc *q, int w, int h)
 	 * old buffer when the new size is greater and (b) to write beyond the
 	 * new buffer when the new size is smaller, hence the min computation.
 	 */
-	(void)memcpy(image, q->image, min);
+	if (min)
+		(void)memcpy(image, q->image, min);
 
-	/* alloc a new buffer for q->pixels if needed */
-	if (!QUIRC_PIXEL_ALIAS_IMAGE) {
-		pixels = calloc(newdim, sizeof(quirc_pixel_t));
-		if (!pixels)
-			goto fail;
-	}
+	/* resize the working buffers, which updates the size on success */
+	if (quirc_resize_work(q, w, h) < 0)
+		goto fail;
 
-	/*
-	 * alloc the work area for the flood filling logic.
-	 *
-	 * the size was chosen with the following assumptions and observations:
-	 *
-	 * - rings are the regions which requires the biggest work area.
-	 * - they consumes the most when they are rotated by about 45 degree.
-	 *   in that case, the necessary depth is about (2 * height_of_the_ring).
-	 * - the maximum height of rings would be about 1/3 of the image height.
-	 */
+	free(q->image);
+	q->image = image;
 
-	if ((size_t)h * 2 / 2 != h) {
-		goto fail; /* size_t overflow */
-	}
-	num_vars = (size_t)h * 2 / 3;
-	if (num_vars == 0) {
-		num_vars = 1;
+	return 0;
+	/* NOTREACHED */
+fail:
+	free(image);
+
+	return -1;
+}
+
+int quirc_set_threshold(struct quirc *q, quirc_threshold_t mode)
+{
+	switch (mode) {
+	case QUIRC_THRESHOLD_OTSU:
+	case QUIRC_THRESHOLD_ADAPTIVE:
+		q->threshold_mode = mode;
+		return 0;
 	}
 
-	vars_byte_size = sizeof(*vars) * num_vars;
-	if (vars_byte_size / sizeof(*vars) != num_vars) {
-		goto fail; /* size_t overflow */
+	return -1;
+}
+
+int quirc_set_threads(struct quirc *q, int threads)
+{
+	struct quirc_pool *pool = NULL;
+	struct quirc_band *bands = NULL;
+	uint32_t *col_sum = NULL;
+	int num_bands = threads > 1 ? threads : 0;
+
+	if (threads < 1)
+		return -1;
+
+	if (num_bands) {
+		pool = quirc_pool_new(threads);
+		if (!pool)
+			goto fail;
+
+		bands = calloc(num_bands, sizeof(*bands));
+		if (!bands)
+			goto fail;
 	}
-	vars = malloc(vars_byte_size);
-	if (!vars)
+
+	col_sum = calloc((size_t)(q->w ? q->w : 1) * threads,
+			 sizeof(*col_sum));
+	if (!col_sum)
 		goto fail;
 
-	/* alloc succeeded, update `q` with the new size and buffers */
-	q->w = w;
-	q->h = h;
-	free(q->image);
-	q->image = image;
-	if (!QUIRC_PIXEL_ALIAS_IMAGE) {
-		free(q->pixels);
-		q->pixels = pixels;
-	}
-	free(q->flood_fill_vars);
-	q->flood_fill_vars = vars;
-	q->num_flood_fill_vars = num_vars;
+	quirc_pool_destroy(q->pool);
+	free_bands(q->bands, q->num_bands);
+	free(q->adapt_col_sum);
+
+	q->pool = pool;
+	q->bands = bands;
+	q->num_bands = num_bands;
+	q->adapt_col_sum = col_sum;
 
 	return 0;
 	/* NOTREACHED */
 fail:
-	free(image);
-	free(pixels);
-	free(vars);
+	quirc_pool_destroy(pool);
+	free(bands);
 
 	return -1;
 }
@@ -145,6 +241,37 @@ int quirc_count(const struct quirc *q)
 	return q->num_grids;
 }
 
+struct decode_job {
+	const struct quirc	*q;
+	struct quirc_code	*codes;
+	struct quirc_data	*data;
+	quirc_decode_error_t	*errors;
+};
+
+static void decode_task(void *arg, int index)
+{
+	struct decode_job *job = (struct decode_job *)arg;
+	quirc_decode_error_t err;
+
+	quirc_extract(job->q, index, &job->codes[index]);
+	err = quirc_decode(&job->codes[index], &job->data[index]);
+	if (job->errors)
+		job->errors[index] = err;
+}
+
+void quirc_decode_all(const struct quirc *q, struct quirc_code *codes,
+		      struct quirc_data *data, quirc_decode_error_t *errors)
+{
+	struct decode_job job;
+
+	job.q = q;
+	job.codes = codes;
+	job.data = data;
+	job.errors = errors;
+
+	quirc_pool_run(q->pool, q->num_grids, decode_task, &job);
+}
+
 static const char *const error_table[] = {
 	[QUIRC_SUCCESS] = "Success",
 	[QUIRC_ERROR_INVALID_GRID_SIZE] = "Invalid grid size",
@@ -56,6 +56,79 @@ int quirc_resize(struct quirc *q, int w, int h);
 uint8_t *quirc_begin(struct quirc *q, int *w, int *h);
 void quirc_end(struct quirc *q);
 
+/* As an alternative to quirc_begin(), this function scans an 8-bit
+ * luma plane owned by the caller, such as the Y plane of an NV21 or
+ * YUV420P frame, without copying it. Rows are stride bytes apart, and
+ * stride must be at least w. The plane is only read, and must remain
+ * valid until quirc_end() returns.
+ *
+ * If w and h differ from the current size, the recognizer's working
+ * buffers are resized and the internal image buffer is released; it
+ * will be reallocated by the next call to quirc_begin().
+ *
+ * This function returns 0 on success, or -1 if the arguments are
+ * invalid or sufficient memory could not be allocated. Call
+ * quirc_end() after it to process the image.
+ */
+int quirc_set_image(struct quirc *q, const uint8_t *luma, int w, int h,
+		    int stride);
+
+/* Enable or disable temporal tracking for video. When enabled, each
+ * quirc_end() first scans only a padded region around the codes found
+ * in the previous frame, and falls back to a full scan in the same
+ * call if that finds fewer codes. A full scan is also forced every
+ * full_scan_interval frames, so that new codes entering the frame are
+ * picked up. Pass 0 to disable tracking (the default).
+ *
+ * Returns 0 on success, or -1 if the interval is negative.
+ */
+int quirc_set_tracking(struct quirc *q, int full_scan_interval);
+
+/* Enable coarse-to-fine scanning for large frames. Capstones are first
+ * searched for on a copy of the frame downscaled by factor (1, 2 or
+ * 4), and grid fitting, alignment pattern search and cell sampling
+ * then run at full resolution only around what was found there.
+ *
+ * min_module is the smallest module size, in full-resolution pixels,
+ * of the codes that must still be found. The factor actually used is
+ * reduced as needed for such modules to remain visible at the coarse
+ * level. A factor of 1 disables the pyramid (the default).
+ *
+ * Returns 0 on success, or -1 if the arguments are invalid.
+ */
+int quirc_set_pyramid(struct quirc *q, int factor, int min_module);
+
+/* Scan with a pool of worker threads. threads is the total number of
+ * threads, counting the caller's; 1 (the default) scans on the
+ * caller's thread alone. Each frame is binarised, labelled and
+ * searched for capstones in bands of rows, and grids are fitted
+ * concurrently. Results are identical to a single-threaded scan.
+ *
+ * Returns 0 on success, or -1 leaving the previous setting in place.
+ */
+int quirc_set_threads(struct quirc *q, int threads);
+
+/* This enum describes the binarisation strategies quirc_end() may use
+ * to separate dark modules from the light background.
+ */
+typedef enum {
+	/* A single global threshold chosen with Otsu's method. This is
+	 * the default and the cheapest option.
+	 */
+	QUIRC_THRESHOLD_OTSU = 0,
+
+	/* A local threshold against the mean of a moving square window
+	 * (Bradley's method). Copes with glare, shadows and lighting
+	 * gradients at a small extra cost per pixel.
+	 */
+	QUIRC_THRESHOLD_ADAPTIVE
+} quirc_threshold_t;
+
+/* Select the binarisation strategy used by subsequent calls to
+ * quirc_end(). Returns 0 on success, or -1 if the mode is unknown.
+ */
+int quirc_set_threshold(struct quirc *q, quirc_threshold_t mode);
+
 /* This structure describes a location in the input image buffer. */
 struct quirc_point {
 	int	x;
@@ -168,6 +241,15 @@ void quirc_extract(const struct quirc *q, int index,
 quirc_decode_error_t quirc_decode(const struct quirc_code *code,
 				  struct quirc_data *data);
 
+/* Extract and decode every QR-code identified in the last processed
+ * image, spreading the work over the pool set up by
+ * quirc_set_threads(). codes, data and errors (which may be NULL) must
+ * each have room for quirc_count() entries. Entry i holds the same
+ * result as quirc_extract() and quirc_decode() for index i.
+ */
+void quirc_decode_all(const struct quirc *q, struct quirc_code *codes,
+		      struct quirc_data *data, quirc_decode_error_t *errors);
+
 /* Flip a QR-code according to optional mirror feature of ISO 18004:2015 */
 void quirc_flip(struct quirc_code *code);
 
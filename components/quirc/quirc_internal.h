@@ -24,27 +24,27 @@
 
 #define QUIRC_ASSERT(a)	assert(a)
 
-#define QUIRC_PIXEL_WHITE	0
-#define QUIRC_PIXEL_BLACK	1
-#define QUIRC_PIXEL_REGION	2
-
-#ifndef QUIRC_MAX_REGIONS
-#define QUIRC_MAX_REGIONS	254
-#endif
 #define QUIRC_MAX_CAPSTONES	32
 #define QUIRC_MAX_GRIDS		(QUIRC_MAX_CAPSTONES * 2)
 
 #define QUIRC_PERSPECTIVE_PARAMS	8
 
-#if QUIRC_MAX_REGIONS < UINT8_MAX
-#define QUIRC_PIXEL_ALIAS_IMAGE	1
-typedef uint8_t quirc_pixel_t;
-#elif QUIRC_MAX_REGIONS < UINT16_MAX
-#define QUIRC_PIXEL_ALIAS_IMAGE	0
-typedef uint16_t quirc_pixel_t;
-#else
-#error "QUIRC_MAX_REGIONS > 65534 is not supported"
-#endif
+/* The adaptive threshold window is 1/QUIRC_ADAPTIVE_WINDOW_DEN of the
+ * image width across, and a pixel is black when it is more than
+ * QUIRC_ADAPTIVE_T percent darker than the window mean.
+ */
+#define QUIRC_ADAPTIVE_WINDOW_DEN	8
+#define QUIRC_ADAPTIVE_T		15
+
+/* When tracking, the region searched first extends this far beyond
+ * the previous frame's codes, as a percentage of their extent.
+ */
+#define QUIRC_TRACK_PAD_PERCENT		50
+
+/* Smallest module size, in coarse pixels, that pyramid scanning relies
+ * on finding at the downscaled level.
+ */
+#define QUIRC_PYRAMID_COARSE_MODULE	2
 
 #ifdef QUIRC_FLOAT_TYPE
 /* Quirc uses double precision floating point internally by default.
@@ -60,10 +60,67 @@ typedef QUIRC_FLOAT_TYPE quirc_float_t;
 typedef double quirc_float_t;
 #endif
 
+/* A rectangle of the image, including (x0, y0) and excluding (x1, y1) */
+struct quirc_rect {
+	int			x0;
+	int			y0;
+	int			x1;
+	int			y1;
+};
+
 struct quirc_region {
 	struct quirc_point	seed;
 	int			count;
 	int			capstone;
+
+	/* Root run of the region's union-find tree */
+	int			run;
+};
+
+/* A horizontal run of black pixels. Runs are joined into 4-connected
+ * regions with a union-find forest.
+ */
+struct quirc_run {
+	int			x0;
+	int			x1;
+	int			y;
+
+	int			parent;
+
+	/* The last region walk that reached this run */
+	unsigned int		visit;
+
+	/* Only meaningful on roots */
+	int			count;
+	int			region;
+};
+
+/* A run on the stack of a region walk, with the next runs to try in
+ * the rows above and below it
+ */
+struct quirc_run_frame {
+	int			run;
+	int			up;
+	int			down;
+};
+
+/* A capstone cross-section found by a band's finder scan, queued for
+ * testing in row order.
+ */
+struct quirc_finder_hit {
+	int			x;
+	int			y;
+	unsigned int		pb[5];
+};
+
+/* Scratch state for one row band when scanning with a worker pool */
+struct quirc_band {
+	unsigned int		histogram[UINT8_MAX + 1];
+
+	int			num_hits;
+	int			max_hits;
+	int			hits_exhausted;
+	struct quirc_finder_hit	*hits;
 };
 
 struct quirc_capstone {
@@ -93,21 +150,52 @@ struct quirc_grid {
 	quirc_float_t		c[QUIRC_PERSPECTIVE_PARAMS];
 };
 
-struct quirc_flood_fill_vars {
-	int y;
-	int right;
-	int left_up;
-	int left_down;
+/* Fixed-point grid sampling tables of one grid: terms[j][o][k] is
+ * coefficient j of the grid's transform times k plus sample offset o.
+ */
+#define QUIRC_SAMPLE_OFFSETS	3
+
+struct quirc_sample_terms {
+	int64_t			terms[QUIRC_PERSPECTIVE_PARAMS]
+				     [QUIRC_SAMPLE_OFFSETS]
+				     [QUIRC_MAX_GRID_SIZE];
 };
 
 struct quirc {
 	uint8_t			*image;
-	quirc_pixel_t		*pixels;
 	int			w;
 	int			h;
 
+	/* The plane being scanned: either q->image, or a caller-owned
+	 * plane passed to quirc_set_image().
+	 */
+	const uint8_t		*src;
+	int			src_stride;
+
+	/* The binarised frame, packed one bit per pixel and set for
+	 * black. Each row starts on a word boundary.
+	 */
+	uint64_t		*bitmap;
+	int			bitmap_stride;
+
+	/* Black runs of the current frame in raster order. The runs of
+	 * row y are row_runs[y] up to row_runs[y + 1]. The table grows on
+	 * demand and is kept across frames.
+	 */
+	int			num_runs;
+	int			max_runs;
+	int			runs_exhausted;
+	struct quirc_run	*runs;
+	int			*row_runs;
+
+	/* Region walks: the number of the last one, and its stack */
+	unsigned int		run_visit;
+	int			max_run_stack;
+	struct quirc_run_frame	*run_stack;
+
 	int			num_regions;
-	struct quirc_region	regions[QUIRC_MAX_REGIONS];
+	int			max_regions;
+	struct quirc_region	*regions;
 
 	int			num_capstones;
 	struct quirc_capstone	capstones[QUIRC_MAX_CAPSTONES];
@@ -115,10 +203,72 @@ struct quirc {
 	int			num_grids;
 	struct quirc_grid	grids[QUIRC_MAX_GRIDS];
 
-	size_t      		num_flood_fill_vars;
-	struct quirc_flood_fill_vars *flood_fill_vars;
+	/* Grid sampling tables, one per grid so that grids can be refined
+	 * on the pool's threads at once. They grow on demand with the
+	 * number of grids and are kept across frames. Without them, or
+	 * with float_sampling set, grids are sampled in floating point.
+	 */
+	int			float_sampling;
+	int			max_sample_terms;
+	struct quirc_sample_terms *sample_terms;
+
+	/* Adaptive thresholding state: the window radius and per-column
+	 * sums over the vertical extent of the window, one row of sums for
+	 * each band.
+	 */
+	quirc_threshold_t	threshold_mode;
+	int			adapt_radius;
+	uint32_t		*adapt_col_sum;
+
+	/* Temporal tracking state: the padded bounding box of the codes
+	 * found by the last scan and how many there were, and the number
+	 * of frames left before a full scan is forced.
+	 */
+	int			track_interval;
+	int			track_countdown;
+	int			track_grids;
+	struct quirc_rect	track_rect;
+
+	/* Coarse-to-fine scanning: the downscale factor, the smallest
+	 * module size in pixels that must still be found, and the
+	 * recognizer used for the downscaled level.
+	 */
+	int			pyramid_factor;
+	int			pyramid_min_module;
+	struct quirc		*coarse;
+
+	/* Worker pool, and one band of rows per thread. Without a pool
+	 * num_bands is zero and the frame is scanned as a whole.
+	 */
+	struct quirc_pool	*pool;
+	int			num_bands;
+	struct quirc_band	*bands;
 };
 
+/* Resize the working buffers used by quirc_end() without touching
+ * q->image. Returns 0 on success, or -1 leaving `q` unmodified.
+ */
+int quirc_resize_work(struct quirc *q, int w, int h);
+
+/************************************************************************
+ * Worker pool
+ */
+
+typedef void (*quirc_task_func_t)(void *arg, int task);
+
+/* Start a pool of num_threads - 1 workers, the caller's thread making
+ * up the number. Returns NULL on failure or if num_threads < 2.
+ */
+struct quirc_pool *quirc_pool_new(int num_threads);
+void quirc_pool_destroy(struct quirc_pool *pool);
+
+/* Call func(arg, i) for each i from 0 to count - 1, spread over the
+ * pool's threads, and return when all calls have finished. With a
+ * NULL pool the calls are made in order on the caller's thread.
+ */
+void quirc_pool_run(struct quirc_pool *pool, int count,
+		    quirc_task_func_t func, void *arg);
+
 /************************************************************************
  * QR-code version information database
  */
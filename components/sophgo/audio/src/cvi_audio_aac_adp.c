@@ -6,6 +6,7 @@
  *   Common audio link lib for AAC codec.
  */
 #include "cvi_audio_aac_adp.h"
+#include "audio_dsp.h"
 #include "cvi_aacdec.h"
 #include "cvi_aacenc.h"
 #include "cvi_audio_dl_adp.h"
@@ -1191,9 +1192,7 @@ CVI_S32 EncodeAACFrm(CVI_VOID* pEncoder, const AUDIO_FRAME_S* pstData,
     CVI_S32 s32Ret = CVI_SUCCESS;
     AENC_AAC_ENCODER_S* pstEncoder = CVI_NULL;
     CVI_U32 u32PtNums;
-    CVI_S32 i;
     CVI_S16 aData[AACENC_BLOCKSIZE * 2 * MAX_CHANNELS];
-    CVI_S16 s16Len = 0;
 
     CVI_U32 u32WaterLine;
 
@@ -1238,17 +1237,11 @@ CVI_S32 EncodeAACFrm(CVI_VOID* pEncoder, const AUDIO_FRAME_S* pstData,
     /* AAC encoder need interleaved data,here change LLLRRR to LRLRLR */
     /* AACLC will encode 1024*2 point, and AACplus encode 2048*2 point*/
     if (pstEncoder->stAACAttr.enSoundMode == AUDIO_SOUND_MODE_STEREO) {
-        s16Len = u32WaterLine;
-        for (i = s16Len - 1; i >= 0; i--) {
-            aData[2 * i] = *((CVI_S16*)pstData->u64VirAddr[0] + i);
-            aData[2 * i + 1] = *((CVI_S16*)pstData->u64VirAddr[1] + i);
-        }
-    } else {
-        CVI_S16* temp = (CVI_S16*)pstData->u64VirAddr[0];
+        const int16_t* planes[2] = { (const int16_t*)pstData->u64VirAddr[0], (const int16_t*)pstData->u64VirAddr[1] };
 
-        s16Len = u32WaterLine;
-        for (i = s16Len - 1; i >= 0; i--)
-            aData[i] = *(temp + i);
+        audio_s16_interleave(planes, aData, u32WaterLine, 2);
+    } else {
+        memcpy(aData, pstData->u64VirAddr[0], u32WaterLine * sizeof(CVI_S16));
     }
 
 #ifdef DUMP_AACENC
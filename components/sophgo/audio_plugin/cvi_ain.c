@@ -60,7 +60,7 @@ static CVI_S32 cvi_audio_params(cvi_ain_t* ain)
     pstAudinAttr->enWorkmode = AIO_MODE_I2S_MASTER;
     pstAudinAttr->u32EXFlag = 0;
     pstAudinAttr->u32FrmNum = 10; /* only use in bind mode */
-    pstAudinAttr->u32PtNumPerFrm = SAMPLE_RATE / 10; /* sample_rate/fps */
+    pstAudinAttr->u32PtNumPerFrm = FRAME_SAMPLES; /* sample_rate/fps */
     pstAudinAttr->u32ClkSel = 0;
     pstAudinAttr->enI2sType = AIO_I2STYPE_INNERCODEC;
 
@@ -130,9 +130,14 @@ ERROR3:
     return s32Ret;
 }
 
-CVI_S32 cvi_audio_get_frame(cvi_ain_t* ain, AUDIO_FRAME_S* pstFrame, AEC_FRAME_S* pstAecFrm)
+CVI_S32 cvi_audio_get_frame(cvi_ain_t* ain, AUDIO_FRAME_S* pstFrame, AEC_FRAME_S* pstAecFrm, CVI_S32 s32MilliSec)
 {
-    return CVI_AI_GetFrame(ain->AiDev, ain->AiChn, pstFrame, pstAecFrm, -1);
+    return CVI_AI_GetFrame(ain->AiDev, ain->AiChn, pstFrame, pstAecFrm, s32MilliSec);
+}
+
+CVI_S32 cvi_audio_release_frame(cvi_ain_t* ain, AUDIO_FRAME_S* pstFrame, AEC_FRAME_S* pstAecFrm)
+{
+    return CVI_AI_ReleaseFrame(ain->AiDev, ain->AiChn, pstFrame, pstAecFrm);
 }
 
 CVI_S32 cvi_audio_deinit(cvi_ain_t* ain)
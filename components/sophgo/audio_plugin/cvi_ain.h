@@ -5,6 +5,7 @@
 
 #define SAMPLE_RATE 16000
 #define CHANNELS 1
+#define FRAME_SAMPLES (SAMPLE_RATE / 10) // Samples delivered per frame
 
 typedef struct cvi_ain {
     int AiDev;
@@ -14,7 +15,8 @@ typedef struct cvi_ain {
 } cvi_ain_t;
 
 CVI_S32 cvi_audio_init(cvi_ain_t* ain);
-CVI_S32 cvi_audio_get_frame(cvi_ain_t* ain, AUDIO_FRAME_S* pstFrame, AEC_FRAME_S* pstAecFrm);
+CVI_S32 cvi_audio_get_frame(cvi_ain_t* ain, AUDIO_FRAME_S* pstFrame, AEC_FRAME_S* pstAecFrm, CVI_S32 s32MilliSec);
+CVI_S32 cvi_audio_release_frame(cvi_ain_t* ain, AUDIO_FRAME_S* pstFrame, AEC_FRAME_S* pstAecFrm);
 CVI_S32 cvi_audio_deinit(cvi_ain_t* ain);
 
 #endif // __CVI_AIN_H__
@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "pcm_ring.h"
+
+// Frames the application has yet to read. Called with the lock held.
+static snd_pcm_uframes_t ring_avail(pcm_ring_t* ring)
+{
+    snd_pcm_uframes_t appl_ptr = ring->io->appl_ptr;
+
+    if (ring->hw_ptr >= appl_ptr)
+        return ring->hw_ptr - appl_ptr;
+    return ring->hw_ptr + ring->boundary - appl_ptr;
+}
+
+static void ring_signal(pcm_ring_t* ring)
+{
+    eventfd_write(ring->event_fd, 1);
+}
+
+static void ring_drain(pcm_ring_t* ring)
+{
+    eventfd_t count;
+
+    eventfd_read(ring->event_fd, &count);
+}
+
+int pcm_ring_init(pcm_ring_t* ring, snd_pcm_ioplug_t* io)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->io = io;
+
+    ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->event_fd < 0) {
+        SNDERR("eventfd failed: %s", strerror(errno));
+        return -errno;
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+
+    // ALSA allocates the buffer and the producer fills it in place, so
+    // no transfer callback is needed
+    io->mmap_rw = 1;
+    io->poll_fd = ring->event_fd;
+    io->poll_events = POLLIN;
+#ifdef SND_PCM_IOPLUG_FLAG_BOUNDARY_WA
+    // Report the pointer up to the boundary, so that a whole buffer
+    // written between two pointer calls is not mistaken for none
+    io->flags |= SND_PCM_IOPLUG_FLAG_BOUNDARY_WA;
+#endif
+
+    return 0;
+}
+
+void pcm_ring_deinit(pcm_ring_t* ring)
+{
+    if (ring->event_fd >= 0) {
+        close(ring->event_fd);
+        ring->event_fd = -1;
+    }
+    pthread_mutex_destroy(&ring->lock);
+}
+
+int pcm_ring_set_hw_constraints(pcm_ring_t* ring, snd_pcm_format_t format,
+    unsigned int channels, unsigned int rate, snd_pcm_uframes_t chunk)
+{
+    static const unsigned int access_list[] = {
+        SND_PCM_ACCESS_RW_INTERLEAVED,
+        SND_PCM_ACCESS_MMAP_INTERLEAVED,
+    };
+    unsigned int format_list[] = { format };
+    unsigned int frame_bytes = snd_pcm_format_physical_width(format) / 8 * channels;
+    snd_pcm_ioplug_t* io = ring->io;
+    int err;
+
+    // The producer moves the pointer a whole write at a time, so a
+    // shorter period would have several boundaries crossed, and the
+    // application woken, only once per write. The buffer must hold at
+    // least two writes, or every write would overrun while the
+    // application reads the last.
+    if ((err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_ACCESS, 2, access_list)) < 0
+        || (err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_FORMAT, 1, format_list)) < 0
+        || (err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_CHANNELS, channels, channels)) < 0
+        || (err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_RATE, rate, rate)) < 0
+        || (err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
+                frame_bytes * chunk, frame_bytes * rate)) < 0
+        || (err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIODS, 2, 64)) < 0
+        || (err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_BUFFER_BYTES,
+                frame_bytes * chunk * 2, frame_bytes * rate * 4)) < 0) {
+        SNDERR("Failed to set hw constraints, err=%d", err);
+        return err;
+    }
+
+    return 0;
+}
+
+int pcm_ring_sw_params(pcm_ring_t* ring, snd_pcm_sw_params_t* params)
+{
+    snd_pcm_uframes_t avail_min;
+    int err;
+
+    err = snd_pcm_sw_params_get_avail_min(params, &avail_min);
+    if (err < 0)
+        return err;
+
+    pthread_mutex_lock(&ring->lock);
+    ring->avail_min = avail_min ? avail_min : 1;
+    pthread_mutex_unlock(&ring->lock);
+
+    return 0;
+}
+
+int pcm_ring_prepare(pcm_ring_t* ring)
+{
+    snd_pcm_ioplug_t* io = ring->io;
+
+    pthread_mutex_lock(&ring->lock);
+    ring->hw_ptr = 0;
+    ring->xrun = 0;
+
+    // The same boundary as ALSA's, so that pointers wrap together
+    ring->boundary = io->buffer_size;
+    while (ring->boundary * 2 <= LONG_MAX - io->buffer_size)
+        ring->boundary *= 2;
+
+    if (!ring->avail_min)
+        ring->avail_min = io->period_size;
+    pthread_mutex_unlock(&ring->lock);
+
+    ring_drain(ring);
+
+    return 0;
+}
+
+void pcm_ring_start(pcm_ring_t* ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->running = 1;
+
+    // Restarts after an overrun count towards the same run
+    if (!ring->start_time.tv_sec) {
+        ring->frames = 0;
+        ring->periods = 0;
+        ring->wakeups = 0;
+        ring->xruns = 0;
+        clock_gettime(CLOCK_MONOTONIC, &ring->start_time);
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void pcm_ring_stop(pcm_ring_t* ring)
+{
+    struct timespec now;
+    double seconds;
+
+    pthread_mutex_lock(&ring->lock);
+    ring->running = 0;
+    if (ring->print_stats && ring->start_time.tv_sec) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        seconds = (now.tv_sec - ring->start_time.tv_sec) + (now.tv_nsec - ring->start_time.tv_nsec) / 1e9;
+        fprintf(stderr, "%s: %lu frames, %lu periods, %lu wakeups (%.1f/s), %lu xruns in %.1f s\n",
+            ring->io->name, ring->frames, ring->periods, ring->wakeups,
+            seconds > 0 ? ring->wakeups / seconds : 0.0, ring->xruns, seconds);
+    }
+    ring->start_time.tv_sec = 0;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+snd_pcm_sframes_t pcm_ring_pointer(pcm_ring_t* ring)
+{
+    snd_pcm_sframes_t pos;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->xrun) {
+        pos = -EPIPE;
+    } else {
+#ifdef SND_PCM_IOPLUG_FLAG_BOUNDARY_WA
+        pos = ring->hw_ptr;
+#else
+        pos = ring->hw_ptr % ring->io->buffer_size;
+#endif
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return pos;
+}
+
+/*
+ * The eventfd is edge triggered on period boundaries and drained here.
+ * alsa-lib checks avail before it polls, so an application that leaves
+ * frames behind is not put to sleep on a drained descriptor.
+ */
+int pcm_ring_poll_revents(pcm_ring_t* ring, struct pollfd* pfd, unsigned int nfds,
+    unsigned short* revents)
+{
+    (void)pfd;
+    (void)nfds;
+
+    ring_drain(ring);
+
+    pthread_mutex_lock(&ring->lock);
+    ring->wakeups++;
+    if (ring->xrun)
+        *revents = POLLIN | POLLERR;
+    else
+        *revents = ring_avail(ring) >= ring->avail_min ? POLLIN : 0;
+    pthread_mutex_unlock(&ring->lock);
+
+    return 0;
+}
+
+void pcm_ring_dump(pcm_ring_t* ring, snd_output_t* out)
+{
+    pthread_mutex_lock(&ring->lock);
+    snd_output_printf(out, "%s capture ring\n", ring->io->name);
+    snd_output_printf(out, "  hw_ptr: %lu, avail_min: %lu\n", ring->hw_ptr, ring->avail_min);
+    snd_output_printf(out, "  frames: %lu, periods: %lu, wakeups: %lu, xruns: %lu\n",
+        ring->frames, ring->periods, ring->wakeups, ring->xruns);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+snd_pcm_uframes_t pcm_ring_write(pcm_ring_t* ring, const void* data, snd_pcm_uframes_t frames)
+{
+    snd_pcm_ioplug_t* io = ring->io;
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t avail, done, crossed;
+    unsigned int frame_bytes;
+    int signal;
+
+    pthread_mutex_lock(&ring->lock);
+    if (!ring->running) {
+        pthread_mutex_unlock(&ring->lock);
+        return 0;
+    }
+
+    avail = ring_avail(ring);
+    if (avail + frames > io->buffer_size) {
+        // The application fell behind; stop until it prepares again
+        ring->running = 0;
+        ring->xrun = 1;
+        ring->xruns++;
+        pthread_mutex_unlock(&ring->lock);
+        ring_signal(ring);
+        return 0;
+    }
+
+    areas = snd_pcm_ioplug_mmap_areas(io);
+    frame_bytes = areas[0].step / 8;
+    for (done = 0; done < frames;) {
+        snd_pcm_uframes_t offset = (ring->hw_ptr + done) % io->buffer_size;
+        snd_pcm_uframes_t n = frames - done;
+
+        if (n > io->buffer_size - offset)
+            n = io->buffer_size - offset;
+        memcpy((char*)areas[0].addr + areas[0].first / 8 + offset * frame_bytes,
+            (const char*)data + done * frame_bytes, n * frame_bytes);
+        done += n;
+    }
+
+    crossed = (ring->hw_ptr % io->period_size + frames) / io->period_size;
+    ring->hw_ptr += frames;
+    if (ring->hw_ptr >= ring->boundary)
+        ring->hw_ptr -= ring->boundary;
+    ring->frames += frames;
+    ring->periods += crossed;
+    signal = crossed && avail + frames >= ring->avail_min;
+    pthread_mutex_unlock(&ring->lock);
+
+    if (signal)
+        ring_signal(ring);
+
+    return frames;
+}
@@ -0,0 +1,59 @@
+#ifndef __PCM_RING_H__
+#define __PCM_RING_H__
+
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Capture ring for the ioplug mmap path. A producer thread writes frames
+ * straight into the buffer that ALSA maps to the application, and the
+ * hardware pointer follows what it has written. An eventfd serves as the
+ * poll descriptor; it is signalled when the pointer crosses a period
+ * boundary with at least avail_min frames available, or on overrun.
+ */
+typedef struct pcm_ring {
+    snd_pcm_ioplug_t* io;
+    pthread_mutex_t lock;
+    int event_fd;
+
+    int running; // Between start and stop, frames go into the buffer
+    int xrun; // Overrun until the next prepare
+    snd_pcm_uframes_t hw_ptr; // Frames written, wrapped at boundary
+    snd_pcm_uframes_t boundary;
+    snd_pcm_uframes_t avail_min;
+
+    // Statistics since the stream was started
+    struct timespec start_time;
+    unsigned long frames;
+    unsigned long periods;
+    unsigned long wakeups;
+    unsigned long xruns;
+    int print_stats; // Print a summary line to stderr on stop
+} pcm_ring_t;
+
+int pcm_ring_init(pcm_ring_t* ring, snd_pcm_ioplug_t* io);
+void pcm_ring_deinit(pcm_ring_t* ring);
+
+// Hardware constraints for an interleaved stream of the given format,
+// fed by a producer that writes chunk frames at a time. Periods are at
+// least one chunk, since the pointer only moves a chunk at a time.
+int pcm_ring_set_hw_constraints(pcm_ring_t* ring, snd_pcm_format_t format,
+    unsigned int channels, unsigned int rate, snd_pcm_uframes_t chunk);
+
+// ioplug callbacks, to be called from the plugin's own
+int pcm_ring_sw_params(pcm_ring_t* ring, snd_pcm_sw_params_t* params);
+int pcm_ring_prepare(pcm_ring_t* ring);
+void pcm_ring_start(pcm_ring_t* ring);
+void pcm_ring_stop(pcm_ring_t* ring);
+snd_pcm_sframes_t pcm_ring_pointer(pcm_ring_t* ring);
+int pcm_ring_poll_revents(pcm_ring_t* ring, struct pollfd* pfd, unsigned int nfds,
+    unsigned short* revents);
+void pcm_ring_dump(pcm_ring_t* ring, snd_output_t* out);
+
+// Producer side: copy interleaved frames into the buffer. Returns the
+// number of frames written, which is 0 when stopped or on overrun.
+snd_pcm_uframes_t pcm_ring_write(pcm_ring_t* ring, const void* data, snd_pcm_uframes_t frames);
+
+#endif // __PCM_RING_H__
@@ -1,87 +1,125 @@
 #include <alsa/asoundlib.h>
 #include <alsa/pcm_external.h>
 #include <alsa/pcm_plugin.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "cvi_ain.h"
+#include "pcm_ring.h"
+
+#define CAPTURE_TIMEOUT_MS 100 // Bounds how long stop waits for the capture thread
 
 typedef struct cvi_pcm_plugin {
     snd_pcm_ioplug_t io;
     cvi_ain_t ain;
+    pcm_ring_t ring;
     snd_pcm_format_t format;
     unsigned int channels;
     unsigned int rate;
-    snd_pcm_sframes_t frames_count;
+    pthread_t thread;
+    volatile int capturing; // Capture thread running and audio input enabled
 } cvi_pcm_plugin_t;
 
 static int init(cvi_pcm_plugin_t* plugin) {
-    plugin->format       = SND_PCM_FORMAT_S16;
-    plugin->channels     = CHANNELS;
-    plugin->rate         = SAMPLE_RATE;
-    plugin->frames_count = SAMPLE_RATE;
+    plugin->format   = SND_PCM_FORMAT_S16;
+    plugin->channels = CHANNELS;
+    plugin->rate     = SAMPLE_RATE;
 
     return 0;
 }
 
+// Moves frames from the audio input into the mapped buffer as they arrive
+static void* capture_thread(void* arg) {
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)arg;
+    AUDIO_FRAME_S stFrame;
+    AEC_FRAME_S stAecFrm;
+
+    while (plugin->capturing) {
+        if (CVI_SUCCESS != cvi_audio_get_frame(&plugin->ain, &stFrame, &stAecFrm, CAPTURE_TIMEOUT_MS)) {
+            continue;
+        }
+        pcm_ring_write(&plugin->ring, stFrame.u64VirAddr[0], stFrame.u32Len);
+        cvi_audio_release_frame(&plugin->ain, &stFrame, &stAecFrm);
+    }
+
+    return NULL;
+}
+
 static int start(snd_pcm_ioplug_t* io) {
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
-    cvi_audio_init(&plugin->ain);
+
+    // After an overrun the stream is prepared and started again while
+    // the capture thread keeps running
+    if (!plugin->capturing) {
+        if (cvi_audio_init(&plugin->ain) != CVI_SUCCESS) {
+            SNDERR("Failed to initialize audio input");
+            return -EIO;
+        }
+
+        plugin->capturing = 1;
+        if (pthread_create(&plugin->thread, NULL, capture_thread, plugin)) {
+            SNDERR("Failed to create capture thread");
+            plugin->capturing = 0;
+            cvi_audio_deinit(&plugin->ain);
+            return -EIO;
+        }
+    }
+
+    pcm_ring_start(&plugin->ring);
     return 0;
 }
 
 static int stop(snd_pcm_ioplug_t* io) {
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
-    cvi_audio_deinit(&plugin->ain);
+
+    pcm_ring_stop(&plugin->ring);
+    if (plugin->capturing) {
+        plugin->capturing = 0;
+        pthread_join(plugin->thread, NULL);
+        cvi_audio_deinit(&plugin->ain);
+    }
     return 0;
 }
 
-static snd_pcm_sframes_t pointer(snd_pcm_ioplug_t* io) {
+static int sw_params(snd_pcm_ioplug_t* io, snd_pcm_sw_params_t* params) {
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
 
-    return plugin->frames_count;
+    return pcm_ring_sw_params(&plugin->ring, params);
 }
 
-static snd_pcm_sframes_t transfer(snd_pcm_ioplug_t* io, const snd_pcm_channel_area_t* areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) {
+static int prepare(snd_pcm_ioplug_t* io) {
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
-    size_t bytes_per_frame   = snd_pcm_format_width(plugin->format) / 8 * plugin->channels;
-    size_t total_bytes       = frames * bytes_per_frame;
 
-    // printf("%s,%d: offset=%d, frames=%d, bpf=%d, total_bytes=%d\n", __FUNCTION__, __LINE__,
-    //     offset, frames, bytes_per_frame, total_bytes);
+    return pcm_ring_prepare(&plugin->ring);
+}
 
-    size_t read_bytes   = 0;
-    unsigned char* addr = areas[0].addr;
-    addr += areas[0].first / 8;
-    addr += offset * bytes_per_frame;
+static snd_pcm_sframes_t pointer(snd_pcm_ioplug_t* io) {
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
 
-    AUDIO_FRAME_S stFrame;
-    AEC_FRAME_S stAecFrm;
-    if (CVI_SUCCESS == cvi_audio_get_frame(&plugin->ain, &stFrame, &stAecFrm)) {
-        read_bytes = stFrame.u32Len * plugin->channels * bytes_per_frame;
-        // printf("%s,%d: read_bytes=%d\n", __FUNCTION__, __LINE__, read_bytes);
-        if (read_bytes > total_bytes) {
-            read_bytes = total_bytes;
-        }
-        memcpy(addr, stFrame.u64VirAddr[0], read_bytes);
-        plugin->frames_count += frames;
-        frames = read_bytes / bytes_per_frame;
-        // printf("%s,%d: frames=%d\n", __FUNCTION__, __LINE__, frames);
-    }
-    if (read_bytes < total_bytes) {
-        memset(addr + read_bytes, 0, total_bytes - read_bytes);
-        frames = read_bytes / bytes_per_frame;
-        // printf("%s,%d: frames=%d\n", __FUNCTION__, __LINE__, frames);
-    }
+    return pcm_ring_pointer(&plugin->ring);
+}
+
+static int poll_revents(snd_pcm_ioplug_t* io, struct pollfd* pfd, unsigned int nfds, unsigned short* revents) {
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
+
+    return pcm_ring_poll_revents(&plugin->ring, pfd, nfds, revents);
+}
+
+static void dump(snd_pcm_ioplug_t* io, snd_output_t* out) {
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
 
-    return frames;
+    pcm_ring_dump(&plugin->ring, out);
 }
 
 static int close_cb(snd_pcm_ioplug_t* io) {
-    // printf("%s,%d\n", __FUNCTION__, __LINE__);
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
+
+    stop(io);
+    pcm_ring_deinit(&plugin->ring);
     free(plugin);
 
     return 0;
@@ -89,8 +127,32 @@ static int close_cb(snd_pcm_ioplug_t* io) {
 
 SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio) {
     int err = 0;
-
-    // printf("%s,%d: %s\n", __FUNCTION__, __LINE__, __TIME__);
+    int print_stats = 0;
+    snd_config_iterator_t i, next;
+
+    snd_config_for_each(i, next, conf) {
+        snd_config_t* n = snd_config_iterator_entry(i);
+        const char* id;
+
+        if (snd_config_get_id(n, &id) < 0)
+            continue;
+
+        // file is for the WAV variant; accepted so that both share a config
+        if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0 || strcmp(id, "hint") == 0
+            || strcmp(id, "file") == 0)
+            continue;
+
+        if (strcmp(id, "stats") == 0) {
+            print_stats = snd_config_get_bool(n);
+            if (print_stats < 0) {
+                SNDERR("Invalid value for %s", id);
+                return -EINVAL;
+            }
+        } else {
+            SNDERR("Unknown field %s", id);
+            return -EINVAL;
+        }
+    }
 
     cvi_pcm_plugin_t* plugin = calloc(1, sizeof(*plugin));
     if (!plugin) {
@@ -104,11 +166,14 @@ SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio) {
     }
 
     static const snd_pcm_ioplug_callback_t callback = {
-        .start    = start,
-        .stop     = stop,
-        .pointer  = pointer,
-        .transfer = transfer,
-        .close    = close_cb,
+        .start        = start,
+        .stop         = stop,
+        .pointer      = pointer,
+        .close        = close_cb,
+        .sw_params    = sw_params,
+        .prepare      = prepare,
+        .poll_revents = poll_revents,
+        .dump         = dump,
     };
 
     snd_pcm_ioplug_t* io = &plugin->io;
@@ -116,17 +181,28 @@ SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio) {
     io->version      = SND_PCM_IOPLUG_VERSION;
     io->name         = "cvi_audio";
     io->flags        = SND_PCM_IOPLUG_FLAG_MONOTONIC;
-    io->mmap_rw      = 0;
     io->callback     = &callback;
     io->private_data = plugin;
 
+    err = pcm_ring_init(&plugin->ring, io);
+    if (err < 0) {
+        goto exit;
+    }
+    plugin->ring.print_stats = print_stats;
+
     err = snd_pcm_ioplug_create(&plugin->io, name, SND_PCM_STREAM_CAPTURE, mode);
-    // printf("%s,%d: name=%s, mode=%d\n", __FUNCTION__, __LINE__, name, mode);
     if (err < 0) {
         SNDERR("snd_pcm_ioplug_create, err=%d", err);
+        pcm_ring_deinit(&plugin->ring);
         goto exit;
     }
 
+    err = pcm_ring_set_hw_constraints(&plugin->ring, plugin->format, plugin->channels, plugin->rate, FRAME_SAMPLES);
+    if (err < 0) {
+        snd_pcm_ioplug_delete(&plugin->io);
+        return err;
+    }
+
     *pcmp = plugin->io.pcm;
 
     return 0;
@@ -1,158 +1,314 @@
 #include <alsa/asoundlib.h>
 #include <alsa/pcm_external.h>
 #include <alsa/pcm_plugin.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-#include "cvi_ain.h"
+#include "pcm_ring.h"
 
-typedef struct wav_header {
-    char chunkId[4]; // "RIFF"
-    uint32_t chunkSize; // Size of the entire file minus 8 bytes (size of this header)
-    char format[4]; // "WAVE"
-    char subChunk1Id[4]; // "fmt "
-    uint32_t subChunk1Size; // Size of the fmt chunk (usually 16 for PCM)
-    uint16_t audioFormat; // Audio format (1 for PCM)
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+typedef struct wav_chunk {
+    char id[4];
+    uint32_t size;
+} wav_chunk_t;
+
+typedef struct wav_fmt {
+    uint16_t audioFormat; // 1 for PCM, 3 for float, 0xfffe for extensible
     uint16_t numChannels; // Number of channels (mono, stereo, etc.)
     uint32_t sampleRate; // Sample rate (samples per second)
     uint32_t byteRate; // Byte rate (sampleRate * numChannels * bitsPerSample/8)
     uint16_t blockAlign; // Block align (numChannels * bitsPerSample/8)
     uint16_t bitsPerSample; // Bits per sample (8, 16, 24, etc.)
-    char subChunk2Id[4]; // "data"
-    uint32_t subChunk2Size; // Size of the data section
-} wav_header_t;
+    uint16_t cbSize; // Size of the extension, if any
+    uint16_t validBitsPerSample;
+    uint32_t channelMask;
+    uint16_t subFormat; // Leading bytes of the extensible format's GUID
+} wav_fmt_t;
 
 typedef struct cvi_pcm_plugin {
     snd_pcm_ioplug_t io;
-    FILE* audio_file;
-    wav_header_t header;
+    pcm_ring_t ring;
     snd_pcm_format_t format;
     unsigned int channels;
     unsigned int rate;
-    snd_pcm_sframes_t frames_count;
+
+    // The whole file is mapped; samples are served from the data chunk
+    void* map;
+    size_t map_size;
+    const uint8_t* data;
+    snd_pcm_uframes_t data_frames;
+    unsigned int frame_bytes;
+    snd_pcm_uframes_t position; // Next frame of the data chunk to serve
+    int loop; // Start over at the end, instead of continuing with silence
+    void* silence;
+    snd_pcm_uframes_t silence_frames;
+
+    pthread_t thread;
+    volatile int capturing;
 } cvi_pcm_plugin_t;
 
-static int read_wav_header(cvi_pcm_plugin_t* plugin)
+static snd_pcm_format_t wav_format(const wav_fmt_t* fmt)
 {
-    wav_header_t* header = &plugin->header;
-    size_t result;
+    uint16_t tag = fmt->audioFormat;
 
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
-    result = fread(header, sizeof(wav_header_t), 1, plugin->audio_file);
-    if (result != 1) {
-        fprintf(stderr, "Failed to read WAV header\n");
-        return -1;
-    }
+    if (tag == WAVE_FORMAT_EXTENSIBLE)
+        tag = fmt->subFormat;
 
-    switch (header->bitsPerSample) {
+    if (tag == WAVE_FORMAT_IEEE_FLOAT && fmt->bitsPerSample == 32)
+        return SND_PCM_FORMAT_FLOAT_LE;
+    if (tag != WAVE_FORMAT_PCM)
+        return SND_PCM_FORMAT_UNKNOWN;
+
+    switch (fmt->bitsPerSample) {
+    case 8:
+        return SND_PCM_FORMAT_U8;
     case 16:
-        plugin->format = SND_PCM_FORMAT_S16_LE;
-        break;
+        return SND_PCM_FORMAT_S16_LE;
+    case 24:
+        return SND_PCM_FORMAT_S24_3LE;
+    case 32:
+        return SND_PCM_FORMAT_S32_LE;
     default:
-        fprintf(stderr, "Unsupported bits per sample: %d\n", header->bitsPerSample);
+        return SND_PCM_FORMAT_UNKNOWN;
+    }
+}
+
+// Walk the RIFF chunks for "fmt " and "data", which may be preceded or
+// separated by others (LIST, fact, ...)
+static int parse_wav(cvi_pcm_plugin_t* plugin)
+{
+    const uint8_t* p = plugin->map;
+    const uint8_t* end = p + plugin->map_size;
+    wav_fmt_t fmt;
+    int have_fmt = 0;
+
+    if (plugin->map_size < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+        SNDERR("Not a WAV file");
         return -1;
     }
+    p += 12;
+
+    memset(&fmt, 0, sizeof(fmt));
+    while (end - p >= (ptrdiff_t)sizeof(wav_chunk_t)) {
+        wav_chunk_t chunk;
+        size_t size;
+
+        memcpy(&chunk, p, sizeof(chunk));
+        p += sizeof(chunk);
+        size = chunk.size;
+        if (size > (size_t)(end - p))
+            size = end - p; // Truncated file, or a streamed header with no size
+
+        if (!memcmp(chunk.id, "fmt ", 4)) {
+            memcpy(&fmt, p, size < sizeof(fmt) ? size : sizeof(fmt));
+            have_fmt = 1;
+        } else if (!memcmp(chunk.id, "data", 4)) {
+            if (!have_fmt)
+                break;
+
+            plugin->format = wav_format(&fmt);
+            plugin->channels = fmt.numChannels;
+            plugin->rate = fmt.sampleRate;
+            plugin->frame_bytes = fmt.blockAlign;
+            if (plugin->format == SND_PCM_FORMAT_UNKNOWN || !plugin->channels || !plugin->rate
+                || plugin->frame_bytes != snd_pcm_format_physical_width(plugin->format) / 8 * plugin->channels) {
+                SNDERR("Unsupported WAV format %#x, %u bits, %u channels",
+                    fmt.audioFormat, fmt.bitsPerSample, fmt.numChannels);
+                return -1;
+            }
 
-    plugin->channels = header->numChannels;
-    plugin->rate = header->sampleRate;
+            plugin->data = p;
+            plugin->data_frames = size / plugin->frame_bytes;
+            return 0;
+        }
 
-    printf("Format: %d\n", plugin->format);
-    printf("Channels: %d\n", plugin->channels);
-    printf("Rate: %d\n", plugin->rate);
+        p += size + (size & 1); // Chunks are padded to even sizes
+    }
 
-    return 0;
+    SNDERR("No fmt and data chunks in WAV file");
+    return -1;
 }
 
 static int init(cvi_pcm_plugin_t* plugin, const char* filename)
 {
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
-    if (!plugin->audio_file) {
-        plugin->audio_file = fopen(filename, "rb");
-        if (!plugin->audio_file) {
-            perror("Failed to open audio file");
-            return -1;
-        }
+    struct stat st;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        SNDERR("Failed to open %s: %s", filename, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        SNDERR("Failed to stat %s", filename);
+        close(fd);
+        return -1;
     }
 
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
-    if (read_wav_header(plugin)) {
-        fclose(plugin->audio_file);
+    plugin->map_size = st.st_size;
+    plugin->map = mmap(NULL, plugin->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (plugin->map == MAP_FAILED) {
+        SNDERR("Failed to map %s: %s", filename, strerror(errno));
+        plugin->map = NULL;
         return -1;
     }
+    madvise(plugin->map, plugin->map_size, MADV_SEQUENTIAL);
 
-    plugin->frames_count = 44100;
+    if (parse_wav(plugin))
+        return -1;
+
+    // Enough silence for the largest period, for after the end of the data
+    plugin->silence_frames = plugin->rate;
+    plugin->silence = malloc(plugin->silence_frames * plugin->frame_bytes);
+    if (!plugin->silence)
+        return -1;
+    snd_pcm_format_set_silence(plugin->format, plugin->silence, plugin->silence_frames * plugin->channels);
 
     return 0;
 }
 
+static void deinit(cvi_pcm_plugin_t* plugin)
+{
+    if (plugin->map)
+        munmap(plugin->map, plugin->map_size);
+    free(plugin->silence);
+}
+
+// Serve frames of the data chunk, wrapping or padding with silence at the end
+static void serve(cvi_pcm_plugin_t* plugin, snd_pcm_uframes_t frames)
+{
+    while (frames) {
+        snd_pcm_uframes_t n;
+
+        if (plugin->position >= plugin->data_frames && plugin->loop && plugin->data_frames)
+            plugin->position = 0;
+
+        if (plugin->position < plugin->data_frames) {
+            n = plugin->data_frames - plugin->position;
+            if (n > frames)
+                n = frames;
+            pcm_ring_write(&plugin->ring, plugin->data + plugin->position * plugin->frame_bytes, n);
+            plugin->position += n;
+        } else {
+            n = frames < plugin->silence_frames ? frames : plugin->silence_frames;
+            pcm_ring_write(&plugin->ring, plugin->silence, n);
+        }
+        frames -= n;
+    }
+}
+
+// Serves one period per period time, paced against the monotonic clock
+// so that timing errors do not accumulate
+static void* capture_thread(void* arg)
+{
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)arg;
+    snd_pcm_uframes_t period = plugin->io.period_size;
+    uint64_t served = 0;
+    struct timespec start, next;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (plugin->capturing) {
+        served += period;
+        uint64_t ns = served * 1000000000ULL / plugin->rate;
+        next.tv_sec = start.tv_sec + ns / 1000000000ULL;
+        next.tv_nsec = start.tv_nsec + ns % 1000000000ULL;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        serve(plugin, period);
+    }
+
+    return NULL;
+}
+
 static int start(snd_pcm_ioplug_t* io)
 {
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
-    // return snd_pcm_start(io->pcm);
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
+
+    if (!plugin->capturing) {
+        plugin->capturing = 1;
+        if (pthread_create(&plugin->thread, NULL, capture_thread, plugin)) {
+            SNDERR("Failed to create capture thread");
+            plugin->capturing = 0;
+            return -EIO;
+        }
+    }
+
+    pcm_ring_start(&plugin->ring);
     return 0;
 }
 
 static int stop(snd_pcm_ioplug_t* io)
 {
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
-    // return snd_pcm_drop(io->pcm);
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
+
+    pcm_ring_stop(&plugin->ring);
+    if (plugin->capturing) {
+        plugin->capturing = 0;
+        pthread_join(plugin->thread, NULL);
+    }
     return 0;
 }
 
+static int sw_params(snd_pcm_ioplug_t* io, snd_pcm_sw_params_t* params)
+{
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
+
+    return pcm_ring_sw_params(&plugin->ring, params);
+}
+
+static int prepare(snd_pcm_ioplug_t* io)
+{
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
+
+    return pcm_ring_prepare(&plugin->ring);
+}
+
 static snd_pcm_sframes_t pointer(snd_pcm_ioplug_t* io)
 {
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
 
-    printf("%s,%d: +++++++++++++++++++++++++\n", __FUNCTION__, __LINE__);
-    printf("%s,%d: appl_ptr=%d, hw_ptr=%d, frames_count=%d\n", __FUNCTION__, __LINE__,
-        io->appl_ptr, io->hw_ptr, plugin->frames_count);
-    printf("%s,%d: +++++++++++++++++++++++++\n", __FUNCTION__, __LINE__);
+    return pcm_ring_pointer(&plugin->ring);
+}
+
+static int poll_revents(snd_pcm_ioplug_t* io, struct pollfd* pfd, unsigned int nfds, unsigned short* revents)
+{
+    cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
 
-    return plugin->frames_count;
+    return pcm_ring_poll_revents(&plugin->ring, pfd, nfds, revents);
 }
 
-// 数据传输回调函数
-static snd_pcm_sframes_t transfer(snd_pcm_ioplug_t* io, const snd_pcm_channel_area_t* areas,
-    snd_pcm_uframes_t offset, snd_pcm_uframes_t size)
+static void dump(snd_pcm_ioplug_t* io, snd_output_t* out)
 {
-    // printf("%s,%d: offset=%d, size=%d\n", __FUNCTION__, __LINE__, offset, size);
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
-    size_t bytes_per_frame = snd_pcm_format_width(plugin->format) / 8 * plugin->channels;
-    size_t total_bytes = size * bytes_per_frame;
-
-    sleep(1);
-
-    // 从文件读取音频数据
-    size_t read_bytes = fread((char*)areas[0].addr + areas[0].first / 8 + offset * bytes_per_frame,
-        1, total_bytes, plugin->audio_file);
-
-    // 更新已读取的帧数
-    plugin->frames_count += read_bytes / bytes_per_frame;
-
-    printf("%s,%d: >>>>>>>>>>>>>>>>>>>>>>>>>\n", __FUNCTION__, __LINE__);
-    printf("%s,%d: offset=%d, frm_size=%d, read_bytes=%d(%d) -> %d\n", __FUNCTION__, __LINE__,
-        offset, size, read_bytes, total_bytes, read_bytes / bytes_per_frame);
-    printf("%s,%d: <<<<<<<<<<<<<<<<<<<<<<<<<\n", __FUNCTION__, __LINE__);
-    // 如果读取的数据少于请求的数据量，则填充剩余部分为静音
-    if (read_bytes < total_bytes) {
-        memset((char*)areas[0].addr + areas[0].first / 8 + offset * bytes_per_frame + read_bytes,
-            0, total_bytes - read_bytes);
-        return read_bytes / bytes_per_frame;
-    }
 
-    return size;
+    pcm_ring_dump(&plugin->ring, out);
 }
 
 static int close_cb(snd_pcm_ioplug_t* io)
 {
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
     cvi_pcm_plugin_t* plugin = (cvi_pcm_plugin_t*)io;
-    if (plugin->audio_file) {
-        fclose(plugin->audio_file);
-        plugin->audio_file = NULL;
-    }
+
+    stop(io);
+    pcm_ring_deinit(&plugin->ring);
+    deinit(plugin);
     free(plugin);
 
     return 0;
@@ -162,19 +318,18 @@ SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio)
 {
     int err = 0;
 
-    printf("%s,%d: %s\n", __FUNCTION__, __LINE__, __TIME__);
     cvi_pcm_plugin_t* plugin = NULL;
     const char* file_name = NULL;
+    int print_stats = 0;
+    int loop = 0;
     snd_config_iterator_t i, next;
 
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
     plugin = calloc(1, sizeof(*plugin));
     if (!plugin) {
         SNDERR("Failed to allocate memory for plugin");
         return -ENOMEM;
     }
 
-    printf("%s,%d\n", __FUNCTION__, __LINE__);
     snd_config_for_each(i, next, conf)
     {
         snd_config_t* n = snd_config_iterator_entry(i);
@@ -192,6 +347,20 @@ SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio)
                 err = -EINVAL;
                 goto exit;
             }
+        } else if (strcmp(id, "stats") == 0) {
+            print_stats = snd_config_get_bool(n);
+            if (print_stats < 0) {
+                SNDERR("Invalid value for %s", id);
+                err = -EINVAL;
+                goto exit;
+            }
+        } else if (strcmp(id, "loop") == 0) {
+            loop = snd_config_get_bool(n);
+            if (loop < 0) {
+                SNDERR("Invalid value for %s", id);
+                err = -EINVAL;
+                goto exit;
+            }
         } else {
             SNDERR("Unknown field %s", id);
             err = -EINVAL;
@@ -199,18 +368,27 @@ SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio)
         }
     }
 
-    printf("file_name: %s\n", file_name);
+    if (!file_name) {
+        SNDERR("No file given");
+        err = -EINVAL;
+        goto exit;
+    }
+
     if (init(plugin, file_name)) {
         err = -EINVAL;
         goto exit;
     }
+    plugin->loop = loop;
 
     static const snd_pcm_ioplug_callback_t callback = {
         .start = start,
         .stop = stop,
         .pointer = pointer,
-        .transfer = transfer,
         .close = close_cb,
+        .sw_params = sw_params,
+        .prepare = prepare,
+        .poll_revents = poll_revents,
+        .dump = dump,
     };
 
     snd_pcm_ioplug_t* io = &plugin->io;
@@ -218,38 +396,35 @@ SND_PCM_PLUGIN_DEFINE_FUNC(cvi_audio)
     io->version = SND_PCM_IOPLUG_VERSION;
     io->name = "cvi_audio";
     io->flags = SND_PCM_IOPLUG_FLAG_MONOTONIC;
-    io->mmap_rw = 0;
     io->callback = &callback;
     io->private_data = plugin;
 
+    err = pcm_ring_init(&plugin->ring, io);
+    if (err < 0)
+        goto exit;
+    plugin->ring.print_stats = print_stats;
+
     err = snd_pcm_ioplug_create(&plugin->io, name, SND_PCM_STREAM_CAPTURE, mode);
-    printf("%s,%d: name=%s, mode=%d\n", __FUNCTION__, __LINE__, name, mode);
     if (err < 0) {
         SNDERR("snd_pcm_ioplug_create, err=%d", err);
+        pcm_ring_deinit(&plugin->ring);
         goto exit;
     }
 
-    *pcmp = plugin->io.pcm;
+    // Periods are served whole, so the smallest period is the chunk size
+    err = pcm_ring_set_hw_constraints(&plugin->ring, plugin->format, plugin->channels, plugin->rate, plugin->rate / 100);
+    if (err < 0) {
+        snd_pcm_ioplug_delete(&plugin->io);
+        return err;
+    }
 
-    printf("%s,%d: SSSSSSSSSSSSSSSSSSSS\n", __FUNCTION__, __LINE__);
-    printf("%s,%d: *pcmp=%p\n", __FUNCTION__, __LINE__, *pcmp);
-    printf("%s,%d: buffer_size=%d\n", __FUNCTION__, __LINE__, plugin->io.buffer_size);
-    printf("%s,%d: EEEEEEEEEEEEEEEEEEEE\n", __FUNCTION__, __LINE__);
-
-    snd_pcm_sframes_t pcm_avail = snd_pcm_ioplug_hw_avail(io, io->hw_ptr, io->appl_ptr);
-    printf("%s,%d: +++++++++++++++++++++++++\n", __FUNCTION__, __LINE__);
-    printf("%s,%d: frames_count=%d\n", __FUNCTION__, __LINE__, plugin->frames_count);
-    printf("%s,%d: stream=%d\n", __FUNCTION__, __LINE__, io->stream);
-    printf("%s,%d: state=%d\n", __FUNCTION__, __LINE__, io->state);
-    printf("%s,%d: appl_ptr=%d\n", __FUNCTION__, __LINE__, io->appl_ptr);
-    printf("%s,%d: hw_ptr=%d\n", __FUNCTION__, __LINE__, io->hw_ptr);
-    printf("%s,%d: pcm_avail=%d\n", __FUNCTION__, __LINE__, pcm_avail);
-    printf("%s,%d: +++++++++++++++++++++++++\n", __FUNCTION__, __LINE__);
+    *pcmp = plugin->io.pcm;
 
     return 0;
 
 exit:
     if (plugin) {
+        deinit(plugin);
         free(plugin);
     }
 
@@ -21,10 +21,15 @@ extern char* app_ipcam_Isp_pq_bin(void);
 #define PQ_BIN_SDR   app_ipcam_Isp_pq_bin()
 #endif
 
+/* Saved AE/AWB state of a pipe, see video_3a.h */
+#define ISP_3A_STATE_PATH   "/mnt/data/isp_3a_%d"
+
 int app_ipcam_Vi_Isp_Init(void);
 int app_ipcam_Vi_Isp_DeInit(void);
 int app_ipcam_Vi_Isp_Start(void);
 int app_ipcam_Vi_Isp_Stop(void);
+/* Time from ISP start to stable exposure in ms, -1 until then */
+int app_ipcam_Isp_StableTime_Get(VI_PIPE ViPipe);
 
 #ifdef __cplusplus
 }
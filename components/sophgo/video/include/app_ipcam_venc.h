@@ -199,6 +199,8 @@ typedef struct APP_VENC_CHN_CFG_T {
     MMF_CHN_S astChn[2];
     VENC_GOP_MODE_E enGopMode;
     APP_GOP_PARAM_U unGopParam;
+    CVI_U32 u32TemporalLayers; /* 0 or 1 without temporal layers, see video_temporal.h */
+    CVI_U32 u32Slices; /* 0 or 1 for whole frames, see video_slice.h */
     VENC_RC_MODE_E enRcMode;
     APP_RC_PARAM_S stRcParam;
     APP_JPEG_CODEC_PARAM_S stJpegCodecParam;
@@ -0,0 +1,169 @@
+/**
+ * @file video_3a.h
+ * @brief Persisted AE/AWB state, to start the ISP from the last converged point
+ *
+ * Without it, AE and AWB start every boot from the sensor's defaults and
+ * the first second or two of video is dark or tinted. The state the ISP
+ * converged to (exposure time, gains, white balance gains and colour
+ * temperature) is saved now and then, and the next start fixes the ISP
+ * to it for a few frames before handing back to auto. If the scene has
+ * changed too much since, which shows as a luma far from the saved one
+ * under the saved exposure, the ISP gets its defaults back instead.
+ *
+ * The ISP is reached through video_3a_isp_t, so the logic runs the same
+ * against the CVI ISP (isp.c) and against a model on a host.
+ */
+
+#ifndef VIDEO_3A_H
+#define VIDEO_3A_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VIDEO_3A_MAGIC              0x41334156  /* "VA3A" */
+#define VIDEO_3A_VERSION            1
+
+#define VIDEO_3A_POLL_MS            100     /* video_3a_poll() interval */
+#define VIDEO_3A_SEED_CHECK_MS      200     /* Under the saved state before checking the scene */
+#define VIDEO_3A_SCENE_RATIO        3       /* Luma off by more than this factor: the scene changed */
+#define VIDEO_3A_LUMA_CLIPPED       250     /* or clipped when the saved one was not */
+#define VIDEO_3A_STABLE_MS          500     /* Exposure and colour temperature held this long */
+#define VIDEO_3A_STABLE_EXPOSURE    0.08    /* Held: within this share */
+#define VIDEO_3A_STABLE_CT          150     /* Held: within this many K */
+#define VIDEO_3A_SAVE_MS            60000   /* Between two saves, the state is on flash */
+#define VIDEO_3A_SAVE_EXPOSURE      0.2     /* Saved again once it moved this share */
+#define VIDEO_3A_SAVE_CT            300     /* or this many K */
+
+/* video_3a_poll() flags */
+#define VIDEO_3A_SEED_KEPT          0x01    /* The saved state matched the scene, auto from there */
+#define VIDEO_3A_SEED_DROPPED       0x02    /* The scene changed, auto from the defaults */
+#define VIDEO_3A_STABLE             0x04    /* Stable for the first time, see stable_ms */
+#define VIDEO_3A_SAVED              0x08    /* The state was saved */
+
+/* What the ISP reports and what it can be fixed to */
+typedef struct {
+    uint32_t exp_time_us;
+    uint32_t again;             /* Gains in the ISP's units */
+    uint32_t dgain;
+    uint32_t isp_dgain;
+    uint16_t wb_gain[4];        /* R, Gr, Gb, B */
+    uint16_t color_temp;        /* K */
+    uint16_t luma;              /* Average luma, 0 to 255 */
+} video_3a_sample_t;
+
+/* On flash */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;              /* sizeof(video_3a_state_t) */
+    uint32_t key;               /* video_3a_key() of the pipe it was saved for */
+    video_3a_sample_t sample;
+    uint32_t crc;               /* CRC-32 of the bytes before it */
+} video_3a_state_t;
+
+typedef struct {
+    int (*query)(void* ctx, video_3a_sample_t* sample);
+    int (*set_manual)(void* ctx, const video_3a_sample_t* sample);
+    int (*set_auto)(void* ctx);
+    void* ctx;
+} video_3a_isp_t;
+
+typedef enum {
+    VIDEO_3A_AUTO = 0,
+    VIDEO_3A_SEEDING,           /* Fixed to the saved state */
+    VIDEO_3A_FALLBACK,          /* Fixed to the defaults for a poll */
+} video_3a_phase_t;
+
+typedef struct {
+    video_3a_isp_t isp;
+    const char* path;
+    uint32_t key;
+    video_3a_phase_t phase;
+    bool seeded;                /* Started from the saved state */
+    bool dropped;               /* The saved state did not match the scene */
+    video_3a_sample_t defaults; /* What the ISP started with */
+    video_3a_sample_t saved;
+    bool has_saved;
+    video_3a_sample_t held;     /* Compared with, for stability */
+    uint64_t held_since_ms;
+    uint64_t start_ms;
+    uint64_t seed_ms;
+    uint64_t save_ms;
+    int32_t stable_ms;          /* Start to stable exposure, -1 until then */
+    bool stable;
+    uint32_t saves;
+} video_3a_t;
+
+/**
+ * Key of the sensor setup a state is for: a state is only used again for the same one
+ * @param sensor Sensor type
+ * @param width Width
+ * @param height Height
+ * @param wdr WDR mode
+ * @return Key
+ */
+uint32_t video_3a_key(uint32_t sensor, uint32_t width, uint32_t height, uint32_t wdr);
+
+/**
+ * Load a saved state
+ * @param path File
+ * @param key Key of the pipe
+ * @param sample Loaded sample
+ * @return 0 on success, -1 if missing, damaged or for another key
+ */
+int video_3a_load(const char* path, uint32_t key, video_3a_sample_t* sample);
+
+/**
+ * Save a state, replacing the file in one step
+ * @param path File
+ * @param key Key of the pipe
+ * @param sample Sample to save
+ * @return 0 on success, -1 on failure
+ */
+int video_3a_save(const char* path, uint32_t key, const video_3a_sample_t* sample);
+
+/**
+ * Whether two samples differ by more than a share of exposure or a colour temperature
+ * @param a Sample
+ * @param b Sample
+ * @param exposure Share of the exposure, time times gains
+ * @param color_temp K
+ * @return true if they differ by more
+ */
+bool video_3a_differs(const video_3a_sample_t* a, const video_3a_sample_t* b, double exposure, uint32_t color_temp);
+
+/**
+ * Start: note the ISP's defaults and fix the ISP to the saved state, if any
+ * @param a State
+ * @param isp ISP
+ * @param path File of the saved state
+ * @param key Key of the pipe
+ * @param now_ms Monotonic time in milliseconds
+ * @return 0 on success, -1 if the ISP could not be queried
+ */
+int video_3a_start(video_3a_t* a, const video_3a_isp_t* isp, const char* path, uint32_t key, uint64_t now_ms);
+
+/**
+ * Check the seed, watch for stable exposure and save, every VIDEO_3A_POLL_MS
+ * @param a State
+ * @param now_ms Monotonic time in milliseconds
+ * @return VIDEO_3A_* flags of what happened
+ */
+int video_3a_poll(video_3a_t* a, uint64_t now_ms);
+
+/**
+ * Stop: save the state if it is stable and moved since the last save
+ * @param a State
+ * @return VIDEO_3A_SAVED if saved
+ */
+int video_3a_stop(video_3a_t* a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIDEO_3A_H */
@@ -32,17 +32,24 @@ extern "C" {
 #define VIDEO_SHM_MAGIC         0x56494445      /* "VIDE" magic number */
 #define VIDEO_SHM_VERSION       1
 
+/* video_frame_meta_t.codec */
+#define VIDEO_SHM_CODEC_H264    0
+#define VIDEO_SHM_CODEC_H265    1
+#define VIDEO_SHM_CODEC_JPEG    2
+
 /* Frame metadata */
 typedef struct {
     uint64_t timestamp_ms;      /* Capture timestamp in milliseconds */
     uint32_t size;              /* Frame data size in bytes */
     uint32_t sequence;          /* Monotonic sequence number */
     uint8_t  is_keyframe;       /* 1 if I-frame, 0 otherwise */
-    uint8_t  codec;             /* 0=H.264, 1=H.265, 2=JPEG */
+    uint8_t  codec;             /* VIDEO_SHM_CODEC_*: 0=H.264, 1=H.265, 2=JPEG */
     uint16_t width;             /* Frame width */
     uint16_t height;            /* Frame height */
     uint8_t  fps;               /* Frames per second */
-    uint8_t  reserved[5];       /* Padding to 32 bytes */
+    uint8_t  temporal_id;       /* Temporal layer of the frame, 0 = base (video_temporal.h) */
+    uint8_t  temporal_layers;   /* Temporal layers in the stream, 0 or 1 without layers */
+    uint8_t  reserved[3];       /* Padding to 32 bytes */
 } video_frame_meta_t;
 
 /* Ring buffer slot */
@@ -0,0 +1,84 @@
+/**
+ * @file video_slice.h
+ * @brief Slices of an encoded channel and where their frames begin and end
+ *
+ * With N slices the encoder codes every frame as N horizontal bands and
+ * hands each one out as soon as it is done, so a transport can send the
+ * top of a frame while the bottom is still being encoded. The handlers
+ * of such a channel then get one call per slice instead of one per frame,
+ * and the last pack of the last slice has bFrameEnd set.
+ *
+ * All slices of a frame carry the frame's PTS. A tracker uses that to
+ * find the frame boundaries even when a last slice never comes, e.g.
+ * when the encoder gave up on the frame, so a new PTS also starts a frame.
+ */
+
+#ifndef VIDEO_SLICE_H
+#define VIDEO_SLICE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VIDEO_SLICES_MAX            8
+
+#define VIDEO_SLICE_H264_ROW        16      /* Macroblock rows */
+#define VIDEO_SLICE_H265_ROW        64      /* CTU rows */
+
+/* video_slice_begin() and video_slice_end() flags */
+#define VIDEO_SLICE_START           0x01    /* The slice starts a frame */
+#define VIDEO_SLICE_CLOSED          0x02    /* It closed a frame whose last slice never came */
+#define VIDEO_SLICE_END             0x04    /* The slice ends the frame */
+
+typedef struct {
+    bool     open;              /* A frame started and its last slice has not come */
+    uint64_t pts;               /* PTS of the open or last frame */
+    uint32_t slices;            /* Slices of the open frame so far */
+    uint32_t size;              /* Bytes of the open frame so far */
+    uint32_t last_slices;       /* Slices of the last frame closed */
+    uint32_t last_size;         /* Bytes of the last frame closed */
+    uint32_t frames;            /* Frames closed */
+    uint32_t unterminated;      /* Frames closed by the next frame instead of their last slice */
+} video_slice_tracker_t;
+
+/**
+ * Encoder rows per slice to split a frame into a number of slices
+ * @param height Frame height in pixels
+ * @param row Height of a row, VIDEO_SLICE_H264_ROW or VIDEO_SLICE_H265_ROW
+ * @param slices Slices per frame
+ * @return Rows per slice, the last slice may have fewer
+ */
+uint32_t video_slice_rows(uint32_t height, uint32_t row, uint32_t slices);
+
+/**
+ * Initialize a tracker, with no frame open
+ * @param tracker Tracker
+ */
+void video_slice_tracker_init(video_slice_tracker_t* tracker);
+
+/**
+ * Start a slice
+ * @param tracker Tracker
+ * @param pts PTS of the slice
+ * @return VIDEO_SLICE_START if the slice starts a frame, with
+ *         VIDEO_SLICE_CLOSED if that closed the previous frame
+ */
+int video_slice_begin(video_slice_tracker_t* tracker, uint64_t pts);
+
+/**
+ * Finish a slice started with video_slice_begin()
+ * @param tracker Tracker
+ * @param size Bytes of the slice
+ * @param last True for the last slice of the frame (bFrameEnd)
+ * @return VIDEO_SLICE_END if the slice ends the frame
+ */
+int video_slice_end(video_slice_tracker_t* tracker, uint32_t size, bool last);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIDEO_SLICE_H */
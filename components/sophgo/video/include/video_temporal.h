@@ -0,0 +1,120 @@
+/**
+ * @file video_temporal.h
+ * @brief Temporal layers of an encoded channel and per-client layer selection
+ *
+ * With N temporal layers the encoder codes a base frame every 2^(N-1)
+ * frames and the frames in between reference only that base frame, so
+ * any of them can be left out without breaking decode. Their temporal
+ * id follows from the position after the last keyframe: with 3 layers
+ * at 30fps the ids run 0 2 1 2 0 2 1 2 ..., and layers 0, 0-1 and 0-2
+ * play at 7.5, 15 and 30fps.
+ *
+ * The position is counted from the frames a transport is handed, so a
+ * frame lost on the way (an oversized P frame the VENC thread skips, a
+ * failed GetStream) would shift every id after it. A lost frame shows
+ * as a gap in the PTS of more than 1.5 frame intervals, as does a drop
+ * in the frame rate for a few frames. From there up to the next keyframe
+ * the position is not known, and every frame is given the base layer,
+ * which is never shed.
+ *
+ * A transport keeps one selector per client and asks it about every
+ * frame. It sheds the top layer when the client's send backlog grows and
+ * adds it back, at a base layer frame, once the backlog has stayed clear.
+ * Only when the base layer cannot be sent either does the client wait
+ * for the next keyframe.
+ */
+
+#ifndef VIDEO_TEMPORAL_H
+#define VIDEO_TEMPORAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define VIDEO_TEMPORAL_LAYERS_MAX       3
+
+/*
+ * Backlogs are counted in frames of the average size of the full stream,
+ * on top of the last keyframe, which may take a few frame times to send
+ */
+#define VIDEO_TEMPORAL_SHED_FRAMES      6       /* Shed a layer above this */
+#define VIDEO_TEMPORAL_CLEAR_FRAMES     1       /* Clear at or below this */
+#define VIDEO_TEMPORAL_DROP_FRAMES      30      /* Drop the base layer above this */
+#define VIDEO_TEMPORAL_SHED_HOLD_MS     250     /* Between two sheds, to let the backlog drain */
+#define VIDEO_TEMPORAL_RECOVER_MS       2000    /* Clear time before adding a layer back */
+#define VIDEO_TEMPORAL_RECOVER_MAX_MS   8000    /* Doubled up to this when an added layer is shed again */
+
+/* Position of a stream's frames after their keyframe */
+typedef struct {
+    uint32_t frames;            /* Since the last keyframe, VIDEO_TEMPORAL_LOST when not known */
+    uint64_t last_pts;
+    uint64_t interval;          /* Between the last two frames */
+} video_temporal_position_t;
+
+#define VIDEO_TEMPORAL_LOST     UINT32_MAX
+
+/* Per-client state */
+typedef struct {
+    uint8_t  layers;            /* Temporal layers in the stream */
+    uint8_t  max_id;            /* Highest temporal id sent */
+    uint8_t  target_id;         /* max_id from the next base layer frame on */
+    bool     need_keyframe;     /* A base layer frame was dropped */
+    uint32_t frame_bytes;       /* Average size of a non-key frame */
+    uint32_t key_bytes;         /* Size of the last keyframe */
+    uint32_t recover_ms;
+    uint64_t clear_since_ms;    /* Backlog clear since */
+    uint64_t shed_ms;           /* Last layer shed */
+    uint64_t added_ms;          /* Last layer added */
+    uint32_t sent;
+    uint32_t shed;              /* Frames left out by shedding */
+    uint32_t dropped;           /* Frames dropped while waiting for a keyframe */
+    uint32_t keyframe_waits;
+} video_temporal_selector_t;
+
+/**
+ * Temporal id of the frame at a position after the last keyframe
+ * @param layers Temporal layers (1 to VIDEO_TEMPORAL_LAYERS_MAX)
+ * @param position 0 for the keyframe
+ * @return 0 for the base layer up to layers - 1
+ */
+uint8_t video_temporal_id(uint8_t layers, uint32_t position);
+
+/**
+ * Temporal id of the next frame of a stream
+ * @param layers Temporal layers
+ * @param position Position of the last frame, zeroed before the first one; updated
+ * @param keyframe True for a keyframe
+ * @param pts The frame's VENC_PACK_S.u64PTS
+ * @return Temporal id, 0 while the position is not known
+ */
+uint8_t video_temporal_next(uint8_t layers, video_temporal_position_t* position, bool keyframe, uint64_t pts);
+
+/**
+ * Initialize a client's selector, with all layers sent
+ * @param selector Selector
+ * @param layers Temporal layers in the stream, 0 or 1 without layers
+ */
+void video_temporal_selector_init(video_temporal_selector_t* selector, uint8_t layers);
+
+/**
+ * Decide whether to send a frame to a client
+ * @param selector The client's selector
+ * @param temporal_id Temporal id of the frame
+ * @param keyframe True for a keyframe
+ * @param size Frame size in bytes
+ * @param backlog Bytes queued to the client and not yet sent
+ * @param now_ms Monotonic time in milliseconds
+ * @return true to send the frame, false to leave it out
+ */
+bool video_temporal_select(video_temporal_selector_t* selector, uint8_t temporal_id, bool keyframe,
+                           uint32_t size, size_t backlog, uint64_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VIDEO_TEMPORAL_H */
@@ -1,5 +1,7 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/prctl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/cvi_comm_sys.h>
@@ -8,6 +10,7 @@
 #include <cvi_bin.h>
 
 #include "app_ipcam_paramparse.h"
+#include "video_3a.h"
 
 /**************************************************************************
  *                              M A C R O S                               *
@@ -37,6 +40,11 @@
  **************************************************************************/
 static pthread_t g_IspPid[VI_MAX_DEV_NUM];
 
+static pthread_t g_Isp3APid;
+static volatile CVI_BOOL g_bIsp3ARun = CVI_FALSE;
+static video_3a_t g_ast3A[VI_MAX_DEV_NUM];
+static CVI_CHAR g_as3APath[VI_MAX_DEV_NUM][64];
+
 #ifdef SUPPORT_ISP_PQTOOL
 static CVI_BOOL bISPDaemon = CVI_FALSE;
 //static CVI_VOID *pISPDHandle = NULL;
@@ -503,6 +511,169 @@ static void *ISP_Thread(void *arg)
     return CVI_NULL;
 }
 
+static uint64_t app_ipcam_Isp_3A_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int app_ipcam_Isp_3A_Query(void *ctx, video_3a_sample_t *pstSample)
+{
+    VI_PIPE ViPipe = (VI_PIPE)(intptr_t)ctx;
+    ISP_EXP_INFO_S stExpInfo;
+    ISP_WB_INFO_S stWBInfo;
+
+    memset(&stExpInfo, 0, sizeof(stExpInfo));
+    memset(&stWBInfo, 0, sizeof(stWBInfo));
+    if ((CVI_ISP_QueryExposureInfo(ViPipe, &stExpInfo) != CVI_SUCCESS) ||
+        (CVI_ISP_QueryWBInfo(ViPipe, &stWBInfo) != CVI_SUCCESS)) {
+        return -1;
+    }
+
+    pstSample->exp_time_us = stExpInfo.u32ExpTime;
+    pstSample->again       = stExpInfo.u32AGain;
+    pstSample->dgain       = stExpInfo.u32DGain;
+    pstSample->isp_dgain   = stExpInfo.u32ISPDGain;
+    pstSample->wb_gain[0]  = stWBInfo.u16Rgain;
+    pstSample->wb_gain[1]  = stWBInfo.u16Grgain;
+    pstSample->wb_gain[2]  = stWBInfo.u16Gbgain;
+    pstSample->wb_gain[3]  = stWBInfo.u16Bgain;
+    pstSample->color_temp  = stWBInfo.u16ColorTemp;
+    pstSample->luma        = stExpInfo.u8AveLum;
+
+    return 0;
+}
+
+static int app_ipcam_Isp_3A_Manual_Set(void *ctx, const video_3a_sample_t *pstSample)
+{
+    VI_PIPE ViPipe = (VI_PIPE)(intptr_t)ctx;
+    ISP_EXPOSURE_ATTR_S stExpAttr;
+    ISP_WB_ATTR_S stWBAttr;
+
+    APP_CHK_RET(CVI_ISP_GetExposureAttr(ViPipe, &stExpAttr), "get exposure attr");
+    stExpAttr.enOpType = OP_TYPE_MANUAL;
+    stExpAttr.stManual.enExpTimeOpType = OP_TYPE_MANUAL;
+    stExpAttr.stManual.enAGainOpType = OP_TYPE_MANUAL;
+    stExpAttr.stManual.enDGainOpType = OP_TYPE_MANUAL;
+    stExpAttr.stManual.enISPDGainOpType = OP_TYPE_MANUAL;
+    stExpAttr.stManual.u32ExpTime = pstSample->exp_time_us;
+    stExpAttr.stManual.u32AGain = pstSample->again;
+    stExpAttr.stManual.u32DGain = pstSample->dgain;
+    stExpAttr.stManual.u32ISPDGain = pstSample->isp_dgain;
+    APP_CHK_RET(CVI_ISP_SetExposureAttr(ViPipe, &stExpAttr), "set exposure attr");
+
+    APP_CHK_RET(CVI_ISP_GetWBAttr(ViPipe, &stWBAttr), "get wb attr");
+    stWBAttr.enOpType = OP_TYPE_MANUAL;
+    stWBAttr.stManual.u16Rgain = pstSample->wb_gain[0];
+    stWBAttr.stManual.u16Grgain = pstSample->wb_gain[1];
+    stWBAttr.stManual.u16Gbgain = pstSample->wb_gain[2];
+    stWBAttr.stManual.u16Bgain = pstSample->wb_gain[3];
+    APP_CHK_RET(CVI_ISP_SetWBAttr(ViPipe, &stWBAttr), "set wb attr");
+
+    return 0;
+}
+
+static int app_ipcam_Isp_3A_Auto_Set(void *ctx)
+{
+    VI_PIPE ViPipe = (VI_PIPE)(intptr_t)ctx;
+    ISP_EXPOSURE_ATTR_S stExpAttr;
+    ISP_WB_ATTR_S stWBAttr;
+
+    APP_CHK_RET(CVI_ISP_GetExposureAttr(ViPipe, &stExpAttr), "get exposure attr");
+    stExpAttr.enOpType = OP_TYPE_AUTO;
+    APP_CHK_RET(CVI_ISP_SetExposureAttr(ViPipe, &stExpAttr), "set exposure attr");
+
+    APP_CHK_RET(CVI_ISP_GetWBAttr(ViPipe, &stWBAttr), "get wb attr");
+    stWBAttr.enOpType = OP_TYPE_AUTO;
+    APP_CHK_RET(CVI_ISP_SetWBAttr(ViPipe, &stWBAttr), "set wb attr");
+
+    return 0;
+}
+
+/* Start AE/AWB from the state saved last time, and save it again once converged (video_3a.h) */
+static void *ISP_3A_Thread(void *arg)
+{
+    APP_PARAM_VI_CTX_S *g_pstViCtx = app_ipcam_Vi_Param_Get();
+    CVI_U32 u32Cnt = g_pstViCtx->u32WorkSnsCnt;
+    CVI_BOOL abStarted[VI_MAX_DEV_NUM] = { CVI_FALSE };
+
+    prctl(PR_SET_NAME, "ISP_3A", 0, 0, 0);
+
+    for (CVI_U32 i = 0; i < u32Cnt; i++) {
+        APP_PARAM_SNS_CFG_T *pstSnsCfg = &g_pstViCtx->astSensorCfg[i];
+        APP_PARAM_CHN_CFG_T *pstChnCfg = &g_pstViCtx->astChnInfo[i];
+        VI_PIPE ViPipe = pstChnCfg->s32ChnId;
+        video_3a_isp_t stIsp = {
+            app_ipcam_Isp_3A_Query, app_ipcam_Isp_3A_Manual_Set, app_ipcam_Isp_3A_Auto_Set, (void *)(intptr_t)ViPipe
+        };
+        CVI_U32 u32Key = video_3a_key(pstSnsCfg->enSnsType, pstChnCfg->u32Width, pstChnCfg->u32Height,
+                                      pstSnsCfg->enWDRMode);
+
+        snprintf(g_as3APath[i], sizeof(g_as3APath[i]), ISP_3A_STATE_PATH, ViPipe);
+        /* CVI_ISP_Run() is just starting on its own thread, give it a few polls */
+        CVI_S32 s32Ret = -1;
+        for (CVI_U32 n = 0; (n < 10) && g_bIsp3ARun; n++) {
+            s32Ret = video_3a_start(&g_ast3A[i], &stIsp, g_as3APath[i], u32Key, app_ipcam_Isp_3A_Now());
+            if (s32Ret == 0) {
+                break;
+            }
+            usleep(VIDEO_3A_POLL_MS * 1000);
+        }
+        if (s32Ret != 0) {
+            APP_PROF_LOG_PRINT(LEVEL_WARN, "ISP%d 3A not available, AE/AWB start from defaults\n", ViPipe);
+            continue;
+        }
+        abStarted[i] = CVI_TRUE;
+        APP_PROF_LOG_PRINT(LEVEL_INFO, "ISP%d AE/AWB %s\n", ViPipe,
+            g_ast3A[i].seeded ? "seeded from the last converged state" : "start from defaults");
+    }
+
+    while (g_bIsp3ARun) {
+        usleep(VIDEO_3A_POLL_MS * 1000);
+        for (CVI_U32 i = 0; i < u32Cnt; i++) {
+            if (!abStarted[i]) {
+                continue;
+            }
+            VI_PIPE ViPipe = g_pstViCtx->astChnInfo[i].s32ChnId;
+            video_3a_t *p3A = &g_ast3A[i];
+            int flags = video_3a_poll(p3A, app_ipcam_Isp_3A_Now());
+
+            if (flags & VIDEO_3A_SEED_DROPPED) {
+                APP_PROF_LOG_PRINT(LEVEL_WARN, "ISP%d scene changed since the 3A state was saved, back to defaults\n", ViPipe);
+            }
+            if (flags & VIDEO_3A_STABLE) {
+                APP_PROF_LOG_PRINT(LEVEL_INFO, "ISP%d exposure stable after %d ms (%s)\n", ViPipe, p3A->stable_ms,
+                    p3A->dropped ? "saved state dropped" : (p3A->seeded ? "seeded" : "no saved state"));
+            }
+            if (flags & VIDEO_3A_SAVED) {
+                APP_PROF_LOG_PRINT(LEVEL_DEBUG, "ISP%d 3A state saved to %s\n", ViPipe, p3A->path);
+            }
+        }
+    }
+
+    for (CVI_U32 i = 0; i < u32Cnt; i++) {
+        if (abStarted[i]) {
+            video_3a_stop(&g_ast3A[i]);
+        }
+    }
+
+    return CVI_NULL;
+}
+
+int app_ipcam_Isp_StableTime_Get(VI_PIPE ViPipe)
+{
+    APP_PARAM_VI_CTX_S *g_pstViCtx = app_ipcam_Vi_Param_Get();
+
+    for (CVI_U32 i = 0; i < g_pstViCtx->u32WorkSnsCnt; i++) {
+        if (g_pstViCtx->astChnInfo[i].s32ChnId == ViPipe) {
+            return g_ast3A[i].stable_ms;
+        }
+    }
+    return -1;
+}
+
 int app_ipcam_Vi_Isp_Start(void)
 {
     CVI_S32 s32Ret;
@@ -562,6 +733,16 @@ int app_ipcam_Vi_Isp_Start(void)
     }
 #endif
 
+    g_bIsp3ARun = CVI_TRUE;
+    for (CVI_U32 i = 0; i < VI_MAX_DEV_NUM; i++) {
+        g_ast3A[i].stable_ms = -1;
+    }
+    s32Ret = pthread_create(&g_Isp3APid, NULL, ISP_3A_Thread, NULL);
+    if (s32Ret != 0) {
+        APP_PROF_LOG_PRINT(LEVEL_WARN, "create isp 3A thread fail, AE/AWB start from defaults\n");
+        g_bIsp3ARun = CVI_FALSE;
+    }
+
     #ifdef SUPPORT_ISP_PQTOOL
     app_ipcam_Ispd_Load();
     #ifndef ARCH_CV183X
@@ -579,6 +760,12 @@ int app_ipcam_Vi_Isp_Stop(void)
     VI_PIPE ViPipe;
     APP_PARAM_VI_CTX_S *g_pstViCtx = app_ipcam_Vi_Param_Get();
 
+    /* The 3A thread saves the state on its way out, so it stops before the ISP */
+    if (g_bIsp3ARun) {
+        g_bIsp3ARun = CVI_FALSE;
+        pthread_join(g_Isp3APid, NULL);
+    }
+
     for (CVI_U32 i = 0; i < g_pstViCtx->u32WorkSnsCnt; i++) {
         APP_PARAM_CHN_CFG_T *pstChnCfg = &g_pstViCtx->astChnInfo[i];
         ViPipe = pstChnCfg->s32ChnId;
@@ -8,6 +8,7 @@
 #include <cvi_ae.h>
 
 #include "app_ipcam_paramparse.h"
+#include "video_slice.h"
 
 #define P_MAX_SIZE (2048 * 1024) //P oversize 512K lost it
 /**************************************************************************
@@ -94,6 +95,43 @@ static CVI_S32 app_ipcam_Venc_FrameLost_Set(VENC_CHN VencChn, APP_FRAMELOST_PARA
     return CVI_SUCCESS;
 }
 
+static CVI_S32 app_ipcam_Venc_RefParam_Set(VENC_CHN VencChn, CVI_U32 u32TemporalLayers)
+{
+    VENC_REF_PARAM_S stRefParam, *pstRefParam = &stRefParam;
+
+    APP_CHK_RET(CVI_VENC_GetRefParam(VencChn, pstRefParam), "get Ref param");
+
+    /* one base frame, then enhance frames that all reference it (video_temporal.h) */
+    pstRefParam->u32Base = 1;
+    pstRefParam->u32Enhance = (1 << (u32TemporalLayers - 1)) - 1;
+    pstRefParam->bEnablePred = CVI_FALSE;
+
+    APP_CHK_RET(CVI_VENC_SetRefParam(VencChn, pstRefParam), "set Ref param");
+
+    return CVI_SUCCESS;
+}
+
+static CVI_S32 app_ipcam_Venc_SliceSplit_Set(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, CVI_U32 u32Height, CVI_U32 u32Slices)
+{
+    if (enType == PT_H264) {
+        VENC_H264_SLICE_SPLIT_S stSliceSplit, *pstSliceSplit = &stSliceSplit;
+
+        APP_CHK_RET(CVI_VENC_GetH264SliceSplit(VencChn, pstSliceSplit), "get H264 slice split");
+        pstSliceSplit->bSplitEnable = CVI_TRUE;
+        pstSliceSplit->u32MbLineNum = video_slice_rows(u32Height, VIDEO_SLICE_H264_ROW, u32Slices);
+        APP_CHK_RET(CVI_VENC_SetH264SliceSplit(VencChn, pstSliceSplit), "set H264 slice split");
+    } else {
+        VENC_H265_SLICE_SPLIT_S stSliceSplit, *pstSliceSplit = &stSliceSplit;
+
+        APP_CHK_RET(CVI_VENC_GetH265SliceSplit(VencChn, pstSliceSplit), "get H265 slice split");
+        pstSliceSplit->bSplitEnable = CVI_TRUE;
+        pstSliceSplit->u32LcuLineNum = video_slice_rows(u32Height, VIDEO_SLICE_H265_ROW, u32Slices);
+        APP_CHK_RET(CVI_VENC_SetH265SliceSplit(VencChn, pstSliceSplit), "set H265 slice split");
+    }
+
+    return CVI_SUCCESS;
+}
+
 static CVI_S32 app_ipcam_Venc_H264Trans_Set(VENC_CHN VencChn)
 {
     VENC_H264_TRANS_S h264Trans = { 0 };
@@ -946,9 +984,12 @@ static void* Thread_Streaming_Proc(void* pArgs)
 
         // get stream
         VENC_STREAM_S stStream = { 0 };
-        stStream.pstPack = (VENC_PACK_S*)malloc(sizeof(VENC_PACK_S) * H26X_MAX_NUM_PACKS);
-        if (stStream.pstPack == NULL) {
+        VENC_PACK_S *pstPack = (VENC_PACK_S*)malloc(sizeof(VENC_PACK_S) * H26X_MAX_NUM_PACKS);
+        if (pstPack == NULL) {
             APP_PROF_LOG_PRINT(LEVEL_ERROR, "streaming malloc memory failed!\n");
+            if (pastVencChnCfg->enBindMode == VENC_BIND_DISABLE) {
+                CVI_VPSS_ReleaseChnFrame(vpssGrp, vpssChn, &stVpssFrame);
+            }
             break;
         }
 
@@ -956,36 +997,58 @@ static void* Thread_Streaming_Proc(void* pArgs)
         memset(&stExpInfo, 0, sizeof(stExpInfo));
         CVI_ISP_QueryExposureInfo(0, &stExpInfo);
         CVI_S32 timeout = (1000 * 2) / (stExpInfo.u32Fps / 100); // u32Fps = fps * 100
-        s32Ret = CVI_VENC_GetStream(VencChn, &stStream, timeout);
-        if (pastVencChnCfg->enBindMode == VENC_BIND_DISABLE) {
-            CVI_VPSS_ReleaseChnFrame(vpssGrp, vpssChn, &stVpssFrame);
-        }
-        if (s32Ret != CVI_SUCCESS || (0 == stStream.u32PackCount)) {
-            APP_PROF_LOG_PRINT(LEVEL_WARN, "CVI_VENC_GetStream, VencChn(%d) cnt(%d), s32Ret = 0x%X timeout:%d %d\n",
-                VencChn, stStream.u32PackCount, s32Ret, timeout, stExpInfo.u32Fps);
-            goto CONTINUE;
-        }
 
-        if ((1 == stStream.u32PackCount) && (stStream.pstPack[0].u32Len > P_MAX_SIZE)) {
-            APP_PROF_LOG_PRINT(LEVEL_WARN, "CVI_VENC_GetStream, VencChn(%d) p oversize:%d\n",
-                VencChn, stStream.pstPack[0].u32Len);
-        } else {
-            /* save streaming to LinkList and proc it in another thread */
-            s32Ret = app_ipcam_LList_Data_Push(&stStream, g_pDataCtx[VencChn]);
+        /* with slices the frame comes out one slice at a time, up to the pack with bFrameEnd */
+        CVI_BOOL bSlices = (pastVencChnCfg->u32Slices > 1);
+        CVI_BOOL bVpssFrame = (pastVencChnCfg->enBindMode == VENC_BIND_DISABLE);
+        CVI_BOOL bFrameEnd = CVI_FALSE;
+        do {
+            memset(&stStream, 0, sizeof(stStream));
+            stStream.pstPack = pstPack;
+            s32Ret = CVI_VENC_GetStream(VencChn, &stStream, timeout);
+            if (s32Ret != CVI_SUCCESS || (0 == stStream.u32PackCount)) {
+                APP_PROF_LOG_PRINT(LEVEL_WARN, "CVI_VENC_GetStream, VencChn(%d) cnt(%d), s32Ret = 0x%X timeout:%d %d\n",
+                    VencChn, stStream.u32PackCount, s32Ret, timeout, stExpInfo.u32Fps);
+                break;
+            }
+
+            if (bSlices) {
+                bFrameEnd = stStream.pstPack[stStream.u32PackCount - 1].bFrameEnd;
+            } else {
+                /* one stream is one frame, so handlers can always look for bFrameEnd */
+                stStream.pstPack[stStream.u32PackCount - 1].bFrameEnd = CVI_TRUE;
+                bFrameEnd = CVI_TRUE;
+            }
+            if (bVpssFrame && bFrameEnd) {
+                CVI_VPSS_ReleaseChnFrame(vpssGrp, vpssChn, &stVpssFrame);
+                bVpssFrame = CVI_FALSE;
+            }
+
+            if ((1 == stStream.u32PackCount) && (stStream.pstPack[0].u32Len > P_MAX_SIZE)) {
+                APP_PROF_LOG_PRINT(LEVEL_WARN, "CVI_VENC_GetStream, VencChn(%d) p oversize:%d\n",
+                    VencChn, stStream.pstPack[0].u32Len);
+            } else if (bSlices) {
+                /* hand the slice out now: the LList copy and its consume thread cost milliseconds */
+                _Data_Handle(&stStream, g_pDataCtx[VencChn]);
+            } else {
+                /* save streaming to LinkList and proc it in another thread */
+                s32Ret = app_ipcam_LList_Data_Push(&stStream, g_pDataCtx[VencChn]);
+                if (s32Ret != CVI_SUCCESS) {
+                    APP_PROF_LOG_PRINT(LEVEL_ERROR, "Venc %d streaming push linklist failed!\n", VencChn);
+                }
+            }
+
+            s32Ret = CVI_VENC_ReleaseStream(VencChn, &stStream);
             if (s32Ret != CVI_SUCCESS) {
-                APP_PROF_LOG_PRINT(LEVEL_ERROR, "Venc %d streaming push linklist failed!\n", VencChn);
+                APP_PROF_LOG_PRINT(LEVEL_ERROR, "CVI_VENC_ReleaseStream, s32Ret = %d\n", s32Ret);
+                break;
             }
-        }
+        } while (!bFrameEnd && pastVencChnCfg->bStart);
 
-        s32Ret = CVI_VENC_ReleaseStream(VencChn, &stStream);
-        if (s32Ret != CVI_SUCCESS) {
-            APP_PROF_LOG_PRINT(LEVEL_ERROR, "CVI_VENC_ReleaseStream, s32Ret = %d\n", s32Ret);
-            goto CONTINUE;
+        if (bVpssFrame) {
+            CVI_VPSS_ReleaseChnFrame(vpssGrp, vpssChn, &stVpssFrame);
         }
-
-    CONTINUE:
-        free(stStream.pstPack);
-        stStream.pstPack = NULL;
+        free(pstPack);
     }
 
     return (CVI_VOID*)CVI_SUCCESS;
@@ -1113,6 +1176,27 @@ int app_ipcam_Venc_Init(APP_VENC_CHN_E VencIdx)
                 APP_PROF_LOG_PRINT(LEVEL_ERROR,"Venc_%d RC frame lost control failed with 0x%x\n", VencChn, s32Ret);
                 goto VENC_EXIT1;
             }
+
+            if (pstVencChnCfg->u32TemporalLayers > 1) {
+                if (pstVencChnCfg->enGopMode != VENC_GOPMODE_NORMALP) {
+                    APP_PROF_LOG_PRINT(LEVEL_WARN, "Venc_%d temporal layers need normal P gop mode, ignored\n", VencChn);
+                    pstVencChnCfg->u32TemporalLayers = 1;
+                } else {
+                    s32Ret = app_ipcam_Venc_RefParam_Set(VencChn, pstVencChnCfg->u32TemporalLayers);
+                    if (s32Ret != CVI_SUCCESS) {
+                        APP_PROF_LOG_PRINT(LEVEL_ERROR,"Venc_%d temporal layers set failed with 0x%x\n", VencChn, s32Ret);
+                        goto VENC_EXIT1;
+                    }
+                }
+            }
+
+            if (pstVencChnCfg->u32Slices > 1) {
+                s32Ret = app_ipcam_Venc_SliceSplit_Set(VencChn, enCodecType, pstVencChnCfg->u32Height, pstVencChnCfg->u32Slices);
+                if (s32Ret != CVI_SUCCESS) {
+                    APP_PROF_LOG_PRINT(LEVEL_ERROR,"Venc_%d slice split set failed with 0x%x\n", VencChn, s32Ret);
+                    goto VENC_EXIT1;
+                }
+            }
         } else if (enCodecType == PT_JPEG) {
             s32Ret = app_ipcam_Venc_Jpeg_Param_Set(VencChn, &pstVencChnCfg->stJpegCodecParam);
                 if (s32Ret != CVI_SUCCESS) {
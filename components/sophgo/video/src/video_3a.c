@@ -0,0 +1,219 @@
+/**
+ * @file video_3a.c
+ * @brief Persisted AE/AWB state and seeding the ISP with it
+ */
+
+/* fileno() and fsync() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "video_3a.h"
+
+static uint32_t crc32(const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t crc     = 0xFFFFFFFF;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static double exposure(const video_3a_sample_t* s) {
+    /* Gains multiply, so their units cancel out in a ratio */
+    return (double)s->exp_time_us * (s->again ? s->again : 1) * (s->dgain ? s->dgain : 1) *
+           (s->isp_dgain ? s->isp_dgain : 1);
+}
+
+uint32_t video_3a_key(uint32_t sensor, uint32_t width, uint32_t height, uint32_t wdr) {
+    uint32_t fields[4] = {sensor, width, height, wdr};
+
+    return crc32(fields, sizeof(fields));
+}
+
+int video_3a_load(const char* path, uint32_t key, video_3a_sample_t* sample) {
+    video_3a_state_t state;
+    FILE* fp = fopen(path, "rb");
+
+    if (fp == NULL) {
+        return -1;
+    }
+    size_t len = fread(&state, 1, sizeof(state), fp);
+    fclose(fp);
+
+    if (len != sizeof(state) || state.magic != VIDEO_3A_MAGIC || state.version != VIDEO_3A_VERSION ||
+        state.size != sizeof(state) || state.crc != crc32(&state, offsetof(video_3a_state_t, crc)) ||
+        state.key != key) {
+        return -1;
+    }
+    *sample = state.sample;
+    return 0;
+}
+
+int video_3a_save(const char* path, uint32_t key, const video_3a_sample_t* sample) {
+    video_3a_state_t state;
+    char tmp[256];
+
+    memset(&state, 0, sizeof(state));
+    state.magic   = VIDEO_3A_MAGIC;
+    state.version = VIDEO_3A_VERSION;
+    state.size    = sizeof(state);
+    state.key     = key;
+    state.sample  = *sample;
+    state.crc     = crc32(&state, offsetof(video_3a_state_t, crc));
+
+    /* A power cut leaves either the old state or the new one */
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    FILE* fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        return -1;
+    }
+    if (fwrite(&state, sizeof(state), 1, fp) != 1 || fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(fp);
+    if (rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+bool video_3a_differs(const video_3a_sample_t* a, const video_3a_sample_t* b, double share, uint32_t color_temp) {
+    double ea = exposure(a);
+    double eb = exposure(b);
+    int ct    = (int)a->color_temp - (int)b->color_temp;
+
+    if (ea > eb * (1 + share) || eb > ea * (1 + share)) {
+        return true;
+    }
+    return (uint32_t)(ct < 0 ? -ct : ct) > color_temp;
+}
+
+static bool scene_matches(const video_3a_sample_t* saved, uint16_t luma) {
+    /* A clipped luma says little about how much brighter it is */
+    if (luma >= VIDEO_3A_LUMA_CLIPPED && saved->luma < VIDEO_3A_LUMA_CLIPPED) {
+        return false;
+    }
+    return (uint32_t)luma * VIDEO_3A_SCENE_RATIO >= saved->luma && luma <= (uint32_t)saved->luma * VIDEO_3A_SCENE_RATIO;
+}
+
+int video_3a_start(video_3a_t* a, const video_3a_isp_t* isp, const char* path, uint32_t key, uint64_t now_ms) {
+    memset(a, 0, sizeof(*a));
+    a->isp           = *isp;
+    a->path          = path;
+    a->key           = key;
+    a->start_ms      = now_ms;
+    a->held_since_ms = now_ms;
+    a->stable_ms     = -1;
+
+    if (isp->query(isp->ctx, &a->defaults) != 0) {
+        return -1;
+    }
+    a->held = a->defaults;
+
+    if (video_3a_load(path, key, &a->saved) == 0 && a->saved.luma > 0) {
+        a->has_saved = true;
+        if (isp->set_manual(isp->ctx, &a->saved) == 0) {
+            a->held    = a->saved;
+            a->seeded  = true;
+            a->phase   = VIDEO_3A_SEEDING;
+            a->seed_ms = now_ms;
+        }
+    }
+    return 0;
+}
+
+int video_3a_poll(video_3a_t* a, uint64_t now_ms) {
+    video_3a_sample_t sample;
+    int flags = 0;
+
+    if (a->isp.query(a->isp.ctx, &sample) != 0) {
+        return 0;
+    }
+
+    switch (a->phase) {
+        case VIDEO_3A_SEEDING:
+            if (now_ms - a->seed_ms < VIDEO_3A_SEED_CHECK_MS) {
+                return 0;
+            }
+            /* Under the saved exposure the scene should look as it did when it was saved */
+            if (!scene_matches(&a->saved, sample.luma)) {
+                a->isp.set_manual(a->isp.ctx, &a->defaults);
+                a->phase         = VIDEO_3A_FALLBACK;
+                a->dropped       = true;
+                a->held          = sample;
+                a->held_since_ms = now_ms;
+                return VIDEO_3A_SEED_DROPPED;
+            }
+            /* Held since the start, when auto leaves it where it is */
+            a->isp.set_auto(a->isp.ctx);
+            a->phase = VIDEO_3A_AUTO;
+            flags |= VIDEO_3A_SEED_KEPT;
+            break;
+
+        case VIDEO_3A_FALLBACK:
+            a->isp.set_auto(a->isp.ctx);
+            a->phase         = VIDEO_3A_AUTO;
+            a->held          = sample;
+            a->held_since_ms = now_ms;
+            return 0;
+
+        default:
+            break;
+    }
+
+    if (video_3a_differs(&sample, &a->held, VIDEO_3A_STABLE_EXPOSURE, VIDEO_3A_STABLE_CT)) {
+        a->held          = sample;
+        a->held_since_ms = now_ms;
+        a->stable        = false;
+    } else if (now_ms - a->held_since_ms >= VIDEO_3A_STABLE_MS) {
+        if (a->stable_ms < 0) {
+            a->stable_ms = (int32_t)(a->held_since_ms - a->start_ms);
+            flags |= VIDEO_3A_STABLE;
+        }
+        a->stable = true;
+    }
+
+    /* Saved when it moved, and not more often than VIDEO_3A_SAVE_MS to spare the flash */
+    if (a->stable && (!a->has_saved || video_3a_differs(&sample, &a->saved, VIDEO_3A_SAVE_EXPOSURE, VIDEO_3A_SAVE_CT)) &&
+        (a->save_ms == 0 || now_ms - a->save_ms >= VIDEO_3A_SAVE_MS)) {
+        a->save_ms = now_ms;
+        if (video_3a_save(a->path, a->key, &sample) == 0) {
+            a->saved     = sample;
+            a->has_saved = true;
+            a->saves++;
+            flags |= VIDEO_3A_SAVED;
+        }
+    }
+    return flags;
+}
+
+int video_3a_stop(video_3a_t* a) {
+    video_3a_sample_t sample;
+
+    if (!a->stable || a->isp.query(a->isp.ctx, &sample) != 0) {
+        return 0;
+    }
+    if (a->has_saved && !video_3a_differs(&sample, &a->saved, VIDEO_3A_SAVE_EXPOSURE, VIDEO_3A_SAVE_CT)) {
+        return 0;
+    }
+    if (video_3a_save(a->path, a->key, &sample) != 0) {
+        return 0;
+    }
+    a->saved     = sample;
+    a->has_saved = true;
+    a->saves++;
+    return VIDEO_3A_SAVED;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file video_slice.c
+ * @brief Slice rows and frame boundaries of sliced streams
+ */
+
+#include "video_slice.h"
+
+uint32_t video_slice_rows(uint32_t height, uint32_t row, uint32_t slices) {
+    uint32_t rows = (height + row - 1) / row;
+
+    if (slices < 1) {
+        slices = 1;
+    }
+    rows = (rows + slices - 1) / slices;
+    return rows > 0 ? rows : 1;
+}
+
+void video_slice_tracker_init(video_slice_tracker_t* tracker) {
+    *tracker = (video_slice_tracker_t){0};
+}
+
+static void close_frame(video_slice_tracker_t* tracker) {
+    tracker->last_slices = tracker->slices;
+    tracker->last_size   = tracker->size;
+    tracker->open        = false;
+    tracker->frames++;
+}
+
+int video_slice_begin(video_slice_tracker_t* tracker, uint64_t pts) {
+    int flags = 0;
+
+    if (tracker->open) {
+        if (pts == tracker->pts) {
+            return 0;
+        }
+        close_frame(tracker);
+        tracker->unterminated++;
+        flags |= VIDEO_SLICE_CLOSED;
+    }
+
+    tracker->open   = true;
+    tracker->pts    = pts;
+    tracker->slices = 0;
+    tracker->size   = 0;
+    return flags | VIDEO_SLICE_START;
+}
+
+int video_slice_end(video_slice_tracker_t* tracker, uint32_t size, bool last) {
+    tracker->slices++;
+    tracker->size += size;
+    if (!last) {
+        return 0;
+    }
+    close_frame(tracker);
+    return VIDEO_SLICE_END;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file video_temporal.c
+ * @brief Temporal layer ids and per-client layer selection
+ */
+
+#include "video_temporal.h"
+
+static uint8_t clamp_layers(uint8_t layers) {
+    if (layers < 1) {
+        return 1;
+    }
+    return layers > VIDEO_TEMPORAL_LAYERS_MAX ? VIDEO_TEMPORAL_LAYERS_MAX : layers;
+}
+
+uint8_t video_temporal_id(uint8_t layers, uint32_t position) {
+    uint32_t period;
+    uint8_t id;
+
+    layers = clamp_layers(layers);
+    period = 1u << (layers - 1);
+    position &= period - 1;
+    if (position == 0) {
+        return 0;
+    }
+
+    /* Halfway between two base frames is layer 1, a quarter of the way layer 2 */
+    id = layers - 1;
+    while ((position & 1) == 0) {
+        position >>= 1;
+        id--;
+    }
+    return id;
+}
+
+uint8_t video_temporal_next(uint8_t layers, video_temporal_position_t* position, bool keyframe, uint64_t pts) {
+    if (position->last_pts != 0) {
+        uint64_t interval = pts - position->last_pts;
+
+        if (pts <= position->last_pts) {
+            position->frames = VIDEO_TEMPORAL_LOST;
+        } else if (position->interval != 0 && interval > position->interval + position->interval / 2) {
+            /* A lost frame, or a lower frame rate, which the interval follows within a few frames */
+            position->frames = VIDEO_TEMPORAL_LOST;
+            position->interval += (interval - position->interval) / 8;
+        } else {
+            position->interval = interval;
+        }
+    }
+    position->last_pts = pts;
+
+    if (keyframe) {
+        position->frames = 0;
+    }
+    if (position->frames == VIDEO_TEMPORAL_LOST) {
+        return 0;
+    }
+    return video_temporal_id(layers, position->frames++);
+}
+
+void video_temporal_selector_init(video_temporal_selector_t* selector, uint8_t layers) {
+    *selector            = (video_temporal_selector_t){0};
+    selector->layers     = clamp_layers(layers);
+    selector->max_id     = selector->layers - 1;
+    selector->target_id  = selector->max_id;
+    selector->recover_ms = VIDEO_TEMPORAL_RECOVER_MS;
+}
+
+bool video_temporal_select(video_temporal_selector_t* selector, uint8_t temporal_id, bool keyframe,
+                           uint32_t size, size_t backlog, uint64_t now_ms) {
+    size_t frames;
+
+    /* Keyframes would make the average swing with the GOP */
+    if (keyframe) {
+        selector->key_bytes = size;
+    } else if (selector->frame_bytes == 0) {
+        selector->frame_bytes = size;
+    } else {
+        selector->frame_bytes += ((int64_t)size - selector->frame_bytes) / 16;
+    }
+    backlog = backlog > selector->key_bytes ? backlog - selector->key_bytes : 0;
+    frames  = backlog / (selector->frame_bytes ? selector->frame_bytes : (size ? size : 1));
+
+    if (frames > VIDEO_TEMPORAL_CLEAR_FRAMES) {
+        selector->clear_since_ms = now_ms;
+    }
+
+    /* Shed the top layer, or give up a pending addition first */
+    if (frames > VIDEO_TEMPORAL_SHED_FRAMES && (selector->target_id > 0) &&
+        (selector->shed_ms == 0 || now_ms - selector->shed_ms >= VIDEO_TEMPORAL_SHED_HOLD_MS)) {
+        if (selector->target_id > selector->max_id) {
+            selector->target_id = selector->max_id;
+        } else {
+            selector->target_id = --selector->max_id;
+        }
+        /* The layer added last did not hold: wait longer next time */
+        if (selector->added_ms != 0 && now_ms - selector->added_ms < selector->recover_ms) {
+            selector->recover_ms *= 2;
+            if (selector->recover_ms > VIDEO_TEMPORAL_RECOVER_MAX_MS) {
+                selector->recover_ms = VIDEO_TEMPORAL_RECOVER_MAX_MS;
+            }
+        }
+        selector->shed_ms = now_ms;
+    }
+
+    /* Add a layer back after the backlog stayed clear */
+    if (selector->target_id == selector->max_id && selector->max_id + 1 < selector->layers &&
+        !selector->need_keyframe && now_ms - selector->clear_since_ms >= selector->recover_ms) {
+        selector->target_id++;
+        selector->clear_since_ms = now_ms;
+        if (now_ms - selector->shed_ms >= VIDEO_TEMPORAL_RECOVER_MAX_MS) {
+            selector->recover_ms = VIDEO_TEMPORAL_RECOVER_MS;
+        }
+    }
+
+    /* Without the base layer the stream only decodes again from a keyframe */
+    if (selector->need_keyframe) {
+        if (!keyframe || frames > VIDEO_TEMPORAL_SHED_FRAMES) {
+            selector->dropped++;
+            return false;
+        }
+        selector->need_keyframe = false;
+    } else if (frames > VIDEO_TEMPORAL_DROP_FRAMES) {
+        if (temporal_id == 0) {
+            selector->need_keyframe = true;
+            selector->keyframe_waits++;
+            selector->dropped++;
+        } else {
+            selector->shed++;
+        }
+        return false;
+    }
+
+    /* Add at a base frame: the frames above it reference only that one */
+    if (temporal_id == 0 && selector->target_id > selector->max_id) {
+        selector->max_id   = selector->target_id;
+        selector->added_ms = now_ms;
+    }
+
+    if (temporal_id > selector->max_id) {
+        selector->shed++;
+        return false;
+    }
+    selector->sent++;
+    return true;
+}
@@ -142,6 +142,84 @@ int registerVideoFrameHandler(video_ch_index_t ch, int index, pfpDataConsumes ha
     return 0;
 }
 
+int setVideoTemporalLayers(video_ch_index_t ch, uint8_t layers) {
+    APP_PARAM_VENC_CTX_S* venc = app_ipcam_Venc_Param_Get();
+
+    if (ch >= venc->s32VencChnCnt) {
+        APP_PROF_LOG_PRINT(LEVEL_ERROR, "ch(%d) > u32ChnCnt(%d)\n", ch, venc->s32VencChnCnt);
+        return -1;
+    }
+    if (layers < 1 || layers > VIDEO_TEMPORAL_LAYERS_MAX) {
+        APP_PROF_LOG_PRINT(LEVEL_ERROR, "video ch(%d) temporal layers(%d) is not support\n", ch, layers);
+        return -1;
+    }
+
+    APP_VENC_CHN_CFG_S* pvchn = &venc->astVencChnCfg[ch];
+    if ((pvchn->enType != PT_H264) && (pvchn->enType != PT_H265)) {
+        APP_PROF_LOG_PRINT(LEVEL_ERROR, "video ch(%d) temporal layers need H.264 or H.265\n", ch);
+        return -1;
+    }
+    pvchn->u32TemporalLayers = layers;
+
+    return 0;
+}
+
+int getVideoTemporalLayers(video_ch_index_t ch) {
+    APP_PARAM_VENC_CTX_S* venc = app_ipcam_Venc_Param_Get();
+
+    if (ch >= venc->s32VencChnCnt || venc->astVencChnCfg[ch].u32TemporalLayers < 1) {
+        return 1;
+    }
+    return venc->astVencChnCfg[ch].u32TemporalLayers;
+}
+
+int setVideoSlices(video_ch_index_t ch, uint8_t slices) {
+    APP_PARAM_VENC_CTX_S* venc = app_ipcam_Venc_Param_Get();
+
+    if (ch >= venc->s32VencChnCnt) {
+        APP_PROF_LOG_PRINT(LEVEL_ERROR, "ch(%d) > u32ChnCnt(%d)\n", ch, venc->s32VencChnCnt);
+        return -1;
+    }
+    if (slices < 1 || slices > VIDEO_SLICES_MAX) {
+        APP_PROF_LOG_PRINT(LEVEL_ERROR, "video ch(%d) slices(%d) is not support\n", ch, slices);
+        return -1;
+    }
+
+    APP_VENC_CHN_CFG_S* pvchn = &venc->astVencChnCfg[ch];
+    if ((pvchn->enType != PT_H264) && (pvchn->enType != PT_H265)) {
+        APP_PROF_LOG_PRINT(LEVEL_ERROR, "video ch(%d) slices need H.264 or H.265\n", ch);
+        return -1;
+    }
+    pvchn->u32Slices = slices;
+
+    return 0;
+}
+
+int getVideoSlices(video_ch_index_t ch) {
+    APP_PARAM_VENC_CTX_S* venc = app_ipcam_Venc_Param_Get();
+
+    if (ch >= venc->s32VencChnCnt || venc->astVencChnCfg[ch].u32Slices < 1) {
+        return 1;
+    }
+    return venc->astVencChnCfg[ch].u32Slices;
+}
+
+uint64_t getVideoPts(void) {
+    CVI_U64 u64Pts = 0;
+
+    CVI_SYS_GetCurPTS(&u64Pts);
+    return u64Pts;
+}
+
+int getVideoExposureStableMs(void) {
+    APP_PARAM_VI_CTX_S* vi = app_ipcam_Vi_Param_Get();
+
+    if (vi->u32WorkSnsCnt < 1) {
+        return -1;
+    }
+    return app_ipcam_Isp_StableTime_Get(vi->astChnInfo[0].s32ChnId);
+}
+
 int setVideoMirror(bool mirror) {
     video_mirror = mirror;
 }
@@ -6,6 +6,8 @@ extern "C" {
 #endif
 
 #include "app_ipcam_paramparse.h"
+#include "video_slice.h"
+#include "video_temporal.h"
 
 typedef enum {
     VIDEO_FORMAT_RGB888 = 0, // no need venc
@@ -50,6 +52,18 @@ int getVideoMirror();
 int getVideoFlip();
 int setupVideo(video_ch_index_t ch, const video_ch_param_t* param);
 int registerVideoFrameHandler(video_ch_index_t ch, int index, pfpDataConsumes handler, void* pUserData);
+// Temporal layers of an H.264/H.265 channel, set after setupVideo() and before startVideo()
+int setVideoTemporalLayers(video_ch_index_t ch, uint8_t layers);
+int getVideoTemporalLayers(video_ch_index_t ch);
+// Slices per frame of an H.264/H.265 channel, set after setupVideo() and before startVideo().
+// With more than one slice the handlers are called once per slice, on the encoder thread.
+int setVideoSlices(video_ch_index_t ch, uint8_t slices);
+int getVideoSlices(video_ch_index_t ch);
+// Current time on the clock of VENC_PACK_S.u64PTS, in microseconds
+uint64_t getVideoPts(void);
+// Time from ISP start to stable exposure in ms, -1 until then. Starts are faster with a
+// saved AE/AWB state of the sensor in /mnt/data, see video_3a.h
+int getVideoExposureStableMs(void);
 
 #ifdef __cplusplus
 }
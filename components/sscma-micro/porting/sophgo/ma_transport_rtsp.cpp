@@ -28,20 +28,21 @@ ma_err_t TransportRTSP::init(const void* config) noexcept {
     ma_err_t ret;
     Guard guard(m_mutex);
 
-    // only support H264
-    if (m_format != MA_PIXEL_FORMAT_H264) {
-        return MA_ENOTSUP;
-    }
-
     const Config* rtsp_config = reinterpret_cast<const Config*>(config);
-    m_port                    = rtsp_config->port;
-    m_format                  = rtsp_config->format;
-    m_name                    = rtsp_config->session;
 
     if (m_initialized) {
         return MA_EBUSY;
     }
 
+    // The server packetises H.264 and H.265 (RFC 6184 / RFC 7798)
+    if (rtsp_config->format != MA_PIXEL_FORMAT_H264 && rtsp_config->format != MA_PIXEL_FORMAT_H265) {
+        return MA_ENOTSUP;
+    }
+
+    m_port   = rtsp_config->port;
+    m_format = rtsp_config->format;
+    m_name   = rtsp_config->session;
+
     m_user = rtsp_config->user;
     m_pass = rtsp_config->pass;
 
@@ -0,0 +1,591 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "talkback_internal.h"
+
+#define JITTER_QUANTILE 0.97f
+#define MARGIN_US       2000  // Added to the jitter for the target delay
+#define SLACK_US        5000  // Delay error tolerated before stretching or shrinking
+#define ADJUST_BLOCKS   3     // Blocks between adjustments while speech plays
+#define QUIET_RMS       200   // Below this, every block may be adjusted
+#define HISTORY_MS      40
+#define CONCEAL_HOLD_MS 10    // Concealment plays at full level for this long,
+#define CONCEAL_FADE_MS 50    // then fades to silence over this
+#define IDLE_MS         500   // An empty buffer this long ends the talk spurt
+
+// Pitch periods searched for concealment and time scaling, 2.5 to 15 ms
+#define LAG_MIN(rate) ((rate) / 400)
+#define LAG_MAX(rate) ((rate) * 15 / 1000)
+
+static inline int32_t ts_diff(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b);
+}
+
+static inline int64_t frames_to_us(const talkback_t* tb, int64_t frames)
+{
+    return frames * 1000000 / tb->rate;
+}
+
+static inline int64_t us_to_frames(const talkback_t* tb, int64_t us)
+{
+    return us * tb->rate / 1000000;
+}
+
+static inline int16_t blend(int16_t a, int16_t b, float w)
+{
+    return (int16_t)lrintf(a + (b - a) * w);
+}
+
+void talkback_jitter_free(talkback_t* tb)
+{
+    free(tb->ring);
+    free(tb->valid);
+    free(tb->history);
+    free(tb->cycle);
+    free(tb->work);
+    free(tb->pcm);
+    free(tb->fifo);
+    if (tb->resampler)
+        audio_resampler_destroy(tb->resampler);
+
+    tb->ring = NULL;
+    tb->valid = NULL;
+    tb->history = NULL;
+    tb->cycle = NULL;
+    tb->work = NULL;
+    tb->pcm = NULL;
+    tb->fifo = NULL;
+    tb->resampler = NULL;
+    tb->rate = 0;
+}
+
+int talkback_jitter_setup(talkback_t* tb, unsigned int rate)
+{
+    unsigned int period_ms = tb->config.period_ms > 10 ? tb->config.period_ms : 10;
+    size_t frames = (size_t)rate * (tb->config.max_delay_ms + 1000) / 1000;
+    size_t size = 1;
+
+    talkback_jitter_free(tb);
+
+    while (size < frames)
+        size <<= 1;
+
+    tb->rate = rate;
+    tb->block = rate * period_ms / 1000;
+    tb->mask = (uint32_t)size - 1;
+    tb->history_len = rate * HISTORY_MS / 1000;
+    tb->ring = malloc(size * sizeof(*tb->ring));
+    tb->valid = calloc(size, 1);
+    tb->history = calloc(tb->history_len, sizeof(*tb->history));
+    tb->cycle = malloc(LAG_MAX(rate) * sizeof(*tb->cycle));
+    tb->work = malloc((LAG_MAX(rate) * 2 + tb->block) * sizeof(*tb->work));
+
+    if (rate != tb->config.rate) {
+        tb->resampler = audio_resampler_create(rate, tb->config.rate, 1);
+        tb->fifo_size = tb->resampler ? audio_resampler_max_out(tb->resampler, tb->block) : 0;
+    } else {
+        tb->fifo_size = tb->block;
+    }
+    tb->pcm = malloc(tb->block * sizeof(*tb->pcm));
+    tb->fifo = malloc(tb->fifo_size * sizeof(*tb->fifo));
+
+    if (!tb->ring || !tb->valid || !tb->history || !tb->cycle || !tb->work || !tb->pcm || !tb->fifo
+        || (rate != tb->config.rate && !tb->resampler)) {
+        talkback_jitter_free(tb);
+        return -1;
+    }
+
+    talkback_jitter_reset(tb);
+    return 0;
+}
+
+void talkback_jitter_reset(talkback_t* tb)
+{
+    tb->state = TALKBACK_IDLE;
+    tb->concealing = 0;
+    tb->fifo_pos = 0;
+    tb->fifo_len = 0;
+    if (tb->resampler)
+        audio_resampler_reset(tb->resampler);
+}
+
+static unsigned int valid_run(const talkback_t* tb, uint32_t ts, unsigned int max)
+{
+    unsigned int n = 0;
+
+    while (n < max && tb->valid[(ts + n) & tb->mask])
+        n++;
+    return n;
+}
+
+static void ring_peek(const talkback_t* tb, int16_t* out, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+        out[i] = tb->ring[(tb->play_ts + i) & tb->mask];
+}
+
+static void ring_skip(talkback_t* tb, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+        tb->valid[(tb->play_ts + i) & tb->mask] = 0;
+    tb->play_ts += n;
+}
+
+static void history_append(talkback_t* tb, const int16_t* in, unsigned int n)
+{
+    unsigned int len = tb->history_len;
+
+    if (n >= len) {
+        memcpy(tb->history, in + n - len, len * sizeof(*in));
+    } else {
+        memmove(tb->history, tb->history + n, (len - n) * sizeof(*in));
+        memcpy(tb->history + len - n, in, n * sizeof(*in));
+    }
+}
+
+/*
+ * The lag in [lo, hi] at which x[i + step * lag] best matches x[i] over
+ * len samples, by cross-correlation normalised by the lagged energy.
+ */
+static unsigned int best_lag(const int16_t* x, int step, unsigned int len, unsigned int lo, unsigned int hi)
+{
+    unsigned int best = lo;
+    float best_score = -INFINITY;
+
+    for (unsigned int k = lo; k <= hi; k++) {
+        const int16_t* y = x + (ptrdiff_t)step * k;
+        float xy = 0.0f;
+        float yy = 0.0f;
+
+        for (unsigned int i = 0; i < len; i++) {
+            xy += (float)x[i] * y[i];
+            yy += (float)y[i] * y[i];
+        }
+        float score = yy > 0.0f ? xy / sqrtf(yy) : 0.0f;
+        if (score > best_score) {
+            best_score = score;
+            best = k;
+        }
+    }
+    return best;
+}
+
+/*
+ * Concealment repeats the last pitch cycle, as in G.711 Appendix I. The
+ * end of the cycle is blended into the samples before its start, so that
+ * it repeats without a click.
+ */
+static void conceal_start(talkback_t* tb)
+{
+    const int16_t* h = tb->history + tb->history_len;
+    unsigned int window = tb->rate / 100;
+    unsigned int lag = best_lag(h - window, -1, window, LAG_MIN(tb->rate), LAG_MAX(tb->rate));
+    unsigned int fade = lag / 4;
+
+    for (unsigned int i = 0; i < lag; i++)
+        tb->cycle[i] = h[(int)i - (int)lag];
+    for (unsigned int i = lag - fade; i < lag; i++)
+        tb->cycle[i] = blend(tb->cycle[i], h[(int)i - 2 * (int)lag], (float)(i - (lag - fade) + 1) / (fade + 1));
+
+    tb->cycle_len = lag;
+    tb->cycle_pos = 0;
+    tb->conceal_run = 0;
+    tb->concealing = 1;
+}
+
+static int conceal_faded(const talkback_t* tb)
+{
+    return tb->conceal_run >= tb->rate * (CONCEAL_HOLD_MS + CONCEAL_FADE_MS) / 1000;
+}
+
+static void conceal_next(talkback_t* tb, int16_t* out, unsigned int n)
+{
+    unsigned int hold = tb->rate * CONCEAL_HOLD_MS / 1000;
+    unsigned int fade = tb->rate * CONCEAL_FADE_MS / 1000;
+
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int run = tb->conceal_run + i;
+        float gain = run < hold ? 1.0f : run >= hold + fade ? 0.0f : 1.0f - (float)(run - hold) / fade;
+
+        out[i] = (int16_t)lrintf(tb->cycle[tb->cycle_pos] * gain);
+        if (++tb->cycle_pos == tb->cycle_len)
+            tb->cycle_pos = 0;
+    }
+    tb->conceal_run += n;
+}
+
+static void update_target(talkback_t* tb, int64_t transit)
+{
+    int64_t sorted[TALKBACK_WINDOW];
+    int64_t jitter;
+    unsigned int n, i, j;
+
+    tb->transit[tb->transit_pos] = transit;
+    tb->transit_pos = (tb->transit_pos + 1) % TALKBACK_WINDOW;
+    if (tb->transit_count < TALKBACK_WINDOW)
+        tb->transit_count++;
+    n = tb->transit_count;
+
+    tb->transit_min = tb->transit[0];
+    for (i = 1; i < n; i++) {
+        if (tb->transit[i] < tb->transit_min)
+            tb->transit_min = tb->transit[i];
+    }
+
+    // Insertion sort; the window is small and a packet arrives every few ms
+    for (i = 0; i < n; i++) {
+        jitter = tb->transit[i] - tb->transit_min;
+        for (j = i; j > 0 && sorted[j - 1] > jitter; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = jitter;
+    }
+    tb->jitter_us = sorted[(unsigned int)(JITTER_QUANTILE * (n - 1))];
+
+    tb->target_us = tb->jitter_us + MARGIN_US;
+    if (tb->target_us < (int64_t)tb->config.min_delay_ms * 1000)
+        tb->target_us = (int64_t)tb->config.min_delay_ms * 1000;
+    if (tb->target_us > (int64_t)tb->config.max_delay_ms * 1000)
+        tb->target_us = (int64_t)tb->config.max_delay_ms * 1000;
+}
+
+static void start_spurt(talkback_t* tb, const talkback_packet_t* pkt, uint64_t arrival_us)
+{
+    tb->state = TALKBACK_BUFFERING;
+    tb->play_ts = pkt->timestamp;
+    tb->end_ts = pkt->timestamp;
+    tb->ref_ts = pkt->timestamp;
+    tb->ref_us = arrival_us;
+    tb->next_seq = pkt->seq;
+    tb->packet_frames = 0;
+    tb->transit_count = 0;
+    tb->transit_pos = 0;
+    tb->idle_run = 0;
+    tb->since_adjust = 0;
+    tb->concealing = 0;
+    tb->anchor_us = 0;
+    memset(tb->valid, 0, tb->mask + 1);
+    tb->stats.spurts++;
+}
+
+int talkback_jitter_push(talkback_t* tb, const talkback_packet_t* pkt, uint64_t arrival_us)
+{
+    const int16_t* samples = tb->decoded;
+    size_t n, frames, fresh = 0;
+    int32_t offset;
+    int16_t gap;
+
+    if (pkt->rate != tb->rate) {
+        // The rate may only change between talk spurts
+        if (tb->state != TALKBACK_IDLE || talkback_jitter_setup(tb, pkt->rate)) {
+            tb->stats.invalid++;
+            return -1;
+        }
+    }
+
+    n = talkback_decode(pkt->codec, pkt->payload, pkt->size, tb->decoded);
+    if (n == 0 || n % pkt->channels) {
+        tb->stats.invalid++;
+        return -1;
+    }
+    frames = n / pkt->channels;
+    if (pkt->channels > 1) {
+        audio_mix_s16(tb->decoded, pkt->channels, tb->mixed, 1, frames);
+        samples = tb->mixed;
+    }
+
+    if (tb->state == TALKBACK_IDLE)
+        start_spurt(tb, pkt, arrival_us);
+
+    gap = (int16_t)(pkt->seq - tb->next_seq);
+    if (gap > 0)
+        tb->stats.lost += gap;
+    else if (gap < 0 && tb->stats.lost > 0)
+        tb->stats.lost--;
+    if (gap >= 0)
+        tb->next_seq = pkt->seq + 1;
+
+    /*
+     * A packet is sent once its last frame is captured, so transit is
+     * measured from its end, and a short packet doesn't look early. Late
+     * packets are measured too; they are what the target must cover.
+     */
+    if (frames > tb->packet_frames)
+        tb->packet_frames = (unsigned int)frames;
+    update_target(tb, (int64_t)(arrival_us - tb->ref_us)
+            - frames_to_us(tb, ts_diff(pkt->timestamp + (uint32_t)frames, tb->ref_ts)));
+
+    offset = ts_diff(pkt->timestamp, tb->play_ts);
+    if (offset + (int64_t)frames <= 0 || offset + (int64_t)frames > (int64_t)tb->mask + 1) {
+        tb->stats.late++;
+        return 0;
+    }
+
+    for (size_t i = offset < 0 ? (size_t)-offset : 0; i < frames; i++) {
+        uint32_t index = (pkt->timestamp + (uint32_t)i) & tb->mask;
+
+        fresh += !tb->valid[index];
+        tb->valid[index] = 1;
+        tb->ring[index] = samples[i];
+    }
+    if (!fresh) {
+        tb->stats.duplicate++;
+        return 0;
+    }
+
+    if (ts_diff(pkt->timestamp + (uint32_t)frames, tb->end_ts) > 0)
+        tb->end_ts = pkt->timestamp + (uint32_t)frames;
+    if (pkt->capture_us) {
+        tb->anchor_ts = pkt->timestamp;
+        tb->anchor_us = pkt->capture_us;
+    }
+    tb->stats.packets++;
+
+    return 0;
+}
+
+// Plays a block with the frame period shortened by one pitch cycle
+static int shrink(talkback_t* tb, int16_t* out, int64_t excess)
+{
+    unsigned int n = tb->block;
+    unsigned int fade = n / 4;
+    unsigned int lo = LAG_MIN(tb->rate);
+    unsigned int hi = LAG_MAX(tb->rate);
+    unsigned int avail, lag;
+
+    if (excess < hi)
+        hi = (unsigned int)excess;
+    if (hi < lo)
+        return 0;
+    avail = valid_run(tb, tb->play_ts, n + hi);
+    if (avail < n + lo)
+        return 0;
+    if (hi > avail - n)
+        hi = avail - n;
+
+    ring_peek(tb, tb->work, n + hi);
+    lag = best_lag(tb->work, 1, fade, lo, hi);
+
+    for (unsigned int i = 0; i < fade; i++)
+        out[i] = blend(tb->work[i], tb->work[i + lag], (float)(i + 1) / (fade + 1));
+    memcpy(out + fade, tb->work + fade + lag, (n - fade) * sizeof(*out));
+
+    ring_skip(tb, n + lag);
+    tb->stats.frames += n;
+    tb->stats.shrunk += lag;
+    return 1;
+}
+
+// Plays a block that repeats the last pitch cycle played
+static int stretch(talkback_t* tb, int16_t* out, int64_t shortfall)
+{
+    unsigned int n = tb->block;
+    unsigned int fade = n / 4;
+    unsigned int lo = LAG_MIN(tb->rate);
+    unsigned int hi = LAG_MAX(tb->rate);
+    unsigned int avail, lag;
+    int16_t* s = tb->work + LAG_MAX(tb->rate);
+
+    if (shortfall < hi)
+        hi = (unsigned int)shortfall;
+    if (hi > n - fade)
+        hi = n - fade;
+    avail = valid_run(tb, tb->play_ts, n - lo);
+    if (hi < lo || avail < n - hi)
+        return 0;
+    if (lo < n - avail)
+        lo = n - avail;
+
+    memcpy(tb->work, tb->history + tb->history_len - LAG_MAX(tb->rate), LAG_MAX(tb->rate) * sizeof(*s));
+    ring_peek(tb, s, avail);
+    lag = best_lag(s, -1, fade, lo, hi);
+
+    for (unsigned int i = 0; i < fade; i++)
+        out[i] = blend(s[i], s[(int)i - (int)lag], (float)(i + 1) / (fade + 1));
+    memcpy(out + fade, s + fade - lag, (n - fade) * sizeof(*out));
+
+    ring_skip(tb, n - lag);
+    tb->stats.frames += n - lag;
+    tb->stats.stretched += lag;
+    return 1;
+}
+
+static void play(talkback_t* tb, int16_t* out, int64_t excess)
+{
+    unsigned int n = tb->block;
+    unsigned int done = 0;
+
+    while (done < n) {
+        unsigned int avail = valid_run(tb, tb->play_ts, n - done);
+        unsigned int hole;
+        int32_t ahead;
+
+        if (avail) {
+            for (unsigned int i = 0; i < avail; i++)
+                out[done + i] = tb->ring[(tb->play_ts + i) & tb->mask];
+            ring_skip(tb, avail);
+
+            if (tb->concealing) {
+                unsigned int fade = avail < n / 4 ? avail : n / 4;
+
+                conceal_next(tb, tb->work, fade);
+                for (unsigned int i = 0; i < fade; i++)
+                    out[done + i] = blend(tb->work[i], out[done + i], (float)(i + 1) / (fade + 1));
+                tb->concealing = 0;
+            }
+            tb->stats.frames += avail;
+            tb->idle_run = 0;
+            history_append(tb, out + done, avail);
+            done += avail;
+            continue;
+        }
+
+        ahead = ts_diff(tb->end_ts, tb->play_ts);
+        if (ahead > 0) {
+            // Lost or late audio; later packets are waiting
+            hole = 0;
+            while (hole < (unsigned int)ahead && !tb->valid[(tb->play_ts + hole) & tb->mask])
+                hole++;
+
+            // Once concealment is silent, a hole is a free place to catch up
+            if (tb->concealing && conceal_faded(tb) && excess > 0) {
+                unsigned int skip = excess < hole ? (unsigned int)excess : hole;
+
+                tb->play_ts += skip;
+                tb->stats.shrunk += skip;
+                excess -= skip;
+                continue;
+            }
+            if (hole > n - done)
+                hole = n - done;
+            tb->play_ts += hole;
+        } else {
+            // Nothing queued; hold the timeline until packets arrive
+            hole = n - done;
+            tb->idle_run += hole;
+            if (tb->idle_run >= tb->rate * IDLE_MS / 1000) {
+                memset(out + done, 0, hole * sizeof(*out));
+                history_append(tb, out + done, hole);
+                tb->state = TALKBACK_IDLE;
+                return;
+            }
+        }
+
+        if (!tb->concealing)
+            conceal_start(tb);
+        // A stall that has faded out is a pause, not lost audio
+        if (ahead > 0 || !conceal_faded(tb))
+            tb->stats.concealed += hole;
+        conceal_next(tb, out + done, hole);
+        history_append(tb, out + done, hole);
+        done += hole;
+    }
+}
+
+static void measure_latency(talkback_t* tb, uint64_t play_us)
+{
+    talkback_stats_t* stats = &tb->stats;
+    float latency;
+
+    if (!tb->anchor_us || !tb->valid[tb->play_ts & tb->mask])
+        return;
+
+    latency = (int64_t)(play_us - tb->anchor_us - frames_to_us(tb, ts_diff(tb->play_ts, tb->anchor_ts))) / 1000.0f;
+    stats->latency_ms = latency;
+    if (!tb->latency_count || latency < stats->latency_min_ms)
+        stats->latency_min_ms = latency;
+    if (!tb->latency_count || latency > stats->latency_max_ms)
+        stats->latency_max_ms = latency;
+    tb->latency_sum += latency;
+    tb->latency_count++;
+    stats->latency_mean_ms = (float)(tb->latency_sum / tb->latency_count);
+}
+
+static unsigned int block_rms(const talkback_t* tb)
+{
+    unsigned int n = valid_run(tb, tb->play_ts, tb->block);
+    float energy = 0.0f;
+
+    for (unsigned int i = 0; i < n; i++) {
+        float s = tb->ring[(tb->play_ts + i) & tb->mask];
+        energy += s * s;
+    }
+    return n ? (unsigned int)sqrtf(energy / n) : 0;
+}
+
+/*
+ * Frames from the next frame to play until the end of the packet that
+ * completes the worst placed of the coming blocks: a block that straddles
+ * a packet boundary waits for the whole of the next packet. Packets are
+ * taken to be cut evenly from the start of the talk spurt.
+ */
+static unsigned int block_wait(const talkback_t* tb)
+{
+    unsigned int pf = tb->packet_frames;
+    unsigned int phase, worst = 0;
+
+    if (!pf)
+        return tb->block;
+
+    phase = (uint32_t)(tb->play_ts - tb->ref_ts) % pf;
+    for (unsigned int i = 0; i < 16; i++) {
+        unsigned int start = phase + i * tb->block;
+        unsigned int end = (start + tb->block + pf - 1) / pf * pf;
+
+        if (end - start > worst)
+            worst = end - start;
+        if (i && start % pf == phase)
+            break;
+    }
+    return worst;
+}
+
+void talkback_jitter_read(talkback_t* tb, int16_t* out, uint64_t now_us, uint64_t play_us)
+{
+    int64_t delay, excess, room;
+    unsigned int wait;
+
+    if (tb->state == TALKBACK_IDLE) {
+        memset(out, 0, tb->block * sizeof(*out));
+        history_append(tb, out, tb->block);
+        return;
+    }
+
+    // How long after the earliest possible arrival of its audio each coming block plays, at worst
+    wait = block_wait(tb);
+    delay = (int64_t)(now_us - tb->ref_us) - frames_to_us(tb, ts_diff(tb->play_ts, tb->ref_ts) + (int64_t)wait)
+        - tb->transit_min;
+    if (tb->state == TALKBACK_BUFFERING) {
+        if (delay < tb->target_us) {
+            memset(out, 0, tb->block * sizeof(*out));
+            history_append(tb, out, tb->block);
+            return;
+        }
+        tb->state = TALKBACK_PLAYING;
+    }
+
+    tb->stats.buffer_ms = delay / 1000.0f;
+    measure_latency(tb, play_us);
+
+    /*
+     * Speech is rescaled at most every few blocks; pauses at any time. A
+     * shrink can move the blocks to straddle packet boundaries, so it only
+     * removes what the worst placement would leave room for.
+     */
+    excess = delay - tb->target_us;
+    room = tb->packet_frames ? excess - frames_to_us(tb, tb->packet_frames + tb->block - 1 - wait) : excess;
+    tb->since_adjust++;
+    if (!tb->concealing && (room > SLACK_US || excess < -SLACK_US)
+        && (tb->since_adjust >= ADJUST_BLOCKS || block_rms(tb) < QUIET_RMS)) {
+        int done = excess > 0 ? shrink(tb, out, us_to_frames(tb, room))
+                              : stretch(tb, out, us_to_frames(tb, -excess));
+        if (done) {
+            tb->since_adjust = 0;
+            history_append(tb, out, tb->block);
+            return;
+        }
+    }
+
+    play(tb, out, excess > 0 ? us_to_frames(tb, excess) : 0);
+}
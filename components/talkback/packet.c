@@ -0,0 +1,182 @@
+#include <string.h>
+#include <time.h>
+
+#include "talkback_internal.h"
+
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 32635
+
+static void put_u16(uint8_t* p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+size_t talkback_packet_write(const talkback_packet_t* pkt, uint8_t* buf, size_t size)
+{
+    if (size < TALKBACK_HEADER_SIZE + (size_t)pkt->size)
+        return 0;
+
+    put_u16(buf, TALKBACK_MAGIC);
+    buf[2] = pkt->codec;
+    buf[3] = pkt->channels;
+    put_u16(buf + 4, pkt->seq);
+    put_u16(buf + 6, pkt->size);
+    put_u32(buf + 8, pkt->rate);
+    put_u32(buf + 12, pkt->timestamp);
+    put_u32(buf + 16, (uint32_t)pkt->capture_us);
+    put_u32(buf + 20, (uint32_t)(pkt->capture_us >> 32));
+    memcpy(buf + TALKBACK_HEADER_SIZE, pkt->payload, pkt->size);
+
+    return TALKBACK_HEADER_SIZE + pkt->size;
+}
+
+int talkback_packet_parse(const uint8_t* buf, size_t size, talkback_packet_t* pkt)
+{
+    if (size < 2)
+        return 0;
+    if (get_u16(buf) != TALKBACK_MAGIC)
+        return -1;
+    if (size < TALKBACK_HEADER_SIZE)
+        return 0;
+
+    pkt->codec = buf[2];
+    pkt->channels = buf[3];
+    pkt->seq = get_u16(buf + 4);
+    pkt->size = get_u16(buf + 6);
+    pkt->rate = get_u32(buf + 8);
+    pkt->timestamp = get_u32(buf + 12);
+    pkt->capture_us = get_u32(buf + 16) | (uint64_t)get_u32(buf + 20) << 32;
+    pkt->payload = buf + TALKBACK_HEADER_SIZE;
+
+    if (pkt->codec > TALKBACK_CODEC_PCMA || pkt->channels == 0 || pkt->rate < 8000 || pkt->rate > 48000)
+        return -1;
+    if (size < TALKBACK_HEADER_SIZE + (size_t)pkt->size)
+        return 0;
+
+    return TALKBACK_HEADER_SIZE + pkt->size;
+}
+
+// G.711 as in the Sun reference implementation
+
+static uint8_t s16_to_ulaw(int16_t pcm)
+{
+    int sign = (pcm >> 8) & 0x80;
+    int v = sign ? -(int)pcm : pcm;
+    int exponent = 7;
+
+    if (v > ULAW_CLIP)
+        v = ULAW_CLIP;
+    v += ULAW_BIAS;
+    for (int mask = 0x4000; !(v & mask) && exponent > 0; mask >>= 1)
+        exponent--;
+
+    return (uint8_t)~(sign | exponent << 4 | ((v >> (exponent + 3)) & 0x0f));
+}
+
+static int16_t ulaw_to_s16(uint8_t u)
+{
+    int t;
+
+    u = (uint8_t)~u;
+    t = (((u & 0x0f) << 3) + ULAW_BIAS) << ((u & 0x70) >> 4);
+
+    return (int16_t)((u & 0x80) ? ULAW_BIAS - t : t - ULAW_BIAS);
+}
+
+static uint8_t s16_to_alaw(int16_t pcm)
+{
+    int v = pcm >> 3;
+    int mask = 0xd5;
+    int seg = 0;
+
+    if (v < 0) {
+        mask = 0x55;
+        v = -v - 1;
+    }
+    while (seg < 8 && v > (0x20 << seg) - 1)
+        seg++;
+    if (seg >= 8)
+        return (uint8_t)(0x7f ^ mask);
+
+    return (uint8_t)((seg << 4 | ((v >> (seg < 2 ? 1 : seg)) & 0x0f)) ^ mask);
+}
+
+static int16_t alaw_to_s16(uint8_t a)
+{
+    int seg, t;
+
+    a ^= 0x55;
+    t = (a & 0x0f) << 4;
+    seg = (a & 0x70) >> 4;
+    if (seg == 0)
+        t += 8;
+    else
+        t = (t + 0x108) << (seg - 1);
+
+    return (int16_t)((a & 0x80) ? t : -t);
+}
+
+size_t talkback_encode(int codec, const int16_t* in, size_t samples, uint8_t* out)
+{
+    switch (codec) {
+    case TALKBACK_CODEC_L16:
+        for (size_t i = 0; i < samples; i++)
+            put_u16(out + i * 2, (uint16_t)in[i]);
+        return samples * 2;
+    case TALKBACK_CODEC_PCMU:
+        for (size_t i = 0; i < samples; i++)
+            out[i] = s16_to_ulaw(in[i]);
+        return samples;
+    case TALKBACK_CODEC_PCMA:
+        for (size_t i = 0; i < samples; i++)
+            out[i] = s16_to_alaw(in[i]);
+        return samples;
+    }
+    return 0;
+}
+
+size_t talkback_decode(int codec, const uint8_t* in, size_t size, int16_t* out)
+{
+    switch (codec) {
+    case TALKBACK_CODEC_L16:
+        if (size & 1)
+            return 0;
+        for (size_t i = 0; i < size / 2; i++)
+            out[i] = (int16_t)get_u16(in + i * 2);
+        return size / 2;
+    case TALKBACK_CODEC_PCMU:
+        for (size_t i = 0; i < size; i++)
+            out[i] = ulaw_to_s16(in[i]);
+        return size;
+    case TALKBACK_CODEC_PCMA:
+        for (size_t i = 0; i < size; i++)
+            out[i] = alaw_to_s16(in[i]);
+        return size;
+    }
+    return 0;
+}
+
+uint64_t talkback_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef TALKBACK_NO_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "talkback_internal.h"
+
+#define PLAYOUT_PRIORITY 80 // SCHED_RR, as for audio input
+
+static void put_le(uint8_t* p, uint32_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void write_wav_header(talkback_t* tb)
+{
+    unsigned int frame_bytes = tb->config.channels * 2;
+    uint8_t h[44];
+
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + tb->file_bytes, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2);
+    put_le(h + 22, tb->config.channels, 2);
+    put_le(h + 24, tb->config.rate, 4);
+    put_le(h + 28, tb->config.rate * frame_bytes, 4);
+    put_le(h + 32, frame_bytes, 2);
+    put_le(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, tb->file_bytes, 4);
+
+    fseek(tb->file, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), tb->file);
+    fseek(tb->file, 0, SEEK_END);
+}
+
+#ifndef TALKBACK_NO_ALSA
+
+static int open_device(talkback_t* tb)
+{
+    snd_pcm_t* pcm;
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_sw_params_t* sw;
+    snd_pcm_uframes_t period = tb->period;
+    snd_pcm_uframes_t buffer = (snd_pcm_uframes_t)tb->period * tb->config.periods;
+    unsigned int rate = tb->config.rate;
+    int err;
+
+    err = snd_pcm_open(&pcm, tb->config.device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+        fprintf(stderr, "talkback: cannot open %s: %s\n", tb->config.device, snd_strerror(err));
+        return err;
+    }
+
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_sw_params_alloca(&sw);
+
+    if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0
+        || (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0
+        || (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16_LE)) < 0
+        || (err = snd_pcm_hw_params_set_channels(pcm, hw, tb->config.channels)) < 0
+        || (err = snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, NULL)) < 0
+        || (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, NULL)) < 0
+        || (err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer)) < 0
+        || (err = snd_pcm_hw_params(pcm, hw)) < 0) {
+        fprintf(stderr, "talkback: cannot set hw params: %s\n", snd_strerror(err));
+        snd_pcm_close(pcm);
+        return err;
+    }
+    if (rate != tb->config.rate) {
+        fprintf(stderr, "talkback: %s does not support %u Hz\n", tb->config.device, tb->config.rate);
+        snd_pcm_close(pcm);
+        return -EINVAL;
+    }
+
+    // Start on the first period, and wake up as soon as one is free
+    if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0
+        || (err = snd_pcm_sw_params_set_start_threshold(pcm, sw, period)) < 0
+        || (err = snd_pcm_sw_params_set_avail_min(pcm, sw, period)) < 0
+        || (err = snd_pcm_sw_params(pcm, sw)) < 0) {
+        fprintf(stderr, "talkback: cannot set sw params: %s\n", snd_strerror(err));
+        snd_pcm_close(pcm);
+        return err;
+    }
+
+    // The null device takes everything at once, so the clock must pace it
+    tb->paced = snd_pcm_type(pcm) == SND_PCM_TYPE_NULL;
+    tb->period = (unsigned int)period;
+    tb->device = pcm;
+
+    return 0;
+}
+
+static void close_device(talkback_t* tb)
+{
+    snd_pcm_drop(tb->device);
+    snd_pcm_close(tb->device);
+    tb->device = NULL;
+}
+
+#else
+
+static int open_device(talkback_t* tb)
+{
+    fprintf(stderr, "talkback: built without ALSA, cannot open %s\n", tb->config.device);
+    return -ENODEV;
+}
+
+static void close_device(talkback_t* tb)
+{
+    tb->device = NULL;
+}
+
+#endif
+
+/*
+ * One period is pulled from the jitter buffer as soon as the device has
+ * room for it, so that every decision is made as late as possible.
+ */
+static void* playout_thread(void* arg)
+{
+    talkback_t* tb = arg;
+    uint64_t period_ns = (uint64_t)tb->period * 1000000000 / tb->config.rate;
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (tb->running) {
+        uint64_t delay_us = 0;
+
+        if (tb->paced) {
+            next.tv_nsec += period_ns;
+            while (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+#ifndef TALKBACK_NO_ALSA
+        else if (tb->device) {
+            snd_pcm_sframes_t delay;
+
+            snd_pcm_wait(tb->device, 100);
+            if (snd_pcm_delay(tb->device, &delay) == 0 && delay > 0)
+                delay_us = (uint64_t)delay * 1000000 / tb->config.rate;
+        }
+#endif
+
+        talkback_pull(tb, tb->period_buf, tb->period, talkback_now_us(), delay_us);
+
+        if (tb->file) {
+            fwrite(tb->period_buf, tb->config.channels * 2, tb->period, tb->file);
+            tb->file_bytes += tb->period * tb->config.channels * 2;
+        }
+#ifndef TALKBACK_NO_ALSA
+        if (tb->device) {
+            snd_pcm_sframes_t n = snd_pcm_writei(tb->device, tb->period_buf, tb->period);
+
+            if (n < 0) {
+                if (n == -EPIPE) {
+                    pthread_mutex_lock(&tb->lock);
+                    tb->stats.xruns++;
+                    pthread_mutex_unlock(&tb->lock);
+                }
+                snd_pcm_recover(tb->device, (int)n, 1);
+            }
+        }
+#endif
+    }
+
+    return NULL;
+}
+
+int talkback_start(talkback_t* tb)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    int err;
+
+    if (tb->running)
+        return 0;
+
+    tb->period = tb->config.rate * tb->config.period_ms / 1000;
+    tb->paced = 0;
+    if (tb->config.file) {
+        tb->file = fopen(tb->config.file, "wb");
+        if (!tb->file) {
+            fprintf(stderr, "talkback: cannot create %s: %s\n", tb->config.file, strerror(errno));
+            return -errno;
+        }
+        tb->file_bytes = 0;
+        tb->paced = 1;
+        write_wav_header(tb);
+    } else if ((err = open_device(tb)) < 0) {
+        return err;
+    }
+
+    tb->period_buf = malloc((size_t)tb->period * tb->config.channels * sizeof(*tb->period_buf));
+    if (!tb->period_buf) {
+        err = -ENOMEM;
+        goto fail;
+    }
+
+    tb->running = 1;
+    pthread_attr_init(&attr);
+    param.sched_priority = PLAYOUT_PRIORITY;
+    pthread_attr_setschedpolicy(&attr, SCHED_RR);
+    pthread_attr_setschedparam(&attr, &param);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    err = pthread_create(&tb->thread, &attr, playout_thread, tb);
+    pthread_attr_destroy(&attr);
+    if (err == EPERM) {
+        // Without the privilege for real-time scheduling
+        err = pthread_create(&tb->thread, NULL, playout_thread, tb);
+    }
+    if (err) {
+        tb->running = 0;
+        err = -err;
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    free(tb->period_buf);
+    tb->period_buf = NULL;
+    if (tb->file) {
+        fclose(tb->file);
+        tb->file = NULL;
+    }
+    if (tb->device)
+        close_device(tb);
+    return err;
+}
+
+void talkback_stop(talkback_t* tb)
+{
+    if (!tb->running)
+        return;
+
+    tb->running = 0;
+    pthread_join(tb->thread, NULL);
+
+    if (tb->file) {
+        write_wav_header(tb);
+        fclose(tb->file);
+        tb->file = NULL;
+    }
+    if (tb->device)
+        close_device(tb);
+    free(tb->period_buf);
+    tb->period_buf = NULL;
+}
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "talkback_internal.h"
+
+void talkback_default_config(talkback_config_t* config)
+{
+    memset(config, 0, sizeof(*config));
+    config->device = "default";
+    config->rate = 16000;
+    config->channels = 1;
+    config->period_ms = 10;
+    config->periods = 2;
+    config->min_delay_ms = 10;
+    config->max_delay_ms = 400;
+}
+
+talkback_t* talkback_create(const talkback_config_t* config)
+{
+    talkback_t* tb;
+
+    if (config->rate < 8000 || config->rate > 48000 || config->channels == 0 || config->period_ms == 0
+        || config->periods < 2 || config->min_delay_ms > config->max_delay_ms)
+        return NULL;
+
+    tb = calloc(1, sizeof(*tb));
+    if (!tb)
+        return NULL;
+
+    tb->config = *config;
+    pthread_mutex_init(&tb->lock, NULL);
+
+    // The largest payload is 65535 PCMU samples, which mix down to half as many frames
+    tb->stream = malloc(TALKBACK_MAX_PACKET);
+    tb->decoded = malloc(65535 * sizeof(*tb->decoded));
+    tb->mixed = malloc(65535 / 2 * sizeof(*tb->mixed));
+    if (!tb->stream || !tb->decoded || !tb->mixed || talkback_jitter_setup(tb, config->rate)) {
+        talkback_destroy(tb);
+        return NULL;
+    }
+
+    return tb;
+}
+
+void talkback_destroy(talkback_t* tb)
+{
+    if (!tb)
+        return;
+
+    talkback_stop(tb);
+    talkback_jitter_free(tb);
+    free(tb->stream);
+    free(tb->decoded);
+    free(tb->mixed);
+    pthread_mutex_destroy(&tb->lock);
+    free(tb);
+}
+
+int talkback_push(talkback_t* tb, const talkback_packet_t* pkt, uint64_t arrival_us)
+{
+    int ret;
+
+    pthread_mutex_lock(&tb->lock);
+    ret = talkback_jitter_push(tb, pkt, arrival_us);
+    pthread_mutex_unlock(&tb->lock);
+
+    return ret;
+}
+
+size_t talkback_feed(talkback_t* tb, const void* data, size_t size, uint64_t arrival_us)
+{
+    const uint8_t* in = data;
+    size_t found = 0;
+
+    while (size) {
+        size_t n = TALKBACK_MAX_PACKET - tb->stream_len;
+        size_t pos = 0;
+
+        if (n > size)
+            n = size;
+        memcpy(tb->stream + tb->stream_len, in, n);
+        tb->stream_len += n;
+        in += n;
+        size -= n;
+
+        for (;;) {
+            talkback_packet_t pkt;
+            int len = talkback_packet_parse(tb->stream + pos, tb->stream_len - pos, &pkt);
+
+            if (len > 0) {
+                talkback_push(tb, &pkt, arrival_us);
+                pos += len;
+                found++;
+            } else if (len < 0) {
+                // Resynchronise on the next byte that could start a header
+                pthread_mutex_lock(&tb->lock);
+                tb->stats.invalid++;
+                pthread_mutex_unlock(&tb->lock);
+                do
+                    pos++;
+                while (pos < tb->stream_len && tb->stream[pos] != (TALKBACK_MAGIC & 0xff));
+            } else {
+                break;
+            }
+        }
+
+        memmove(tb->stream, tb->stream + pos, tb->stream_len - pos);
+        tb->stream_len -= pos;
+    }
+
+    return found;
+}
+
+void talkback_pull(talkback_t* tb, int16_t* out, size_t frames, uint64_t now_us, uint64_t delay_us)
+{
+    unsigned int rate = tb->config.rate;
+    unsigned int channels = tb->config.channels;
+    size_t done = 0;
+
+    pthread_mutex_lock(&tb->lock);
+    tb->stats.device_ms = delay_us / 1000.0f;
+
+    while (done < frames) {
+        size_t n;
+
+        if (!tb->rate) {
+            // Out of memory when the rate last changed
+            memset(out + done * channels, 0, (frames - done) * channels * sizeof(*out));
+            break;
+        }
+
+        if (tb->fifo_pos == tb->fifo_len) {
+            uint64_t play_us = now_us + delay_us + (uint64_t)done * 1000000 / rate;
+
+            tb->fifo_pos = 0;
+            if (!tb->resampler) {
+                talkback_jitter_read(tb, tb->fifo, now_us, play_us);
+                tb->fifo_len = tb->block;
+            } else {
+                size_t in = tb->block;
+
+                play_us += (uint64_t)audio_resampler_delay(tb->resampler) * 1000000 / rate;
+                talkback_jitter_read(tb, tb->pcm, now_us, play_us);
+                tb->fifo_len = tb->fifo_size;
+                audio_resampler_process_s16(tb->resampler, tb->pcm, &in, tb->fifo, &tb->fifo_len);
+            }
+        }
+
+        n = tb->fifo_len - tb->fifo_pos;
+        if (n > frames - done)
+            n = frames - done;
+        audio_mix_s16(tb->fifo + tb->fifo_pos, 1, out + done * channels, channels, n);
+        tb->fifo_pos += n;
+        done += n;
+    }
+
+    pthread_mutex_unlock(&tb->lock);
+}
+
+void talkback_reset(talkback_t* tb)
+{
+    pthread_mutex_lock(&tb->lock);
+    tb->stream_len = 0;
+    if (tb->rate)
+        talkback_jitter_reset(tb);
+    pthread_mutex_unlock(&tb->lock);
+}
+
+void talkback_get_stats(talkback_t* tb, talkback_stats_t* stats)
+{
+    pthread_mutex_lock(&tb->lock);
+    tb->stats.jitter_ms = tb->jitter_us / 1000.0f;
+    tb->stats.target_ms = tb->target_us / 1000.0f;
+    if (tb->state != TALKBACK_PLAYING)
+        tb->stats.buffer_ms = 0.0f;
+    *stats = tb->stats;
+    pthread_mutex_unlock(&tb->lock);
+}
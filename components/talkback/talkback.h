@@ -0,0 +1,139 @@
+#ifndef __TALKBACK_H__
+#define __TALKBACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Downlink audio for two-way talkback. Clients send packets of PCM or
+ * G.711 audio over any byte stream or datagram transport; an adaptive
+ * jitter buffer reorders them, conceals lost and late audio, and stretches
+ * or shrinks playout to follow the network's delay variation. Playout is
+ * through ALSA with a small period, or into a WAV file paced like a
+ * device when there is no sound card.
+ */
+
+/*
+ * Packet header, little endian, followed by size bytes of payload:
+ *
+ *   u16 magic       TALKBACK_MAGIC
+ *   u8  codec       TALKBACK_CODEC_*
+ *   u8  channels    interleaved in the payload; mixed down for playout
+ *   u16 seq         incremented by one per packet
+ *   u16 size        payload bytes
+ *   u32 rate        sample rate, the same for the whole talk spurt
+ *   u32 timestamp   of the first frame, counted in frames at rate
+ *   u64 capture_us  sender's CLOCK_REALTIME at capture, 0 if unknown
+ *
+ * timestamp keeps counting through silence, so that a gap between two
+ * talk spurts is played as a gap.
+ */
+#define TALKBACK_MAGIC       0x4b54 // "TK"
+#define TALKBACK_HEADER_SIZE 24
+
+enum {
+    TALKBACK_CODEC_L16  = 0, // Signed 16-bit little endian
+    TALKBACK_CODEC_PCMU = 1, // G.711 mu-law
+    TALKBACK_CODEC_PCMA = 2, // G.711 A-law
+};
+
+typedef struct talkback_packet {
+    uint8_t codec;
+    uint8_t channels;
+    uint16_t seq;
+    uint16_t size;
+    uint32_t rate;
+    uint32_t timestamp;
+    uint64_t capture_us;
+    const uint8_t* payload;
+} talkback_packet_t;
+
+// Writes header and payload; returns the bytes written, or 0 if buf is too small
+size_t talkback_packet_write(const talkback_packet_t* pkt, uint8_t* buf, size_t size);
+
+// Parses one packet; returns its length, 0 if more bytes are needed, or -1
+// if buf does not start with a valid header
+int talkback_packet_parse(const uint8_t* buf, size_t size, talkback_packet_t* pkt);
+
+// Encodes S16 samples for a packet; returns the payload bytes
+size_t talkback_encode(int codec, const int16_t* in, size_t samples, uint8_t* out);
+
+// Decodes a payload; returns the samples, or 0 for an odd L16 length
+size_t talkback_decode(int codec, const uint8_t* in, size_t size, int16_t* out);
+
+// CLOCK_REALTIME in microseconds, the clock of capture_us
+uint64_t talkback_now_us(void);
+
+typedef struct talkback_config {
+    const char* device;        // ALSA playback device, e.g. "default" or "null"
+    const char* file;          // WAV file to write instead of a device
+    unsigned int rate;         // Playout rate (default 16000)
+    unsigned int channels;     // Playout channels (default 1)
+    unsigned int period_ms;    // ALSA period (default 10)
+    unsigned int periods;      // ALSA buffer, in periods (default 2)
+    unsigned int min_delay_ms; // Jitter buffer delay bounds (default 10 and 400)
+    unsigned int max_delay_ms;
+} talkback_config_t;
+
+// Frame counts are at the rate of the packets, before resampling for playout
+typedef struct talkback_stats {
+    uint64_t packets;      // Accepted into the jitter buffer
+    uint64_t late;         // Arrived after their audio was due, or too early to hold
+    uint64_t duplicate;
+    uint64_t invalid;      // Bad header, codec or rate change mid-spurt
+    uint64_t lost;         // Missing sequence numbers
+    uint64_t frames;       // Played from packets
+    uint64_t concealed;    // Synthesised for lost, late or missing audio
+    uint64_t stretched;    // Added by time stretching
+    uint64_t shrunk;       // Removed by time shrinking
+    uint64_t xruns;
+    uint32_t spurts;       // Talk spurts started
+    float jitter_ms;       // Delay variation at the 95th percentile
+    float target_ms;       // Jitter buffer delay the playout aims for
+    float buffer_ms;       // Current jitter buffer delay
+    float device_ms;       // Output latency after the jitter buffer
+    float latency_ms;      // Mouth to speaker, last, minimum, mean and maximum;
+    float latency_min_ms;  // 0 unless packets carry a capture time
+    float latency_mean_ms;
+    float latency_max_ms;
+} talkback_stats_t;
+
+typedef struct talkback talkback_t;
+
+void talkback_default_config(talkback_config_t* config);
+talkback_t* talkback_create(const talkback_config_t* config);
+void talkback_destroy(talkback_t* tb);
+
+// Starts and stops the playout thread on the device or file
+int talkback_start(talkback_t* tb);
+void talkback_stop(talkback_t* tb);
+
+// Queues one packet that arrived at arrival_us (talkback_now_us() clock)
+int talkback_push(talkback_t* tb, const talkback_packet_t* pkt, uint64_t arrival_us);
+
+// Queues the packets in a byte stream, which may split them anywhere;
+// returns the number of complete packets found. Only one thread may feed.
+size_t talkback_feed(talkback_t* tb, const void* data, size_t size, uint64_t arrival_us);
+
+/*
+ * Produces the next frames of playout, for callers that drive their own
+ * output. now_us is the current time, and delay_us how long until the
+ * first frame is heard. The playout thread calls this once per period.
+ */
+void talkback_pull(talkback_t* tb, int16_t* out, size_t frames, uint64_t now_us, uint64_t delay_us);
+
+// Forgets the current talk spurt, e.g. when the client disconnects; not
+// while another thread feeds
+void talkback_reset(talkback_t* tb);
+
+void talkback_get_stats(talkback_t* tb, talkback_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TALKBACK_H__
@@ -0,0 +1,99 @@
+#ifndef __TALKBACK_INTERNAL_H__
+#define __TALKBACK_INTERNAL_H__
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "audio_dsp.h"
+#include "talkback.h"
+
+#define TALKBACK_MAX_PACKET (TALKBACK_HEADER_SIZE + 65535)
+#define TALKBACK_WINDOW     128 // Packets in the delay statistics
+
+enum {
+    TALKBACK_IDLE,      // No talk spurt; playing silence
+    TALKBACK_BUFFERING, // First packets queued, waiting for the target delay
+    TALKBACK_PLAYING,
+};
+
+struct talkback {
+    talkback_config_t config;
+    pthread_mutex_t lock;
+
+    // Byte stream reassembly and decoding
+    uint8_t* stream;
+    size_t stream_len;
+    int16_t* decoded;
+    int16_t* mixed;
+
+    // Jitter buffer, at the rate of the current talk spurt
+    int state;
+    unsigned int rate;
+    unsigned int block;   // Frames decided on at once, at least 10 ms
+    int16_t* ring;
+    uint8_t* valid;
+    uint32_t mask;
+    uint32_t play_ts;     // Next frame to play
+    uint32_t end_ts;      // End of the latest frame received
+    uint32_t ref_ts;      // First frame of the spurt, and when it arrived
+    uint64_t ref_us;
+    uint16_t next_seq;
+    unsigned int packet_frames; // Longest packet of the spurt
+    int64_t transit[TALKBACK_WINDOW]; // Arrival relative to the first packet, in us
+    unsigned int transit_count;
+    unsigned int transit_pos;
+    int64_t transit_min;
+    int64_t jitter_us;
+    int64_t target_us;
+    unsigned int idle_run;     // Frames stalled on an empty buffer
+    unsigned int since_adjust; // Blocks since the last stretch or shrink
+
+    // Concealment
+    int16_t* history;          // Last frames played
+    unsigned int history_len;
+    int16_t* cycle;            // Pitch cycle repeated while concealing
+    unsigned int cycle_len;
+    unsigned int cycle_pos;
+    unsigned int conceal_run;
+    int concealing;
+    int16_t* work;
+
+    // Conversion to the playout rate
+    audio_resampler_t* resampler;
+    int16_t* pcm;              // A block at the jitter buffer's rate
+    int16_t* fifo;             // Frames at the playout rate not yet pulled
+    size_t fifo_pos;
+    size_t fifo_len;
+    size_t fifo_size;
+
+    // Mouth-to-speaker latency
+    uint32_t anchor_ts;        // A frame whose capture time is known
+    uint64_t anchor_us;
+    double latency_sum;
+    uint64_t latency_count;
+
+    talkback_stats_t stats;
+
+    // Playout thread, on an ALSA device or a WAV file
+    pthread_t thread;
+    volatile int running;
+    void* device;
+    FILE* file;
+    uint32_t file_bytes;
+    int paced;                 // Timed by the clock rather than by the device
+    unsigned int period;
+    int16_t* period_buf;
+};
+
+// Sets up the jitter buffer for a new rate; called with the lock held
+int talkback_jitter_setup(talkback_t* tb, unsigned int rate);
+void talkback_jitter_free(talkback_t* tb);
+void talkback_jitter_reset(talkback_t* tb);
+
+int talkback_jitter_push(talkback_t* tb, const talkback_packet_t* pkt, uint64_t arrival_us);
+
+// Produces one block at the jitter buffer's rate. play_us is when the
+// first frame will be heard.
+void talkback_jitter_read(talkback_t* tb, int16_t* out, uint64_t now_us, uint64_t play_us);
+
+#endif // __TALKBACK_INTERNAL_H__
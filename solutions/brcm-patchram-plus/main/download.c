@@ -0,0 +1,582 @@
+/*****************************************************************************
+**
+**  Name:          download.c
+**
+**  Description:   Fast patchram download; see download.h.
+**
+**                 The legacy download sends one command at a time at the
+**                 initial 115200 baud and waits for each Command Complete
+**                 without a timeout. Here the HCD file is sent at the
+**                 highest rate that works, commands are pipelined up to the
+**                 window the controller reports, and every wait is bounded.
+**
+******************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "download.h"
+
+#define HCI_COMMAND_PKT		0x01
+#define HCI_EVENT_PKT		0x04
+#define EVT_CMD_COMPLETE	0x0e
+#define EVT_CMD_STATUS		0x0f
+
+#define OP_RESET		0x0c03
+#define OP_READ_LOCAL_VERSION	0x1001
+#define OP_UPDATE_BAUD_RATE	0xfc18
+#define OP_DOWNLOAD_MINIDRIVER	0xfc2e
+#define OP_WRITE_RAM		0xfc4c
+#define OP_LAUNCH_RAM		0xfc4e
+
+#define INIT_BAUD		115200
+
+/* Timeouts, in ms */
+#define COMMAND_TIMEOUT		1000
+#define PROBE_TIMEOUT		100
+#define RESET_RETRY		100
+#define RESET_TIMEOUT		4000
+
+extern void dump(unsigned char *out, int len);
+
+/* Rates to try, fastest first */
+static const struct {
+	int baud_rate;
+	speed_t speed;
+} fast_rates[] = {
+#ifndef __CYGWIN__
+	{ 4000000, B4000000 },
+	{ 3500000, B3500000 },
+#endif
+	{ 3000000, B3000000 },
+	{ 2500000, B2500000 },
+	{ 2000000, B2000000 },
+	{ 1500000, B1500000 },
+	{ 1000000, B1000000 },
+	{ 921600, B921600 },
+	{ 460800, B460800 },
+	{ 230400, B230400 }
+};
+
+typedef struct {
+	int fd;
+	struct termios *termios;
+	const tFastDownload *cfg;
+	int baud_rate;
+	int ncmd;		/* Num_HCI_Command_Packets of the last event */
+	unsigned char rx[1024];
+	int rx_len;
+} tLink;
+
+typedef struct {
+	int offset;		/* Of the opcode in the file */
+	int len;		/* Opcode, length and parameters */
+	int opcode;
+} tRecord;
+
+static long
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
+static int
+write_all(tLink *link, const unsigned char *buf, int len)
+{
+	int done = 0;
+	int n;
+
+	if (link->cfg->debug) {
+		fprintf(stderr, "writing\n");
+		dump((unsigned char *)buf, len);
+	}
+
+	while (done < len) {
+		n = write(link->fd, buf + done, len - done);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return(-1);
+		}
+		done += n;
+	}
+
+	return(0);
+}
+
+/* Reads what has arrived, waiting up to timeout ms for something */
+static int
+fill(tLink *link, int timeout)
+{
+	struct pollfd pfd = { link->fd, POLLIN, 0 };
+	int n;
+
+	if (link->rx_len == (int)sizeof(link->rx))
+		link->rx_len = 0;
+
+	n = poll(&pfd, 1, timeout < 0 ? 0 : timeout);
+	if (n <= 0)
+		return(-1);
+
+	n = read(link->fd, link->rx + link->rx_len, sizeof(link->rx) - link->rx_len);
+	if (n <= 0)
+		return(-1);
+
+	link->rx_len += n;
+	return(0);
+}
+
+static void
+discard_input(tLink *link)
+{
+	tcflush(link->fd, TCIFLUSH);
+	link->rx_len = 0;
+}
+
+/*
+ * Reads one HCI event into buf, skipping anything that does not start
+ * like one. Returns its length, or -1 if none arrived within timeout ms.
+ */
+static int
+read_event(tLink *link, unsigned char *buf, int timeout)
+{
+	long deadline = now_ms() + timeout;
+	int skip;
+	int len;
+
+	for (;;) {
+		for (skip = 0; skip < link->rx_len && link->rx[skip] != HCI_EVENT_PKT; skip++)
+			;
+		if (skip) {
+			memmove(link->rx, link->rx + skip, link->rx_len - skip);
+			link->rx_len -= skip;
+		}
+
+		if (link->rx_len >= 3 && link->rx_len >= 3 + link->rx[2]) {
+			len = 3 + link->rx[2];
+			memcpy(buf, link->rx, len);
+			memmove(link->rx, link->rx + len, link->rx_len - len);
+			link->rx_len -= len;
+
+			if (link->cfg->debug) {
+				fprintf(stderr, "received %d\n", len);
+				dump(buf, len);
+			}
+			return(len);
+		}
+
+		if (fill(link, (int)(deadline - now_ms())) < 0)
+			return(-1);
+	}
+}
+
+/*
+ * Takes the opcode, status and Num_HCI_Command_Packets of a Command
+ * Complete or Command Status event. Returns 0 if it was one of those.
+ */
+static int
+parse_complete(tLink *link, const unsigned char *buf, int len, int *opcode, int *status)
+{
+	if (buf[1] == EVT_CMD_COMPLETE && len >= 7) {
+		link->ncmd = buf[3];
+		*opcode = buf[4] | (buf[5] << 8);
+		*status = buf[6];
+		return(0);
+	}
+
+	if (buf[1] == EVT_CMD_STATUS && len >= 7) {
+		*status = buf[3];
+		link->ncmd = buf[4];
+		*opcode = buf[5] | (buf[6] << 8);
+		return(0);
+	}
+
+	return(-1);
+}
+
+static int
+wait_complete(tLink *link, int opcode, int timeout, int *status)
+{
+	long deadline = now_ms() + timeout;
+	unsigned char buf[260];
+	int len;
+	int op;
+
+	while ((len = read_event(link, buf, (int)(deadline - now_ms()))) > 0) {
+		if (parse_complete(link, buf, len, &op, status) == 0 && op == opcode)
+			return(0);
+	}
+
+	return(-1);
+}
+
+static int
+command(tLink *link, int opcode, const unsigned char *params, int plen, int timeout, int *status)
+{
+	unsigned char buf[260];
+
+	buf[0] = HCI_COMMAND_PKT;
+	buf[1] = opcode & 0xff;
+	buf[2] = opcode >> 8;
+	buf[3] = plen;
+	if (plen)
+		memcpy(&buf[4], params, plen);
+
+	if (write_all(link, buf, plen + 4) < 0)
+		return(-1);
+
+	return(wait_complete(link, opcode, timeout, status));
+}
+
+/* Sets the UART speed and checks that it took */
+static int
+set_speed(tLink *link, speed_t speed)
+{
+	struct termios check;
+
+	tcdrain(link->fd);
+	cfsetospeed(link->termios, speed);
+	cfsetispeed(link->termios, speed);
+	if (tcsetattr(link->fd, TCSANOW, link->termios) < 0)
+		return(-1);
+
+	if (tcgetattr(link->fd, &check) < 0 || cfgetospeed(&check) != speed)
+		return(-1);
+
+	return(0);
+}
+
+/* HCI Reset, sent again every RESET_RETRY ms until it is answered */
+static int
+reset(tLink *link)
+{
+	long deadline = now_ms() + RESET_TIMEOUT;
+	int status;
+
+	do {
+		if (command(link, OP_RESET, NULL, 0, RESET_RETRY, &status) == 0)
+			return(status ? -1 : 0);
+	} while (now_ms() < deadline);
+
+	return(-1);
+}
+
+static int
+probe(tLink *link)
+{
+	int status;
+
+	return(command(link, OP_READ_LOCAL_VERSION, NULL, 0, PROBE_TIMEOUT, &status) == 0 && status == 0 ? 0 : -1);
+}
+
+static void
+encode_baud_rate(int baud_rate, unsigned char *params)
+{
+	params[0] = 0;
+	params[1] = 0;
+	params[2] = baud_rate & 0xff;
+	params[3] = (baud_rate >> 8) & 0xff;
+	params[4] = (baud_rate >> 16) & 0xff;
+	params[5] = (baud_rate >> 24) & 0xff;
+}
+
+/*
+ * Moves both sides to a new rate and checks the link with a command at
+ * it. Returns 0 if the link works at the new rate, -1 if it is still
+ * working at the old one, and -2 if the controller is lost.
+ */
+static int
+switch_baud(tLink *link, int baud_rate, speed_t speed)
+{
+	speed_t old_speed = cfgetospeed(link->termios);
+	int old_baud_rate = link->baud_rate;
+	unsigned char params[6];
+	int status;
+
+	/* Rates this UART cannot do are not offered to the controller */
+	if (set_speed(link, speed) < 0 || set_speed(link, old_speed) < 0) {
+		set_speed(link, old_speed);
+		return(-1);
+	}
+
+	encode_baud_rate(baud_rate, params);
+	if (command(link, OP_UPDATE_BAUD_RATE, params, 6, COMMAND_TIMEOUT, &status) < 0)
+		return(-2);
+	if (status)
+		return(-1);
+
+	if (set_speed(link, speed) == 0) {
+		discard_input(link);
+		if (probe(link) == 0) {
+			link->baud_rate = baud_rate;
+			return(0);
+		}
+	}
+
+	/*
+	 * The controller took the rate but the link does not work at it.
+	 * Ask it to go back, at the new rate, and let it answer before the
+	 * UART follows; the answer may well be unreadable.
+	 */
+	fprintf(stderr, "No response at %d baud, going back to %d\n", baud_rate, old_baud_rate);
+	encode_baud_rate(old_baud_rate, params);
+	command(link, OP_UPDATE_BAUD_RATE, params, 6, PROBE_TIMEOUT, &status);
+
+	if (set_speed(link, old_speed) < 0)
+		return(-2);
+	discard_input(link);
+
+	return(probe(link) == 0 ? -1 : -2);
+}
+
+static unsigned char *
+read_hcd(int hcd_fd, int *size, tRecord **records, int *count)
+{
+	struct stat st;
+	unsigned char *data;
+	int done = 0;
+	int n = 0;
+	int pos;
+	int len;
+
+	if (fstat(hcd_fd, &st) < 0 || st.st_size <= 0)
+		return(NULL);
+
+	data = malloc(st.st_size);
+	if (data == NULL)
+		return(NULL);
+
+	lseek(hcd_fd, 0, SEEK_SET);
+	while (done < st.st_size && (len = read(hcd_fd, data + done, st.st_size - done)) > 0)
+		done += len;
+
+	/* Each record is an HCI command without its packet type */
+	for (pos = 0; pos + 3 <= done; pos += 3 + data[pos + 2])
+		n++;
+	if (done != st.st_size || pos != done) {
+		free(data);
+		return(NULL);
+	}
+
+	*records = malloc(n * sizeof(**records));
+	if (*records == NULL) {
+		free(data);
+		return(NULL);
+	}
+
+	for (pos = 0, n = 0; pos < done; pos += 3 + data[pos + 2], n++) {
+		(*records)[n].offset = pos;
+		(*records)[n].len = 3 + data[pos + 2];
+		(*records)[n].opcode = data[pos] | (data[pos + 1] << 8);
+	}
+
+	*size = done;
+	*count = n;
+	return(data);
+}
+
+/*
+ * Sends the records, keeping as many outstanding as the window and the
+ * controller allow. The controller's depth is the Num_HCI_Command_Packets
+ * it reported when idle, after the minidriver: later values do not count
+ * commands still on the wire, so they only pause the download when 0.
+ * Launch_RAM goes alone, once all else is confirmed, since the
+ * controller restarts after it.
+ */
+/*
+ * Asks the controller back to the initial rate, at the rate in use, and
+ * moves the UART after it, so that a download that fails at a fast rate
+ * leaves the controller where the next attempt expects to find it.
+ */
+static void
+restore_baud(tLink *link)
+{
+	unsigned char params[6];
+	int status;
+
+	encode_baud_rate(INIT_BAUD, params);
+	if (command(link, OP_UPDATE_BAUD_RATE, params, 6, COMMAND_TIMEOUT, &status) < 0 || status)
+		fprintf(stderr, "No answer to going back to %d baud\n", INIT_BAUD);
+
+	set_speed(link, B115200);
+	link->baud_rate = INIT_BAUD;
+	discard_input(link);
+}
+
+static int
+send_records(tLink *link, const unsigned char *data, const tRecord *records, int count, int *peak)
+{
+	unsigned char *out;
+	unsigned char buf[260];
+	int window = link->cfg->window > 0 ? link->cfg->window : 1;
+	int paused = 0;
+	int outstanding = 0;
+	int confirmed = 0;
+	int next = 0;
+	int opcode;
+	int status;
+	int len;
+
+	if (link->ncmd > 0 && link->ncmd < window)
+		window = link->ncmd;
+
+	out = malloc(window * 259);
+	if (out == NULL)
+		return(-1);
+
+	*peak = 0;
+	while (confirmed < count) {
+		len = 0;
+		while (next < count && !paused && outstanding < window) {
+			if (records[next].opcode == OP_LAUNCH_RAM && outstanding > 0)
+				break;
+
+			out[len] = HCI_COMMAND_PKT;
+			memcpy(&out[len + 1], data + records[next].offset, records[next].len);
+			len += 1 + records[next].len;
+			outstanding++;
+
+			if (records[next++].opcode == OP_LAUNCH_RAM)
+				break;
+		}
+
+		if (len && write_all(link, out, len) < 0)
+			break;
+		if (outstanding > *peak)
+			*peak = outstanding;
+
+		if (outstanding == 0) {
+			/* Nothing to wait for; a controller that says 0 still takes one */
+			paused = 0;
+			continue;
+		}
+
+		if ((len = read_event(link, buf, COMMAND_TIMEOUT)) < 0) {
+			fprintf(stderr, "No response to command %d of %d\n", confirmed + 1, count);
+			break;
+		}
+
+		if (parse_complete(link, buf, len, &opcode, &status) < 0)
+			continue;
+		paused = link->ncmd == 0;
+
+		if (opcode != records[confirmed].opcode)
+			continue;
+		if (status) {
+			fprintf(stderr, "Command %d of %d failed with status 0x%02x\n", confirmed + 1, count, status);
+			break;
+		}
+		outstanding--;
+		confirmed++;
+	}
+
+	free(out);
+	return(confirmed == count ? 0 : -1);
+}
+
+int
+fast_download(int uart_fd, int hcd_fd, struct termios *termios, const tFastDownload *cfg)
+{
+	tLink link;
+	tRecord *records = NULL;
+	unsigned char *data;
+	long t0, t_reset, t_baud, t_minidriver, t_download, t_launch;
+	unsigned int i;
+	int size;
+	int count;
+	int download_baud;
+	int peak = 0;
+	int status;
+	int ret = -1;
+
+	memset(&link, 0, sizeof(link));
+	link.fd = uart_fd;
+	link.termios = termios;
+	link.cfg = cfg;
+	link.baud_rate = INIT_BAUD;
+	link.ncmd = 1;
+
+	t0 = now_ms();
+
+	data = read_hcd(hcd_fd, &size, &records, &count);
+	if (data == NULL) {
+		fprintf(stderr, "HCD file could not be read\n");
+		return(-1);
+	}
+
+	if (set_speed(&link, B115200) < 0 || reset(&link) < 0) {
+		fprintf(stderr, "No response to HCI Reset\n");
+		goto out;
+	}
+	t_reset = now_ms();
+
+	for (i = 0; i < sizeof(fast_rates) / sizeof(fast_rates[0]); i++) {
+		if (fast_rates[i].baud_rate > cfg->max_baud || fast_rates[i].baud_rate <= INIT_BAUD)
+			continue;
+
+		status = switch_baud(&link, fast_rates[i].baud_rate, fast_rates[i].speed);
+		if (status == 0)
+			break;
+		if (status == -2) {
+			fprintf(stderr, "Lost the controller trying %d baud\n", fast_rates[i].baud_rate);
+			goto out;
+		}
+	}
+	t_baud = now_ms();
+
+	if (command(&link, OP_DOWNLOAD_MINIDRIVER, NULL, 0, COMMAND_TIMEOUT, &status) < 0 || status) {
+		fprintf(stderr, "Download Minidriver failed\n");
+		goto out;
+	}
+
+	if (!cfg->no2bytes) {
+		while (link.rx_len < 2 && fill(&link, COMMAND_TIMEOUT) == 0)
+			;
+		link.rx_len = 0;
+	}
+
+	if (cfg->tosleep) {
+		usleep(cfg->tosleep);
+	}
+	t_minidriver = now_ms();
+
+	if (send_records(&link, data, records, count, &peak) < 0)
+		goto out;
+	t_download = now_ms();
+	download_baud = link.baud_rate;
+
+	/* The new firmware starts at the initial rate */
+	if (link.baud_rate != INIT_BAUD) {
+		set_speed(&link, B115200);
+		link.baud_rate = INIT_BAUD;
+	}
+	discard_input(&link);
+	if (reset(&link) < 0) {
+		fprintf(stderr, "No response to HCI Reset after launch\n");
+		goto out;
+	}
+	t_launch = now_ms();
+
+	fprintf(stderr, "Download phases (ms): reset %ld, baud %ld, minidriver %ld, download %ld, launch %ld, total %ld\n",
+		t_reset - t0, t_baud - t_reset, t_minidriver - t_baud, t_download - t_minidriver,
+		t_launch - t_download, t_launch - t0);
+	fprintf(stderr, "Downloaded %d commands, %d bytes at %d baud, up to %d outstanding\n",
+		count, size, download_baud, peak);
+	ret = 0;
+
+out:
+	if (link.baud_rate != INIT_BAUD)
+		restore_baud(&link);
+	free(records);
+	free(data);
+	return(ret);
+}
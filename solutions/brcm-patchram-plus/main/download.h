@@ -0,0 +1,37 @@
+/*****************************************************************************
+**
+**  Name:          download.h
+**
+**  Description:   Fast patchram download. The controller is moved to the
+**                 highest baud rate both sides can use before the download,
+**                 each switch is verified with a command at the new rate and
+**                 undone if it fails, and Write_RAM commands are sent as far
+**                 ahead as the controller's Num_HCI_Command_Packets allows.
+**
+******************************************************************************/
+
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include <termios.h>
+
+#define FAST_DOWNLOAD_DEFAULT_BAUD	3000000
+#define FAST_DOWNLOAD_DEFAULT_WINDOW	8
+
+typedef struct {
+	int max_baud;		/* Highest rate to try for the download */
+	int window;		/* Most commands outstanding, whatever the controller allows */
+	int no2bytes;
+	int tosleep;		/* Microseconds before the download */
+	int debug;
+} tFastDownload;
+
+/*
+ * Resets the controller, downloads the HCD file and launches it, leaving
+ * the controller and the UART at 115200 as after a legacy download.
+ * Prints the time of each phase on stderr. Returns 0 on success.
+ */
+int fast_download(int uart_fd, int hcd_fd, struct termios *termios,
+	const tFastDownload *cfg);
+
+#endif
@@ -81,6 +81,11 @@
 **                          do not generate these two bytes.>
 **						<--tosleep=number of microsseconds to sleep before
 **							patchram download begins.>
+**						<--fast_download[=max_baud_rate] downloads at the
+**							highest rate up to max_baud_rate (default
+**							3000000) that works, with commands pipelined.>
+**						<--window=number of commands outstanding at most
+**							in a fast download (default 8).>
 **						uart_device_name
 **
 **                 For example:
@@ -126,6 +131,8 @@
 #include <string.h>
 #include <signal.h>
 
+#include "download.h"
+
 #ifdef ANDROID
 #include <cutils/properties.h>
 #define LOG_TAG "brcm_patchram_plus"
@@ -166,6 +173,8 @@ int scopcm = 0;
 int i2s = 0;
 int no2bytes = 0;
 int tosleep = 0;
+int fast_baudrate = 0;
+int fast_window = FAST_DOWNLOAD_DEFAULT_WINDOW;
 
 struct termios termios;
 uchar buffer[1024];
@@ -393,6 +402,30 @@ parse_tosleep(char *optarg)
 	return(0);
 }
 
+int
+parse_fast_download(char *optarg)
+{
+	fast_baudrate = optarg ? atoi(optarg) : FAST_DOWNLOAD_DEFAULT_BAUD;
+
+	if (fast_baudrate <= 0) {
+		return(1);
+	}
+
+	return(0);
+}
+
+int
+parse_window(char *optarg)
+{
+	fast_window = atoi(optarg);
+
+	if (fast_window <= 0) {
+		return(1);
+	}
+
+	return(0);
+}
+
 void
 usage(char *argv0)
 {
@@ -435,6 +468,10 @@ usage(char *argv0)
 	printf("\t\tbefore starting patchram download. Newer chips\n");
 	printf("\t\tdo not generate these two bytes.>\n");
 	printf("\t<--tosleep=microseconds>\n");
+	printf("\t<--fast_download[=max_baud_rate]> - Downloads at the\n");
+	printf("\t\thighest rate that works, with commands pipelined\n");
+	printf("\t<--window=commands> - Most commands outstanding\n");
+	printf("\t\tin a fast download\n");
 	printf("\tuart_device_name\n");
 }
 
@@ -449,7 +486,8 @@ parse_cmd_line(int argc, char **argv)
 	PFI parse[] = { parse_patchram, parse_baudrate,
 		parse_bdaddr, parse_enable_lpm, parse_enable_hci,
 		parse_use_baudrate_for_download,
-		parse_scopcm, parse_i2s, parse_no2bytes, parse_tosleep};
+		parse_scopcm, parse_i2s, parse_no2bytes, parse_tosleep,
+		parse_fast_download, parse_window};
 
 	while (1) {
 		int this_option_optind = optind ? optind : 1;
@@ -466,6 +504,8 @@ parse_cmd_line(int argc, char **argv)
 			{"i2s", 1, 0, 0},
 			{"no2bytes", 0, 0, 0},
 			{"tosleep", 1, 0, 0},
+			{"fast_download", 2, 0, 0},
+			{"window", 1, 0, 0},
 			{0, 0, 0, 0}
 		};
 
@@ -664,6 +704,23 @@ proc_patchram()
 	proc_reset();
 }
 
+void
+proc_fast_download()
+{
+	tFastDownload cfg;
+
+	cfg.max_baud = fast_baudrate;
+	cfg.window = fast_window;
+	cfg.no2bytes = no2bytes;
+	cfg.tosleep = tosleep;
+	cfg.debug = debug;
+
+	if (fast_download(uart_fd, hcdfile_fd, &termios, &cfg)) {
+		fprintf(stderr, "Fast download failed\n");
+		exit(6);
+	}
+}
+
 void
 proc_baudrate()
 {
@@ -799,16 +856,20 @@ main (int argc, char **argv)
 
 	init_uart();
 
-	proc_reset();
+	if (fast_baudrate && hcdfile_fd > 0) {
+		proc_fast_download();
+	} else {
+		proc_reset();
 
-	if (use_baudrate_for_download) {
-		if (termios_baudrate) {
-			proc_baudrate();
+		if (use_baudrate_for_download) {
+			if (termios_baudrate) {
+				proc_baudrate();
+			}
 		}
-	}
 
-	if (hcdfile_fd > 0) {
-		proc_patchram();
+		if (hcdfile_fd > 0) {
+			proc_patchram();
+		}
 	}
 
 	if (termios_baudrate) {
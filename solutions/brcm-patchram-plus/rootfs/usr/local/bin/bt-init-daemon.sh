@@ -11,7 +11,9 @@ echo "[$DESC] Starting background init..."
 
 # Step 1: Load firmware
 echo "[$DESC] Loading firmware..."
-$PATCHRAM --no2bytes --patchram "$FIRMWARE" /dev/$HCI_DEV
+# Fast download at up to 3 Mbaud; the legacy one at 115200 if that fails
+$PATCHRAM --no2bytes --fast_download --patchram "$FIRMWARE" /dev/$HCI_DEV || \
+	$PATCHRAM --no2bytes --patchram "$FIRMWARE" /dev/$HCI_DEV
 echo "[$DESC] Firmware loaded."
 
 # Step 2: hciattach
@@ -1,4 +1,5 @@
 #include "../../components/sophgo/video/include/video_shm.h"
+#include "nal.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -28,6 +29,7 @@ constexpr int64_t MAX_DURATION_MS = 1 * 60 * 60 * 1000; // 1 hour
 class Recorder {
 private:
     std::string outputDir;
+    int channel;
     video_shm_consumer_t consumer;
     uint8_t* buffer;
     std::atomic<bool> running;
@@ -48,9 +50,9 @@ private:
     uint8_t detectedFps;
     std::string currentFilename;  // Store current recording filename
     
-    // SPS/PPS caching for codec configuration
-    std::vector<uint8_t> spsData;
-    std::vector<uint8_t> ppsData;
+    // Codec of the stream (from the frame metadata) and its [VPS/]SPS/PPS
+    nal::Codec codec;
+    nal::ParameterSets paramSets;
     bool codecConfigured;
     
     // Configuration
@@ -58,11 +60,6 @@ private:
     int videoHeight;
     int videoFramerate;
     
-    // H.264 NAL unit types
-    static const uint8_t NAL_TYPE_SPS = 7;
-    static const uint8_t NAL_TYPE_PPS = 8;
-    static const uint8_t NAL_TYPE_IDR = 5;
-    
     std::string generateFilename() {
         auto now = std::chrono::system_clock::now();
         auto time = std::chrono::system_clock::to_time_t(now);
@@ -71,92 +68,24 @@ private:
         return outputDir + "/" + buf;
     }
 
-    // Extract NAL units from frame data (Annex-B format)
-    void extractNALUnits(const uint8_t* data, int size) {
-        for (int i = 0; i <= size - 4; i++) {
-            bool isStartCode = false;
-            int startCodeLen = 0;
-            
-            if (data[i] == 0x00 && data[i+1] == 0x00) {
-                if (data[i+2] == 0x01) {
-                    isStartCode = true;
-                    startCodeLen = 3;
-                } else if (i + 3 < size && data[i+2] == 0x00 && data[i+3] == 0x01) {
-                    isStartCode = true;
-                    startCodeLen = 4;
-                }
-            }
-            
-            if (isStartCode && i + startCodeLen < size) {
-                uint8_t nalType = data[i + startCodeLen] & 0x1F;
-                
-                // Find next start code to determine NAL unit size
-                int nextStart = size;
-                for (int j = i + startCodeLen; j < size - 4; j++) {
-                    if ((data[j] == 0x00 && data[j+1] == 0x00 && data[j+2] == 0x01) ||
-                        (data[j] == 0x00 && data[j+1] == 0x00 && data[j+2] == 0x00 && data[j+3] == 0x01)) {
-                        nextStart = j;
-                        break;
-                    }
-                }
-                
-                int nalSize = nextStart - i;
-                
-                if (nalType == NAL_TYPE_SPS && spsData.empty()) {
-                    // Store NAL unit without start code
-                    spsData.assign(data + i + startCodeLen, data + i + nalSize);
-                } else if (nalType == NAL_TYPE_PPS && ppsData.empty()) {
-                    // Store NAL unit without start code
-                    ppsData.assign(data + i + startCodeLen, data + i + nalSize);
-                }
-                
-                i += nalSize - 1;
-            }
-        }
-    }
-
     bool configureCodec() {
-        if (codecConfigured || spsData.empty() || ppsData.empty()) {
+        if (codecConfigured || !paramSets.complete(codec)) {
             return codecConfigured;
         }
 
-        // Create extradata with SPS and PPS
-        size_t extradataSize = spsData.size() + ppsData.size() + 100; // Extra space for headers
-        uint8_t* extradata = (uint8_t*)av_malloc(extradataSize);
-        if (!extradata) {
-            std::cerr << "Failed to allocate extradata" << std::endl;
+        // Build avcC (H.264) or hvcC (H.265) extradata
+        std::vector<uint8_t> record = codec == nal::Codec::H265 ? nal::buildHvcC(paramSets) : nal::buildAvcC(paramSets);
+        if (record.empty()) {
+            std::cerr << "Invalid parameter sets, cannot build codec configuration" << std::endl;
             return false;
         }
-
-        // Build avcC format extradata
-        uint8_t* p = extradata;
-        *p++ = 1; // configurationVersion
-        *p++ = spsData[1]; // AVCProfileIndication
-        *p++ = spsData[2]; // profile_compatibility
-        *p++ = spsData[3]; // AVCLevelIndication
-        *p++ = 0xFF; // lengthSizeMinusOne (4 bytes)
-        
-        // SPS
-        *p++ = 0xE1; // numOfSequenceParameterSets (1)
-        *p++ = (spsData.size() >> 8) & 0xFF;
-        *p++ = spsData.size() & 0xFF;
-        memcpy(p, spsData.data(), spsData.size());
-        p += spsData.size();
-        
-        // PPS
-        *p++ = 1; // numOfPictureParameterSets
-        *p++ = (ppsData.size() >> 8) & 0xFF;
-        *p++ = ppsData.size() & 0xFF;
-        memcpy(p, ppsData.data(), ppsData.size());
-        p += ppsData.size();
-
-        int extradataActualSize = p - extradata;
+        const uint8_t* extradata = record.data();
+        int extradataActualSize = record.size();
 
         // Set extradata for stream codecpar
         videoStream->codecpar->extradata = (uint8_t*)av_malloc(extradataActualSize + AV_INPUT_BUFFER_PADDING_SIZE);
         if (!videoStream->codecpar->extradata) {
             std::cerr << "Failed to allocate stream extradata" << std::endl;
-            av_free(extradata);
             return false;
         }
         memcpy(videoStream->codecpar->extradata, extradata, extradataActualSize);
@@ -170,16 +99,12 @@ private:
             av_free(videoStream->codecpar->extradata);
             videoStream->codecpar->extradata = nullptr;
             videoStream->codecpar->extradata_size = 0;
-            av_free(extradata);
             return false;
         }
         memcpy(codecCtx->extradata, extradata, extradataActualSize);
         memset(codecCtx->extradata + extradataActualSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
         codecCtx->extradata_size = extradataActualSize;
 
-        // Free the temporary buffer
-        av_free(extradata);
-
         codecConfigured = true;
         return true;
     }
@@ -202,30 +127,31 @@ private:
         }
         videoStream->id = formatCtx->nb_streams - 1;
 
+        AVCodecID codecId = codec == nal::Codec::H265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+
         // Configure stream codec parameters directly
         videoStream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-        videoStream->codecpar->codec_id = AV_CODEC_ID_H264;
+        videoStream->codecpar->codec_id = codecId;
         videoStream->codecpar->width = videoWidth;
         videoStream->codecpar->height = videoHeight;
         videoStream->codecpar->format = AV_PIX_FMT_YUV420P;
+        if (codec == nal::Codec::H265) {
+            // hvc1: parameter sets only in hvcC, which is what Apple players require
+            videoStream->codecpar->codec_tag = MKTAG('h', 'v', 'c', '1');
+        }
         
         // Set time base for 30 fps
-        videoStream->time_base = (AVRational){1, 90000}; // Use 90kHz timebase for H.264
-
-        // Allocate codec context for later use
-        const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-        if (!codec) {
-            std::cerr << "H.264 codec not found" << std::endl;
-            return false;
-        }
+        videoStream->time_base = (AVRational){1, 90000}; // Use 90kHz timebase for H.264/H.265
 
-        codecCtx = avcodec_alloc_context3(codec);
+        // Allocate codec context for later use. Muxing does not decode, so
+        // a libavcodec built without the decoder is fine.
+        codecCtx = avcodec_alloc_context3(avcodec_find_decoder(codecId));
         if (!codecCtx) {
             std::cerr << "Failed to allocate codec context" << std::endl;
             return false;
         }
 
-        codecCtx->codec_id = AV_CODEC_ID_H264;
+        codecCtx->codec_id = codecId;
         codecCtx->codec_type = AVMEDIA_TYPE_VIDEO;
         codecCtx->width = videoWidth;
         codecCtx->height = videoHeight;
@@ -233,8 +159,8 @@ private:
         codecCtx->framerate = (AVRational){videoFramerate, 1};
         codecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
 
-        // Configure codec if we already have SPS/PPS
-        if (!spsData.empty() && !ppsData.empty()) {
+        // Configure codec if we already have the parameter sets
+        if (paramSets.complete(codec)) {
             if (!configureCodec()) {
                 return false;
             }
@@ -305,66 +231,12 @@ private:
         return true;
     }
 
-    // Convert Annex-B NAL units to AVCC format (length-prefixed)
-    int convertAnnexBToAvcc(const uint8_t* annexb, int size, uint8_t* avcc) {
-        int outPos = 0;
-        int i = 0;
-
-        while (i < size) {
-            // Find start code
-            int startCodeLen = 0;
-            if (i + 2 < size && annexb[i] == 0 && annexb[i+1] == 0 && annexb[i+2] == 1) {
-                startCodeLen = 3;
-            } else if (i + 3 < size && annexb[i] == 0 && annexb[i+1] == 0 && annexb[i+2] == 0 && annexb[i+3] == 1) {
-                startCodeLen = 4;
-            }
-
-            if (startCodeLen == 0) {
-                i++;
-                continue;
-            }
-
-            i += startCodeLen;
-            int nalStart = i;
-
-            // Find next start code to determine NAL size
-            int nalEnd = size;
-            for (int j = i; j < size - 2; j++) {
-                if ((j + 2 < size && annexb[j] == 0 && annexb[j+1] == 0 && annexb[j+2] == 1) ||
-                    (j + 3 < size && annexb[j] == 0 && annexb[j+1] == 0 && annexb[j+2] == 0 && annexb[j+3] == 1)) {
-                    nalEnd = j;
-                    break;
-                }
-            }
-
-            int nalSize = nalEnd - nalStart;
-            if (nalSize > 0) {
-                // Skip SPS/PPS in stream (they're in extradata)
-                uint8_t nalType = annexb[nalStart] & 0x1F;
-                if (nalType != NAL_TYPE_SPS && nalType != NAL_TYPE_PPS) {
-                    // Write length prefix (4 bytes, big-endian)
-                    avcc[outPos++] = (nalSize >> 24) & 0xFF;
-                    avcc[outPos++] = (nalSize >> 16) & 0xFF;
-                    avcc[outPos++] = (nalSize >> 8) & 0xFF;
-                    avcc[outPos++] = nalSize & 0xFF;
-                    
-                    // Copy NAL data
-                    memcpy(avcc + outPos, annexb + nalStart, nalSize);
-                    outPos += nalSize;
-                }
-            }
-
-            i = nalEnd;
-        }
-
-        return outPos;
-    }
-
 public:
-    Recorder(const std::string& dir) 
-        : outputDir(dir), buffer(nullptr), running(false), consumerInitialized(false),
+    Recorder(const std::string& dir, int ch) 
+        : outputDir(dir), channel(ch), buffer(nullptr), running(false), consumerInitialized(false),
           formatCtx(nullptr), videoStream(nullptr), codecCtx(nullptr), packet(nullptr),
-          bytesWritten(0), frameCount(0), firstFrameTimestamp(0), lastDts(0), detectedFps(30), codecConfigured(false),
+          bytesWritten(0), frameCount(0), firstFrameTimestamp(0), lastDts(0), detectedFps(30),
+          codec(nal::Codec::H264), codecConfigured(false),
           videoWidth(1920), videoHeight(1080), videoFramerate(30) {
         memset(&consumer, 0, sizeof(consumer));
     }
@@ -378,7 +250,7 @@ public:
         mkdir(outputDir.c_str(), 0755);
 
         // Initialize consumer
-        if (video_shm_consumer_init(&consumer) != 0) {
+        if (video_shm_consumer_init_channel(&consumer, channel) != 0) {
             std::cerr << "Failed to initialize consumer" << std::endl;
             return false;
         }
@@ -432,7 +304,7 @@ public:
 
     void run() {
         video_frame_meta_t meta;
-        std::cout << "Recorder started. Waiting for SPS/PPS and keyframe..." << std::endl;
+        std::cout << "Recorder started on CH" << channel << ". Waiting for parameter sets and keyframe..." << std::endl;
 
         bool fileCreated = false;
         uint8_t* avccBuffer = (uint8_t*)malloc(VIDEO_SHM_MAX_FRAME_SIZE * 2);
@@ -454,16 +326,38 @@ public:
                 continue; // Timeout
             }
 
-            // Extract SPS/PPS if we don't have them yet
-            if (spsData.empty() || ppsData.empty()) {
-                extractNALUnits(buffer, frameSize);
+            if (meta.codec != VIDEO_SHM_CODEC_H264 && meta.codec != VIDEO_SHM_CODEC_H265) {
+                continue; // Not a video stream this recorder can mux
+            }
+
+            // The streamer was restarted with another codec: the sample
+            // entry cannot change within a file, so start a new one
+            nal::Codec frameCodec = static_cast<nal::Codec>(meta.codec);
+            if (frameCodec != codec) {
+                if (fileCreated) {
+                    std::cout << "Codec changed, closing " << currentFilename << std::endl;
+                    closeOutputFile();
+                    fileCreated = false;
+                }
+                codec = frameCodec;
+                paramSets.clear();
+            }
+
+            // Extract the parameter sets if we don't have them yet
+            if (!paramSets.complete(codec)) {
+                paramSets.collect(codec, buffer, frameSize);
             }
 
             // Wait for keyframe and codec configuration before starting file
             if (!fileCreated) {
-                if (meta.is_keyframe != 1 || spsData.empty() || ppsData.empty()) {
+                if (meta.is_keyframe != 1 || !paramSets.complete(codec)) {
                     continue;
                 }
+
+                if (meta.width > 0 && meta.height > 0) {
+                    videoWidth = meta.width;
+                    videoHeight = meta.height;
+                }
                 
                 // Capture FPS from frame metadata and update configuration
                 if (meta.fps > 0) {
@@ -478,11 +372,13 @@ public:
                     return;
                 }
                 fileCreated = true;
-                std::cout << "Recording started: " << currentFilename << std::endl;
+                std::cout << "Recording started: " << currentFilename << " ("
+                          << (codec == nal::Codec::H265 ? "H.265" : "H.264") << ", "
+                          << videoWidth << "x" << videoHeight << ")" << std::endl;
             }
 
-            // Configure codec with SPS/PPS if not already done
-            if (!codecConfigured && !spsData.empty() && !ppsData.empty()) {
+            // Configure codec with the parameter sets if not already done
+            if (!codecConfigured && paramSets.complete(codec)) {
                 if (!configureCodec()) {
                     std::cerr << "Failed to configure codec" << std::endl;
                     free(avccBuffer);
@@ -507,8 +403,8 @@ public:
                 }
             }
 
-            // Convert Annex-B to AVCC format
-            int avccSize = convertAnnexBToAvcc(buffer, frameSize, avccBuffer);
+            // Convert Annex-B to length-prefixed samples (AVCC / HVCC)
+            int avccSize = nal::toLengthPrefixed(codec, buffer, frameSize, avccBuffer);
             if (avccSize <= 0) {
                 continue; // Skip frames with no valid NAL units
             }
@@ -534,7 +430,7 @@ public:
             int64_t relativeTimeMs = meta.timestamp_ms - firstFrameTimestamp;
             int64_t pts = relativeTimeMs * 90;
             
-            // For H.264 streams without B-frames (typical for camera), DTS = PTS
+            // For streams without B-frames (typical for camera), DTS = PTS
             // Ensure monotonically increasing DTS to avoid decoder errors
             int64_t dts = pts;
             if (dts <= lastDts) {
@@ -591,6 +487,7 @@ void signalHandler(int sig) {
 
 int main(int argc, char* argv[]) {
     std::string outputDir;
+    int channel = 0;
     
     // Simple argument parsing
     bool userSpecifiedDir = false;
@@ -598,9 +495,15 @@ int main(int argc, char* argv[]) {
         if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
             outputDir = argv[++i];
             userSpecifiedDir = true;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            channel = atoi(argv[++i]);
+            if (channel < 0 || channel > 2) {
+                std::cerr << "Invalid channel: " << argv[i] << " (0-2)" << std::endl;
+                return 1;
+            }
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
-            std::cout << "Usage: " << argv[0] << " [-o output_dir]" << std::endl;
-            std::cout << "Default: /mnt/sd (or /userdata/video if SD card not mounted)" << std::endl;
+            std::cout << "Usage: " << argv[0] << " [-o output_dir] [-c channel]" << std::endl;
+            std::cout << "Default: /mnt/sd (or /userdata/video if SD card not mounted), channel 0" << std::endl;
             return 0;
         }
     }
@@ -622,7 +525,7 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    Recorder recorder(outputDir);
+    Recorder recorder(outputDir, channel);
     g_recorder = &recorder;
 
     // Setup signal handlers
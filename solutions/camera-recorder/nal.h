@@ -0,0 +1,348 @@
+// H.264 / H.265 Annex-B helpers for camera-recorder.
+//
+// Splits the frames camera-streamer writes to shared memory into NAL units,
+// keeps the parameter sets, builds the avcC / hvcC records that go into the
+// MP4 sample entry and converts the rest to length-prefixed samples. Has no
+// libav dependency so that tools/hevc-check can test it on the host.
+
+#ifndef CAMERA_RECORDER_NAL_H
+#define CAMERA_RECORDER_NAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace nal {
+
+// Same values as video_frame_meta_t.codec
+enum class Codec : uint8_t {
+    H264 = 0,
+    H265 = 1,
+};
+
+// H.264 NAL unit types
+static const int H264_IDR = 5;
+static const int H264_SPS = 7;
+static const int H264_PPS = 8;
+
+// H.265 NAL unit types
+static const int H265_IRAP_FIRST = 16;  // BLA_W_LP
+static const int H265_IRAP_LAST  = 23;  // RSV_IRAP_VCL23
+static const int H265_VPS        = 32;
+static const int H265_SPS        = 33;
+static const int H265_PPS        = 34;
+
+inline int type(Codec codec, const uint8_t* nal) {
+    return codec == Codec::H265 ? (nal[0] >> 1) & 0x3F : nal[0] & 0x1F;
+}
+
+inline bool isParameterSet(Codec codec, int t) {
+    if (codec == Codec::H265) {
+        return t == H265_VPS || t == H265_SPS || t == H265_PPS;
+    }
+    return t == H264_SPS || t == H264_PPS;
+}
+
+inline bool isKeyframe(Codec codec, int t) {
+    if (codec == Codec::H265) {
+        return t >= H265_IRAP_FIRST && t <= H265_IRAP_LAST;
+    }
+    return t == H264_IDR;
+}
+
+// Calls fn(nal, size) for each NAL unit of an Annex-B buffer, without its
+// start code and trailing zero bytes
+template <typename F>
+void forEach(const uint8_t* data, size_t size, F fn) {
+    size_t i = 0, start = 0;
+    bool found = false;
+
+    while (i + 3 <= size) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (found) {
+                size_t end = i;
+                while (end > start && data[end - 1] == 0) {
+                    end--;
+                }
+                if (end > start) {
+                    fn(data + start, end - start);
+                }
+            }
+            i += 3;
+            start = i;
+            found = true;
+        } else if (data[i + 2] > 1) {
+            i += 3;
+        } else {
+            i++;
+        }
+    }
+    if (found && start < size) {
+        size_t end = size;
+        while (end > start && data[end - 1] == 0) {
+            end--;
+        }
+        if (end > start) {
+            fn(data + start, end - start);
+        }
+    }
+}
+
+// Parameter sets of a stream; the first of each kind is kept
+struct ParameterSets {
+    std::vector<uint8_t> vps;
+    std::vector<uint8_t> sps;
+    std::vector<uint8_t> pps;
+
+    void collect(Codec codec, const uint8_t* data, size_t size) {
+        forEach(data, size, [&](const uint8_t* n, size_t len) {
+            int t = type(codec, n);
+            if (codec == Codec::H265 && t == H265_VPS && vps.empty()) {
+                vps.assign(n, n + len);
+            } else if (t == (codec == Codec::H265 ? H265_SPS : H264_SPS) && sps.empty()) {
+                sps.assign(n, n + len);
+            } else if (t == (codec == Codec::H265 ? H265_PPS : H264_PPS) && pps.empty()) {
+                pps.assign(n, n + len);
+            }
+        });
+    }
+
+    bool complete(Codec codec) const {
+        return !sps.empty() && !pps.empty() && (codec != Codec::H265 || !vps.empty());
+    }
+
+    void clear() {
+        vps.clear();
+        sps.clear();
+        pps.clear();
+    }
+};
+
+// Reads the RBSP of a NAL unit, skipping emulation prevention bytes
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) {
+        rbsp_.reserve(size);
+        int zeros = 0;
+        for (size_t i = 0; i < size; i++) {
+            if (zeros >= 2 && data[i] == 3) {
+                zeros = 0;  // 00 00 03 -> 00 00
+                continue;
+            }
+            zeros = data[i] == 0 ? zeros + 1 : 0;
+            rbsp_.push_back(data[i]);
+        }
+    }
+
+    uint32_t bits(int n) {
+        uint32_t v = 0;
+        while (n-- > 0) {
+            if (pos_ >= rbsp_.size() * 8) {
+                error_ = true;
+                return 0;
+            }
+            v = (v << 1) | ((rbsp_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1);
+            pos_++;
+        }
+        return v;
+    }
+
+    void skip(size_t n) {
+        pos_ += n;
+        if (pos_ > rbsp_.size() * 8) {
+            error_ = true;
+        }
+    }
+
+    uint32_t ue() {
+        int leading = 0;
+        while (bits(1) == 0) {
+            if (error_ || ++leading > 31) {
+                error_ = true;
+                return 0;
+            }
+        }
+        return leading ? (1u << leading) - 1 + bits(leading) : 0;
+    }
+
+    bool error() const {
+        return error_;
+    }
+
+private:
+    std::vector<uint8_t> rbsp_;
+    size_t pos_ = 0;
+    bool error_ = false;
+};
+
+// The fields of an H.265 SPS that hvcC repeats
+struct HevcSps {
+    uint8_t profile_space;
+    uint8_t tier_flag;
+    uint8_t profile_idc;
+    uint32_t profile_compatibility_flags;
+    uint8_t constraint_indicator_flags[6];
+    uint8_t level_idc;
+    uint8_t max_sub_layers;
+    uint8_t temporal_id_nesting;
+    uint8_t chroma_format_idc;
+    uint8_t bit_depth_luma_minus8;
+    uint8_t bit_depth_chroma_minus8;
+    uint32_t width;  // Cropped by the conformance window
+    uint32_t height;
+};
+
+inline bool parseHevcSps(const uint8_t* nal, size_t size, HevcSps& sps) {
+    if (size < 4) {
+        return false;
+    }
+    BitReader r(nal + 2, size - 2);  // After the NAL unit header
+
+    r.bits(4);  // sps_video_parameter_set_id
+    int max_sub_layers_minus1 = r.bits(3);
+    sps.max_sub_layers        = max_sub_layers_minus1 + 1;
+    sps.temporal_id_nesting   = r.bits(1);
+
+    // profile_tier_level(1, sps_max_sub_layers_minus1)
+    sps.profile_space               = r.bits(2);
+    sps.tier_flag                   = r.bits(1);
+    sps.profile_idc                 = r.bits(5);
+    sps.profile_compatibility_flags = r.bits(32);
+    for (int i = 0; i < 6; i++) {
+        sps.constraint_indicator_flags[i] = r.bits(8);
+    }
+    sps.level_idc = r.bits(8);
+
+    bool profile_present[8] = {false}, level_present[8] = {false};
+    for (int i = 0; i < max_sub_layers_minus1; i++) {
+        profile_present[i] = r.bits(1);
+        level_present[i]   = r.bits(1);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        for (int i = max_sub_layers_minus1; i < 8; i++) {
+            r.bits(2);  // reserved_zero_2bits
+        }
+    }
+    for (int i = 0; i < max_sub_layers_minus1; i++) {
+        if (profile_present[i]) {
+            r.skip(88);
+        }
+        if (level_present[i]) {
+            r.skip(8);
+        }
+    }
+
+    r.ue();  // sps_seq_parameter_set_id
+    uint32_t chroma_format_idc = r.ue();
+    if (chroma_format_idc > 3) {
+        return false;
+    }
+    sps.chroma_format_idc = chroma_format_idc;
+    if (sps.chroma_format_idc == 3) {
+        r.bits(1);  // separate_colour_plane_flag
+    }
+    uint32_t width  = r.ue();
+    uint32_t height = r.ue();
+    if (r.bits(1)) {  // conformance_window_flag
+        uint32_t sub_width  = sps.chroma_format_idc == 1 || sps.chroma_format_idc == 2 ? 2 : 1;
+        uint32_t sub_height = sps.chroma_format_idc == 1 ? 2 : 1;
+        uint32_t left = r.ue(), right = r.ue(), top = r.ue(), bottom = r.ue();
+        width -= sub_width * (left + right);
+        height -= sub_height * (top + bottom);
+    }
+    sps.width                   = width;
+    sps.height                  = height;
+    uint32_t bit_depth_luma_minus8   = r.ue();
+    uint32_t bit_depth_chroma_minus8 = r.ue();
+    sps.bit_depth_luma_minus8        = bit_depth_luma_minus8;
+    sps.bit_depth_chroma_minus8      = bit_depth_chroma_minus8;
+
+    return !r.error() && bit_depth_luma_minus8 <= 7 && bit_depth_chroma_minus8 <= 7;
+}
+
+// AVCDecoderConfigurationRecord (ISO/IEC 14496-15, 5.3.3.1)
+inline std::vector<uint8_t> buildAvcC(const ParameterSets& ps) {
+    std::vector<uint8_t> out;
+    if (ps.sps.size() < 4 || ps.pps.empty()) {
+        return out;
+    }
+    out.push_back(1);          // configurationVersion
+    out.push_back(ps.sps[1]);  // AVCProfileIndication
+    out.push_back(ps.sps[2]);  // profile_compatibility
+    out.push_back(ps.sps[3]);  // AVCLevelIndication
+    out.push_back(0xFF);       // lengthSizeMinusOne (4 bytes)
+    out.push_back(0xE1);       // numOfSequenceParameterSets (1)
+    out.push_back((ps.sps.size() >> 8) & 0xFF);
+    out.push_back(ps.sps.size() & 0xFF);
+    out.insert(out.end(), ps.sps.begin(), ps.sps.end());
+    out.push_back(1);  // numOfPictureParameterSets
+    out.push_back((ps.pps.size() >> 8) & 0xFF);
+    out.push_back(ps.pps.size() & 0xFF);
+    out.insert(out.end(), ps.pps.begin(), ps.pps.end());
+    return out;
+}
+
+// HEVCDecoderConfigurationRecord (ISO/IEC 14496-15, 8.3.3.1), with one
+// VPS, SPS and PPS marked complete so that samples need not repeat them
+inline std::vector<uint8_t> buildHvcC(const ParameterSets& ps) {
+    std::vector<uint8_t> out;
+    HevcSps sps;
+    if (ps.vps.empty() || ps.pps.empty() || !parseHevcSps(ps.sps.data(), ps.sps.size(), sps)) {
+        return out;
+    }
+
+    out.push_back(1);  // configurationVersion
+    out.push_back((sps.profile_space << 6) | (sps.tier_flag << 5) | sps.profile_idc);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back((sps.profile_compatibility_flags >> shift) & 0xFF);
+    }
+    out.insert(out.end(), sps.constraint_indicator_flags, sps.constraint_indicator_flags + 6);
+    out.push_back(sps.level_idc);
+    out.push_back(0xF0);  // min_spatial_segmentation_idc = 0
+    out.push_back(0x00);
+    out.push_back(0xFC);  // parallelismType = 0 (unknown)
+    out.push_back(0xFC | sps.chroma_format_idc);
+    out.push_back(0xF8 | sps.bit_depth_luma_minus8);
+    out.push_back(0xF8 | sps.bit_depth_chroma_minus8);
+    out.push_back(0);  // avgFrameRate = 0 (unspecified)
+    out.push_back(0);
+    // constantFrameRate = 0, numTemporalLayers, temporalIdNested, lengthSizeMinusOne = 3
+    out.push_back((sps.max_sub_layers << 3) | (sps.temporal_id_nesting << 2) | 3);
+
+    const std::vector<uint8_t>* arrays[] = {&ps.vps, &ps.sps, &ps.pps};
+    const int types[]                    = {H265_VPS, H265_SPS, H265_PPS};
+    out.push_back(3);  // numOfArrays
+    for (int i = 0; i < 3; i++) {
+        out.push_back(0x80 | types[i]);  // array_completeness = 1
+        out.push_back(0);                // numNalus = 1
+        out.push_back(1);
+        out.push_back((arrays[i]->size() >> 8) & 0xFF);
+        out.push_back(arrays[i]->size() & 0xFF);
+        out.insert(out.end(), arrays[i]->begin(), arrays[i]->end());
+    }
+    return out;
+}
+
+// Converts Annex-B to 4-byte length-prefixed NAL units, leaving out the
+// parameter sets (they are in the sample entry). out must hold size + 4
+// bytes per NAL unit; returns the bytes written.
+inline size_t toLengthPrefixed(Codec codec, const uint8_t* data, size_t size, uint8_t* out) {
+    size_t pos = 0;
+    forEach(data, size, [&](const uint8_t* n, size_t len) {
+        if (isParameterSet(codec, type(codec, n))) {
+            return;
+        }
+        out[pos++] = (len >> 24) & 0xFF;
+        out[pos++] = (len >> 16) & 0xFF;
+        out[pos++] = (len >> 8) & 0xFF;
+        out[pos++] = len & 0xFF;
+        memcpy(out + pos, n, len);
+        pos += len;
+    });
+    return pos;
+}
+
+}  // namespace nal
+
+#endif  // CAMERA_RECORDER_NAL_H
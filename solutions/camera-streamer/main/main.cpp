@@ -1,6 +1,7 @@
+#include <algorithm>
 #include <chrono>
 #include <iostream>
-#include <set>
+#include <map>
 #include <queue>
 #include <mutex>
 #include <string.h>
@@ -27,17 +28,52 @@ extern "C" {
 #define NUM_CHANNELS 3     // CH0, CH1, CH2
 #define POLL_TIMEOUT_MS 10 // Mongoose poll timeout
 #define MAX_FRAMES_PER_BATCH 3 // Process up to 10 frames per channel per iteration
+#define WS_MORE_SLICES 0x80    // Channel ID flag: more slices of the frame follow
+#define LATENCY_REPORT_MS 10000
+
+// Queued NAL unit, with the frame it belongs to
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    uint32_t frame_size;    // Whole frame
+    uint8_t temporal_id;
+    bool keyframe;
+    bool frame_start;       // First NAL unit of the frame
+    bool frame_end;         // Last NAL unit of the frame
+    uint64_t pts;           // Capture time, on the getVideoPts() clock
+} queued_frame_t;
+
+// Per-client state: which temporal layers the client keeps up with
+typedef struct {
+    video_temporal_selector_t selector;
+    bool send;              // Decision for the current frame
+} client_state_t;
 
 // Per-channel state structure
 typedef struct {
     video_ch_index_t channel_id;
     video_ch_param_t params;
-    std::queue<std::pair<uint8_t*, size_t>> frame_queue;
+    uint8_t temporal_layers;
+    video_temporal_position_t temporal_position;
+    uint8_t slices;
+    // Frame the encoder is handing out, touched only by the callback
+    video_slice_tracker_t slice_tracker;
+    bool frame_keyframe;
+    uint8_t frame_temporal_id;
+    uint64_t frame_timestamp;    // Of the first slice, sent with every slice
+    uint32_t frame_sizes[2];     // Last non-key and key frame, for frames still coming out
+    std::vector<uint8_t> shm_frame;  // Slices of the frame, written to shared memory at its end
+    // Glass-to-socket latency, in microseconds
+    uint64_t latency_first_sum, latency_first_max;
+    uint64_t latency_end_sum, latency_end_max;
+    uint32_t latency_frames;
+    std::queue<queued_frame_t> frame_queue;
     std::mutex queue_mutex;
-    std::set<struct mg_connection*> ws_clients;
+    std::map<struct mg_connection*, client_state_t> ws_clients;
     std::mutex clients_mutex;
     video_shm_producer_t shm_producer;
     bool shm_enabled;
+    std::vector<uint8_t> vps_cache;  // Cache VPS for keyframes (H.265 only)
     std::vector<uint8_t> sps_cache;  // Cache SPS for keyframes
     std::vector<uint8_t> pps_cache;  // Cache PPS for keyframes
     std::mutex header_mutex;
@@ -46,6 +82,8 @@ typedef struct {
 static volatile bool g_running = true;
 static struct mg_mgr g_mgr;
 static channel_state_t g_channels[NUM_CHANNELS];
+static unsigned long g_wakeup_id = 0;  // Connection woken up when a frame is queued
+static bool g_latency = false;
 
 // Signal handler for graceful shutdown
 static void signal_handler(int signo) {
@@ -55,6 +93,11 @@ static void signal_handler(int signo) {
     }
 }
 
+static uint64_t monotonic_ms() {
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+}
+
 // Helper function to parse WebSocket channel parameter
 static int parse_channel_param(struct mg_http_message *hm) {
     char channel_str[8] = {0};
@@ -106,7 +149,9 @@ static void ws_handler(struct mg_connection *c, int ev, void *ev_data) {
     } else if (ev == MG_EV_WS_OPEN) {
         int channel = get_connection_channel(c);
         std::lock_guard<std::mutex> lock(g_channels[channel].clients_mutex);
-        g_channels[channel].ws_clients.insert(c);
+        client_state_t& client = g_channels[channel].ws_clients[c];
+        video_temporal_selector_init(&client.selector, g_channels[channel].temporal_layers);
+        client.send = false;
         printf("%s: WebSocket client connected to CH%d (%zu total)\n", 
                TAG, channel, g_channels[channel].ws_clients.size());
     } else if (ev == MG_EV_CLOSE || ev == MG_EV_ERROR) {
@@ -124,7 +169,71 @@ static void ws_handler(struct mg_connection *c, int ev, void *ev_data) {
     }
 }
 
-// Video frame callback - queues frames for main thread to send
+// NAL unit kinds the callback cares about, for either codec
+typedef enum {
+    PACK_VPS,
+    PACK_SPS,
+    PACK_PPS,
+    PACK_KEYFRAME,
+    PACK_OTHER
+} pack_kind_t;
+
+static pack_kind_t classify_pack(const channel_state_t* channel, const VENC_PACK_S* ppack) {
+    if (channel->params.format == VIDEO_FORMAT_H265) {
+        switch (ppack->DataType.enH265EType) {
+            case H265E_NALU_VPS:      return PACK_VPS;
+            case H265E_NALU_SPS:      return PACK_SPS;
+            case H265E_NALU_PPS:      return PACK_PPS;
+            case H265E_NALU_IDRSLICE:
+            case H265E_NALU_ISLICE:   return PACK_KEYFRAME;
+            default:                  return PACK_OTHER;
+        }
+    }
+    switch (ppack->DataType.enH264EType) {
+        case H264E_NALU_SPS:      return PACK_SPS;
+        case H264E_NALU_PPS:      return PACK_PPS;
+        case H264E_NALU_IDRSLICE:
+        case H264E_NALU_ISLICE:   return PACK_KEYFRAME;
+        default:                  return PACK_OTHER;
+    }
+}
+
+static const char* codec_name(video_format_t format) {
+    return format == VIDEO_FORMAT_H265 ? "H.265" : "H.264";
+}
+
+// Writes a frame to shared memory (zero-copy for local apps)
+static void write_shm_frame(channel_state_t* channel, const uint8_t* data, uint32_t len, bool keyframe,
+                            uint8_t temporal_id, uint64_t timestamp) {
+    video_frame_meta_t meta = {0};
+    meta.timestamp_ms = timestamp;
+    meta.size = len;
+    meta.is_keyframe = keyframe ? 1 : 0;
+    meta.codec = channel->params.format == VIDEO_FORMAT_H265 ? VIDEO_SHM_CODEC_H265 : VIDEO_SHM_CODEC_H264;
+    meta.width = channel->params.width;
+    meta.height = channel->params.height;
+    meta.fps = channel->params.fps;
+    meta.temporal_id = temporal_id;
+    meta.temporal_layers = channel->temporal_layers;
+
+    if (video_shm_producer_write(&channel->shm_producer, data, len, &meta) < 0) {
+        printf("%s: WARNING: Failed to write frame to shared memory CH%d\n", 
+               TAG, channel->channel_id);
+    }
+}
+
+// Ends the frame being handed out, once its last slice has come
+static void end_frame(channel_state_t* channel) {
+    channel->frame_sizes[channel->frame_keyframe ? 1 : 0] = channel->slice_tracker.last_size;
+    if (channel->slices > 1 && channel->shm_enabled && !channel->shm_frame.empty()) {
+        write_shm_frame(channel, channel->shm_frame.data(), channel->shm_frame.size(), channel->frame_keyframe,
+                        channel->frame_temporal_id, channel->frame_timestamp);
+    }
+    channel->shm_frame.clear();
+}
+
+// Video frame callback - queues frames for main thread to send. Called once
+// per frame, or once per slice on channels with slices.
 static int video_frame_callback(void* pData, void* pArgs, void* pUserData) {
     VENC_STREAM_S* pstStream = (VENC_STREAM_S*)pData;
     channel_state_t* channel = (channel_state_t*)pUserData;
@@ -138,46 +247,97 @@ static int video_frame_callback(void* pData, void* pArgs, void* pUserData) {
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
     uint64_t timestamp = static_cast<uint64_t>(ms);
 
+    bool is_h265 = (channel->params.format == VIDEO_FORMAT_H265);
+    bool sliced = (channel->slices > 1);
+    uint64_t pts = pstStream->pstPack[0].u64PTS;
+    bool stream_end = pstStream->pstPack[pstStream->u32PackCount - 1].bFrameEnd;
+    bool stream_keyframe = false;
+    uint32_t stream_size = 0;
+    int last_sent = -1;  // Last pack that goes out, not a parameter set
+    for (CVI_U32 i = 0; i < pstStream->u32PackCount; i++) {
+        VENC_PACK_S* ppack = &pstStream->pstPack[i];
+        pack_kind_t kind = classify_pack(channel, ppack);
+        stream_keyframe |= (kind == PACK_KEYFRAME);
+        stream_size += ppack->u32Len - ppack->u32Offset;
+        if (kind == PACK_KEYFRAME || kind == PACK_OTHER) {
+            last_sent = (int)i;
+        }
+    }
+
+    // Temporal layer of the frame, counted from its keyframe. Every slice of
+    // a keyframe is a key slice, so the first one tells.
+    int slice_flags = video_slice_begin(&channel->slice_tracker, pts);
+    if (slice_flags & VIDEO_SLICE_CLOSED) {
+        end_frame(channel);
+    }
+    bool frame_start = (slice_flags & VIDEO_SLICE_START) != 0;
+    bool need_params = frame_start;
+    if (frame_start) {
+        channel->frame_timestamp = timestamp;
+        channel->frame_keyframe = stream_keyframe;
+        channel->frame_temporal_id = video_temporal_next(channel->temporal_layers, &channel->temporal_position,
+                                                         stream_keyframe, pts);
+    }
+    timestamp = channel->frame_timestamp;
+    bool frame_is_keyframe = channel->frame_keyframe;
+    uint8_t temporal_id = channel->frame_temporal_id;
+    // The selector decides at the first slice, before the size of the frame is known
+    uint32_t frame_size = stream_end ? stream_size : channel->frame_sizes[frame_is_keyframe ? 1 : 0];
+    if (frame_size == 0) {
+        frame_size = stream_size;
+    }
+    bool queued = false;
+
     // Prepare frame data
     for (CVI_U32 i = 0; i < pstStream->u32PackCount; i++) {
         VENC_PACK_S* ppack = &pstStream->pstPack[i];
         uint8_t* frame_data = ppack->pu8Addr + ppack->u32Offset;
         uint32_t frame_len = ppack->u32Len - ppack->u32Offset;
 
-        // Detect SPS/PPS and cache them
-        bool is_sps = (ppack->DataType.enH264EType == H264E_NALU_SPS);
-        bool is_pps = (ppack->DataType.enH264EType == H264E_NALU_PPS);
-        bool is_keyframe = (ppack->DataType.enH264EType == H264E_NALU_IDRSLICE ||
-                           ppack->DataType.enH264EType == H264E_NALU_ISLICE);
+        // Detect VPS/SPS/PPS and cache them
+        pack_kind_t kind = classify_pack(channel, ppack);
+        bool is_keyframe = (kind == PACK_KEYFRAME);
+
+        if (kind == PACK_VPS) {
+            std::lock_guard<std::mutex> lock(channel->header_mutex);
+            channel->vps_cache.assign(frame_data, frame_data + frame_len);
+            // Don't send VPS separately, we'll prepend to keyframes
+            continue;
+        }
 
-        if (is_sps) {
+        if (kind == PACK_SPS) {
             std::lock_guard<std::mutex> lock(channel->header_mutex);
             channel->sps_cache.assign(frame_data, frame_data + frame_len);
             // Don't send SPS separately, we'll prepend to keyframes
             continue;
         }
         
-        if (is_pps) {
+        if (kind == PACK_PPS) {
             std::lock_guard<std::mutex> lock(channel->header_mutex);
             channel->pps_cache.assign(frame_data, frame_data + frame_len);
             // Don't send PPS separately, we'll prepend to keyframes
             continue;
         }
 
-        // For keyframes, prepend SPS+PPS - allocate persistent buffer
+        // For keyframes, prepend [VPS+]SPS+PPS to the first slice - allocate persistent buffer
         uint8_t* final_frame_data = frame_data;
         uint32_t final_frame_len = frame_len;
         uint8_t* combined_buffer = nullptr;
         
-        if (is_keyframe) {
+        if (is_keyframe && need_params) {
+            need_params = false;
             std::lock_guard<std::mutex> lock(channel->header_mutex);
-            if (!channel->sps_cache.empty() && !channel->pps_cache.empty()) {
-                // Allocate persistent buffer for combined frame: SPS + PPS + Keyframe
-                final_frame_len = channel->sps_cache.size() + channel->pps_cache.size() + frame_len;
+            if (!channel->sps_cache.empty() && !channel->pps_cache.empty() &&
+                (!is_h265 || !channel->vps_cache.empty())) {
+                // Allocate persistent buffer for combined frame: [VPS +] SPS + PPS + Keyframe
+                final_frame_len = channel->vps_cache.size() + channel->sps_cache.size() +
+                                  channel->pps_cache.size() + frame_len;
                 combined_buffer = new uint8_t[final_frame_len];
                 
-                // Copy SPS + PPS + Keyframe into persistent buffer
+                // Copy [VPS +] SPS + PPS + Keyframe into persistent buffer
                 size_t offset = 0;
+                memcpy(combined_buffer + offset, channel->vps_cache.data(), channel->vps_cache.size());
+                offset += channel->vps_cache.size();
                 memcpy(combined_buffer + offset, channel->sps_cache.data(), channel->sps_cache.size());
                 offset += channel->sps_cache.size();
                 memcpy(combined_buffer + offset, channel->pps_cache.data(), channel->pps_cache.size());
@@ -188,29 +348,26 @@ static int video_frame_callback(void* pData, void* pArgs, void* pUserData) {
             }
         }
 
-        // Write to shared memory (zero-copy for local apps)
+        // Shared memory gets whole frames, so slices are collected until the last one
         if (channel->shm_enabled) {
-            video_frame_meta_t meta = {0};
-            meta.timestamp_ms = timestamp;
-            meta.size = final_frame_len;
-            meta.is_keyframe = is_keyframe ? 1 : 0;
-            meta.codec = 0;  // H.264
-            meta.width = channel->params.width;
-            meta.height = channel->params.height;
-            meta.fps = channel->params.fps;
-
-            if (video_shm_producer_write(&channel->shm_producer, final_frame_data, final_frame_len, &meta) < 0) {
-                printf("%s: WARNING: Failed to write frame to shared memory CH%d\n", 
-                       TAG, channel->channel_id);
+            if (sliced) {
+                channel->shm_frame.insert(channel->shm_frame.end(), final_frame_data,
+                                          final_frame_data + final_frame_len);
+            } else {
+                write_shm_frame(channel, final_frame_data, final_frame_len, is_keyframe, temporal_id, timestamp);
             }
         }
 
         // Allocate buffer for frame: [channel_id(1)] + [frame_data(N)] + [timestamp(8)]
         size_t total_len = 1 + final_frame_len + 8;
         uint8_t* buffer = new uint8_t[total_len];
+        bool frame_end = stream_end && (int)i == last_sent;
         
         // Pack: channel ID + frame data + timestamp
         buffer[0] = (uint8_t)channel->channel_id;
+        if (sliced && !frame_end) {
+            buffer[0] |= WS_MORE_SLICES;
+        }
         memcpy(buffer + 1, final_frame_data, final_frame_len);
         memcpy(buffer + 1 + final_frame_len, &timestamp, 8);
         
@@ -222,8 +379,11 @@ static int video_frame_callback(void* pData, void* pArgs, void* pUserData) {
         // Queue frame for main thread to send
         {
             std::lock_guard<std::mutex> lock(channel->queue_mutex);
-            if (channel->frame_queue.size() < MAX_QUEUE_SIZE) {
-                channel->frame_queue.push(std::make_pair(buffer, total_len));
+            if (channel->frame_queue.size() < (size_t)MAX_QUEUE_SIZE * channel->slices) {
+                channel->frame_queue.push({buffer, total_len, frame_size, temporal_id,
+                                           frame_is_keyframe, frame_start, frame_end, pts});
+                frame_start = false;
+                queued = true;
             } else {
                 // Queue full, drop frame and free buffer
                 delete[] buffer;
@@ -231,14 +391,28 @@ static int video_frame_callback(void* pData, void* pArgs, void* pUserData) {
         }
     }
 
+    if (video_slice_end(&channel->slice_tracker, stream_size, stream_end) & VIDEO_SLICE_END) {
+        end_frame(channel);
+    }
+
+    // Wake the main loop instead of leaving the frame to its next poll
+    if (queued && g_wakeup_id != 0) {
+        uint8_t channel_id = (uint8_t)channel->channel_id;
+        mg_wakeup(&g_mgr, g_wakeup_id, &channel_id, sizeof(channel_id));
+    }
+
     return CVI_SUCCESS;
 }
 
 // Initialize a single channel
 static int init_channel(channel_state_t* channel, video_ch_index_t ch_id, 
-                        const video_ch_param_t* params) {
+                        const video_ch_param_t* params, uint8_t temporal_layers, uint8_t slices) {
     channel->channel_id = ch_id;
     channel->params = *params;
+    channel->temporal_layers = 1;
+    channel->temporal_position = {};
+    channel->slices = 1;
+    video_slice_tracker_init(&channel->slice_tracker);
     channel->shm_enabled = false;
     
     // Initialize shared memory IPC with channel-specific name
@@ -252,8 +426,8 @@ static int init_channel(channel_state_t* channel, video_ch_index_t ch_id,
     }
     
     // Configure video channel
-    printf("%s: Configuring CH%d: %dx%d @ %dfps H.264\n", 
-           TAG, ch_id, params->width, params->height, params->fps);
+    printf("%s: Configuring CH%d: %dx%d @ %dfps %s\n", 
+           TAG, ch_id, params->width, params->height, params->fps, codec_name(params->format));
     
     if (setupVideo(ch_id, params) != 0) {
         fprintf(stderr, "%s: Failed to setup CH%d\n", TAG, ch_id);
@@ -262,6 +436,26 @@ static int init_channel(channel_state_t* channel, video_ch_index_t ch_id,
         }
         return -1;
     }
+
+    // Temporal layers, so that slow clients can be sent fewer frames
+    if (temporal_layers > 1) {
+        if (setVideoTemporalLayers(ch_id, temporal_layers) == 0) {
+            channel->temporal_layers = temporal_layers;
+            printf("%s: CH%d: %d temporal layers\n", TAG, ch_id, temporal_layers);
+        } else {
+            fprintf(stderr, "%s: WARNING: CH%d: temporal layers not supported, sending all frames\n", TAG, ch_id);
+        }
+    }
+
+    // Slices, so that the top of a frame goes out while the rest is encoded
+    if (slices > 1) {
+        if (setVideoSlices(ch_id, slices) == 0) {
+            channel->slices = slices;
+            printf("%s: CH%d: %d slices per frame\n", TAG, ch_id, slices);
+        } else {
+            fprintf(stderr, "%s: WARNING: CH%d: slices not supported, sending whole frames\n", TAG, ch_id);
+        }
+    }
     
     // Register frame callback with channel context
     registerVideoFrameHandler(ch_id, 0, video_frame_callback, channel);
@@ -277,7 +471,7 @@ static void cleanup_channel(channel_state_t* channel) {
     {
         std::lock_guard<std::mutex> lock(channel->queue_mutex);
         while (!channel->frame_queue.empty()) {
-            delete[] channel->frame_queue.front().first;
+            delete[] channel->frame_queue.front().data;
             channel->frame_queue.pop();
         }
     }
@@ -288,6 +482,39 @@ static void cleanup_channel(channel_state_t* channel) {
     }
 }
 
+// Time from capture to handing the first and the last slice of a frame to the sockets
+static void record_latency(channel_state_t* channel, const queued_frame_t* frame) {
+    uint64_t now = getVideoPts();
+    uint64_t latency = now > frame->pts ? now - frame->pts : 0;
+
+    if (frame->frame_start) {
+        channel->latency_first_sum += latency;
+        channel->latency_first_max = std::max(channel->latency_first_max, latency);
+    }
+    if (frame->frame_end) {
+        channel->latency_end_sum += latency;
+        channel->latency_end_max = std::max(channel->latency_end_max, latency);
+        channel->latency_frames++;
+    }
+}
+
+static void report_latency() {
+    for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+        channel_state_t* channel = &g_channels[ch];
+        if (channel->latency_frames == 0) {
+            continue;
+        }
+        printf("%s: CH%d glass-to-socket over %u frames (%d slices): first slice %.1f ms avg / %.1f ms max, "
+               "frame %.1f ms avg / %.1f ms max\n",
+               TAG, ch, channel->latency_frames, channel->slices,
+               channel->latency_first_sum / 1000.0 / channel->latency_frames, channel->latency_first_max / 1000.0,
+               channel->latency_end_sum / 1000.0 / channel->latency_frames, channel->latency_end_max / 1000.0);
+        channel->latency_first_sum = channel->latency_first_max = 0;
+        channel->latency_end_sum = channel->latency_end_max = 0;
+        channel->latency_frames = 0;
+    }
+}
+
 // Process queued frames and send to clients (called from main thread)
 static void process_frame_queues() {
     for (int ch = 0; ch < NUM_CHANNELS; ch++) {
@@ -296,7 +523,7 @@ static void process_frame_queues() {
         // Process multiple frames per iteration for better throughput
         int frames_processed = 0;
         while (frames_processed < MAX_FRAMES_PER_BATCH) {
-            std::pair<uint8_t*, size_t> frame;
+            queued_frame_t frame;
             bool has_frame = false;
             
             // Get frame from queue
@@ -313,44 +540,102 @@ static void process_frame_queues() {
                 break; // No more frames for this channel
             }
             
-            // Make a copy of client connections to avoid holding mutex during I/O
+            // Pick the clients that get this frame. Clients are only added and
+            // removed on this thread, so the connections stay valid below.
             std::vector<struct mg_connection*> clients_copy;
+            uint64_t now_ms = monotonic_ms();
             {
                 std::lock_guard<std::mutex> lock(channel->clients_mutex);
                 clients_copy.reserve(channel->ws_clients.size());
-                for (auto conn : channel->ws_clients) {
-                    clients_copy.push_back(conn);
+                for (auto& entry : channel->ws_clients) {
+                    struct mg_connection* conn = entry.first;
+                    client_state_t& client = entry.second;
+                    if (frame.frame_start) {
+                        client.send = video_temporal_select(&client.selector, frame.temporal_id, frame.keyframe,
+                                                            frame.frame_size, conn->send.len, now_ms);
+                    }
+                    if (client.send) {
+                        clients_copy.push_back(conn);
+                    }
                 }
             }
             
-            // Send to all clients without holding the mutex
+            // Send to the clients without holding the mutex
             for (auto conn : clients_copy) {
                 if (conn && conn->is_websocket) {
-                    mg_ws_send(conn, frame.first, frame.second, WEBSOCKET_OP_BINARY);
+                    mg_ws_send(conn, frame.data, frame.len, WEBSOCKET_OP_BINARY);
                 }
             }
+            if (g_latency && !clients_copy.empty()) {
+                record_latency(channel, &frame);
+            }
             
             // Free buffer
-            delete[] frame.first;
-            frames_processed++;
+            delete[] frame.data;
+            if (frame.frame_end) {
+                frames_processed++;
+            }
         }
     }
 }
 
-int main(int argc, char* argv[]) {
-    printf("%s: Starting multi-channel camera streamer on port %s\n", TAG, WS_PORT);
+// Parses "<channel>=<h264|h265>" into params[channel].format
+static int parse_codec_option(const char* arg, video_ch_param_t* params) {
+    int channel = -1;
+    char codec[8] = {0};
 
-    // Setup signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    if (sscanf(arg, "%d=%7s", &channel, codec) != 2 || channel < 0 || channel >= NUM_CHANNELS) {
+        return -1;
+    }
+    if (strcmp(codec, "h264") == 0) {
+        params[channel].format = VIDEO_FORMAT_H264;
+    } else if (strcmp(codec, "h265") == 0) {
+        params[channel].format = VIDEO_FORMAT_H265;
+    } else {
+        return -1;
+    }
+    return 0;
+}
 
-    // Initialize video subsystem
-    printf("%s: Initializing video subsystem...\n", TAG);
-    if (initVideo() != 0) {
-        fprintf(stderr, "%s: Failed to initialize video\n", TAG);
+// Parses "<channel>=<layers>" into layers[channel]
+static int parse_layers_option(const char* arg, uint8_t* layers) {
+    int channel = -1;
+    int count = 0;
+
+    if (sscanf(arg, "%d=%d", &channel, &count) != 2 || channel < 0 || channel >= NUM_CHANNELS ||
+        count < 1 || count > VIDEO_TEMPORAL_LAYERS_MAX) {
+        return -1;
+    }
+    layers[channel] = (uint8_t)count;
+    return 0;
+}
+
+// Parses "<channel>=<slices>" into slices[channel]
+static int parse_slices_option(const char* arg, uint8_t* slices) {
+    int channel = -1;
+    int count = 0;
+
+    if (sscanf(arg, "%d=%d", &channel, &count) != 2 || channel < 0 || channel >= NUM_CHANNELS ||
+        count < 1 || count > VIDEO_SLICES_MAX) {
         return -1;
     }
+    slices[channel] = (uint8_t)count;
+    return 0;
+}
 
+static void print_usage(const char* name) {
+    printf("Usage: %s [-c <channel>=<h264|h265>]... [-l <channel>=<1-%d>]... [-s <channel>=<1-%d>]... [-m]\n",
+           name, VIDEO_TEMPORAL_LAYERS_MAX, VIDEO_SLICES_MAX);
+    printf("  -c, --codec   Codec of a channel (default: h264 on all channels)\n");
+    printf("  -l, --layers  Temporal layers of a channel (default: 1, no layers)\n");
+    printf("  -s, --slices  Slices per frame of a channel, sent as they are encoded (default: 1, whole frames)\n");
+    printf("  -m, --latency Print the glass-to-socket latency of each channel every %d s\n", LATENCY_REPORT_MS / 1000);
+    printf("Example: %s -c 0=h265   (CH0 in H.265 for recording, CH1/CH2 in H.264)\n", name);
+    printf("Example: %s -l 1=3      (CH1 at 30/15/7.5fps for slow clients)\n", name);
+    printf("Example: %s -s 1=4 -m   (CH1 in 4 slices, to compare its latency with CH0)\n", name);
+}
+
+int main(int argc, char* argv[]) {
     // Configure all three channels
     video_ch_param_t params[NUM_CHANNELS] = {
         // CH0: High resolution - 1920x1080 @ 30fps
@@ -360,11 +645,57 @@ int main(int argc, char* argv[]) {
         // CH2: Low resolution - 640x480 @ 15fps
         { .format = VIDEO_FORMAT_H264, .width = 640, .height = 480, .fps = 15 }
     };
-    
+    uint8_t layers[NUM_CHANNELS] = { 1, 1, 1 };
+    uint8_t slices[NUM_CHANNELS] = { 1, 1, 1 };
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--codec") == 0) && i + 1 < argc) {
+            if (parse_codec_option(argv[++i], params) != 0) {
+                fprintf(stderr, "%s: Invalid codec option: %s\n", TAG, argv[i]);
+                print_usage(argv[0]);
+                return -1;
+            }
+        } else if ((strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--layers") == 0) && i + 1 < argc) {
+            if (parse_layers_option(argv[++i], layers) != 0) {
+                fprintf(stderr, "%s: Invalid layers option: %s\n", TAG, argv[i]);
+                print_usage(argv[0]);
+                return -1;
+            }
+        } else if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--slices") == 0) && i + 1 < argc) {
+            if (parse_slices_option(argv[++i], slices) != 0) {
+                fprintf(stderr, "%s: Invalid slices option: %s\n", TAG, argv[i]);
+                print_usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--latency") == 0) {
+            g_latency = true;
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            fprintf(stderr, "%s: Unknown option: %s\n", TAG, argv[i]);
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    printf("%s: Starting multi-channel camera streamer on port %s\n", TAG, WS_PORT);
+
+    // Setup signal handlers
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // Initialize video subsystem
+    printf("%s: Initializing video subsystem...\n", TAG);
+    if (initVideo() != 0) {
+        fprintf(stderr, "%s: Failed to initialize video\n", TAG);
+        return -1;
+    }
+
     // Initialize all channels
     bool all_channels_ok = true;
     for (int ch = 0; ch < NUM_CHANNELS; ch++) {
-        if (init_channel(&g_channels[ch], (video_ch_index_t)ch, &params[ch]) != 0) {
+        if (init_channel(&g_channels[ch], (video_ch_index_t)ch, &params[ch], layers[ch], slices[ch]) != 0) {
             fprintf(stderr, "%s: Failed to initialize CH%d, continuing with other channels\n", TAG, ch);
             all_channels_ok = false;
         }
@@ -392,6 +723,13 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
+    // Let the encoder threads wake the poll below as soon as a frame is queued
+    if (mg_wakeup_init(&g_mgr)) {
+        g_wakeup_id = listen_conn->id;
+    } else {
+        fprintf(stderr, "%s: WARNING: Failed to set up wakeups, frames wait for the next poll\n", TAG);
+    }
+
     // Start video streaming
     printf("%s: Starting video streams...\n", TAG);
     if (startVideo() != 0) {
@@ -406,15 +744,20 @@ int main(int argc, char* argv[]) {
     }
 
     printf("%s: Multi-channel camera streamer is running\n", TAG);
-    printf("%s: CH0: 1920x1080@30fps (High) - ws://<device-ip>:%s/?channel=0\n", TAG, WS_PORT);
-    printf("%s: CH1: 1280x720@30fps (Medium) - ws://<device-ip>:%s/?channel=1\n", TAG, WS_PORT);
-    printf("%s: CH2: 640x480@15fps (Low) - ws://<device-ip>:%s/?channel=2\n", TAG, WS_PORT);
+    printf("%s: CH0: 1920x1080@30fps %s (High) - ws://<device-ip>:%s/?channel=0\n", TAG, codec_name(params[0].format), WS_PORT);
+    printf("%s: CH1: 1280x720@30fps %s (Medium) - ws://<device-ip>:%s/?channel=1\n", TAG, codec_name(params[1].format), WS_PORT);
+    printf("%s: CH2: 640x480@15fps %s (Low) - ws://<device-ip>:%s/?channel=2\n", TAG, codec_name(params[2].format), WS_PORT);
     printf("%s: Press Ctrl+C to stop\n", TAG);
 
     // Main event loop - process both mongoose events AND frame queues
+    uint64_t latency_report_ms = monotonic_ms() + LATENCY_REPORT_MS;
     while (g_running) {
         mg_mgr_poll(&g_mgr, POLL_TIMEOUT_MS);
         process_frame_queues();   // Send queued frames
+        if (g_latency && monotonic_ms() >= latency_report_ms) {
+            report_latency();
+            latency_report_ms += LATENCY_REPORT_MS;
+        }
     }
 
     // Cleanup
@@ -0,0 +1,296 @@
+#include "asset_cache.h"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+enum { ENC_IDENTITY, ENC_GZIP, ENC_BR, ENC_COUNT };
+
+static const char *const s_encodings[ENC_COUNT] = {"identity", "gzip", "br"};
+static const char *const s_suffixes[ENC_COUNT] = {"", ".gz", ".br"};
+
+struct asset {
+  char *path;  // As requested, e.g. "/js/oobe-app.js"
+  const char *mime;
+  const char *cache_control;
+  uint64_t hash;  // Of the identity content, for the ETag
+  char *data[ENC_COUNT];
+  size_t len[ENC_COUNT];
+};
+
+struct asset_cache {
+  struct asset *assets;
+  size_t count;
+  size_t cap;
+  size_t bytes;
+  size_t max_file_size;
+};
+
+static const struct {
+  const char *ext;
+  const char *mime;
+} s_mime_types[] = {
+    {"html", "text/html; charset=utf-8"}, {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},   {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"}, {"json", "application/json"},
+    {"svg", "image/svg+xml"},             {"png", "image/png"},
+    {"jpg", "image/jpeg"},                {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},                 {"webp", "image/webp"},
+    {"ico", "image/x-icon"},              {"woff", "font/woff"},
+    {"woff2", "font/woff2"},              {"ttf", "font/ttf"},
+    {"txt", "text/plain; charset=utf-8"},
+};
+
+static const char *extension(const char *path) {
+  const char *dot = strrchr(path, '.');
+  const char *slash = strrchr(path, '/');
+  return dot != NULL && (slash == NULL || dot > slash) ? dot + 1 : "";
+}
+
+static const char *guess_mime(const char *path) {
+  const char *ext = extension(path);
+  for (size_t i = 0; i < sizeof(s_mime_types) / sizeof(s_mime_types[0]); i++) {
+    if (mg_casecmp(ext, s_mime_types[i].ext) == 0) return s_mime_types[i].mime;
+  }
+  return "application/octet-stream";
+}
+
+// Pages are revalidated on every load, so that an update shows at once;
+// the files they reference are fetched again at most hourly
+static const char *guess_cache_control(const char *path) {
+  const char *ext = extension(path);
+  if (mg_casecmp(ext, "html") == 0 || mg_casecmp(ext, "htm") == 0) return "no-cache";
+  return "max-age=3600";
+}
+
+static uint64_t fnv1a(const char *data, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) data[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *fp = fopen(path, "rb");
+  char *data = NULL;
+  struct stat st;
+
+  if (fp == NULL) return NULL;
+  if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+    data = (char *) malloc(st.st_size > 0 ? (size_t) st.st_size : 1);
+    if (data != NULL && fread(data, 1, (size_t) st.st_size, fp) != (size_t) st.st_size) {
+      free(data);
+      data = NULL;
+    }
+    *len = (size_t) st.st_size;
+  }
+  fclose(fp);
+  return data;
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+  size_t n = strlen(name), m = strlen(suffix);
+  return n >= m && strcmp(name + n - m, suffix) == 0;
+}
+
+static void add_file(struct asset_cache *cache, const char *file, const char *path) {
+  struct asset a;
+  char variant[MG_PATH_MAX];
+
+  memset(&a, 0, sizeof(a));
+  a.data[ENC_IDENTITY] = read_file(file, &a.len[ENC_IDENTITY]);
+  if (a.data[ENC_IDENTITY] == NULL) return;
+
+  // Variants are only worth keeping when they are smaller
+  for (int e = ENC_GZIP; e < ENC_COUNT; e++) {
+    if (mg_snprintf(variant, sizeof(variant), "%s%s", file, s_suffixes[e]) >= sizeof(variant)) continue;
+    a.data[e] = read_file(variant, &a.len[e]);
+    if (a.data[e] != NULL && a.len[e] >= a.len[ENC_IDENTITY]) {
+      free(a.data[e]);
+      a.data[e] = NULL;
+    }
+  }
+
+  if (cache->count == cache->cap) {
+    size_t cap = cache->cap ? cache->cap * 2 : 32;
+    struct asset *assets = (struct asset *) realloc(cache->assets, cap * sizeof(*assets));
+    if (assets == NULL) {
+      for (int e = 0; e < ENC_COUNT; e++) free(a.data[e]);
+      return;
+    }
+    cache->assets = assets;
+    cache->cap = cap;
+  }
+
+  a.path = strdup(path);
+  if (a.path == NULL) {
+    for (int e = 0; e < ENC_COUNT; e++) free(a.data[e]);
+    return;
+  }
+  a.mime = guess_mime(path);
+  a.cache_control = guess_cache_control(path);
+  a.hash = fnv1a(a.data[ENC_IDENTITY], a.len[ENC_IDENTITY]);
+  for (int e = 0; e < ENC_COUNT; e++) {
+    if (a.data[e] != NULL) cache->bytes += a.len[e];
+  }
+  cache->assets[cache->count++] = a;
+}
+
+static void scan(struct asset_cache *cache, const char *dir, const char *prefix) {
+  DIR *d = opendir(dir);
+  struct dirent *de;
+
+  if (d == NULL) return;
+  while ((de = readdir(d)) != NULL) {
+    char file[MG_PATH_MAX], path[MG_PATH_MAX];
+    struct stat st;
+
+    if (de->d_name[0] == '.' || has_suffix(de->d_name, ".gz") || has_suffix(de->d_name, ".br")) continue;
+    if (mg_snprintf(file, sizeof(file), "%s/%s", dir, de->d_name) >= sizeof(file) ||
+        mg_snprintf(path, sizeof(path), "%s/%s", prefix, de->d_name) >= sizeof(path) ||
+        stat(file, &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      scan(cache, file, path);
+    } else if (S_ISREG(st.st_mode) && (size_t) st.st_size <= cache->max_file_size) {
+      add_file(cache, file, path);
+    }
+  }
+  closedir(d);
+}
+
+static int compare_assets(const void *a, const void *b) {
+  return strcmp(((const struct asset *) a)->path, ((const struct asset *) b)->path);
+}
+
+struct asset_cache *asset_cache_load(const char *root_dir, size_t max_file_size) {
+  struct asset_cache *cache = (struct asset_cache *) calloc(1, sizeof(*cache));
+  if (cache == NULL) return NULL;
+
+  cache->max_file_size = max_file_size;
+  if (max_file_size > 0) scan(cache, root_dir, "");
+  if (cache->count > 0) qsort(cache->assets, cache->count, sizeof(*cache->assets), compare_assets);
+  return cache;
+}
+
+void asset_cache_free(struct asset_cache *cache) {
+  if (cache == NULL) return;
+  for (size_t i = 0; i < cache->count; i++) {
+    free(cache->assets[i].path);
+    for (int e = 0; e < ENC_COUNT; e++) free(cache->assets[i].data[e]);
+  }
+  free(cache->assets);
+  free(cache);
+}
+
+size_t asset_cache_count(const struct asset_cache *cache) {
+  return cache->count;
+}
+
+size_t asset_cache_bytes(const struct asset_cache *cache) {
+  return cache->bytes;
+}
+
+// The quality, in thousandths, that an Accept-Encoding header gives a
+// coding; an explicit entry takes precedence over "*"
+static int accept_quality(const struct mg_str *ae, const char *coding) {
+  struct mg_str s, entry, name, params;
+  int star = -1;
+
+  if (ae == NULL) return 0;
+  s = *ae;
+  while (mg_span(s, &entry, &s, ',')) {
+    int q = 1000;
+
+    if (!mg_span(entry, &name, &params, ';')) continue;
+    while (name.len > 0 && name.buf[0] == ' ') name.buf++, name.len--;
+    while (name.len > 0 && name.buf[name.len - 1] == ' ') name.len--;
+
+    for (size_t i = 0; i + 2 < params.len; i++) {
+      if ((params.buf[i] == 'q' || params.buf[i] == 'Q') && params.buf[i + 1] == '=') {
+        char num[8];
+        mg_snprintf(num, sizeof(num), "%.*s", (int) (params.len - i - 2), params.buf + i + 2);
+        q = (int) (atof(num) * 1000 + 0.5);
+        break;
+      }
+    }
+
+    if (mg_strcasecmp(name, mg_str(coding)) == 0) return q;
+    if (mg_strcasecmp(name, mg_str("*")) == 0) star = q;
+  }
+  return star > 0 ? star : 0;
+}
+
+// Whether an If-None-Match header lists the tag, or is "*"
+static bool etag_matches(const struct mg_str *inm, const char *etag) {
+  struct mg_str s, entry;
+
+  if (inm == NULL) return false;
+  s = *inm;
+  while (mg_span(s, &entry, &s, ',')) {
+    while (entry.len > 0 && entry.buf[0] == ' ') entry.buf++, entry.len--;
+    while (entry.len > 0 && entry.buf[entry.len - 1] == ' ') entry.len--;
+    if (entry.len > 2 && entry.buf[0] == 'W' && entry.buf[1] == '/') entry.buf += 2, entry.len -= 2;
+    if (mg_strcmp(entry, mg_str("*")) == 0 || mg_strcmp(entry, mg_str(etag)) == 0) return true;
+  }
+  return false;
+}
+
+bool asset_cache_serve(const struct asset_cache *cache, struct mg_connection *c, struct mg_http_message *hm) {
+  bool head = mg_strcasecmp(hm->method, mg_str("HEAD")) == 0;
+  char path[MG_PATH_MAX], etag[40];
+  struct asset key, *a;
+  struct mg_str *ae;
+  int n, enc = ENC_IDENTITY;
+
+  if (cache == NULL || cache->count == 0 || (!head && mg_strcasecmp(hm->method, mg_str("GET")) != 0)) return false;
+
+  n = mg_url_decode(hm->uri.buf, hm->uri.len, path, sizeof(path) - 10, 0);
+  if (n <= 0) return false;
+  if (path[n - 1] == '/') strcat(path, "index.html");
+
+  key.path = path;
+  a = (struct asset *) bsearch(&key, cache->assets, cache->count, sizeof(*cache->assets), compare_assets);
+  if (a == NULL) return false;
+
+  ae = mg_http_get_header(hm, "Accept-Encoding");
+  for (int e = ENC_GZIP; e < ENC_COUNT; e++) {
+    if (a->data[e] != NULL && a->len[e] < a->len[enc] && accept_quality(ae, s_encodings[e]) > 0) enc = e;
+  }
+
+  // Each variant is a different representation, so it has its own tag
+  mg_snprintf(etag, sizeof(etag), "\"%llx%s%s\"", (unsigned long long) a->hash, enc ? "-" : "",
+              enc ? s_suffixes[enc] + 1 : "");
+
+  if (etag_matches(mg_http_get_header(hm, "If-None-Match"), etag)) {
+    mg_printf(c,
+              "HTTP/1.1 304 Not Modified\r\n"
+              "ETag: %s\r\n"
+              "Cache-Control: %s\r\n"
+              "Vary: Accept-Encoding\r\n"
+              "Content-Length: 0\r\n\r\n",
+              etag, a->cache_control);
+    c->is_resp = 0;
+    return true;
+  }
+
+  mg_printf(c,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %lu\r\n"
+            "%s%s%s"
+            "ETag: %s\r\n"
+            "Cache-Control: %s\r\n"
+            "Vary: Accept-Encoding\r\n\r\n",
+            a->mime, (unsigned long) a->len[enc], enc ? "Content-Encoding: " : "", enc ? s_encodings[enc] : "",
+            enc ? "\r\n" : "", etag, a->cache_control);
+  if (!head) mg_send(c, a->data[enc], a->len[enc]);
+  c->is_resp = 0;  // Mark response end
+  return true;
+}
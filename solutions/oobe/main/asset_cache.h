@@ -0,0 +1,27 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mongoose.h"
+
+// Web assets held in memory, with the gzip and brotli variants that the
+// build puts next to them (name.gz, name.br), so that a page load needs no
+// flash reads and no compression on the device. Files larger than
+// max_file_size stay on disk.
+struct asset_cache;
+
+struct asset_cache *asset_cache_load(const char *root_dir, size_t max_file_size);
+void asset_cache_free(struct asset_cache *cache);
+
+// Files and bytes held, counting every variant
+size_t asset_cache_count(const struct asset_cache *cache);
+size_t asset_cache_bytes(const struct asset_cache *cache);
+
+// Replies to a GET or HEAD of a cached file, picking the smallest variant
+// the client accepts, with an ETag and Cache-Control. Returns false, having
+// sent nothing, for any other request.
+bool asset_cache_serve(const struct asset_cache *cache, struct mg_connection *c, struct mg_http_message *hm);
+
+#endif  // ASSET_CACHE_H
@@ -1,7 +1,9 @@
 #include "mongoose.h"
+#include "asset_cache.h"
 
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -22,6 +24,8 @@ struct app_config {
   const char *root_dir;
   const char *cert_file;
   const char *key_file;
+  size_t cache_max;  // Largest file held in memory, 0 to serve everything from disk
+  struct asset_cache *assets;
 };
 
 static void get_mac_address(const char *interface, char *mac_buf, size_t buf_size) {
@@ -100,10 +104,14 @@ static void fn(struct mg_connection *c, int ev, void *ev_data) {
     return;
   }
 
+  if (asset_cache_serve(cfg->assets, c, hm)) return;
+
+  // Large files; mongoose still picks a .gz variant when the client takes gzip
   struct mg_http_serve_opts opts;
   memset(&opts, 0, sizeof(opts));
   opts.root_dir = cfg->root_dir;
   opts.page404 = "index.html";
+  opts.extra_headers = "Vary: Accept-Encoding\r\n";
   mg_http_serve_dir(c, hm, &opts);
 }
 
@@ -114,6 +122,7 @@ static void usage(const char *argv0) {
   fprintf(stderr, "  --root PATH          Web root directory (default: /usr/share/oobe/www)\n");
   fprintf(stderr, "  --cert PATH          TLS certificate file (default: /etc/supervisor/certs/cert.pem)\n");
   fprintf(stderr, "  --key PATH           TLS key file (default: /etc/supervisor/certs/key.pem)\n");
+  fprintf(stderr, "  --cache-max BYTES    Largest file held in memory, 0 for none (default: 262144)\n");
   fprintf(stderr, "  -h, --help           Show this help\n");
 }
 
@@ -123,6 +132,8 @@ int main(int argc, char **argv) {
   cfg.root_dir = "/usr/share/oobe/www";
   cfg.cert_file = "/etc/supervisor/certs/cert.pem";
   cfg.key_file = "/etc/supervisor/certs/key.pem";
+  cfg.cache_max = 256 * 1024;
+  cfg.assets = NULL;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
@@ -133,6 +144,8 @@ int main(int argc, char **argv) {
       cfg.cert_file = argv[++i];
     } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
       cfg.key_file = argv[++i];
+    } else if (strcmp(argv[i], "--cache-max") == 0 && i + 1 < argc) {
+      cfg.cache_max = strtoul(argv[++i], NULL, 10);
     } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       usage(argv[0]);
       return 0;
@@ -146,6 +159,12 @@ int main(int argc, char **argv) {
   signal(SIGINT, handle_signal);
   signal(SIGTERM, handle_signal);
 
+  cfg.assets = asset_cache_load(cfg.root_dir, cfg.cache_max);
+  if (cfg.assets != NULL) {
+    fprintf(stderr, "Cached %lu files, %lu bytes\n", (unsigned long) asset_cache_count(cfg.assets),
+            (unsigned long) asset_cache_bytes(cfg.assets));
+  }
+
   struct mg_mgr mgr;
   mg_mgr_init(&mgr);
 
@@ -153,6 +172,7 @@ int main(int argc, char **argv) {
   if (lc == NULL) {
     fprintf(stderr, "Failed to listen on %s\n", cfg.listen_addr);
     mg_mgr_free(&mgr);
+    asset_cache_free(cfg.assets);
     return 1;
   }
 
@@ -175,5 +195,6 @@ int main(int argc, char **argv) {
   }
 
   mg_mgr_free(&mgr);
+  asset_cache_free(cfg.assets);
   return 0;
 }
@@ -74,9 +74,8 @@ static int fpProcessQRCodeFrame(void* pData, void* pArgs, void* pUserData) {
     for (int i = 0; i < iterations; ++i) {
         auto start_time = std::chrono::high_resolution_clock::now();
 
-        // Copy grayscale data to Quirc buffer
-        uint8_t* buffer = quirc_begin(qr, nullptr, nullptr);
-        memcpy(buffer, gray.data(), f->u32Width * f->u32Height);
+        // Scan the grayscale image in place
+        quirc_set_image(qr, gray.data(), f->u32Width, f->u32Height, f->u32Width);
         quirc_end(qr);
 
         // Extract and decode QR codes (only store results from first iteration)
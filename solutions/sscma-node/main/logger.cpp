@@ -0,0 +1,359 @@
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ma_config.h"
+
+#ifndef MA_DEBUG_LEVEL
+#define MA_DEBUG_LEVEL 3
+#endif
+
+namespace ma::logger {
+
+std::atomic<int> max_level{MA_DEBUG_LEVEL};
+std::atomic<uint32_t> generation{1};
+
+namespace {
+
+constexpr size_t RING_SIZE   = 512;  // Power of two
+constexpr size_t INLINE_TEXT = 192;  // Longer messages are allocated
+constexpr size_t TAG_SIZE    = 32;
+constexpr size_t BATCH_SIZE  = 16384;
+
+struct Record {
+    std::atomic<size_t> seq;
+    Level level;
+    struct timespec time;
+    char tag[TAG_SIZE];
+    char* heap;
+    char text[INLINE_TEXT];
+};
+
+Record ring[RING_SIZE];
+std::atomic<size_t> enqueue_pos{0};
+size_t dequeue_pos = 0;
+std::atomic<uint64_t> dropped_count{0};
+std::atomic<bool> running{false};
+std::atomic<bool> waiting{false};
+sem_t wakeup;
+std::thread writer;
+int file_fd = -1;
+
+std::mutex levels_mutex;
+Level default_level = static_cast<Level>(MA_DEBUG_LEVEL);
+std::map<std::string, Level> levels;
+
+int priority(Level level) {
+    switch (level) {
+        case Level::Error:
+            return LOG_ERR;
+        case Level::Warning:
+            return LOG_WARNING;
+        case Level::Info:
+            return LOG_INFO;
+        default:
+            return LOG_DEBUG;
+    }
+}
+
+const char* levelName(Level level) {
+    static const char* names[] = {"N", "E", "W", "I", "D", "V"};
+    return names[static_cast<int>(level)];
+}
+
+bool parseLevel(const std::string& name, Level& level) {
+    static const char* names[] = {"none", "error", "warning", "info", "debug", "verbose"};
+    for (int i = 0; i <= static_cast<int>(Level::Verbose); i++) {
+        if (name == names[i] || name == std::to_string(i)) {
+            level = static_cast<Level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Longest module that is the tag or a "::" prefix of it
+Level levelOf(const char* tag) {
+    Level level      = default_level;
+    size_t best      = 0;
+    size_t tag_len   = strlen(tag);
+    for (const auto& [module, module_level] : levels) {
+        size_t len = module.size();
+        if (len > best && len <= tag_len && module.compare(0, len, tag, len) == 0 &&
+            (len == tag_len || (tag[len] == ':' && tag[len + 1] == ':'))) {
+            level = module_level;
+            best  = len;
+        }
+    }
+    return level;
+}
+
+void updateLevels() {
+    int max = static_cast<int>(default_level);
+    for (const auto& [module, level] : levels) {
+        max = std::max(max, static_cast<int>(level));
+    }
+    max_level.store(max, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool enqueue(Level level, const char* tag, const char* fmt, va_list args) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Record* r;
+
+    for (;;) {
+        r          = &ring[pos & (RING_SIZE - 1)];
+        size_t seq = r->seq.load(std::memory_order_acquire);
+        intptr_t d = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (d == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (d < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    r->level = level;
+    clock_gettime(CLOCK_REALTIME, &r->time);
+    strncpy(r->tag, tag, TAG_SIZE - 1);
+    r->tag[TAG_SIZE - 1] = '\0';
+    r->heap              = nullptr;
+
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(r->text, INLINE_TEXT, fmt, args);
+    if (len >= static_cast<int>(INLINE_TEXT)) {
+        r->heap = static_cast<char*>(malloc(len + 1));
+        if (r->heap) {
+            vsnprintf(r->heap, len + 1, fmt, copy);
+        }
+    }
+    va_end(copy);
+
+    r->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void flushBatch(std::string& batch) {
+    size_t done = 0;
+    while (done < batch.size()) {
+        ssize_t n = ::write(file_fd, batch.data() + done, batch.size() - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    batch.clear();
+}
+
+void emit(Level level, const struct timespec& time, const char* tag, const char* text, std::string& batch) {
+    if (file_fd < 0) {
+        syslog(priority(level), "%s", text);
+        return;
+    }
+
+    struct tm tm;
+    char head[96];
+    localtime_r(&time.tv_sec, &tm);
+    size_t n = strftime(head, sizeof(head), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(head + n, sizeof(head) - n, ".%03ld %s %s: ", time.tv_nsec / 1000000, levelName(level), tag);
+
+    batch.append(head);
+    batch.append(text);
+    batch.push_back('\n');
+    if (batch.size() >= BATCH_SIZE) {
+        flushBatch(batch);
+    }
+}
+
+// Only the writer thread, or stop() once it has gone, takes records out
+size_t drain() {
+    static uint64_t reported = 0;
+    std::string batch;
+    size_t count = 0;
+
+    for (;;) {
+        Record& r = ring[dequeue_pos & (RING_SIZE - 1)];
+        if (r.seq.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            break;
+        }
+        emit(r.level, r.time, r.tag, r.heap ? r.heap : r.text, batch);
+        free(r.heap);
+        r.seq.store(dequeue_pos + RING_SIZE, std::memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+
+    uint64_t lost = dropped_count.load(std::memory_order_relaxed);
+    if (lost != reported) {
+        char text[64];
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(text, sizeof(text), "%llu log messages dropped", static_cast<unsigned long long>(lost - reported));
+        emit(Level::Warning, now, "ma::logger", text, batch);
+        reported = lost;
+    }
+
+    if (!batch.empty()) {
+        flushBatch(batch);
+    }
+    return count;
+}
+
+bool empty() {
+    return ring[dequeue_pos & (RING_SIZE - 1)].seq.load(std::memory_order_acquire) != dequeue_pos + 1;
+}
+
+void writerLoop() {
+    while (running.load(std::memory_order_acquire)) {
+        if (drain() > 0) {
+            continue;
+        }
+
+        // Producers post only when the writer says it is about to sleep
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (empty() && running.load(std::memory_order_acquire)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            sem_timedwait(&wakeup, &deadline);
+        }
+        waiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace
+
+void refresh(Site& site, const char* tag) {
+    std::lock_guard<std::mutex> lock(levels_mutex);
+    uint32_t current = generation.load(std::memory_order_relaxed);
+    site.level.store(static_cast<int>(levelOf(tag)), std::memory_order_relaxed);
+    site.generation.store(current, std::memory_order_relaxed);
+}
+
+void write(Level level, const char* tag, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    if (!running.load(std::memory_order_acquire)) {
+        vsyslog(priority(level), fmt, args);
+    } else if (!enqueue(level, tag, fmt, args)) {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.exchange(false, std::memory_order_relaxed)) {
+            sem_post(&wakeup);
+        }
+    }
+
+    va_end(args);
+}
+
+void setLevel(const std::string& module, Level level) {
+    std::lock_guard<std::mutex> lock(levels_mutex);
+    if (module.empty()) {
+        default_level = level;
+    } else {
+        levels[module] = level;
+    }
+    updateLevels();
+}
+
+bool configure(const std::string& spec) {
+    std::vector<std::pair<std::string, Level>> items;
+    size_t start = 0;
+
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(start, end - start);
+        size_t eq        = item.rfind('=');
+        Level level;
+        if (!item.empty()) {
+            if (!parseLevel(eq == std::string::npos ? item : item.substr(eq + 1), level)) {
+                return false;
+            }
+            items.emplace_back(eq == std::string::npos ? "" : item.substr(0, eq), level);
+        }
+        start = end + 1;
+    }
+
+    for (const auto& [module, level] : items) {
+        setLevel(module, level);
+    }
+    return true;
+}
+
+bool start(const char* file) {
+    static bool registered = false;
+
+    if (running.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    if (file && *file) {
+        file_fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (file_fd < 0) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < RING_SIZE; i++) {
+        ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos = 0;
+    sem_init(&wakeup, 0, 0);
+
+    running.store(true, std::memory_order_release);
+    writer = std::thread(writerLoop);
+
+    if (!registered) {
+        atexit(stop);
+        registered = true;
+    }
+    return true;
+}
+
+void stop() {
+    if (!running.exchange(false, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    sem_post(&wakeup);
+    if (writer.get_id() == std::this_thread::get_id()) {
+        // From a signal handler or atexit on the writer itself
+        writer.detach();
+        return;
+    }
+    writer.join();
+    drain();
+    sem_destroy(&wakeup);
+
+    if (file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
+    }
+}
+
+uint64_t dropped() {
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+}  // namespace ma::logger
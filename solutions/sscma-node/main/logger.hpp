@@ -1,39 +1,105 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <string>
+
 #include <syslog.h>
 #include <unistd.h>
 
-#define MA_LOGE(TAG, ...)             \
-    do {                              \
-        syslog(LOG_ERR, __VA_ARGS__); \
-    } while (0)
+/*
+ * Logging for sscma-node.
+ *
+ * The level is checked in the process, before the arguments are evaluated,
+ * so a disabled MA_LOGV(TAG, "%s", json.dump().c_str()) costs two relaxed
+ * loads. Each module, named by its TAG, can have its own level; a level set
+ * for "ma::node" also applies to "ma::node::save" unless that has its own.
+ * Once start() has been called, messages go through a lock-free ring to a
+ * background thread that writes them to syslog or a file; before that, and
+ * after stop(), they go to syslog directly.
+ */
 
+namespace ma::logger {
 
-#define MA_LOGW(TAG, ...)                 \
-    do {                                  \
-        syslog(LOG_WARNING, __VA_ARGS__); \
-    } while (0)
+enum class Level : int {
+    None = 0,
+    Error,
+    Warning,
+    Info,
+    Debug,
+    Verbose,
+};
 
-#define MA_LOGI(TAG, ...)              \
-    do {                               \
-        syslog(LOG_INFO, __VA_ARGS__); \
-    } while (0)
+// Per call site cache of the level of its module
+struct Site {
+    std::atomic<uint32_t> generation{0};
+    std::atomic<int> level{0};
+};
 
+// Highest level of any module, and a counter bumped when levels change
+extern std::atomic<int> max_level;
+extern std::atomic<uint32_t> generation;
 
-#define MA_LOGD(TAG, ...)               \
-    do {                                \
-        syslog(LOG_DEBUG, __VA_ARGS__); \
-    } while (0)
+void refresh(Site& site, const char* tag);
+void write(Level level, const char* tag, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+inline bool enabled(Site& site, Level level, const char* tag) {
+    if (site.generation.load(std::memory_order_relaxed) != generation.load(std::memory_order_relaxed)) {
+        refresh(site, tag);
+    }
+    return static_cast<int>(level) <= site.level.load(std::memory_order_relaxed);
+}
+
+inline const char* tagName(const char* tag) {
+    return tag;
+}
+
+inline const char* tagName(const std::string& tag) {
+    return tag.c_str();
+}
+
+// Sets the level of a module, or the default level if module is empty
+void setLevel(const std::string& module, Level level);
+
+// Parses "info" or "info,ma::node::save=verbose,ma::node::server=debug";
+// levels are none, error, warning, info, debug, verbose or 0 to 5
+bool configure(const std::string& spec);
 
-#define MA_LOGV(TAG, ...)               \
-    do {                                \
-        syslog(LOG_DEBUG, __VA_ARGS__); \
+// Starts the background writer, to file if given (appended), otherwise to syslog
+bool start(const char* file = nullptr);
+
+// Writes what is queued and stops the background writer
+void stop();
+
+// Messages lost because the ring was full
+uint64_t dropped();
+
+}  // namespace ma::logger
+
+#define MA_LOG_AT(LEVEL, TAG, ...)                                                                              \
+    do {                                                                                                        \
+        static ma::logger::Site _ma_log_site;                                                                   \
+        if (static_cast<int>(LEVEL) <= ma::logger::max_level.load(std::memory_order_relaxed) &&                 \
+            ma::logger::enabled(_ma_log_site, LEVEL, ma::logger::tagName(TAG))) {                               \
+            ma::logger::write(LEVEL, ma::logger::tagName(TAG), __VA_ARGS__);                                    \
+        }                                                                                                       \
     } while (0)
 
+#define MA_LOGE(TAG, ...) MA_LOG_AT(ma::logger::Level::Error, TAG, __VA_ARGS__)
+
+#define MA_LOGW(TAG, ...) MA_LOG_AT(ma::logger::Level::Warning, TAG, __VA_ARGS__)
+
+#define MA_LOGI(TAG, ...) MA_LOG_AT(ma::logger::Level::Info, TAG, __VA_ARGS__)
+
+#define MA_LOGD(TAG, ...) MA_LOG_AT(ma::logger::Level::Debug, TAG, __VA_ARGS__)
+
+#define MA_LOGV(TAG, ...) MA_LOG_AT(ma::logger::Level::Verbose, TAG, __VA_ARGS__)
+
 
 #define MA_ASSERT(expr)                                      \
     do {                                                     \
         if (!(expr)) {                                       \
+            ma::logger::stop();                              \
             syslog(LOG_ERR, "Failed assertion '%s'", #expr); \
             while (1) {                                      \
                 ma_abort();                                  \
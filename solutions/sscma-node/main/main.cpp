@@ -32,6 +32,8 @@ void show_help() {
               << "  -c, --config <file>  Configuration file, default is " << MA_NODE_CONFIG_FILE << "\n"
               << "  --start              Start the service\n"
               << "  --daemon             Run in daemon mode\n"
+              << "  --log-level <spec>   Log levels, e.g. info,ma::node::save=verbose (default: info)\n"
+              << "  --log-file <file>    Log to a file instead of syslog\n"
               << std::endl;
 }
 
@@ -39,7 +41,8 @@ int main(int argc, char** argv) {
 
     openlog("sscma", LOG_CONS | LOG_PERROR, LOG_DAEMON);
 
-    setlogmask(LOG_UPTO(LOG_INFO));
+    // Levels are checked in the process, before formatting; see logger.hpp
+    setlogmask(LOG_UPTO(LOG_DEBUG));
 
     MA_LOGD("main", "version: %s build: %s", PROJECT_VERSION, __DATE__ " " __TIME__);
 
@@ -50,6 +53,7 @@ int main(int argc, char** argv) {
         } else {
             NodeFactory::clear();
         }
+        ma::logger::stop();
         closelog();
         exit(1);
     });
@@ -58,6 +62,7 @@ int main(int argc, char** argv) {
     std::string config_file = MA_NODE_CONFIG_FILE;
     bool start_service      = false;
     bool daemon             = false;
+    std::string log_file;
 
     if (argc < 2) {
         show_help();
@@ -85,6 +90,20 @@ int main(int argc, char** argv) {
         } else if (arg == "--daemon") {
             daemon = true;
             start_service = true;
+        } else if (arg == "--log-level") {
+            if (i + 1 < argc && ma::logger::configure(argv[i + 1])) {
+                ++i;
+            } else {
+                std::cerr << "Error: Invalid argument for --log-level" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--log-file") {
+            if (i + 1 < argc) {
+                log_file = argv[++i];
+            } else {
+                std::cerr << "Error: Missing argument for --log-file" << std::endl;
+                return 1;
+            }
         } else {
             std::cerr << "Error: Unknown option " << arg << std::endl;
             return 1;
@@ -133,6 +152,12 @@ int main(int argc, char** argv) {
             }
         }
 
+        // After the fork, which the writer thread would not survive
+        if (!ma::logger::start(log_file.c_str())) {
+            MA_LOGE(TAG, "cannot open log file %s", log_file.c_str());
+            exit(1);
+        }
+
         NodeServer server(client);
 
         server.setStorage(config);
@@ -146,6 +171,7 @@ int main(int argc, char** argv) {
         }
     }
 
+    ma::logger::stop();
     closelog();
     return 0;
 }
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "audio_level.h"
+
+namespace ma::node {
+
+static constexpr float MIN_DBFS = -100.0f;
+
+// Unvoiced sounds cross zero more often than voiced speech and hum
+static constexpr float UNVOICED_ZCR = 0.3f;
+
+// How fast the noise floor may rise, in dB per second
+static constexpr float NOISE_RISE = 1.0f;
+
+static inline float toDbfs(float amplitude) {
+    if (amplitude <= 0.0f) {
+        return MIN_DBFS;
+    }
+    return std::max(MIN_DBFS, 20.0f * std::log10(amplitude / 32768.0f));
+}
+
+#if defined(__GNUC__)
+
+// Eight lanes map onto SSE2/NEON registers on the host and onto the vector
+// unit of the C906 with -march=rv64gcv0p7, without target intrinsics
+typedef int16_t v8i16 __attribute__((vector_size(16)));
+typedef float v8f32 __attribute__((vector_size(32)));
+
+static inline v8i16 load8(const int16_t* p) {
+    v8i16 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void measureAudioLevel(const int16_t* samples, size_t count, AudioLevel* level) {
+    if (count == 0) {
+        level->rms  = MIN_DBFS;
+        level->peak = MIN_DBFS;
+        level->zcr  = 0.0f;
+        return;
+    }
+
+    float energy  = static_cast<float>(samples[0]) * samples[0];
+    int hi        = samples[0];
+    int lo        = samples[0];
+    size_t cross  = 0;
+    size_t i      = 1;
+    v8f32 venergy = {};
+    v8i16 vhi     = v8i16{} + samples[0];
+    v8i16 vlo     = vhi;
+
+    // Each pass compares a block with the same block one sample earlier.
+    // Crossings are counted in 16-bit lanes and folded before they wrap.
+    while (i + 8 <= count) {
+        size_t end   = std::min(count, i + 8 * 32767);
+        v8i16 vcross = {};
+
+        for (; i + 8 <= end; i += 8) {
+            v8i16 x    = load8(samples + i);
+            v8i16 prev = load8(samples + i - 1);
+            v8f32 f    = __builtin_convertvector(x, v8f32);
+
+            venergy += f * f;
+            vhi = x > vhi ? x : vhi;
+            vlo = x < vlo ? x : vlo;
+            vcross -= (x ^ prev) < 0;
+        }
+        for (int k = 0; k < 8; k++) {
+            cross += static_cast<uint16_t>(vcross[k]);
+        }
+    }
+    for (int k = 0; k < 8; k++) {
+        energy += venergy[k];
+        hi = std::max<int>(hi, vhi[k]);
+        lo = std::min<int>(lo, vlo[k]);
+    }
+
+    for (; i < count; i++) {
+        energy += static_cast<float>(samples[i]) * samples[i];
+        hi = std::max<int>(hi, samples[i]);
+        lo = std::min<int>(lo, samples[i]);
+        cross += (samples[i] ^ samples[i - 1]) < 0;
+    }
+
+    level->rms  = toDbfs(std::sqrt(energy / count));
+    level->peak = toDbfs(static_cast<float>(std::max(hi, -lo)));
+    level->zcr  = count > 1 ? static_cast<float>(cross) / (count - 1) : 0.0f;
+}
+
+#else
+
+void measureAudioLevel(const int16_t* samples, size_t count, AudioLevel* level) {
+    float energy = 0.0f;
+    int hi       = 0;
+    int lo       = 0;
+    size_t cross = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        energy += static_cast<float>(samples[i]) * samples[i];
+        hi = std::max<int>(hi, samples[i]);
+        lo = std::min<int>(lo, samples[i]);
+        if (i > 0) {
+            cross += (samples[i] ^ samples[i - 1]) < 0;
+        }
+    }
+
+    level->rms  = count ? toDbfs(std::sqrt(energy / count)) : MIN_DBFS;
+    level->peak = toDbfs(static_cast<float>(std::max(hi, -lo)));
+    level->zcr  = count > 1 ? static_cast<float>(cross) / (count - 1) : 0.0f;
+}
+
+#endif
+
+VoiceDetector::VoiceDetector(float margin, float floor, int hangover) : margin_(margin), floor_(floor), hangover_(hangover), noise_(MIN_DBFS), hold_(0), primed_(false) {}
+
+void VoiceDetector::reset() {
+    noise_  = MIN_DBFS;
+    hold_   = 0;
+    primed_ = false;
+}
+
+void VoiceDetector::process(const int16_t* samples, size_t count, int duration, AudioLevel* level) {
+    measureAudioLevel(samples, count, level);
+
+    if (!primed_) {
+        noise_  = level->rms;
+        primed_ = true;
+    }
+
+    bool speech = level->rms > floor_ && (level->rms > noise_ + margin_ || (level->rms > noise_ + margin_ / 2 && level->zcr > UNVOICED_ZCR));
+
+    // The floor follows quiet chunks down at once but rises slowly, so
+    // that speech does not lift it while a louder background still does
+    if (level->rms < noise_) {
+        noise_ = level->rms;
+    } else {
+        noise_ = std::min(level->rms, noise_ + NOISE_RISE * duration / 1000.0f);
+    }
+
+    if (speech) {
+        hold_ = hangover_;
+    } else {
+        hold_ = std::max(0, hold_ - duration);
+    }
+    level->active = speech || hold_ > 0;
+}
+
+}  // namespace ma::node
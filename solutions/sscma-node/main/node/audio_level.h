@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ma::node {
+
+// Options for consumers of CHN_AUDIO. With AUDIO_ACTIVE_ONLY a consumer
+// receives only chunks with voice activity, starting one chunk early.
+// AUDIO_COMFORT_NOISE adds empty frames flagged as sid during silence,
+// at its start and then every second or when the noise level changes,
+// for consumers that need to fill the gaps.
+enum { AUDIO_ALL = 0, AUDIO_ACTIVE_ONLY = 1, AUDIO_COMFORT_NOISE = 2 };
+
+// Levels of one chunk of mono S16 audio. rms and peak are in dBFS.
+struct AudioLevel {
+    float rms;
+    float peak;
+    float zcr;    // Sign changes per sample pair, 0 to 1
+    bool active;  // Voice activity, including hangover
+};
+
+// Computes the levels of a chunk in one pass over the samples
+void measureAudioLevel(const int16_t* samples, size_t count, AudioLevel* level);
+
+/*
+ * Energy and zero-crossing voice activity detector. A chunk is speech when
+ * its energy is margin dB above the tracked noise floor, or half of that
+ * with the zero-crossing rate of unvoiced sounds. Activity is held for the
+ * hangover time after the last speech chunk, so that pauses between words
+ * and trailing consonants are not cut.
+ */
+class VoiceDetector {
+public:
+    VoiceDetector(float margin = 9.0f, float floor = -60.0f, int hangover = 400);
+
+    void setMargin(float margin) {
+        margin_ = margin;
+    }
+    void setHangover(int hangover) {
+        hangover_ = hangover;
+    }
+
+    // Measures the chunk and updates the detector; duration is in ms
+    void process(const int16_t* samples, size_t count, int duration, AudioLevel* level);
+    void reset();
+
+    float noiseFloor() const {
+        return noise_;
+    }
+
+private:
+    float margin_;    // Above the noise floor, in dB
+    float floor_;     // Below this level, in dBFS, a chunk is never speech
+    int hangover_;    // In ms
+    float noise_;     // Tracked noise floor, in dBFS
+    int hold_;        // Remaining hangover, in ms
+    bool primed_;
+};
+
+/*
+ * Hands measured chunks to the consumers of CHN_AUDIO according to their
+ * options. Frames are reference counted: every hand-over to deliver()
+ * carries one reference, which the consumer or deliver() itself releases,
+ * and the chunk held back as pre-roll keeps one more until the next chunk.
+ * F is audioFrame; taking it as a parameter keeps this header free of the
+ * node's types, so that the logic can be checked on the host.
+ */
+template <typename F>
+class AudioGate {
+public:
+    ~AudioGate() {
+        drop(false);
+    }
+
+    // Consumer i has options[i], or AUDIO_ALL past the end of options.
+    // duration is the chunk's length in ms; deliver(frame, i) posts one
+    // reference to consumer i, or releases it.
+    template <typename Deliver>
+    void push(F* frame, const std::vector<int>& options, size_t consumers, int duration, Deliver deliver) {
+        const AudioLevel& level = frame->level;
+        size_t gated            = 0;
+        size_t comfort          = 0;
+
+        for (size_t i = 0; i < consumers; i++) {
+            int option = optionOf(options, i);
+            if (option & AUDIO_ACTIVE_ONLY) {
+                gated++;
+                comfort += (option & AUDIO_COMFORT_NOISE) != 0;
+            }
+        }
+        size_t receivers = level.active ? consumers : consumers - gated;
+        bool hold        = gated > 0 && !level.active;
+        frame->ref(receivers + (hold ? 1 : 0));
+
+        if (level.active && !active_ && preroll_ != nullptr) {
+            preroll_->ref(gated);
+            for (size_t i = 0; i < consumers; i++) {
+                if (optionOf(options, i) & AUDIO_ACTIVE_ONLY) {
+                    deliver(preroll_, i);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < consumers; i++) {
+            if (level.active || !(optionOf(options, i) & AUDIO_ACTIVE_ONLY)) {
+                deliver(frame, i);
+            }
+        }
+
+        if (preroll_ != nullptr) {
+            preroll_->release();
+            preroll_ = nullptr;
+        }
+        if (hold) {
+            preroll_ = frame;
+        }
+
+        since_sid_ = std::min(since_sid_ + duration, SID_INTERVAL);
+        if (comfort > 0 && !level.active && (active_ || since_sid_ >= SID_INTERVAL || std::fabs(level.rms - sid_level_) > SID_CHANGE)) {
+            F* sid         = new F();
+            sid->chn       = frame->chn;
+            sid->timestamp = frame->timestamp;
+            sid->level     = level;
+            sid->sid       = true;
+            sid->ref(comfort);
+            for (size_t i = 0; i < consumers; i++) {
+                int option = optionOf(options, i);
+                if ((option & AUDIO_ACTIVE_ONLY) && (option & AUDIO_COMFORT_NOISE)) {
+                    deliver(sid, i);
+                }
+            }
+            since_sid_ = 0;
+            sid_level_ = level.rms;
+        }
+
+        active_ = level.active;
+    }
+
+    // For a chunk that nobody receives: gives up the pre-roll, and notes
+    // the activity so that the next onset is still found
+    void drop(bool active) {
+        if (preroll_ != nullptr) {
+            preroll_->release();
+            preroll_ = nullptr;
+        }
+        active_ = active;
+    }
+
+private:
+    static constexpr int SID_INTERVAL = 1000;  // In ms
+    static constexpr float SID_CHANGE = 3.0f;  // In dB
+
+    static int optionOf(const std::vector<int>& options, size_t i) {
+        return i < options.size() ? options[i] : AUDIO_ALL;
+    }
+
+    F* preroll_     = nullptr;
+    bool active_    = false;
+    int since_sid_  = SID_INTERVAL;
+    float sid_level_ = 0.0f;
+};
+
+}  // namespace ma::node
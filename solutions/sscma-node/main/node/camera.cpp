@@ -1,5 +1,6 @@
 
 #include <alsa/asoundlib.h>
+#include <cmath>
 
 #include "camera.h"
 
@@ -40,6 +41,7 @@ CameraNode::CameraNode(std::string id)
       preview_(false),
       websocket_(true),
       audio_(80),
+      meter_(0),
       mirror_(false),
       flip_(false),
       option_(0),
@@ -53,6 +55,8 @@ CameraNode::CameraNode(std::string id)
         channels_[i].enabled    = false;
         channels_[i].format     = MA_PIXEL_FORMAT_H264;
         channels_[i].fps        = 30;
+        channels_[i].layers     = 1;
+        channels_[i].position   = {};
     }
     channels_.shrink_to_fit();
 }
@@ -61,9 +65,24 @@ CameraNode::~CameraNode() {
     onDestroy();
 };
 
-static inline bool isKeyFrame(int format) {
+static inline bool isKeyFrame(ma_pixel_format_t format, const VENC_PACK_S* pack) {
     bool isKey = false;
-    switch (format) {
+    if (format == MA_PIXEL_FORMAT_H265) {
+        switch (pack->DataType.enH265EType) {
+            case H265E_NALU_ISLICE:
+            case H265E_NALU_VPS:
+            case H265E_NALU_SPS:
+            case H265E_NALU_IDRSLICE:
+            case H265E_NALU_SEI:
+            case H265E_NALU_PPS:
+                isKey = true;
+                break;
+            default:
+                break;
+        }
+        return isKey;
+    }
+    switch (pack->DataType.enH264EType) {
         case H264E_NALU_ISLICE:
         case H264E_NALU_SPS:
         case H264E_NALU_IDRSLICE:
@@ -71,6 +90,8 @@ static inline bool isKeyFrame(int format) {
         case H264E_NALU_PPS:
             isKey = true;
             break;
+        default:
+            break;
     }
     return isKey;
 }
@@ -82,9 +103,6 @@ int CameraNode::vencCallback(void* pData, void* pArgs) {
     APP_VENC_CHN_CFG_S* pstVencChnCfg = (APP_VENC_CHN_CFG_S*)pstDataParam->pParam;
     VENC_CHN VencChn                  = pstVencChnCfg->VencChn;
 
-    if (!started_ || !enabled_ || channels_[VencChn].msgboxes.empty()) {
-        return CVI_SUCCESS;
-    }
     if (pstVencChnCfg->VencChn >= CHN_MAX) {
         MA_LOGW(TAG, "invalid chn %d", pstVencChnCfg->VencChn);
         return CVI_SUCCESS;
@@ -93,17 +111,30 @@ int CameraNode::vencCallback(void* pData, void* pArgs) {
     VENC_STREAM_S* pstStream = (VENC_STREAM_S*)pData;
     VENC_PACK_S* ppack;
 
+    if (pstStream->u32PackCount == 0) {
+        return CVI_SUCCESS;
+    }
+    // The slice comes last in the stream. Every frame is counted, also those
+    // nobody is waiting for, or the ids would be lost up to the next keyframe.
+    bool key            = isKeyFrame(channels_[VencChn].format, &pstStream->pstPack[pstStream->u32PackCount - 1]);
+    uint8_t temporal_id = video_temporal_next(channels_[VencChn].layers, &channels_[VencChn].position, key,
+                                              pstStream->pstPack[0].u64PTS);
+
+    if (!started_ || !enabled_ || channels_[VencChn].msgboxes.empty()) {
+        return CVI_SUCCESS;
+    }
+
     for (int i = 0; i < pstStream->u32PackCount; i++) {
         videoFrame* frame = nullptr;
         ppack             = &pstStream->pstPack[i];
-        if (VencChn == CHN_H264 && isKeyFrame(ppack->DataType.enH264EType)) {
+        if (VencChn == CHN_H264 && isKeyFrame(channels_[VencChn].format, ppack)) {
             int cnt    = 0;
             int offset = 0;
             int size   = 0;
             for (int j = i; j < pstStream->u32PackCount; j++) {
                 size += pstStream->pstPack[j].u32Len - pstStream->pstPack[j].u32Offset;
                 cnt++;
-                if (!isKeyFrame(pstStream->pstPack[j].DataType.enH264EType)) {
+                if (!isKeyFrame(channels_[VencChn].format, &pstStream->pstPack[j])) {
                     break;
                 }
             }
@@ -126,6 +157,7 @@ int CameraNode::vencCallback(void* pData, void* pArgs) {
             frame->img.physical        = false;
             frame->img.data            = new uint8_t[size];
             frame->fps                 = channels_[VencChn].fps;
+            frame->temporal_id         = temporal_id;
             channels_[VencChn].dropped = false;
             for (int j = i; j < i + cnt; j++) {
                 memcpy(frame->img.data + offset, pstStream->pstPack[j].pu8Addr + pstStream->pstPack[j].u32Offset, pstStream->pstPack[j].u32Len - pstStream->pstPack[j].u32Offset);
@@ -148,6 +180,7 @@ int CameraNode::vencCallback(void* pData, void* pArgs) {
             frame->img.physical = false;
             frame->img.data     = new uint8_t[ppack->u32Len - ppack->u32Offset];
             frame->fps          = channels_[VencChn].fps;
+            frame->temporal_id  = temporal_id;
             frame->blocks.push_back({frame->img.data, ppack->u32Len - ppack->u32Offset});
             memcpy(frame->img.data, ppack->pu8Addr + ppack->u32Offset, ppack->u32Len - ppack->u32Offset);
         }
@@ -156,7 +189,10 @@ int CameraNode::vencCallback(void* pData, void* pArgs) {
             for (auto& msgbox : channels_[VencChn].msgboxes) {
                 if (!msgbox->post(frame, Tick::fromMilliseconds(static_cast<int>(1000.0 / channels_[VencChn].fps)))) {
                     frame->release();
-                    channels_[VencChn].dropped = true;
+                    // Nothing references an upper layer frame, only the base layer needs a keyframe
+                    if (temporal_id == 0) {
+                        channels_[VencChn].dropped = true;
+                    }
                 }
             }
         }
@@ -207,7 +243,7 @@ void CameraNode::threadEntry() {
     while (started_) {
         if (frame_.fetch(reinterpret_cast<void**>(&frame), Tick::fromSeconds(1))) {
             Thread::enterCritical();
-            if (transport_ && frame->img.format == MA_PIXEL_FORMAT_H264) {
+            if (transport_ && (frame->img.format == MA_PIXEL_FORMAT_H264 || frame->img.format == MA_PIXEL_FORMAT_H265)) {
                 transport_->send(reinterpret_cast<const char*>(frame->img.data), frame->img.size);
             } else {
                 if (Tick::current() - last > Tick::fromMilliseconds(100)) {
@@ -323,10 +359,26 @@ void CameraNode::threadAudioEntry() {
         return;
     }
 
-    buffer = new uint16_t[chunk_size * bits_per_sample / 8 * 2 + 1];
+    // One period per read: the capture plugin's periods are the 100 ms
+    // the driver delivers at once, so larger reads only add latency
+    size_t chunk_bytes = chunk_size * bits_per_sample / 8 * CHANNELS;
+    buffer             = new uint16_t[chunk_bytes / sizeof(uint16_t) + 1];
+
+    AudioGate<audioFrame> gate;
+    ma_tick_t last_meter = 0;
+    uint32_t chunks      = 0;
+    uint32_t voiced      = 0;
+
+    auto deliver = [](audioFrame* frame, MessageBox* msgbox) {
+        if (msgbox->isFull() || !msgbox->post(frame, Tick::fromMilliseconds(20))) {
+            frame->release();
+        }
+    };
+
+    vad_.reset();
 
     while (started_) {
-        pcm_return = snd_pcm_readi(handle, buffer, chunk_size * 2);
+        pcm_return = snd_pcm_readi(handle, buffer, chunk_size);
         if (pcm_return == -EPIPE) {
             MA_LOGW(TAG, "overrun occurred");
             if (snd_pcm_prepare(handle) < 0) {
@@ -338,23 +390,40 @@ void CameraNode::threadAudioEntry() {
             MA_LOGE(TAG, "error from read: %s", snd_strerror(pcm_return));
             break;
         }
-        if (!enabled_ || channels_[CHN_AUDIO].msgboxes.empty()) {
+
+        AudioLevel level;
+        vad_.process(reinterpret_cast<const int16_t*>(buffer), pcm_return * CHANNELS, pcm_return * 1000 / rate, &level);
+        chunks++;
+        voiced += level.active;
+
+        if (meter_ > 0 && Tick::current() - last_meter >= Tick::fromMilliseconds(meter_)) {
+            server_->response(id_,
+                              json::object({{"type", MA_MSG_TYPE_EVT},
+                                            {"name", "audio"},
+                                            {"code", MA_OK},
+                                            {"data", {{"rms", std::round(level.rms * 10) / 10}, {"peak", std::round(level.peak * 10) / 10}, {"active", level.active}}}}));
+            last_meter = Tick::current();
+        }
+
+        channel& audio = channels_[CHN_AUDIO];
+        if (!enabled_ || audio.msgboxes.empty()) {
+            gate.drop(level.active);
             continue;
         }
+
         audioFrame* frame = new audioFrame();
         frame->chn        = CHN_AUDIO;
-        frame->data       = new uint8_t[chunk_size * bits_per_sample / 8 * 2];
-        frame->size       = chunk_size * bits_per_sample / 8 * 2;
+        frame->data       = new uint8_t[chunk_bytes];
+        frame->size       = chunk_bytes;
         frame->timestamp  = Tick::current();
-        memcpy(frame->data, buffer, chunk_size * bits_per_sample / 8 * 2);
-        frame->ref(channels_[CHN_AUDIO].msgboxes.size());
-        for (auto& msgbox : channels_[CHN_AUDIO].msgboxes) {
-            if (msgbox->isFull() || !msgbox->post(frame, Tick::fromMilliseconds(20))) {
-                frame->release();
-            }
-        }
+        frame->level      = level;
+        memcpy(frame->data, buffer, chunk_bytes);
+        gate.push(frame, audio.options, audio.msgboxes.size(), pcm_return * 1000 / rate, [&](audioFrame* f, size_t i) { deliver(f, audio.msgboxes[i]); });
     }
 
+    gate.drop(false);
+    MA_LOGI(TAG, "audio: %u of %u chunks active, noise floor %.1f dBFS", voiced, chunks, vad_.noiseFloor());
+
     snd_pcm_close(handle);
     delete[] buffer;
 }
@@ -424,6 +493,18 @@ ma_err_t CameraNode::onCreate(const json& config) {
         }
     }
 
+    if (config.contains("meter") && config["meter"].is_number()) {
+        meter_ = std::max(0, config["meter"].get<int>());
+    }
+
+    if (config.contains("vad_margin") && config["vad_margin"].is_number()) {
+        vad_.setMargin(config["vad_margin"].get<float>());
+    }
+
+    if (config.contains("vad_hangover") && config["vad_hangover"].is_number()) {
+        vad_.setHangover(config["vad_hangover"].get<int>());
+    }
+
     if (config.contains("fps") && config["fps"].is_number()) {
         fps_ = config["fps"].get<int>();
         if (fps_ < 1) {
@@ -434,6 +515,14 @@ ma_err_t CameraNode::onCreate(const json& config) {
         }
     }
 
+    if (config.contains("layers") && config["layers"].is_number()) {
+        int layers = config["layers"].get<int>();
+        if (layers < 1 || layers > VIDEO_TEMPORAL_LAYERS_MAX) {
+            MA_THROW(Exception(MA_EINVAL, "Invalid temporal layers: " + std::to_string(layers)));
+        }
+        channels_[CHN_H264].layers = layers;
+    }
+
     if (config.contains("light") && config["light"].is_number()) {
         light_ = config["light"].get<int>();
     }
@@ -556,6 +645,9 @@ ma_err_t CameraNode::onControl(const std::string& control, const json& data) {
             system("echo 1 > /sys/devices/platform/leds/leds/white/brightness");
         }
         server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_OK}, {"data", {"light", light_}}}));
+    } else if (control == "meter" && data.is_number()) {
+        meter_ = std::max(0, data.get<int>());
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_OK}, {"data", {"meter", meter_}}}));
     } else if (control == "enabled" && data.is_boolean()) {
         bool enabled = data.get<bool>();
         if (enabled_ != enabled) {
@@ -655,8 +747,13 @@ ma_err_t CameraNode::onStart() {
         param.height = channels_[i].height;
         param.fps    = channels_[i].fps;
         MA_LOGI(TAG, "start channel %d format %d width %d height %d fps %d", i, param.format, param.width, param.height, param.fps);
+        channels_[i].position = {};
         if (channels_[i].enabled) {
             setupVideo(static_cast<video_ch_index_t>(i), &param);
+            if (channels_[i].layers > 1 && setVideoTemporalLayers(static_cast<video_ch_index_t>(i), channels_[i].layers) != 0) {
+                MA_LOGW(TAG, "channel %d: temporal layers not supported", i);
+                channels_[i].layers = 1;
+            }
             if (i == CHN_RAW) {
                 registerVideoFrameHandler(static_cast<video_ch_index_t>(i), 0, vpssCallbackStub, this);
             } else {
@@ -720,10 +817,12 @@ ma_err_t CameraNode::config(int chn, int32_t width, int32_t height, int32_t fps,
     return MA_OK;
 }
 
-ma_err_t CameraNode::attach(int chn, MessageBox* msgbox) {
+ma_err_t CameraNode::attach(int chn, MessageBox* msgbox, int option) {
     Guard guard(mutex_);
     if (channels_[chn].enabled) {
         MA_LOGI(TAG, "attach %p to %d", msgbox, chn);
+        // The option goes first, as the audio thread indexes it by msgbox
+        channels_[chn].options.push_back(option);
         channels_[chn].msgboxes.push_back(msgbox);
     }
     return MA_OK;
@@ -737,6 +836,7 @@ ma_err_t CameraNode::detach(int chn, MessageBox* msgbox) {
         enabled_ = false;
         MA_LOGI(TAG, "detach %p from %d", msgbox, chn);
         Thread::sleep(Tick::fromMilliseconds(50));  // skip last frame
+        channels_[chn].options.erase(channels_[chn].options.begin() + (it - channels_[chn].msgboxes.begin()));
         channels_[chn].msgboxes.erase(it);
         enabled_ = true;
     }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "audio_level.h"
 #include "node.h"
 #include "server.h"
 
@@ -23,7 +24,10 @@ typedef struct {
     bool configured;
     bool enabled;
     bool dropped;
+    uint8_t layers;      // Temporal layers of an encoded channel
+    video_temporal_position_t position;
     std::vector<MessageBox*> msgboxes;
+    std::vector<int> options;
 } channel;
 
 class Frame {
@@ -55,6 +59,7 @@ public:
     std::vector<std::pair<void*, size_t>> blocks;
     ma_img_t img;
     int fps;
+    uint8_t temporal_id = 0;  // 0 = base layer; a consumer may skip the frames above it
 };
 
 class audioFrame : public Frame {
@@ -62,6 +67,8 @@ public:
     audioFrame() : Frame() {
         data = nullptr;
         size = 0;
+        sid  = false;
+        memset(&level, 0, sizeof(level));
     }
     inline void release() override {
         if (ref_cnt.load(std::memory_order_relaxed) == 0 || ref_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
@@ -72,6 +79,8 @@ public:
 
     uint8_t* data;
     size_t size;
+    AudioLevel level;
+    bool sid;  // Silence descriptor, no data; level holds the noise
 };
 
 class CameraNode : public Node {
@@ -88,7 +97,7 @@ public:
     ma_err_t onDestroy() override;
 
     ma_err_t config(int chn, int32_t width = -1, int32_t height = -1, int32_t fps = -1, ma_pixel_format_t format = MA_PIXEL_FORMAT_UNKNOWN, bool enabled = true);
-    ma_err_t attach(int chn, MessageBox* msgbox);
+    ma_err_t attach(int chn, MessageBox* msgbox, int option = AUDIO_ALL);
     ma_err_t detach(int chn, MessageBox* msgbox);
 
 protected:
@@ -107,6 +116,8 @@ private:
     bool preview_;
     bool websocket_;
     int audio_;
+    int meter_;
+    VoiceDetector vad_;
     int option_;
     int fps_;
     int light_;
@@ -14,7 +14,10 @@ using namespace ma::model;
 
 static constexpr char TAG[] = "ma::node::qrcode";
 
-QRCodeNode::QRCodeNode(std::string id) : Node("qr", id), count_(0), thread_(nullptr), camera_(nullptr), raw_frame_(1) {}
+// Frames between forced full-frame scans while tracking a code
+#define QR_TRACKING_FULL_SCAN_INTERVAL 10
+
+QRCodeNode::QRCodeNode(std::string id) : Node("qr", id), count_(0), thread_(nullptr), camera_(nullptr), raw_frame_(1), qr_(nullptr), qr_width_(0), qr_height_(0) {}
 
 QRCodeNode::~QRCodeNode() {
     onDestroy();
@@ -40,7 +43,6 @@ void QRCodeNode::threadEntry() {
         }
 
         Thread::enterCritical();
-        struct quirc* q = nullptr;
         try {
             const int width     = frame->img.width;
             const int height    = frame->img.height;
@@ -51,28 +53,29 @@ void QRCodeNode::threadEntry() {
                 data = frame->img.data;
             }
 
-            // Initialize quirc decoder
-            q = quirc_new();
-            if (!q) {
-                MA_LOGE(TAG, "Failed to allocate quirc decoder");
-                if (frame->img.physical) {
-                    CVI_SYS_Munmap(frame->img.data, frame->img.size);
+            // Keep one decoder across frames so that tracking can reuse the
+            // previous frame's code locations
+            if (!qr_) {
+                qr_        = quirc_new();
+                qr_width_  = 0;
+                qr_height_ = 0;
+                if (qr_) {
+                    quirc_set_tracking(qr_, QR_TRACKING_FULL_SCAN_INTERVAL);
                 }
-                frame->release();
-                Thread::exitCritical();
-                continue;
             }
 
-            if (quirc_resize(q, width, height) < 0) {
-                MA_LOGE(TAG, "Failed to resize quirc decoder");
+            if (!qr_ || ((qr_width_ != width || qr_height_ != height) && quirc_resize(qr_, width, height) < 0)) {
+                MA_LOGE(TAG, "Failed to set up quirc decoder for %dx%d", width, height);
                 if (frame->img.physical) {
                     CVI_SYS_Munmap(frame->img.data, frame->img.size);
                 }
                 frame->release();
-                quirc_destroy(q);
                 Thread::exitCritical();
                 continue;
             }
+            qr_width_  = width;
+            qr_height_ = height;
+            struct quirc* q = qr_;
 
             // Convert RGB888 -> Grayscale (required by quirc)
             uint8_t* gray_image = quirc_begin(q, nullptr, nullptr);
@@ -123,10 +126,6 @@ void QRCodeNode::threadEntry() {
             MA_LOGE(TAG, "Error processing frame: %s", e.what());
         }
 
-        // Cleanup
-        if (q) {
-            quirc_destroy(q);
-        }
         frame->release();
         Thread::sleep(Tick::fromMilliseconds(500));  // limit fps
         Thread::exitCritical();
@@ -226,6 +225,11 @@ ma_err_t QRCodeNode::onDestroy() {
         thread_ = nullptr;
     }
 
+    if (qr_) {
+        quirc_destroy(qr_);
+        qr_ = nullptr;
+    }
+
     created_ = false;
     return MA_OK;
 }
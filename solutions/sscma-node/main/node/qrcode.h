@@ -90,6 +90,9 @@ protected:
     Thread* thread_;          ///< Worker thread
     CameraNode* camera_;      ///< Connected camera node
     MessageBox raw_frame_;    ///< Message box to receive raw RGB888 frames
+    struct quirc* qr_;        ///< Decoder, kept across frames for tracking
+    int qr_width_;            ///< Size the decoder is currently set up for
+    int qr_height_;
 };
 
 }  // namespace ma::node
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include "camera.h"  // Explicitly include camera.h to ensure audioFrame and videoFrame are available
 #include "save.h"
 
+#include "audio_dsp.h"
+
 // Default folders for saving
 #ifndef NODE_SAVE_PATH_LOCAL
 #define NODE_SAVE_PATH_LOCAL "/userdata/Videos/"
@@ -173,7 +175,7 @@ bool SaveNode::openFile(videoFrame* frame) {
 
     avStream_->id                   = avFmtCtx_->nb_streams - 1;
     avStream_->time_base            = {1, 1000000};  // Time base in milliseconds
-    avStream_->codecpar->codec_id   = AV_CODEC_ID_H264;
+    avStream_->codecpar->codec_id   = frame->img.format == MA_PIXEL_FORMAT_H265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
     avStream_->codecpar->width      = frame->img.width;
     avStream_->codecpar->height     = frame->img.height;
     avStream_->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
@@ -289,12 +291,7 @@ void SaveNode::closeFile() {
 
             const int16_t* pcm_data = (const int16_t*)audio_buffer_.data();
             int samples             = audioCodecCtx_->frame_size;
-            for (int i = 0; i < samples; i++) {
-                for (int ch = 0; ch < CHANNELS; ch++) {
-                    float val                         = pcm_data[i * CHANNELS + ch] / 32768.0f;
-                    ((float*)audioFrame->data[ch])[i] = val;
-                }
-            }
+            audio_s16_to_f32_planar(pcm_data, reinterpret_cast<float* const*>(audioFrame->data), samples, CHANNELS);
 
             audio_buffer_.erase(audio_buffer_.begin(), audio_buffer_.begin() + needed_bytes);
 
@@ -346,12 +343,7 @@ void SaveNode::closeFile() {
             } else {
                 const int16_t* pcm_data = (const int16_t*)audio_buffer_.data();
                 int samples             = audioCodecCtx_->frame_size;
-                for (int i = 0; i < samples; i++) {
-                    for (int ch = 0; ch < CHANNELS; ch++) {
-                        float val                         = pcm_data[i * CHANNELS + ch] / 32768.0f;
-                        ((float*)audioFrame->data[ch])[i] = val;
-                    }
-                }
+                audio_s16_to_f32_planar(pcm_data, reinterpret_cast<float* const*>(audioFrame->data), samples, CHANNELS);
 
                 audio_buffer_.clear();
 
@@ -575,12 +567,7 @@ void SaveNode::threadEntry() {
 
                         const int16_t* pcm_data = (const int16_t*)audio_buffer_.data();
                         int samples             = audioCodecCtx_->frame_size;
-                        for (int i = 0; i < samples; i++) {
-                            for (int ch = 0; ch < CHANNELS; ch++) {
-                                float val                         = pcm_data[i * CHANNELS + ch] / 32768.0f;
-                                ((float*)audioFrame->data[ch])[i] = val;
-                            }
-                        }
+                        audio_s16_to_f32_planar(pcm_data, reinterpret_cast<float* const*>(audioFrame->data), samples, CHANNELS);
 
                         audio_buffer_.erase(audio_buffer_.begin(), audio_buffer_.begin() + needed_bytes);
 
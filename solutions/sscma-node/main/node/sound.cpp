@@ -0,0 +1,448 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "sound.h"
+
+namespace ma::node {
+
+using namespace ma::engine;
+
+static constexpr char TAG[] = "ma::node::sound";
+
+#define DEFAULT_MODEL "/userdata/Models/sound.cvimodel"
+
+static size_t elements(const ma_shape_t& shape) {
+    size_t n = 1;
+    for (size_t i = 0; i < shape.size; i++) {
+        n *= shape.dims[i];
+    }
+    return n;
+}
+
+SoundNode::SoundNode(std::string id)
+    : Node("sound", id),
+      uri_(""),
+      engine_(nullptr),
+      mel_(nullptr),
+      frames_(0),
+      interval_(48),
+      threshold_(0.3f),
+      topk_(5),
+      head_(0),
+      filled_(0),
+      pending_(0),
+      feature_ms_(0.0f),
+      thread_(nullptr),
+      camera_(nullptr),
+      frame_(30) {
+    audio_mel_default_config(&config_);
+}
+
+SoundNode::~SoundNode() {
+    onDestroy();
+}
+
+// Copies the frames, oldest first, into the engine's own input buffer
+void SoundNode::setInput() {
+    ma_tensor_t input = engine_->getInput(0);
+    int32_t mels      = config_.mels;
+    float inv         = input.quant_param.scale > 0.0f ? 1.0f / input.quant_param.scale : 1.0f;
+    int32_t zero      = input.quant_param.zero_point;
+
+    for (int32_t i = 0; i < frames_; i++) {
+        const float* src = history_.data() + ((head_ + i) % frames_) * mels;
+        size_t offset    = static_cast<size_t>(i) * mels;
+
+        if (input.type == MA_TENSOR_TYPE_F32) {
+            memcpy(static_cast<float*>(input.data.data) + offset, src, mels * sizeof(float));
+        } else if (input.type == MA_TENSOR_TYPE_S8) {
+            int8_t* dst = static_cast<int8_t*>(input.data.data) + offset;
+            for (int32_t k = 0; k < mels; k++) {
+                dst[k] = static_cast<int8_t>(std::clamp<long>(std::lrint(src[k] * inv) + zero, -128, 127));
+            }
+        } else {
+            uint8_t* dst = static_cast<uint8_t*>(input.data.data) + offset;
+            for (int32_t k = 0; k < mels; k++) {
+                dst[k] = static_cast<uint8_t>(std::clamp<long>(std::lrint(src[k] * inv) + zero, 0, 255));
+            }
+        }
+    }
+}
+
+void SoundNode::invoke() {
+    json reply = json::object({{"type", MA_MSG_TYPE_EVT}, {"name", "sound"}, {"code", MA_OK}, {"data", json::object()}});
+
+    Thread::enterCritical();
+
+    ma_tick_t start = Tick::current();
+    setInput();
+    ma_err_t err = engine_->run();
+    ma_tick_t end = Tick::current();
+
+    reply["data"]["classes"] = json::array();
+    reply["data"]["labels"]  = json::array();
+
+    if (err == MA_OK) {
+        ma_tensor_t output = engine_->getOutput(0);
+        size_t classes     = elements(output.shape);
+        std::vector<std::pair<float, int32_t>> scores;
+
+        for (size_t i = 0; i < classes; i++) {
+            float score;
+            if (output.type == MA_TENSOR_TYPE_F32) {
+                score = static_cast<const float*>(output.data.data)[i];
+            } else if (output.type == MA_TENSOR_TYPE_S8) {
+                score = (static_cast<const int8_t*>(output.data.data)[i] - output.quant_param.zero_point) * output.quant_param.scale;
+            } else {
+                score = (static_cast<const uint8_t*>(output.data.data)[i] - output.quant_param.zero_point) * output.quant_param.scale;
+            }
+            if (score >= threshold_) {
+                scores.emplace_back(score, static_cast<int32_t>(i));
+            }
+        }
+
+        std::sort(scores.begin(), scores.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        if (topk_ > 0 && scores.size() > static_cast<size_t>(topk_)) {
+            scores.resize(topk_);
+        }
+
+        for (auto& score : scores) {
+            reply["data"]["classes"].push_back({static_cast<int8_t>(std::min(score.first, 1.0f) * 100), score.second});
+            if (labels_.size() > static_cast<size_t>(score.second)) {
+                reply["data"]["labels"].push_back(labels_[score.second]);
+            } else {
+                reply["data"]["labels"].push_back(std::string("N/A-" + std::to_string(score.second)));
+            }
+        }
+    } else {
+        reply["code"] = err;
+    }
+
+    Thread::exitCritical();
+
+    // Feature extraction is spread over the audio since the last inference
+    reply["data"]["perf"] = json::array();
+    reply["data"]["perf"].push_back({std::lrint(feature_ms_), Tick::toMilliseconds(end - start), Tick::toMilliseconds(Tick::current() - end)});
+    feature_ms_ = 0.0f;
+
+    server_->response(id_, reply);
+}
+
+void SoundNode::threadEntry() {
+    Frame* frame = nullptr;
+    int32_t mels = config_.mels;
+
+    server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", "enabled"}, {"code", MA_OK}, {"data", enabled_.load()}}));
+
+    while (started_) {
+        if (!frame_.fetch(reinterpret_cast<void**>(&frame), Tick::fromSeconds(2))) {
+            continue;
+        }
+
+        audioFrame* audio = static_cast<audioFrame*>(frame);
+
+        // Start over when enabled again, rather than classify across the gap
+        if (!enabled_) {
+            frame->release();
+            audio_mel_reset(mel_);
+            head_    = 0;
+            filled_  = 0;
+            pending_ = 0;
+            continue;
+        }
+
+        const int16_t* samples = reinterpret_cast<const int16_t*>(audio->data);
+        size_t count           = audio->size / sizeof(int16_t);
+        size_t max             = audio_mel_max_frames(mel_, count);
+
+        if (features_.size() < max * mels) {
+            features_.resize(max * mels);
+        }
+
+        ma_tick_t start = Tick::current();
+        size_t n        = audio_mel_process_s16(mel_, samples, count, features_.data());
+        feature_ms_ += Tick::toMicroseconds(Tick::current() - start) / 1000.0f;
+        frame->release();
+
+        for (size_t i = 0; i < n; i++) {
+            int32_t slot;
+            if (filled_ < frames_) {
+                slot = filled_++;
+            } else {
+                slot  = head_;
+                head_ = (head_ + 1) % frames_;
+            }
+            memcpy(history_.data() + static_cast<size_t>(slot) * mels, features_.data() + i * mels, mels * sizeof(float));
+            pending_++;
+
+            if (filled_ == frames_ && pending_ >= interval_) {
+                pending_ = 0;
+                invoke();
+            }
+        }
+    }
+}
+
+void SoundNode::threadEntryStub(void* obj) {
+    reinterpret_cast<SoundNode*>(obj)->threadEntry();
+}
+
+ma_err_t SoundNode::onCreate(const json& config) {
+    Guard guard(mutex_);
+
+    int32_t window_ms   = 25;
+    int32_t hop_ms      = 10;
+    int32_t interval_ms = 480;
+
+    labels_.clear();
+
+    if (config.contains("uri") && config["uri"].is_string()) {
+        uri_ = config["uri"].get<std::string>();
+    }
+
+    if (uri_.empty()) {
+        uri_ = DEFAULT_MODEL;
+    }
+
+    if (access(uri_.c_str(), R_OK) != 0) {
+        MA_THROW(Exception(MA_ENOENT, "Model file not found " + uri_));
+    }
+
+    // find model.json
+    size_t pos = uri_.find_last_of(".");
+    if (pos != std::string::npos) {
+        std::string path = uri_.substr(0, pos) + ".json";
+        if (access(path.c_str(), R_OK) == 0) {
+            std::ifstream ifs(path);
+            if (!ifs.is_open()) {
+                MA_THROW(Exception(MA_EINVAL, "Model config file not found " + path));
+            }
+            ifs >> info_;
+            if (info_.is_object()) {
+                if (info_.contains("classes") && info_["classes"].is_array()) {
+                    labels_ = info_["classes"].get<std::vector<std::string>>();
+                }
+            }
+        }
+    }
+
+    // override classes
+    if (labels_.size() == 0 && config.contains("labels") && config["labels"].is_array() && config["labels"].size() > 0) {
+        labels_ = config["labels"].get<std::vector<std::string>>();
+    }
+
+    // The front end the model was trained with; the defaults are those of YAMNet
+    if (config.contains("window_ms") && config["window_ms"].is_number_integer()) {
+        window_ms = config["window_ms"].get<int32_t>();
+    }
+    if (config.contains("hop_ms") && config["hop_ms"].is_number_integer()) {
+        hop_ms = config["hop_ms"].get<int32_t>();
+    }
+    if (config.contains("mels") && config["mels"].is_number_integer()) {
+        config_.mels = config["mels"].get<unsigned int>();
+    }
+    if (config.contains("fmin") && config["fmin"].is_number()) {
+        config_.fmin = config["fmin"].get<float>();
+    }
+    if (config.contains("fmax") && config["fmax"].is_number()) {
+        config_.fmax = config["fmax"].get<float>();
+    }
+    if (config.contains("log_offset") && config["log_offset"].is_number()) {
+        config_.log_offset = config["log_offset"].get<float>();
+    }
+    if (config.contains("power") && config["power"].is_boolean()) {
+        config_.power = config["power"].get<bool>();
+    }
+    if (config.contains("interval") && config["interval"].is_number_integer()) {
+        interval_ms = config["interval"].get<int32_t>();
+    }
+    if (config.contains("threshold") && config["threshold"].is_number()) {
+        threshold_ = config["threshold"].get<float>();
+    }
+    if (config.contains("topk") && config["topk"].is_number_integer()) {
+        topk_ = config["topk"].get<int32_t>();
+    }
+
+    if (window_ms <= 0 || hop_ms <= 0) {
+        MA_THROW(Exception(MA_EINVAL, "Invalid window or hop"));
+    }
+    config_.rate     = SAMPLE_RATE;
+    config_.window   = SAMPLE_RATE * window_ms / 1000;
+    config_.hop      = SAMPLE_RATE * hop_ms / 1000;
+    config_.fft_size = 1;
+    while (config_.fft_size < config_.window) {
+        config_.fft_size <<= 1;
+    }
+    interval_ = std::max(1, interval_ms / hop_ms);
+
+    MA_TRY {
+        mel_ = audio_mel_create(&config_);
+        if (mel_ == nullptr) {
+            MA_THROW(Exception(MA_EINVAL, "Invalid audio feature config"));
+        }
+
+        engine_ = new EngineDefault();
+
+        if (engine_ == nullptr) {
+            MA_THROW(Exception(MA_ENOMEM, "Engine init failed"));
+        }
+        if (engine_->init() != MA_OK) {
+            MA_THROW(Exception(MA_EINVAL, "Engine init failed"));
+        }
+        if (engine_->load(uri_) != MA_OK) {
+            MA_THROW(Exception(MA_EINVAL, "Engine load failed"));
+        }
+
+        // The input is frames of mels values; its shape gives the number of frames
+        ma_tensor_t input = engine_->getInput(0);
+        size_t size       = elements(input.shape);
+        if (input.type != MA_TENSOR_TYPE_F32 && input.type != MA_TENSOR_TYPE_S8 && input.type != MA_TENSOR_TYPE_U8) {
+            MA_THROW(Exception(MA_ENOTSUP, "Model input type not supported"));
+        }
+        if (size == 0 || size % config_.mels != 0) {
+            MA_THROW(Exception(MA_EINVAL, "Model input does not match the mel bands"));
+        }
+        frames_ = size / config_.mels;
+        history_.assign(size, 0.0f);
+
+        MA_LOGI(TAG, "model: %s, %d frames of %u mels, every %d ms", uri_.c_str(), frames_, config_.mels, interval_ * hop_ms);
+
+        thread_ = new Thread((type_ + "#" + id_).c_str(), &SoundNode::threadEntryStub, this);
+        if (thread_ == nullptr) {
+            MA_THROW(Exception(MA_ENOMEM, "Not enough memory"));
+        }
+    }
+    MA_CATCH(ma::Exception & e) {
+        if (engine_ != nullptr) {
+            delete engine_;
+            engine_ = nullptr;
+        }
+        audio_mel_destroy(mel_);
+        mel_ = nullptr;
+        MA_THROW(e);
+    }
+    MA_CATCH(std::exception & e) {
+        if (engine_ != nullptr) {
+            delete engine_;
+            engine_ = nullptr;
+        }
+        audio_mel_destroy(mel_);
+        mel_ = nullptr;
+        MA_THROW(Exception(MA_EINVAL, e.what()));
+    }
+
+    created_ = true;
+
+    server_->response(id_,
+                      json::object({{"type", MA_MSG_TYPE_RESP},
+                                    {"name", "create"},
+                                    {"code", MA_OK},
+                                    {"data", {{"frames", frames_}, {"mels", config_.mels}, {"hop", hop_ms}, {"interval", interval_ * hop_ms}, {"info", info_}}}}));
+
+    return MA_OK;
+}
+
+ma_err_t SoundNode::onControl(const std::string& control, const json& data) {
+    Guard guard(mutex_);
+    if (control == "config") {
+        if (data.contains("threshold") && data["threshold"].is_number()) {
+            threshold_ = data["threshold"].get<float>();
+        }
+        if (data.contains("topk") && data["topk"].is_number_integer()) {
+            topk_ = data["topk"].get<int32_t>();
+        }
+        if (data.contains("interval") && data["interval"].is_number_integer()) {
+            interval_ = std::max(1, data["interval"].get<int32_t>() * static_cast<int32_t>(config_.rate) / static_cast<int32_t>(config_.hop * 1000));
+        }
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_OK}, {"data", data}}));
+    } else if (control == "enabled" && data.is_boolean()) {
+        enabled_.store(data.get<bool>());
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_OK}, {"data", enabled_.load()}}));
+    } else {
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_ENOTSUP}, {"data", "Not supported"}}));
+    }
+    return MA_OK;
+}
+
+ma_err_t SoundNode::onStart() {
+    Guard guard(mutex_);
+    if (started_) {
+        return MA_OK;
+    }
+
+    for (auto& dep : dependencies_) {
+        if (dep.second->type() == "camera") {
+            camera_ = static_cast<CameraNode*>(dep.second);
+            break;
+        }
+    }
+
+    if (camera_ == nullptr) {
+        MA_THROW(Exception(MA_ENOTSUP, "No camera node found"));
+        return MA_ENOTSUP;
+    }
+
+    audio_mel_reset(mel_);
+    head_       = 0;
+    filled_     = 0;
+    pending_    = 0;
+    feature_ms_ = 0.0f;
+
+    camera_->attach(CHN_AUDIO, &frame_);
+
+    MA_LOGI(TAG, "start sound: %s(%s)", type_.c_str(), id_.c_str());
+    started_ = true;
+
+    thread_->start(this);
+
+    return MA_OK;
+}
+
+ma_err_t SoundNode::onStop() {
+    Guard guard(mutex_);
+    if (!started_) {
+        return MA_OK;
+    }
+    started_ = false;
+
+    if (thread_ != nullptr) {
+        thread_->join();
+    }
+
+    if (camera_ != nullptr) {
+        camera_->detach(CHN_AUDIO, &frame_);
+        camera_ = nullptr;
+    }
+    return MA_OK;
+}
+
+ma_err_t SoundNode::onDestroy() {
+    Guard guard(mutex_);
+
+    if (!created_) {
+        return MA_OK;
+    }
+
+    onStop();
+
+    if (thread_ != nullptr) {
+        delete thread_;
+        thread_ = nullptr;
+    }
+    if (engine_ != nullptr) {
+        delete engine_;
+        engine_ = nullptr;
+    }
+    audio_mel_destroy(mel_);
+    mel_ = nullptr;
+
+    created_ = false;
+
+    return MA_OK;
+}
+
+REGISTER_NODE_SINGLETON("sound", SoundNode);
+
+}  // namespace ma::node
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "node.h"
+#include "server.h"
+
+#include "camera.h"
+
+#include "audio_dsp.h"
+
+namespace ma::node {
+
+/*
+ * Sound event detection on the audio of a camera node. The audio is
+ * turned into log-mel frames as it arrives, and every interval the last
+ * frames, as many as the model's input holds, are classified; scores
+ * above the threshold are sent as a "sound" event.
+ */
+class SoundNode : public Node {
+
+public:
+    SoundNode(std::string id);
+    ~SoundNode();
+
+    ma_err_t onCreate(const json& config) override;
+    ma_err_t onStart() override;
+    ma_err_t onControl(const std::string& control, const json& data) override;
+    ma_err_t onStop() override;
+    ma_err_t onDestroy() override;
+
+protected:
+    void threadEntry();
+    static void threadEntryStub(void* obj);
+
+private:
+    void setInput();
+    void invoke();
+
+protected:
+    std::string uri_;
+    json info_;
+    std::vector<std::string> labels_;
+    Engine* engine_;
+    audio_mel_config_t config_;
+    audio_mel_t* mel_;
+    int32_t frames_;    // Mel frames in the model input
+    int32_t interval_;  // Between inferences, in mel frames
+    float threshold_;
+    int32_t topk_;
+    std::vector<float> history_;   // The last frames_ mel frames, as a ring
+    std::vector<float> features_;  // Frames of the current audio chunk
+    int32_t head_;                 // Oldest frame in history_
+    int32_t filled_;
+    int32_t pending_;              // Frames since the last inference
+    float feature_ms_;             // Time spent on the frames of the next inference
+    Thread* thread_;
+    CameraNode* camera_;
+    MessageBox frame_;
+};
+
+}  // namespace ma::node
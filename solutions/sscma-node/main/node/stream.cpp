@@ -9,7 +9,7 @@ namespace ma::node {
 
 static constexpr char TAG[] = "ma::node::stream";
 
-StreamNode::StreamNode(std::string id) : Node("stream", id), port_(0), host_(""), url_(""), username_(""), password_(""), thread_(nullptr), camera_(nullptr), frame_(60), transport_(nullptr) {
+StreamNode::StreamNode(std::string id) : Node("stream", id), port_(0), host_(""), url_(""), username_(""), password_(""), thread_(nullptr), camera_(nullptr), frame_(60), format_(MA_PIXEL_FORMAT_H264), transport_(nullptr), vad_(false) {
     char hostname[1024];
     hostname[1023] = '\0';
     gethostname(hostname, 1023);
@@ -76,6 +76,24 @@ ma_err_t StreamNode::onCreate(const json& config) {
         password_ = config["password"].get<std::string>();
     }
 
+    // "h265" roughly halves the bitrate at the same quality; the camera
+    // encodes its H.264 channel with whichever codec is chosen here
+    if (config.contains("codec") && config["codec"].is_string()) {
+        std::string codec = config["codec"].get<std::string>();
+        if (codec == "h264") {
+            format_ = MA_PIXEL_FORMAT_H264;
+        } else if (codec == "h265") {
+            format_ = MA_PIXEL_FORMAT_H265;
+        } else {
+            MA_THROW(Exception(MA_EINVAL, "Unsupported codec: " + codec));
+        }
+    }
+
+    // Leave out the audio of silent periods to save uplink bandwidth
+    if (config.contains("vad") && config["vad"].is_boolean()) {
+        vad_ = config["vad"].get<bool>();
+    }
+
     if (session_.empty()) {
         MA_THROW(Exception(MA_EINVAL, "Session is empty"));
     }
@@ -97,7 +115,7 @@ ma_err_t StreamNode::onCreate(const json& config) {
         MA_THROW(Exception(MA_ENOMEM, "Not enough memory"));
     }
 
-    TransportRTSP::Config rtspConfig = {port_, MA_PIXEL_FORMAT_H264, MA_AUDIO_FORMAT_PCM, 16000, 1, 16, session_, username_, password_};
+    TransportRTSP::Config rtspConfig = {port_, format_, MA_AUDIO_FORMAT_PCM, 16000, 1, 16, session_, username_, password_};
 
     err = transport_->init(&rtspConfig);
     if (err != MA_OK) {
@@ -167,9 +185,9 @@ ma_err_t StreamNode::onStart() {
         return MA_ENOTSUP;
     }
 
-    camera_->config(CHN_H264);
+    camera_->config(CHN_H264, -1, -1, -1, format_);
     camera_->attach(CHN_H264, &frame_);
-    camera_->attach(CHN_AUDIO, &frame_);
+    camera_->attach(CHN_AUDIO, &frame_, vad_ ? AUDIO_ACTIVE_ONLY : AUDIO_ALL);
 
     started_ = true;
 
@@ -30,10 +30,12 @@ protected:
     std::string url_;
     std::string username_;
     std::string password_;
+    ma_pixel_format_t format_;
     TransportRTSP* transport_;
     CameraNode* camera_;
     MessageBox frame_;
     Thread* thread_;
+    bool vad_;
 };
 
 }  // namespace ma::node
\ No newline at end of file
@@ -0,0 +1,290 @@
+// talkback_node.cpp
+#include <algorithm>
+#include <cmath>
+
+#include "talkback_node.h"
+
+namespace ma::node {
+
+static constexpr char TAG[] = "ma::node::talkback";
+
+// How often the transport is polled; the arrival times of packets are only this precise
+static constexpr int POLL_MS = 2;
+
+TalkbackNode::TalkbackNode(std::string id)
+    : Node("talkback", id),
+      port_(8070),
+      codec_(TALKBACK_CODEC_L16),
+      report_(1000),
+      device_("default"),
+      talkback_(nullptr),
+      transport_(nullptr),
+      camera_(nullptr),
+      frame_(30),
+      thread_(nullptr),
+      seq_(0),
+      timestamp_(0) {
+    talkback_default_config(&config_);
+}
+
+TalkbackNode::~TalkbackNode() {
+    onDestroy();
+}
+
+void TalkbackNode::receive() {
+    size_t n;
+
+    while (transport_->available() > 0 && (n = transport_->receive(reinterpret_cast<char*>(buffer_.data()), buffer_.size())) > 0) {
+        if (enabled_) {
+            talkback_feed(talkback_, buffer_.data(), n, talkback_now_us());
+        }
+    }
+}
+
+void TalkbackNode::send(audioFrame* frame) {
+    const int16_t* pcm = reinterpret_cast<const int16_t*>(frame->data);
+    size_t frames      = frame->size / (sizeof(int16_t) * CHANNELS);
+    size_t max         = 32767 / CHANNELS;  // Payload of at most 65535 bytes
+
+    if (frame->sid || frame->data == nullptr) {
+        return;
+    }
+
+    // The frame was stamped when its last sample was read
+    uint64_t end_us = talkback_now_us() - Tick::toMicroseconds(Tick::current() - frame->timestamp);
+
+    while (frames > 0) {
+        size_t n              = std::min(frames, max);
+        talkback_packet_t pkt = {};
+
+        pkt.codec      = static_cast<uint8_t>(codec_);
+        pkt.channels   = CHANNELS;
+        pkt.seq        = seq_++;
+        pkt.rate       = SAMPLE_RATE;
+        pkt.timestamp  = timestamp_;
+        pkt.capture_us = end_us - static_cast<uint64_t>(frames) * 1000000 / SAMPLE_RATE;
+        pkt.payload    = payload_.data();
+        pkt.size       = static_cast<uint16_t>(talkback_encode(codec_, pcm, n * CHANNELS, payload_.data()));
+
+        size_t size = talkback_packet_write(&pkt, buffer_.data(), buffer_.size());
+        transport_->send(reinterpret_cast<const char*>(buffer_.data()), size);
+
+        pcm += n * CHANNELS;
+        frames -= n;
+        timestamp_ += n;
+    }
+}
+
+json TalkbackNode::stats() {
+    talkback_stats_t s;
+    talkback_get_stats(talkback_, &s);
+
+    auto round1    = [](float v) { return std::round(v * 10) / 10; };
+    uint64_t total = s.frames + s.concealed;
+
+    return json::object({{"packets", s.packets},
+                         {"late", s.late},
+                         {"lost", s.lost},
+                         {"invalid", s.invalid},
+                         {"concealed", total > 0 ? round1(100.0f * s.concealed / total) : 0.0f},
+                         {"xruns", s.xruns},
+                         {"jitter", round1(s.jitter_ms)},
+                         {"target", round1(s.target_ms)},
+                         {"buffer", round1(s.buffer_ms)},
+                         {"device", round1(s.device_ms)},
+                         {"latency", {{"last", round1(s.latency_ms)}, {"min", round1(s.latency_min_ms)}, {"mean", round1(s.latency_mean_ms)}, {"max", round1(s.latency_max_ms)}}}});
+}
+
+void TalkbackNode::threadEntry() {
+    Frame* frame          = nullptr;
+    ma_tick_t last_report = Tick::current();
+
+    server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", "enabled"}, {"code", MA_OK}, {"data", enabled_.load()}}));
+
+    while (started_) {
+        if (camera_ != nullptr && frame_.fetch(reinterpret_cast<void**>(&frame), Tick::fromMilliseconds(POLL_MS))) {
+            if (enabled_) {
+                send(static_cast<audioFrame*>(frame));
+            }
+            frame->release();
+        } else if (camera_ == nullptr) {
+            Thread::sleep(Tick::fromMilliseconds(POLL_MS));
+        }
+
+        receive();
+
+        if (report_ > 0 && Tick::current() - last_report >= Tick::fromMilliseconds(report_)) {
+            server_->response(id_, json::object({{"type", MA_MSG_TYPE_EVT}, {"name", "talkback"}, {"code", MA_OK}, {"data", stats()}}));
+            last_report = Tick::current();
+        }
+    }
+}
+
+void TalkbackNode::threadEntryStub(void* obj) {
+    reinterpret_cast<TalkbackNode*>(obj)->threadEntry();
+}
+
+ma_err_t TalkbackNode::onCreate(const json& config) {
+    Guard guard(mutex_);
+
+    MA_LOGD(TAG, "config: %s", config.dump().c_str());
+
+    if (config.contains("port") && config["port"].is_number_integer()) {
+        port_ = config["port"].get<int>();
+    }
+    if (config.contains("device") && config["device"].is_string()) {
+        device_ = config["device"].get<std::string>();
+    }
+    if (config.contains("rate") && config["rate"].is_number_integer()) {
+        config_.rate = config["rate"].get<unsigned int>();
+    }
+    if (config.contains("period") && config["period"].is_number_integer()) {
+        config_.period_ms = config["period"].get<unsigned int>();
+    }
+    if (config.contains("min_delay") && config["min_delay"].is_number_integer()) {
+        config_.min_delay_ms = config["min_delay"].get<unsigned int>();
+    }
+    if (config.contains("max_delay") && config["max_delay"].is_number_integer()) {
+        config_.max_delay_ms = config["max_delay"].get<unsigned int>();
+    }
+    if (config.contains("report") && config["report"].is_number_integer()) {
+        report_ = std::max(0, config["report"].get<int>());
+    }
+    if (config.contains("codec") && config["codec"].is_string()) {
+        std::string codec = config["codec"].get<std::string>();
+        codec_            = codec == "pcmu" ? TALKBACK_CODEC_PCMU : codec == "pcma" ? TALKBACK_CODEC_PCMA : TALKBACK_CODEC_L16;
+    }
+    if (config.contains("enabled") && config["enabled"].is_boolean()) {
+        enabled_ = config["enabled"].get<bool>();
+    }
+    config_.device = device_.c_str();
+
+    talkback_ = talkback_create(&config_);
+    if (talkback_ == nullptr) {
+        MA_THROW(Exception(MA_EINVAL, "Invalid config"));
+    }
+
+    buffer_.resize(TALKBACK_HEADER_SIZE + 65535);
+    payload_.resize(65535);
+
+    thread_ = new Thread((type_ + "#" + id_).c_str(), &TalkbackNode::threadEntryStub, this);
+    if (thread_ == nullptr) {
+        talkback_destroy(talkback_);
+        talkback_ = nullptr;
+        MA_THROW(Exception(MA_ENOMEM, "Not enough memory"));
+    }
+
+    MA_LOGI(TAG, "port: %d, device: %s, rate: %u, period: %u ms, delay: %u-%u ms", port_, device_.c_str(), config_.rate, config_.period_ms, config_.min_delay_ms, config_.max_delay_ms);
+
+    server_->response(id_,
+                      json::object({{"type", MA_MSG_TYPE_RESP},
+                                    {"name", "create"},
+                                    {"code", MA_OK},
+                                    {"data", {{"port", port_}, {"device", device_}, {"rate", config_.rate}, {"period", config_.period_ms}}}}));
+
+    created_ = true;
+    return MA_OK;
+}
+
+ma_err_t TalkbackNode::onStart() {
+    Guard guard(mutex_);
+    if (started_) {
+        return MA_OK;
+    }
+
+    camera_ = nullptr;
+    for (auto& dep : dependencies_) {
+        if (dep.second->type() == "camera") {
+            camera_ = static_cast<CameraNode*>(dep.second);
+            break;
+        }
+    }
+
+    int err = talkback_start(talkback_);
+    if (err < 0) {
+        MA_LOGE(TAG, "cannot play on %s: %d", device_.c_str(), err);
+        MA_THROW(Exception(MA_EIO, "Cannot open audio output"));
+    }
+
+    TransportWebSocket::Config ws_config = {.port = port_};
+    transport_                           = new TransportWebSocket();
+    if (transport_ == nullptr) {
+        talkback_stop(talkback_);
+        MA_THROW(Exception(MA_ENOMEM, "Not enough memory"));
+    }
+    transport_->init(&ws_config);
+    MA_LOGI(TAG, "talkback websocket server started on port %d", port_);
+
+    if (camera_ != nullptr) {
+        camera_->attach(CHN_AUDIO, &frame_);
+    }
+
+    seq_       = 0;
+    timestamp_ = 0;
+    started_   = true;
+    thread_->start(this);
+    return MA_OK;
+}
+
+ma_err_t TalkbackNode::onControl(const std::string& control, const json& data) {
+    Guard guard(mutex_);
+    if (control == "enabled" && data.is_boolean()) {
+        enabled_.store(data.get<bool>());
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_OK}, {"data", enabled_.load()}}));
+    } else if (control == "stats") {
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_OK}, {"data", stats()}}));
+    } else {
+        server_->response(id_, json::object({{"type", MA_MSG_TYPE_RESP}, {"name", control}, {"code", MA_ENOTSUP}, {"data", "Not supported"}}));
+    }
+    return MA_OK;
+}
+
+ma_err_t TalkbackNode::onStop() {
+    Guard guard(mutex_);
+    if (!started_) {
+        return MA_OK;
+    }
+    started_ = false;
+
+    if (thread_ != nullptr) {
+        thread_->join();
+    }
+
+    if (camera_ != nullptr) {
+        camera_->detach(CHN_AUDIO, &frame_);
+        camera_ = nullptr;
+    }
+
+    if (transport_ != nullptr) {
+        transport_->deInit();
+        delete transport_;
+        transport_ = nullptr;
+    }
+
+    talkback_stop(talkback_);
+    talkback_reset(talkback_);
+    return MA_OK;
+}
+
+ma_err_t TalkbackNode::onDestroy() {
+    Guard guard(mutex_);
+    if (!created_) {
+        return MA_OK;
+    }
+
+    onStop();
+    if (thread_ != nullptr) {
+        delete thread_;
+        thread_ = nullptr;
+    }
+
+    talkback_destroy(talkback_);
+    talkback_ = nullptr;
+
+    created_ = false;
+    return MA_OK;
+}
+
+REGISTER_NODE_SINGLETON("talkback", TalkbackNode);
+
+}  // namespace ma::node
@@ -0,0 +1,55 @@
+// talkback_node.h
+#pragma once
+
+#include "camera.h"
+#include "node.h"
+
+#include "talkback.h"
+
+namespace ma::node {
+
+/*
+ * Two-way talkback over a WebSocket. The client sends talkback packets
+ * (components/talkback) that are played through the jitter buffer on an
+ * ALSA device; with a camera node as a dependency, the captured audio is
+ * sent back to the client as packets of the same format.
+ */
+class TalkbackNode : public Node {
+
+public:
+    TalkbackNode(std::string id);
+    ~TalkbackNode();
+
+    ma_err_t onCreate(const json& config) override;
+    ma_err_t onStart() override;
+    ma_err_t onControl(const std::string& control, const json& data) override;
+    ma_err_t onStop() override;
+    ma_err_t onDestroy() override;
+
+protected:
+    void threadEntry();
+    static void threadEntryStub(void* obj);
+
+private:
+    void receive();
+    void send(audioFrame* frame);
+    json stats();
+
+protected:
+    int port_;
+    int codec_;   // Of the audio sent to the client
+    int report_;  // Stats event interval in ms, 0 for none
+    std::string device_;
+    talkback_config_t config_;
+    talkback_t* talkback_;
+    TransportWebSocket* transport_;
+    CameraNode* camera_;
+    MessageBox frame_;
+    Thread* thread_;
+    uint16_t seq_;
+    uint32_t timestamp_;
+    std::vector<uint8_t> buffer_;
+    std::vector<uint8_t> payload_;
+};
+
+}  // namespace ma::node
@@ -8,6 +8,15 @@
 #include <cstdlib>
 #include <getopt.h>
 #include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 extern "C" {
 #include "video_shm.h"
@@ -16,13 +25,64 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "schema.h"
+
 #define TAG "qr-reader"
 #define CHANNEL_ID 2  // Read from camera-streamer channel 2 (640x480@15fps)
 
+// H.264 NAL unit types used for frame scheduling
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR   5
+#define H264_NAL_SEI   6
+#define H264_NAL_SPS   7
+#define H264_NAL_PPS   8
+#define H264_NAL_AUD   9
+
+// Daemon mode
+#define DEFAULT_SOCKET_PATH "/tmp/sscma-qrcode-reader.sock"
+#define MAX_CLIENTS         8
+#define MAX_REQUEST_SIZE    1024
+#define GOP_BUFFER_LIMIT    (4 * 1024 * 1024)  // Bytes of frames kept for catch-up decoding
+#define RESULT_CACHE_SIZE   64
+
 static volatile bool g_running = true;
 static volatile bool g_cancelled = false;
 static video_shm_consumer_t g_consumer;
 
+// Which frames are handed to the H.264 decoder
+enum DecodeMode {
+    DECODE_KEYFRAME,  // IDR frames only; P-frames never reach the decoder
+    DECODE_ALL,       // Every reference frame, to scan between keyframes
+};
+
+// Summary of the NAL units in one H.264 access unit
+struct AccessUnitInfo {
+    bool has_idr;       // Decodable on its own
+    bool is_reference;  // Later frames may predict from it
+};
+
+// Recorded Annex-B H.264 stream, replayed in place of camera-streamer
+struct FileSource {
+    uint8_t* data;
+    int size;
+    int pos;        // Start of the next access unit
+    int fps;        // Replay rate, 0 = as fast as possible
+    bool loop;      // Rewind at the end instead of stopping
+    uint32_t sequence;
+    std::chrono::steady_clock::time_point start;
+};
+
+static FileSource g_file_source;
+static bool g_use_file = false;
+
+// Frame counters and CPU usage reported with the result
+struct ScanStats {
+    int frames_decoded;
+    int frames_scanned;
+    struct rusage usage_start;
+    std::chrono::steady_clock::time_point start;
+};
+
 // FFmpeg decoder context
 struct H264Decoder {
     const AVCodec* codec;
@@ -48,7 +108,7 @@ static void signal_handler(int signo) {
 }
 
 // Initialize H.264 decoder
-static int init_h264_decoder(H264Decoder* decoder, int width, int height) {
+static int init_h264_decoder(H264Decoder* decoder, int width, int height, DecodeMode mode) {
     decoder->initialized = false;
     
     // Find H.264 decoder
@@ -70,6 +130,19 @@ static int init_h264_decoder(H264Decoder* decoder, int width, int height) {
     decoder->codec_ctx->height = height;
     decoder->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
     
+    // Only the Y plane is scanned: skip chroma reconstruction where the
+    // decoder supports it, and return each picture as soon as its packet
+    // is sent rather than after a frame-threading delay
+    decoder->codec_ctx->flags |= AV_CODEC_FLAG_GRAY | AV_CODEC_FLAG_LOW_DELAY;
+    decoder->codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    decoder->codec_ctx->thread_count = 1;
+    
+    // In keyframe mode the decoder discards anything but IDR pictures, in
+    // case a non-IDR slice gets past the NAL filter
+    if (mode == DECODE_KEYFRAME) {
+        decoder->codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    }
+    
     // Open codec
     if (avcodec_open2(decoder->codec_ctx, decoder->codec, NULL) < 0) {
         fprintf(stderr, "[%s] ERROR: Could not open codec\n", TAG);
@@ -114,7 +187,7 @@ static void cleanup_h264_decoder(H264Decoder* decoder) {
 }
 
 // Initialize QR decoder
-static int init_qr_decoder(QRDecoder* qr_decoder, int width, int height) {
+static int init_qr_decoder(QRDecoder* qr_decoder, int width, int height, quirc_threshold_t threshold) {
     qr_decoder->initialized = false;
     
     qr_decoder->qr = quirc_new();
@@ -129,6 +202,8 @@ static int init_qr_decoder(QRDecoder* qr_decoder, int width, int height) {
         return -1;
     }
     
+    quirc_set_threshold(qr_decoder->qr, threshold);
+    
     qr_decoder->initialized = true;
     fprintf(stderr, "[%s] QR decoder initialized (%dx%d)\n", TAG, width, height);
     return 0;
@@ -143,21 +218,9 @@ static void cleanup_qr_decoder(QRDecoder* qr_decoder) {
     qr_decoder->initialized = false;
 }
 
-// Convert YUV420P to grayscale (just copy Y plane)
-static void yuv420p_to_grayscale(const AVFrame* frame, uint8_t* gray_data, int width, int height) {
-    // In YUV420P format, the Y plane is the first plane and contains grayscale data
-    // Simply copy the Y plane
-    const uint8_t* y_plane = frame->data[0];
-    int y_linesize = frame->linesize[0];
-    
-    for (int y = 0; y < height; y++) {
-        memcpy(gray_data + y * width, y_plane + y * y_linesize, width);
-    }
-}
-
-// Decode H.264 frame to grayscale
-static int decode_h264_frame(H264Decoder* decoder, const uint8_t* h264_data, 
-                              int h264_size, uint8_t* gray_data, int width, int height) {
+// Decode H.264 frame; on success decoder->frame holds the picture and its
+// Y plane (data[0], linesize[0]) is the grayscale image
+static int decode_h264_frame(H264Decoder* decoder, const uint8_t* h264_data, int h264_size) {
     if (!decoder->initialized) {
         return -1;
     }
@@ -188,87 +251,689 @@ static int decode_h264_frame(H264Decoder* decoder, const uint8_t* h264_data,
         return -1;
     }
     
-    // Convert YUV420P to grayscale (extract Y plane)
-    yuv420p_to_grayscale(decoder->frame, gray_data, width, height);
+    return 0;
+}
+
+// Return the offset of the NAL header following the next Annex-B start
+// code at or after pos, or size if there is none
+static int next_nal(const uint8_t* data, int size, int pos) {
+    for (int i = pos; i + 3 < size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            return i + 3;
+        }
+    }
+    return size;
+}
+
+// Classify an access unit by its first slice, without decoding it
+static void parse_access_unit(const uint8_t* data, int size, AccessUnitInfo* info) {
+    info->has_idr = false;
+    info->is_reference = false;
+    
+    for (int pos = next_nal(data, size, 0); pos < size; pos = next_nal(data, size, pos)) {
+        int type = data[pos] & 0x1f;
+        
+        if (type == H264_NAL_SLICE || type == H264_NAL_IDR) {
+            info->has_idr = type == H264_NAL_IDR;
+            info->is_reference = (data[pos] & 0x60) != 0;  // nal_ref_idc
+            return;
+        }
+    }
+}
+
+// Find where the access unit starting at pos ends: at the first AUD, SEI,
+// SPS or PPS, or slice with first_mb_in_slice == 0, after its own slices
+static int access_unit_end(const uint8_t* data, int size, int pos) {
+    bool have_slice = false;
+    
+    for (int nal = next_nal(data, size, pos); nal < size; nal = next_nal(data, size, nal)) {
+        int type = data[nal] & 0x1f;
+        bool is_slice = type == H264_NAL_SLICE || type == H264_NAL_IDR;
+        
+        if (have_slice &&
+            (type == H264_NAL_AUD || type == H264_NAL_SEI || type == H264_NAL_SPS ||
+             type == H264_NAL_PPS || (is_slice && nal + 1 < size && (data[nal + 1] & 0x80)))) {
+            // Back up over the start code, which may have a leading zero
+            int end = nal - 3;
+            return end > pos && data[end - 1] == 0 ? end - 1 : end;
+        }
+        
+        if (is_slice) {
+            have_slice = true;
+        }
+    }
+    return size;
+}
+
+// Load a recorded stream for replay
+static int open_file_source(FileSource* src, const char* path, int fps) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "[%s] ERROR: Could not open %s\n", TAG, path);
+        return -1;
+    }
+    
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    
+    *src = FileSource();
+    src->data = size > 0 && size < 0x7fffffff ? (uint8_t*)malloc(size) : NULL;
+    if (!src->data || fread(src->data, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "[%s] ERROR: Could not read %s\n", TAG, path);
+        free(src->data);
+        src->data = NULL;
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
     
+    src->size = (int)size;
+    src->fps = fps;
+    src->start = std::chrono::steady_clock::now();
+    fprintf(stderr, "[%s] Replaying %s (%ld bytes) at %d fps\n", TAG, path, size, fps);
     return 0;
 }
 
-// Schema validation for QR code data
-static bool validate_schema(const char* data, const char* schema_name) {
-    // Simple JSON format check
-    if (!data || strlen(data) == 0) {
-        return false;
+// Read the next access unit, paced at the replay rate. Returns its size,
+// or -1 at the end of the stream.
+static int file_source_read(FileSource* src, uint8_t* data, video_frame_meta_t* meta) {
+    if (src->pos >= src->size) {
+        if (!src->loop) {
+            return -1;
+        }
+        src->pos = 0;
     }
     
-    if (strcmp(schema_name, "authority_config") == 0) {
-        // Check for required fields in authority config
-        return (strstr(data, "\"type\"") != NULL && 
-                strstr(data, "authority_alert") != NULL);
-    } else if (strcmp(schema_name, "wifi_config") == 0) {
-        // Check for ssid field
-        return (strstr(data, "\"ssid\"") != NULL);
-    } else if (strcmp(schema_name, "device_pairing") == 0) {
-        // Check for device_id field
-        return (strstr(data, "\"device_id\"") != NULL);
+    int end = access_unit_end(src->data, src->size, src->pos);
+    int size = end - src->pos;
+    if (size > VIDEO_SHM_MAX_FRAME_SIZE) {
+        fprintf(stderr, "[%s] ERROR: Access unit of %d bytes is too large\n", TAG, size);
+        return -1;
     }
     
-    // Unknown schema - accept any data
-    return true;
+    memcpy(data, src->data + src->pos, size);
+    src->pos = end;
+    
+    // Timestamps follow the stream's nominal rate even when replaying
+    // as fast as possible, so that --scan-rate still applies
+    int rate = src->fps > 0 ? src->fps : 15;
+    AccessUnitInfo info;
+    parse_access_unit(data, size, &info);
+    
+    memset(meta, 0, sizeof(*meta));
+    meta->timestamp_ms = (uint64_t)src->sequence * 1000 / rate;
+    meta->size = size;
+    meta->sequence = src->sequence++;
+    meta->is_keyframe = info.has_idr;
+    meta->fps = rate;
+    
+    if (src->fps > 0) {
+        std::this_thread::sleep_until(src->start + std::chrono::milliseconds(meta->timestamp_ms));
+    }
+    return size;
+}
+
+// Release the video source, camera-streamer or file
+static void close_input() {
+    if (g_use_file) {
+        free(g_file_source.data);
+        g_file_source.data = NULL;
+    } else {
+        video_shm_consumer_destroy(&g_consumer);
+    }
+}
+
+// Append frame counters and CPU usage to a JSON result object
+static void print_scan_stats(const ScanStats* stats) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    auto cpu_us = [](const struct rusage& u) {
+        return (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1000000.0 + u.ru_utime.tv_usec + u.ru_stime.tv_usec;
+    };
+    double wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - stats->start).count();
+    double cpu_percent = wall_us > 0 ? 100.0 * (cpu_us(usage) - cpu_us(stats->usage_start)) / wall_us : 0.0;
+    
+    printf(",\"frames_decoded\":%d,\"frames_scanned\":%d,\"cpu_percent\":%.1f",
+           stats->frames_decoded, stats->frames_scanned, cpu_percent);
 }
 
 // Escape JSON string for output
-static void print_json_escaped(const char* str) {
+static std::string json_escape(const char* str) {
+    std::string out;
     for (const char* p = str; *p; p++) {
         unsigned char c = (unsigned char)*p;
         switch (c) {
-            case '"':  printf("\\\""); break;
-            case '\\': printf("\\\\"); break;
-            case '\b': printf("\\b"); break;
-            case '\f': printf("\\f"); break;
-            case '\n': printf("\\n"); break;
-            case '\r': printf("\\r"); break;
-            case '\t': printf("\\t"); break;
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
             default:
                 // Handle control characters
                 if (c < 32) {
-                    printf("\\u%04x", c);
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
                 } else {
-                    printf("%c", c);
+                    out += (char)c;
                 }
                 break;
         }
     }
+    return out;
+}
+
+static void print_json_escaped(const char* str) {
+    fputs(json_escape(str).c_str(), stdout);
+}
+
+// Format one decoded QR code as a JSON object's fields, without braces
+static std::string qr_code_fields(const struct quirc_data& qr, bool validated) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "\",\"version\":%d,\"ecc_level\":\"%c\",\"mask\":%d,\"data_type\":%d,\"validated\":%s",
+             qr.version, "MLHQ"[qr.ecc_level], qr.mask, qr.data_type, validated ? "true" : "false");
+    return "\"data\":\"" + json_escape((const char*)qr.payload) + buf;
+}
+
+// Format the "qr_codes" and "count" fields of a successful result
+static std::string qr_codes_fields(const std::vector<struct quirc_data>& qr_codes, bool validated) {
+    std::string out = "\"qr_codes\":[";
+    for (size_t i = 0; i < qr_codes.size(); i++) {
+        if (i > 0) out += ",";
+        out += "{" + qr_code_fields(qr_codes[i], validated) + "}";
+    }
+    return out + "],\"count\":" + std::to_string(qr_codes.size());
+}
+
+// Key for deduplicating and caching QR codes by payload
+static std::string payload_key(const struct quirc_data& qr) {
+    return std::string((const char*)qr.payload, qr.payload_len);
+}
+
+// Scan a decoded picture's Y plane in place, returning the codes that decode
+static void scan_picture(QRDecoder* qr_decoder, const AVFrame* picture, std::vector<struct quirc_data>* results) {
+    results->clear();
+    
+    if (quirc_set_image(qr_decoder->qr, picture->data[0], picture->width,
+                        picture->height, picture->linesize[0]) != 0) {
+        return;
+    }
+    quirc_end(qr_decoder->qr);
+    
+    // Extract and decode QR codes
+    int count = quirc_count(qr_decoder->qr);
+    
+    for (int i = 0; i < count; i++) {
+        struct quirc_code code;
+        struct quirc_data data;
+        
+        quirc_extract(qr_decoder->qr, i, &code);
+        if (quirc_decode(&code, &data) == QUIRC_SUCCESS) {
+            results->push_back(data);
+        }
+    }
+}
+
+// A client of the daemon and its scan request
+struct ScanClient {
+    int fd;
+    std::string input;      // Request line as received so far
+    bool active;            // Request parsed, scan in progress
+    bool done;              // Final result sent, to be closed
+    int max_results;
+    std::string schema;
+    const SchemaRule* schema_rule;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point deadline;
+    int frames_processed;
+    std::unordered_set<std::string> seen;
+    std::vector<struct quirc_data> found;
+};
+
+// A recently decoded QR code, so that new requests can be answered
+// before the next frame is scanned
+struct CachedResult {
+    struct quirc_data data;
+    std::chrono::steady_clock::time_point last_seen;
+};
+
+// Resident scanner state: the decoder stays attached and warm between
+// requests, and the frames since the last IDR are kept so that a new
+// request can catch up without waiting for the next one
+struct Daemon {
+    H264Decoder* decoder;
+    QRDecoder* qr_decoder;
+    int listen_fd;
+    int scan_rate;
+    int cache_ttl_ms;
+    std::vector<ScanClient> clients;
+    std::vector<std::vector<uint8_t>> gop;
+    size_t gop_bytes;
+    bool gop_valid;     // gop starts with an IDR and holds every reference frame since
+    bool synced;        // Decoder has seen every reference frame up to now
+    std::unordered_map<std::string, CachedResult> cache;
+};
+
+static long elapsed_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static int open_listen_socket(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[%s] ERROR: Socket path too long: %s\n", TAG, path);
+        return -1;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "[%s] ERROR: Could not create socket: %s\n", TAG, strerror(errno));
+        return -1;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, MAX_CLIENTS) < 0) {
+        fprintf(stderr, "[%s] ERROR: Could not listen on %s: %s\n", TAG, path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send one line to a client. Lines are short, so a client that cannot
+// take them within the send timeout is dropped.
+static void client_send(ScanClient* client, const std::string& line) {
+    size_t sent = 0;
+    while (!client->done && sent < line.size()) {
+        ssize_t n = send(client->fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            client->done = true;
+        } else {
+            sent += n;
+        }
+    }
+}
+
+static void client_finish(ScanClient* client, const std::string& result) {
+    client_send(client, result + "\n");
+    client->done = true;
+}
+
+// Find the value of "key" in a flat JSON object, or NULL if absent
+static const char* json_find(const std::string& json, const char* key) {
+    std::string pattern = std::string("\"") + key + "\"";
+    size_t pos = json.find(pattern);
+    if (pos == std::string::npos) {
+        return NULL;
+    }
+    
+    pos += pattern.size();
+    while (pos < json.size() && (json[pos] == ' ' || json[pos] == ':')) {
+        pos++;
+    }
+    return json.c_str() + pos;
 }
 
-// Check if QR code is already in the found list
-static bool is_duplicate_qr(const std::vector<struct quirc_data>& qr_codes, const struct quirc_data* new_qr) {
-    for (const auto& existing : qr_codes) {
-        if (existing.payload_len == new_qr->payload_len &&
-            memcmp(existing.payload, new_qr->payload, existing.payload_len) == 0) {
-            return true;
+// Parse a request such as {"timeout":30,"max_results":1,"schema":"wifi_config"}
+static bool parse_request(ScanClient* client) {
+    const std::string& line = client->input;
+    const char* value;
+    int timeout_seconds = 30;
+    
+    if (line.find('{') == std::string::npos) {
+        return false;
+    }
+    
+    if ((value = json_find(line, "timeout"))) {
+        timeout_seconds = atoi(value);
+        if (timeout_seconds <= 0) timeout_seconds = 30;
+    }
+    
+    client->max_results = 1;
+    if ((value = json_find(line, "max_results"))) {
+        client->max_results = atoi(value);
+    }
+    
+    if ((value = json_find(line, "schema")) && *value == '"') {
+        const char* end = strchr(value + 1, '"');
+        if (!end) {
+            return false;
         }
+        client->schema.assign(value + 1, end);
+        client->schema_rule = schema_find(client->schema.c_str());
+    }
+    
+    client->start = std::chrono::steady_clock::now();
+    client->deadline = client->start + std::chrono::seconds(timeout_seconds);
+    return true;
+}
+
+// Hand a decoded QR code to a client's request, streaming it as an event
+// and sending the final result once the request is satisfied
+static void client_deliver(ScanClient* client, const struct quirc_data& data, bool cached) {
+    if (!client->active || client->done || !client->seen.insert(payload_key(data)).second) {
+        return;
+    }
+    
+    bool validated = !client->schema.empty();
+    if (validated && !schema_validate((const char*)data.payload, client->schema_rule)) {
+        client_finish(client, "{\"success\":false,\"reason\":\"validation_failed\",\"qr_data\":\"" +
+                      json_escape((const char*)data.payload) + "\",\"schema_expected\":\"" +
+                      json_escape(client->schema.c_str()) + "\",\"frames_processed\":" +
+                      std::to_string(client->frames_processed) + ",\"detection_time_ms\":" +
+                      std::to_string(elapsed_since(client->start)) + "}");
+        return;
+    }
+    
+    client->found.push_back(data);
+    client_send(client, "{\"event\":\"qr_code\"," + qr_code_fields(data, validated) +
+                ",\"cached\":" + (cached ? "true" : "false") +
+                ",\"elapsed_ms\":" + std::to_string(elapsed_since(client->start)) + "}\n");
+    
+    if (client->max_results > 0 && (int)client->found.size() >= client->max_results) {
+        client_finish(client, "{\"success\":true," + qr_codes_fields(client->found, validated) +
+                      ",\"frames_processed\":" + std::to_string(client->frames_processed) +
+                      ",\"detection_time_ms\":" + std::to_string(elapsed_since(client->start)) + "}");
+    }
+}
+
+// Send the final result of a request that ran out of time or was cut short
+static void client_expire(ScanClient* client, const char* reason) {
+    if (!client->found.empty()) {
+        client_finish(client, "{\"success\":true," + qr_codes_fields(client->found, !client->schema.empty()) +
+                      ",\"frames_processed\":" + std::to_string(client->frames_processed) +
+                      ",\"detection_time_ms\":" + std::to_string(elapsed_since(client->start)) + "}");
+    } else {
+        client_finish(client, std::string("{\"success\":false,\"reason\":\"") + reason +
+                      "\",\"frames_processed\":" + std::to_string(client->frames_processed) +
+                      ",\"scan_duration_ms\":" + std::to_string(elapsed_since(client->start)) + "}");
     }
-    return false;
+}
+
+// Accept new clients, read their requests and answer them from the cache
+static void service_clients(Daemon* d) {
+    for (;;) {
+        // Blocking, so that SO_SNDTIMEO applies to sends; reads use MSG_DONTWAIT
+        int fd = accept4(d->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            break;
+        }
+        if (d->clients.size() >= MAX_CLIENTS) {
+            fprintf(stderr, "[%s] Too many clients, rejecting\n", TAG);
+            close(fd);
+            continue;
+        }
+        
+        // Sends may block briefly
+        struct timeval tv = {0, 100000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        
+        ScanClient client;
+        client.fd = fd;
+        client.active = false;
+        client.done = false;
+        client.frames_processed = 0;
+        client.schema_rule = NULL;
+        d->clients.push_back(std::move(client));
+    }
+    
+    auto now = std::chrono::steady_clock::now();
+    
+    for (ScanClient& client : d->clients) {
+        char buf[256];
+        ssize_t n = -1;
+        
+        // A client that closes its end cancels its request
+        while (!client.done && (n = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) client.done = true;
+                break;
+            }
+            if (!client.active) {
+                client.input.append(buf, n);
+            }
+        }
+        if (n == 0) {
+            client.done = true;
+        }
+        
+        if (client.done || client.active) {
+            continue;
+        }
+        
+        size_t eol = client.input.find('\n');
+        if (eol == std::string::npos) {
+            if (client.input.size() > MAX_REQUEST_SIZE) {
+                client_finish(&client, "{\"success\":false,\"reason\":\"bad_request\"}");
+            }
+            continue;
+        }
+        
+        client.input.resize(eol);
+        if (!parse_request(&client)) {
+            client_finish(&client, "{\"success\":false,\"reason\":\"bad_request\"}");
+            continue;
+        }
+        client.active = true;
+        fprintf(stderr, "[%s] Request: max_results=%d, schema=%s\n", TAG, client.max_results,
+                client.schema.empty() ? "none" : client.schema.c_str());
+        
+        // Codes seen within the cache lifetime are most likely still in view
+        for (const auto& entry : d->cache) {
+            if (now - entry.second.last_seen <= std::chrono::milliseconds(d->cache_ttl_ms)) {
+                client_deliver(&client, entry.second.data, true);
+            }
+        }
+    }
+}
+
+// Remember the codes found in a frame, dropping those not seen lately
+static void update_cache(Daemon* d, const std::vector<struct quirc_data>& results) {
+    auto now = std::chrono::steady_clock::now();
+    
+    for (const struct quirc_data& data : results) {
+        CachedResult& entry = d->cache[payload_key(data)];
+        entry.data = data;
+        entry.last_seen = now;
+    }
+    
+    for (auto it = d->cache.begin(); it != d->cache.end();) {
+        if (now - it->second.last_seen > std::chrono::milliseconds(d->cache_ttl_ms) ||
+            d->cache.size() > RESULT_CACHE_SIZE) {
+            it = d->cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Keep every reference frame since the last IDR for catch-up decoding
+static void buffer_gop(Daemon* d, const uint8_t* data, int size, const AccessUnitInfo& au) {
+    if (au.has_idr) {
+        d->gop.clear();
+        d->gop_bytes = 0;
+        d->gop_valid = true;
+    }
+    if (!d->gop_valid || !au.is_reference) {
+        return;
+    }
+    
+    if (d->gop_bytes + size > GOP_BUFFER_LIMIT) {
+        // Too long to catch up on; wait for the next IDR instead
+        d->gop.clear();
+        d->gop_bytes = 0;
+        d->gop_valid = false;
+        return;
+    }
+    d->gop.emplace_back(data, data + size);
+    d->gop_bytes += size;
+}
+
+static int run_daemon(H264Decoder* decoder, QRDecoder* qr_decoder, uint8_t* frame_buffer,
+                      const char* socket_path, int scan_rate, int cache_ttl_ms) {
+    Daemon d;
+    d.decoder = decoder;
+    d.qr_decoder = qr_decoder;
+    d.scan_rate = scan_rate;
+    d.cache_ttl_ms = cache_ttl_ms;
+    d.gop_bytes = 0;
+    d.gop_valid = false;
+    d.synced = false;
+    
+    d.listen_fd = open_listen_socket(socket_path);
+    if (d.listen_fd < 0) {
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "[%s] Daemon listening on %s\n", TAG, socket_path);
+    
+    uint64_t scan_interval_ms = scan_rate > 0 ? 1000 / scan_rate : 0;
+    uint64_t last_scan_ms = 0;
+    bool scanned = false;
+    std::vector<struct quirc_data> frame_results;
+    
+    while (g_running) {
+        service_clients(&d);
+        
+        // Requests that ran out of time get what was found so far
+        auto now = std::chrono::steady_clock::now();
+        bool active = false;
+        for (ScanClient& client : d.clients) {
+            if (client.active && !client.done && now >= client.deadline) {
+                client_expire(&client, "timeout");
+            }
+            active |= client.active && !client.done;
+        }
+        
+        for (size_t i = 0; i < d.clients.size();) {
+            if (d.clients[i].done) {
+                close(d.clients[i].fd);
+                d.clients.erase(d.clients.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        
+        video_frame_meta_t meta;
+        int frame_size = g_use_file ? file_source_read(&g_file_source, frame_buffer, &meta)
+                                    : video_shm_consumer_wait(&g_consumer, frame_buffer, &meta, 100);
+        if (frame_size < 0) {
+            fprintf(stderr, "[%s] ERROR: Failed to read frame\n", TAG);
+            break;
+        }
+        if (frame_size == 0) {
+            continue;
+        }
+        
+        AccessUnitInfo au;
+        parse_access_unit(frame_buffer, frame_size, &au);
+        buffer_gop(&d, frame_buffer, frame_size, au);
+        
+        // Idle: nothing is decoded until a request arrives
+        if (!active) {
+            d.synced = false;
+            continue;
+        }
+        
+        bool scan_due = !scanned || meta.timestamp_ms - last_scan_ms >= scan_interval_ms;
+        bool got_picture = false;
+        
+        if (!d.synced) {
+            if (!d.gop_valid) {
+                continue;
+            }
+            
+            // Catch up through the buffered frames, which end with this
+            // one if it is a reference frame
+            avcodec_flush_buffers(decoder->codec_ctx);
+            for (const std::vector<uint8_t>& frame : d.gop) {
+                got_picture = decode_h264_frame(decoder, frame.data(), frame.size()) == 0;
+            }
+            if (!au.is_reference) {
+                got_picture = decode_h264_frame(decoder, frame_buffer, frame_size) == 0;
+            }
+            d.synced = true;
+            fprintf(stderr, "[%s] Caught up on %zu buffered frames\n", TAG, d.gop.size());
+        } else if (au.is_reference || scan_due) {
+            got_picture = decode_h264_frame(decoder, frame_buffer, frame_size) == 0;
+        }
+        
+        if (!got_picture || !scan_due) {
+            continue;
+        }
+        scanned = true;
+        last_scan_ms = meta.timestamp_ms;
+        
+        scan_picture(qr_decoder, decoder->frame, &frame_results);
+        update_cache(&d, frame_results);
+        
+        for (ScanClient& client : d.clients) {
+            if (!client.active || client.done) {
+                continue;
+            }
+            client.frames_processed++;
+            for (const struct quirc_data& data : frame_results) {
+                client_deliver(&client, data, false);
+            }
+        }
+    }
+    
+    for (ScanClient& client : d.clients) {
+        if (client.active && !client.done) {
+            client_expire(&client, "cancelled");
+        }
+        close(client.fd);
+    }
+    close(d.listen_fd);
+    unlink(socket_path);
+    
+    fprintf(stderr, "[%s] Daemon stopped\n", TAG);
+    return g_cancelled ? 0 : 2;
 }
 
 int main(int argc, char* argv[]) {
     int timeout_seconds = 30;
     int max_results = 1;
     const char* schema = NULL;
+    quirc_threshold_t threshold = QUIRC_THRESHOLD_OTSU;
+    DecodeMode decode_mode = DECODE_KEYFRAME;
+    int scan_rate = -1;
+    const char* input_path = NULL;
+    int input_fps = 15;
+    bool daemon = false;
+    const char* socket_path = DEFAULT_SOCKET_PATH;
+    int cache_ttl_ms = 1000;
     
     // Parse command-line arguments
     static struct option long_options[] = {
         {"timeout",     required_argument, 0, 't'},
         {"max-results", required_argument, 0, 'm'},
         {"schema",      required_argument, 0, 's'},
+        {"threshold",   required_argument, 0, 'b'},
+        {"decode",      required_argument, 0, 'd'},
+        {"scan-rate",   required_argument, 0, 'r'},
+        {"input",       required_argument, 0, 'i'},
+        {"input-fps",   required_argument, 0, 'f'},
+        {"daemon",      no_argument,       0, 'D'},
+        {"socket",      required_argument, 0, 'S'},
+        {"cache-ttl",   required_argument, 0, 'c'},
         {"help",        no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
     
     int opt;
     int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "t:m:s:h", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:m:s:b:d:r:i:f:DS:c:h", long_options, &option_index)) != -1) {
         switch (opt) {
             case 't':
                 timeout_seconds = atoi(optarg);
@@ -280,13 +945,68 @@ int main(int argc, char* argv[]) {
             case 's':
                 schema = optarg;
                 break;
+            case 'b':
+                if (strcmp(optarg, "adaptive") == 0) {
+                    threshold = QUIRC_THRESHOLD_ADAPTIVE;
+                } else if (strcmp(optarg, "otsu") == 0) {
+                    threshold = QUIRC_THRESHOLD_OTSU;
+                } else {
+                    fprintf(stderr, "Unknown threshold mode: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'd':
+                if (strcmp(optarg, "keyframe") == 0) {
+                    decode_mode = DECODE_KEYFRAME;
+                } else if (strcmp(optarg, "all") == 0) {
+                    decode_mode = DECODE_ALL;
+                } else {
+                    fprintf(stderr, "Unknown decode mode: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'r':
+                scan_rate = atoi(optarg);
+                if (scan_rate < 0) scan_rate = 0;
+                break;
+            case 'i':
+                input_path = optarg;
+                break;
+            case 'f':
+                input_fps = atoi(optarg);
+                if (input_fps < 0) input_fps = 0;
+                break;
+            case 'D':
+                daemon = true;
+                break;
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 'c':
+                cache_ttl_ms = atoi(optarg);
+                if (cache_ttl_ms < 0) cache_ttl_ms = 0;
+                break;
             case 'h':
                 printf("Usage: %s [OPTIONS]\n", argv[0]);
                 printf("Options:\n");
                 printf("  --timeout <seconds>      Scan timeout (default: 30)\n");
                 printf("  --max-results <count>    Maximum QR codes (default: 1, 0=unlimited)\n");
                 printf("  --schema <name>          Validate against schema\n");
-                printf("                           (authority_config, wifi_config, device_pairing)\n");
+                printf("                           (authority_config, wifi_config, device_pairing,\n");
+                printf("                           wifi_uri, https_url)\n");
+                printf("  --threshold <mode>       Binarisation: otsu (default) or adaptive\n");
+                printf("                           (adaptive copes with glare and shadows)\n");
+                printf("  --decode <mode>          Frames to decode: keyframe (default, IDR only)\n");
+                printf("                           or all (reference frames, to scan between keyframes)\n");
+                printf("  --scan-rate <fps>        Maximum scans per second (default: 0=every\n");
+                printf("                           keyframe in keyframe mode, 5 in all mode)\n");
+                printf("  --input <file>           Replay a recorded H.264 Annex-B stream instead\n");
+                printf("                           of camera-streamer channel 2\n");
+                printf("  --input-fps <fps>        Replay rate for --input (default: 15, 0=unpaced)\n");
+                printf("  --daemon                 Stay resident and serve scan requests on a socket\n");
+                printf("  --socket <path>          Daemon socket (default: %s)\n", DEFAULT_SOCKET_PATH);
+                printf("  --cache-ttl <ms>         Age up to which results answer new requests\n");
+                printf("                           at once (default: 1000, 0=disabled)\n");
                 printf("  --help                   Show this help\n");
                 return 0;
             default:
@@ -295,55 +1015,75 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // The daemon decodes every reference frame while a request is
+    // active, so that catching up from the buffered GOP stays possible
+    if (daemon) {
+        decode_mode = DECODE_ALL;
+    }
+    if (scan_rate < 0) {
+        scan_rate = decode_mode == DECODE_ALL && !daemon ? 5 : 0;
+    }
+    uint64_t scan_interval_ms = scan_rate > 0 ? 1000 / scan_rate : 0;
+    
+    schema_compile();
+    const SchemaRule* schema_rule = schema ? schema_find(schema) : NULL;
+    if (schema && !schema_rule) {
+        fprintf(stderr, "[%s] Unknown schema %s, accepting any data\n", TAG, schema);
+    }
+    
     // Diagnostic logging
-    fprintf(stderr, "[%s] Starting scan with timeout=%ds, max_results=%d", 
-            TAG, timeout_seconds, max_results);
-    if (schema) {
-        fprintf(stderr, ", schema=%s", schema);
+    if (daemon) {
+        fprintf(stderr, "[%s] Starting daemon with decode=all, scan_rate=%d, cache_ttl=%dms\n",
+                TAG, scan_rate, cache_ttl_ms);
+    } else {
+        fprintf(stderr, "[%s] Starting scan with timeout=%ds, max_results=%d, decode=%s, scan_rate=%d", 
+                TAG, timeout_seconds, max_results,
+                decode_mode == DECODE_ALL ? "all" : "keyframe", scan_rate);
+        if (schema) {
+            fprintf(stderr, ", schema=%s", schema);
+        }
+        fprintf(stderr, "\n");
     }
-    fprintf(stderr, "\n");
     
     // Setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    // Initialize consumer for channel 2
-    fprintf(stderr, "[%s] Connecting to camera stream channel 2...\n", TAG);
-    if (video_shm_consumer_init_channel(&g_consumer, CHANNEL_ID) != 0) {
-        fprintf(stderr, "[%s] ERROR: Failed to initialize consumer\n", TAG);
-        fprintf(stderr, "[%s] Is camera-streamer running?\n", TAG);
-        printf("{\"success\":false,\"reason\":\"camera_init_failed\",\"error\":\"Failed to connect to video stream\"}\n");
-        return 2;
-    }
+    // Initialize the recorded stream, or the consumer for channel 2
+    if (input_path) {
+        if (open_file_source(&g_file_source, input_path, input_fps) != 0) {
+            printf("{\"success\":false,\"reason\":\"camera_init_failed\",\"error\":\"Failed to open input stream\"}\n");
+            return 2;
+        }
+        g_file_source.loop = daemon;
+        g_use_file = true;
+    } else {
+        fprintf(stderr, "[%s] Connecting to camera stream channel 2...\n", TAG);
+        if (video_shm_consumer_init_channel(&g_consumer, CHANNEL_ID) != 0) {
+            fprintf(stderr, "[%s] ERROR: Failed to initialize consumer\n", TAG);
+            fprintf(stderr, "[%s] Is camera-streamer running?\n", TAG);
+            printf("{\"success\":false,\"reason\":\"camera_init_failed\",\"error\":\"Failed to connect to video stream\"}\n");
+            return 2;
+        }
     
-    fprintf(stderr, "[%s] Camera connected: waiting for stream info...\n", TAG);
+        fprintf(stderr, "[%s] Camera connected: waiting for stream info...\n", TAG);
+    }
     
     // Allocate frame buffer
     uint8_t* frame_buffer = (uint8_t*)malloc(VIDEO_SHM_MAX_FRAME_SIZE);
     if (!frame_buffer) {
         fprintf(stderr, "[%s] ERROR: Failed to allocate frame buffer\n", TAG);
-        video_shm_consumer_destroy(&g_consumer);
-        printf("{\"success\":false,\"reason\":\"memory_error\"}\n");
-        return 2;
-    }
-    
-    // Allocate grayscale buffer (for decoded frames)
-    uint8_t* gray_buffer = (uint8_t*)malloc(640 * 480);
-    if (!gray_buffer) {
-        fprintf(stderr, "[%s] ERROR: Failed to allocate grayscale buffer\n", TAG);
-        free(frame_buffer);
-        video_shm_consumer_destroy(&g_consumer);
+        close_input();
         printf("{\"success\":false,\"reason\":\"memory_error\"}\n");
         return 2;
     }
     
     // Initialize H.264 decoder
     H264Decoder decoder = {0};
-    if (init_h264_decoder(&decoder, 640, 480) < 0) {
+    if (init_h264_decoder(&decoder, 640, 480, decode_mode) < 0) {
         fprintf(stderr, "[%s] ERROR: Failed to initialize H.264 decoder\n", TAG);
-        free(gray_buffer);
         free(frame_buffer);
-        video_shm_consumer_destroy(&g_consumer);
+        close_input();
         printf("{\"success\":false,\"reason\":\"decoder_init_failed\"}\n");
         return 2;
     }
@@ -351,20 +1091,38 @@ int main(int argc, char* argv[]) {
     
     // Initialize QR decoder
     QRDecoder qr_decoder = {0};
-    if (init_qr_decoder(&qr_decoder, 640, 480) < 0) {
+    if (init_qr_decoder(&qr_decoder, 640, 480, threshold) < 0) {
         fprintf(stderr, "[%s] ERROR: Failed to initialize QR decoder\n", TAG);
         cleanup_h264_decoder(&decoder);
-        free(gray_buffer);
         free(frame_buffer);
-        video_shm_consumer_destroy(&g_consumer);
+        close_input();
         printf("{\"success\":false,\"reason\":\"qr_decoder_init_failed\"}\n");
         return 2;
     }
     fprintf(stderr, "[%s] QR decoder initialized\n", TAG);
     
+    if (daemon) {
+        int ret = run_daemon(&decoder, &qr_decoder, frame_buffer, socket_path, scan_rate, cache_ttl_ms);
+        cleanup_qr_decoder(&qr_decoder);
+        cleanup_h264_decoder(&decoder);
+        free(frame_buffer);
+        close_input();
+        return ret;
+    }
+    
     int frame_count = 0;
     std::vector<struct quirc_data> found_qr_codes;
+    std::vector<struct quirc_data> frame_results;
+    std::unordered_set<std::string> seen_payloads;
     auto scan_start = std::chrono::steady_clock::now();
+    bool have_keyframe = false;
+    bool end_of_stream = false;
+    bool scanned = false;
+    uint64_t last_scan_ms = 0;
+    
+    ScanStats stats = {};
+    stats.start = scan_start;
+    getrusage(RUSAGE_SELF, &stats.usage_start);
     
     fprintf(stderr, "[%s] Scanning for QR codes...\n", TAG);
     
@@ -376,14 +1134,15 @@ int main(int argc, char* argv[]) {
                 std::chrono::steady_clock::now() - scan_start).count();
             fprintf(stderr, "[%s] Scan cancelled after %d frames\n", TAG, frame_count);
             
-            printf("{\"success\":false,\"reason\":\"cancelled\",\"frames_processed\":%d,\"scan_duration_ms\":%ld}\n",
+            printf("{\"success\":false,\"reason\":\"cancelled\",\"frames_processed\":%d,\"scan_duration_ms\":%ld",
                    frame_count, elapsed_ms);
+            print_scan_stats(&stats);
+            printf("}\n");
             
             cleanup_qr_decoder(&qr_decoder);
             cleanup_h264_decoder(&decoder);
-            free(gray_buffer);
             free(frame_buffer);
-            video_shm_consumer_destroy(&g_consumer);
+            close_input();
             return 3;
         }
         
@@ -395,24 +1154,31 @@ int main(int argc, char* argv[]) {
             auto elapsed_ms = elapsed_sec * 1000;
             fprintf(stderr, "[%s] Timeout after %d frames\n", TAG, frame_count);
             
-            printf("{\"success\":false,\"reason\":\"timeout\",\"frames_processed\":%d,\"scan_duration_ms\":%ld}\n",
+            printf("{\"success\":false,\"reason\":\"timeout\",\"frames_processed\":%d,\"scan_duration_ms\":%ld",
                    frame_count, elapsed_ms);
+            print_scan_stats(&stats);
+            printf("}\n");
             
             cleanup_qr_decoder(&qr_decoder);
             cleanup_h264_decoder(&decoder);
-            free(gray_buffer);
             free(frame_buffer);
-            video_shm_consumer_destroy(&g_consumer);
+            close_input();
             return 1;
         }
         
         video_frame_meta_t meta;
         
         // Wait for next frame (1 second timeout)
-        int frame_size = video_shm_consumer_wait(&g_consumer, frame_buffer, &meta, 1000);
+        int frame_size = g_use_file ? file_source_read(&g_file_source, frame_buffer, &meta)
+                                    : video_shm_consumer_wait(&g_consumer, frame_buffer, &meta, 1000);
         
         if (frame_size < 0) {
-            fprintf(stderr, "[%s] ERROR: Failed to read frame\n", TAG);
+            if (g_use_file) {
+                fprintf(stderr, "[%s] End of input stream after %d frames\n", TAG, frame_count);
+                end_of_stream = true;
+            } else {
+                fprintf(stderr, "[%s] ERROR: Failed to read frame\n", TAG);
+            }
             break;
         }
         
@@ -429,75 +1195,85 @@ int main(int argc, char* argv[]) {
                     TAG, frame_count, (float)elapsed_sec);
         }
         
-        // Process keyframes for QR code detection
-        if (meta.is_keyframe) {
-            // Decode H.264 frame to grayscale
-            if (decode_h264_frame(&decoder, frame_buffer, frame_size, 
-                                   gray_buffer, meta.width, meta.height) == 0) {
+        // Pick the frames worth decoding from their NAL headers, so that
+        // skipped frames cost nothing beyond the shared memory read
+        AccessUnitInfo au;
+        parse_access_unit(frame_buffer, frame_size, &au);
+        
+        if (au.has_idr) {
+            have_keyframe = true;
+        }
+        
+        bool scan_due = !scanned || meta.timestamp_ms - last_scan_ms >= scan_interval_ms;
+        bool decode_frame;
+        
+        if (decode_mode == DECODE_KEYFRAME) {
+            decode_frame = au.has_idr && scan_due;
+        } else {
+            // Reference frames are decoded even when no scan is due, to
+            // keep the prediction chain intact up to the next scan
+            decode_frame = have_keyframe && (au.is_reference || scan_due);
+        }
+        
+        if (!decode_frame || decode_h264_frame(&decoder, frame_buffer, frame_size) != 0) {
+            continue;
+        }
+        stats.frames_decoded++;
+        
+        if (!scan_due) {
+            continue;
+        }
+        scanned = true;
+        last_scan_ms = meta.timestamp_ms;
+        stats.frames_scanned++;
+        
+        // Scan the decoder's Y plane in place
+        scan_picture(&qr_decoder, decoder.frame, &frame_results);
+        
+        for (const struct quirc_data& data : frame_results) {
+            fprintf(stderr, "[%s] QR #%zu decoded: %d bytes\n", 
+                    TAG, found_qr_codes.size() + 1, data.payload_len);
+            
+            // Check for duplicates
+            if (!seen_payloads.insert(payload_key(data)).second) {
+                fprintf(stderr, "[%s] Duplicate QR code, ignoring\n", TAG);
+                continue;
+            }
+            
+            // Schema validation if requested
+            if (schema) {
+                bool valid = schema_validate((const char*)data.payload, schema_rule);
+                fprintf(stderr, "[%s] Schema validation: %s %s\n", 
+                        TAG, schema, valid ? "PASS" : "FAIL");
                 
-                // Copy image data to quirc buffer
-                uint8_t* buffer = quirc_begin(qr_decoder.qr, NULL, NULL);
-                if (buffer) {
-                    memcpy(buffer, gray_buffer, meta.width * meta.height);
-                    quirc_end(qr_decoder.qr);
+                if (!valid) {
+                    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - scan_start).count();
                     
-                    // Extract and decode QR codes
-                    int count = quirc_count(qr_decoder.qr);
+                    printf("{\"success\":false,\"reason\":\"validation_failed\",\"qr_data\":\"");
+                    print_json_escaped((const char*)data.payload);
+                    printf("\",\"schema_expected\":\"%s\",\"frames_processed\":%d,\"detection_time_ms\":%ld",
+                           schema, frame_count, elapsed_ms);
+                    print_scan_stats(&stats);
+                    printf("}\n");
                     
-                    for (int i = 0; i < count; i++) {
-                        struct quirc_code code;
-                        struct quirc_data data;
-                        
-                        quirc_extract(qr_decoder.qr, i, &code);
-                        quirc_decode_error_t err = quirc_decode(&code, &data);
-                        
-                        if (err == QUIRC_SUCCESS) {
-                            fprintf(stderr, "[%s] QR #%zu decoded: %d bytes\n", 
-                                    TAG, found_qr_codes.size() + 1, data.payload_len);
-                            
-                            // Check for duplicates
-                            if (is_duplicate_qr(found_qr_codes, &data)) {
-                                fprintf(stderr, "[%s] Duplicate QR code, ignoring\n", TAG);
-                                continue;
-                            }
-                            
-                            // Schema validation if requested
-                            if (schema) {
-                                bool valid = validate_schema((char*)data.payload, schema);
-                                fprintf(stderr, "[%s] Schema validation: %s %s\n", 
-                                        TAG, schema, valid ? "PASS" : "FAIL");
-                                
-                                if (!valid) {
-                                    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                        std::chrono::steady_clock::now() - scan_start).count();
-                                    
-                                    printf("{\"success\":false,\"reason\":\"validation_failed\",\"qr_data\":\"");
-                                    print_json_escaped((char*)data.payload);
-                                    printf("\",\"schema_expected\":\"%s\",\"frames_processed\":%d,\"detection_time_ms\":%ld}\n",
-                                           schema, frame_count, elapsed_ms);
-                                    
-                                    cleanup_qr_decoder(&qr_decoder);
-                                    cleanup_h264_decoder(&decoder);
-                                    free(gray_buffer);
-                                    free(frame_buffer);
-                                    video_shm_consumer_destroy(&g_consumer);
-                                    return 2;
-                                }
-                            }
-                            
-                            // Add to found list
-                            found_qr_codes.push_back(data);
-                            fprintf(stderr, "[%s] Added QR code #%zu to results\n", TAG, found_qr_codes.size());
-                            
-                            // Check if we've collected enough QR codes
-                            if (max_results > 0 && (int)found_qr_codes.size() >= max_results) {
-                                g_running = false;
-                                break;
-                            }
-                        }
-                    }
+                    cleanup_qr_decoder(&qr_decoder);
+                    cleanup_h264_decoder(&decoder);
+                    free(frame_buffer);
+                    close_input();
+                    return 2;
                 }
             }
+            
+            // Add to found list
+            found_qr_codes.push_back(data);
+            fprintf(stderr, "[%s] Added QR code #%zu to results\n", TAG, found_qr_codes.size());
+            
+            // Check if we've collected enough QR codes
+            if (max_results > 0 && (int)found_qr_codes.size() >= max_results) {
+                g_running = false;
+                break;
+            }
         }
     }
     
@@ -509,28 +1285,22 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "[%s] Scan complete: %zu QR code(s) in %.1fs\n", 
                 TAG, found_qr_codes.size(), elapsed_ms / 1000.0);
         
-        printf("{\"success\":true,\"qr_codes\":[");
-        for (size_t i = 0; i < found_qr_codes.size(); i++) {
-            if (i > 0) printf(",");
-            printf("{\"data\":\"");
-            print_json_escaped((char*)found_qr_codes[i].payload);
-            printf("\",\"version\":%d,\"ecc_level\":\"%c\",\"mask\":%d,\"data_type\":%d,\"validated\":%s}",
-                   found_qr_codes[i].version,
-                   "MLHQ"[found_qr_codes[i].ecc_level],
-                   found_qr_codes[i].mask,
-                   found_qr_codes[i].data_type,
-                   schema ? "true" : "false");
-        }
-        printf("],\"count\":%zu,\"frames_processed\":%d,\"detection_time_ms\":%ld}\n",
-               found_qr_codes.size(), frame_count, elapsed_ms);
+        printf("{\"success\":true,%s,\"frames_processed\":%d,\"detection_time_ms\":%ld",
+               qr_codes_fields(found_qr_codes, schema != NULL).c_str(), frame_count, elapsed_ms);
+        print_scan_stats(&stats);
+        printf("}\n");
+    } else if (end_of_stream) {
+        printf("{\"success\":false,\"reason\":\"end_of_stream\",\"frames_processed\":%d,\"scan_duration_ms\":%ld",
+               frame_count, elapsed_ms);
+        print_scan_stats(&stats);
+        printf("}\n");
     }
     
     // Cleanup
     cleanup_qr_decoder(&qr_decoder);
     cleanup_h264_decoder(&decoder);
-    free(gray_buffer);
     free(frame_buffer);
-    video_shm_consumer_destroy(&g_consumer);
+    close_input();
     
     fprintf(stderr, "[%s] Shutdown complete\n", TAG);
     return found_qr_codes.size() > 0 ? 0 : 1;
@@ -0,0 +1,233 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+
+#define PRINTABLE_ASCII " -~"
+#define URI_CHARS       "A-Za-z0-9._~:/?#[]@!$&'()*+,;=%-"
+
+static SchemaRule g_schemas[] = {
+    // name               prefix      min  max   charset          tokens
+    {"authority_config", NULL,       0,   0,    NULL,            {"\"type\"", "authority_alert"}},
+    {"wifi_config",      NULL,       0,   0,    NULL,            {"\"ssid\""}},
+    {"device_pairing",   NULL,       0,   0,    NULL,            {"\"device_id\""}},
+    {"wifi_uri",         "WIFI:",    8,   512,  PRINTABLE_ASCII, {"S:"}},
+    {"https_url",        "https://", 12,  2048, URI_CHARS,       {}},
+};
+
+// Deterministic matcher over byte classes; bytes that occur in no token
+// share class 0, which keeps the transition table a few hundred bytes.
+// States are numbered by their row offset in the table.
+struct SchemaMatcher {
+    uint8_t byte_class[256];
+    int num_classes;
+    std::vector<uint16_t> next;     // next[state + class]
+    std::vector<uint32_t> matched;  // Tokens ending at each state
+};
+
+static SchemaMatcher g_schema_matcher;
+
+// What schema_compile() derives from each rule, in the order of g_schemas
+struct CompiledRule {
+    uint32_t required;   // Token ids that must all be seen
+    bool tokens_only;    // Nothing to check but the tokens
+    bool allowed[256];   // Bytes of the charset
+    bool stop[256];      // Bytes not allowed, or that start a token
+};
+
+static CompiledRule g_compiled[sizeof(g_schemas) / sizeof(g_schemas[0])];
+
+// Mark the bytes of a charset such as "A-Za-z_-"; a '-' that is first or
+// last stands for itself
+static void compile_charset(bool* allowed, const char* charset) {
+    if (!charset) {
+        memset(allowed, 1, 256);
+        allowed[0] = false;
+        return;
+    }
+    memset(allowed, 0, 256);
+    for (const uint8_t* p = (const uint8_t*)charset; *p; p++) {
+        if (p[1] == '-' && p[2]) {
+            for (unsigned c = p[0]; c <= p[2]; c++) {
+                allowed[c] = true;
+            }
+            p += 2;
+        } else {
+            allowed[*p] = true;
+        }
+    }
+}
+
+void schema_compile(void) {
+    SchemaMatcher* m = &g_schema_matcher;
+    std::vector<std::string> tokens;
+
+    // Number the distinct tokens, and give each byte used in them a class
+    memset(m->byte_class, 0, sizeof(m->byte_class));
+    m->num_classes = 1;
+    for (size_t r = 0; r < sizeof(g_schemas) / sizeof(g_schemas[0]); r++) {
+        const SchemaRule& rule = g_schemas[r];
+        CompiledRule* compiled = &g_compiled[r];
+
+        compile_charset(compiled->allowed, rule.charset);
+        for (int c = 0; c < 256; c++) {
+            compiled->stop[c] = !compiled->allowed[c];
+        }
+        compiled->tokens_only = !rule.prefix && !rule.min_len && !rule.max_len && !rule.charset;
+
+        compiled->required = 0;
+        for (int i = 0; i < SCHEMA_MAX_TOKENS && rule.tokens[i]; i++) {
+            size_t id = 0;
+            while (id < tokens.size() && tokens[id] != rule.tokens[i]) {
+                id++;
+            }
+            if (id == tokens.size()) {
+                tokens.push_back(rule.tokens[i]);
+            }
+            compiled->required |= 1u << id;
+            compiled->stop[(uint8_t)rule.tokens[i][0]] = true;
+
+            for (const char* p = rule.tokens[i]; *p; p++) {
+                if (!m->byte_class[(uint8_t)*p]) {
+                    m->byte_class[(uint8_t)*p] = m->num_classes++;
+                }
+            }
+        }
+    }
+
+    // Build the trie of tokens, with -1 for missing edges
+    const int nc = m->num_classes;
+    std::vector<int> trie(nc, -1);
+    m->matched.assign(1, 0);
+    for (size_t id = 0; id < tokens.size(); id++) {
+        int state = 0;
+        for (char c : tokens[id]) {
+            int* edge = &trie[state * nc + m->byte_class[(uint8_t)c]];
+            if (*edge < 0) {
+                *edge = m->matched.size();
+                trie.resize(trie.size() + nc, -1);
+                m->matched.push_back(0);
+                edge = &trie[state * nc + m->byte_class[(uint8_t)c]];
+            }
+            state = *edge;
+        }
+        m->matched[state] |= 1u << id;
+    }
+
+    // Fill in the missing edges breadth first, from each state's longest
+    // proper suffix that is also a trie state
+    const size_t num_states = m->matched.size();
+    std::vector<int> fail(num_states, 0);
+    std::vector<int> queue;
+    m->next.assign(num_states * nc, 0);
+
+    for (int c = 0; c < nc; c++) {
+        int child = trie[c];
+        if (child > 0) {
+            m->next[c] = child;
+            queue.push_back(child);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); head++) {
+        int state = queue[head];
+        m->matched[state] |= m->matched[fail[state]];
+
+        for (int c = 0; c < nc; c++) {
+            int child = trie[state * nc + c];
+            if (child > 0) {
+                fail[child] = m->next[fail[state] * nc + c];
+                m->next[state * nc + c] = child;
+                queue.push_back(child);
+            } else {
+                m->next[state * nc + c] = m->next[fail[state] * nc + c];
+            }
+        }
+    }
+
+    for (uint16_t& state : m->next) {
+        state *= nc;
+    }
+    std::vector<uint32_t> matched(num_states * nc, 0);
+    for (size_t state = 0; state < num_states; state++) {
+        matched[state * nc] = m->matched[state];
+    }
+    m->matched.swap(matched);
+}
+
+const SchemaRule* schema_find(const char* name) {
+    for (const SchemaRule& rule : g_schemas) {
+        if (strcmp(rule.name, name) == 0) {
+            return &rule;
+        }
+    }
+    return NULL;
+}
+
+const SchemaRule* schema_rules(size_t* count) {
+    *count = sizeof(g_schemas) / sizeof(g_schemas[0]);
+    return g_schemas;
+}
+
+bool schema_validate(const char* data, const SchemaRule* rule) {
+    if (!data || !*data) {
+        return false;
+    }
+    if (!rule) {
+        return true;
+    }
+    // A schema that only asks for tokens is a few strstr() calls, which
+    // libc runs a word or a vector at a time; that beats stepping the
+    // automaton a byte at a time for the one or two tokens such schemas have
+    if (g_compiled[rule - g_schemas].tokens_only) {
+        for (int i = 0; i < SCHEMA_MAX_TOKENS && rule->tokens[i]; i++) {
+            if (!strstr(data, rule->tokens[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (rule->prefix && strncmp(data, rule->prefix, strlen(rule->prefix)) != 0) {
+        return false;
+    }
+
+    // Locals, since the payload's bytes could otherwise alias the tables
+    const CompiledRule* compiled = &g_compiled[rule - g_schemas];
+    const SchemaMatcher* m = &g_schema_matcher;
+    const uint8_t* byte_class = m->byte_class;
+    const uint16_t* next = m->next.data();
+    const uint32_t* matched = m->matched.data();
+    const bool* allowed = compiled->allowed;
+    const bool* stop = compiled->stop;
+    const uint32_t required = compiled->required;
+    const size_t min_len = rule->min_len;
+    const size_t max_len = rule->max_len;
+    const uint8_t* start = (const uint8_t*)data;
+    const uint8_t* p = start;
+    uint32_t seen = 0;
+    unsigned state = 0;
+
+    for (;;) {
+        // Outside any token, skip ahead to the next byte that can start
+        // one of this schema's tokens or that it does not allow
+        if (!state) {
+            while (!stop[*p]) {
+                p++;
+            }
+        }
+        const uint8_t c = *p;
+        if (!allowed[c]) {
+            break;
+        }
+        p++;
+
+        state = next[state + byte_class[c]];
+        seen |= matched[state];
+    }
+    if (*p) {
+        return false;
+    }
+
+    const size_t len = p - start;
+    return (seen & required) == required && len >= min_len && (!max_len || len <= max_len);
+}
@@ -0,0 +1,36 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Validation of QR payloads against named schemas. A schema can ask for
+// a prefix, a length range, the bytes allowed and tokens that must all
+// appear somewhere, such as JSON field names. A schema with nothing but
+// tokens is validated with strstr(). For the others, schema_compile()
+// turns the tokens into one Aho-Corasick automaton and each charset into
+// a byte table, so that validating a payload is a single pass over it.
+#define SCHEMA_MAX_TOKENS 4
+
+struct SchemaRule {
+    const char* name;
+    const char* prefix;                     // The payload starts with it, or NULL
+    size_t min_len;                         // Bytes
+    size_t max_len;                         // Bytes, 0 for no limit
+    const char* charset;                    // Allowed bytes as ranges, e.g. "A-Za-z0-9_-", or NULL for any
+    const char* tokens[SCHEMA_MAX_TOKENS];  // Must all appear
+};
+
+// Compile the schemas; call once before schema_validate()
+void schema_compile(void);
+
+// Look up a schema by name; NULL for unknown schemas, which accept any data
+const SchemaRule* schema_find(const char* name);
+
+// All schemas, for tests
+const SchemaRule* schema_rules(size_t* count);
+
+// Whether a NUL-terminated payload meets a schema; empty payloads never do
+bool schema_validate(const char* data, const SchemaRule* rule);
+
+#endif  // SCHEMA_H
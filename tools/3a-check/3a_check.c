@@ -0,0 +1,433 @@
+/* 3a-check - persisted AE/AWB state against a model ISP
+ *
+ * Runs components/sophgo/video's video_3a against a model of the ISP, the
+ * way isp.c runs it against the CVI ISP: started with the ISP, polled
+ * every VIDEO_3A_POLL_MS and stopped with it.
+ *
+ * The model has a scene brightness and colour temperature. The frame luma
+ * is the brightness times the exposure (time times gain), clipped at 255.
+ * In auto, AE moves the exposure a share of the way to the target luma
+ * every frame and AWB moves the colour temperature a share of the way to
+ * the scene's, which is about how slowly a real ISP starts from defaults
+ * that do not fit the scene. In manual the ISP keeps what it was given.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <video_3a.h>
+
+#define FPS             30
+#define TARGET_LUMA     60.0    // AE target
+#define LUMA_SCALE      6e-4    // Luma of a brightness of 1 at an exposure of 1 us at 1x
+#define AE_SPEED        0.1     // Share of the way to the target, in log, per frame
+#define AWB_SPEED       0.08    // Share of the way to the scene's colour temperature per frame
+#define MAX_EXP_US      33000   // 1 / FPS
+#define MAX_GAIN        (64 * 1024)
+#define DEFAULT_EXP     10000.0 // Sensor defaults: 10 ms at 1x
+#define DEFAULT_CT      5000.0
+#define GOOD_LUMA       0.25    // A good frame: luma within this share of the target
+#define GOOD_CT         300.0   // and colour temperature within this many K of the scene
+
+typedef struct scene {
+    const char* name;
+    double brightness;
+    double color_temp;
+} scene_t;
+
+static const scene_t office = { "office", 40, 4000 };
+static const scene_t day    = { "day", 1000, 6000 };
+static const scene_t night  = { "night", 0.5, 2800 };
+
+typedef struct model {
+    double brightness;  // Scene
+    double scene_ct;
+    double exposure;    // us at 1x
+    double color_temp;  // AWB
+    int ae_manual;
+    int awb_manual;
+    int queries;
+} model_t;
+
+typedef struct run {
+    int seeded, dropped, kept;
+    int stable_ms;      // -1 if never stable
+    int good_frame;     // First good frame, -1 if none
+    int saves;
+} run_t;
+
+static int failures;
+static int verbose;
+static char dir[64];
+
+static void check(int ok, const char* what, const char* where)
+{
+    if (!ok) {
+        printf("FAIL: %s (%s)\n", what, where);
+        failures++;
+    }
+}
+
+static double model_luma(const model_t* m)
+{
+    double luma = m->brightness * m->exposure * LUMA_SCALE;
+
+    return luma > 255 ? 255 : luma;
+}
+
+static int model_query(void* ctx, video_3a_sample_t* s)
+{
+    model_t* m = (model_t*)ctx;
+    double exp_time = m->exposure < MAX_EXP_US ? m->exposure : MAX_EXP_US;
+    double gain = m->exposure / exp_time * 1024;
+
+    memset(s, 0, sizeof(*s));
+    s->exp_time_us = (uint32_t)(exp_time + 0.5);
+    s->again = (uint32_t)(gain + 0.5);
+    s->dgain = 1024;
+    s->isp_dgain = 1024;
+    s->wb_gain[0] = (uint16_t)(1024 * m->color_temp / DEFAULT_CT);
+    s->wb_gain[1] = 1024;
+    s->wb_gain[2] = 1024;
+    s->wb_gain[3] = (uint16_t)(1024 * DEFAULT_CT / m->color_temp);
+    s->color_temp = (uint16_t)(m->color_temp + 0.5);
+    s->luma = (uint16_t)(model_luma(m) + 0.5);
+    m->queries++;
+    return 0;
+}
+
+static int model_set_manual(void* ctx, const video_3a_sample_t* s)
+{
+    model_t* m = (model_t*)ctx;
+
+    m->exposure = (double)s->exp_time_us * s->again / 1024 * s->dgain / 1024 * s->isp_dgain / 1024;
+    m->color_temp = s->color_temp;
+    m->ae_manual = 1;
+    m->awb_manual = 1;
+    return 0;
+}
+
+static int model_set_auto(void* ctx)
+{
+    model_t* m = (model_t*)ctx;
+
+    m->ae_manual = 0;
+    m->awb_manual = 0;
+    return 0;
+}
+
+static void model_init(model_t* m, const scene_t* scene)
+{
+    memset(m, 0, sizeof(*m));
+    m->brightness = scene->brightness;
+    m->scene_ct = scene->color_temp;
+    m->exposure = DEFAULT_EXP;
+    m->color_temp = DEFAULT_CT;
+}
+
+static void model_frame(model_t* m)
+{
+    if (!m->ae_manual) {
+        double luma = model_luma(m);
+        double max = (double)MAX_EXP_US * MAX_GAIN / 1024;
+
+        m->exposure *= pow(TARGET_LUMA / (luma < 1 ? 1 : luma), AE_SPEED);
+        if (m->exposure > max) {
+            m->exposure = max;
+        }
+        if (m->exposure < 1) {
+            m->exposure = 1;
+        }
+    }
+    if (!m->awb_manual) {
+        m->color_temp += (m->scene_ct - m->color_temp) * AWB_SPEED;
+    }
+}
+
+static int model_good(const model_t* m)
+{
+    return fabs(model_luma(m) - TARGET_LUMA) <= TARGET_LUMA * GOOD_LUMA && fabs(m->color_temp - m->scene_ct) <= GOOD_CT;
+}
+
+static void path_of(char* path, size_t len, const char* name)
+{
+    snprintf(path, len, "%s/%s", dir, name);
+}
+
+/* Run from the ISP start for ms, and stop if asked */
+static run_t run(model_t* m, video_3a_t* a, const char* path, uint32_t key, int ms, int stop)
+{
+    video_3a_isp_t isp = { model_query, model_set_manual, model_set_auto, m };
+    run_t r;
+    uint64_t next_poll = VIDEO_3A_POLL_MS;
+
+    memset(&r, 0, sizeof(r));
+    r.good_frame = -1;
+    video_3a_start(a, &isp, path, key, 0);
+    r.seeded = a->seeded;
+
+    for (int frame = 0; (uint64_t)frame * 1000 / FPS < (uint64_t)ms; frame++) {
+        uint64_t now = (uint64_t)frame * 1000 / FPS;
+
+        while (next_poll <= now) {
+            int flags = video_3a_poll(a, next_poll);
+
+            r.kept |= (flags & VIDEO_3A_SEED_KEPT) != 0;
+            r.dropped |= (flags & VIDEO_3A_SEED_DROPPED) != 0;
+            if (verbose && flags) {
+                printf("  %6llu ms: flags %#x, luma %.0f, exposure %.0f, %.0f K\n", (unsigned long long)next_poll, flags,
+                       model_luma(m), m->exposure, m->color_temp);
+            }
+            next_poll += VIDEO_3A_POLL_MS;
+        }
+        if (r.good_frame < 0 && model_good(m)) {
+            r.good_frame = frame;
+        }
+        model_frame(m);
+    }
+    if (stop) {
+        video_3a_stop(a);
+    }
+    r.stable_ms = a->stable_ms;
+    r.saves = a->saves;
+    return r;
+}
+
+static void report(const char* name, const run_t* r)
+{
+    printf("%-10s %-8s %6d ms %6d frames %6d\n", name, r->dropped ? "dropped" : (r->seeded ? "seeded" : "-"), r->stable_ms,
+           r->good_frame, r->saves);
+}
+
+/* Boots in a scene, with whatever the file holds, and stops after 5 s */
+static run_t boot(const char* name, const scene_t* scene, const char* path, uint32_t key)
+{
+    model_t m;
+    video_3a_t a;
+    run_t r;
+
+    model_init(&m, scene);
+    r = run(&m, &a, path, key, 5000, 1);
+    report(name, &r);
+    return r;
+}
+
+static void check_boots(void)
+{
+    char path[128];
+    uint32_t key = video_3a_key(1, 1920, 1080, 0);
+    run_t cold, warm, changed, corrupt, other, kept;
+    video_3a_sample_t s, saved_night;
+
+    printf("%-10s %-8s %9s %13s %6s\n", "boot", "seed", "stable", "first good", "saves");
+
+    path_of(path, sizeof(path), "cold");
+    unlink(path);
+    cold = boot("cold", &office, path, key);
+    check(!cold.seeded, "nothing to seed from", "cold");
+    check(cold.stable_ms >= 0, "stable", "cold");
+    check(cold.good_frame > 0, "first frames off", "cold");
+    check(cold.saves == 1, "saved once", "cold");
+    check(video_3a_load(path, key, &s) == 0, "state loads", "cold");
+
+    warm = boot("warm", &office, path, key);
+    check(warm.seeded && warm.kept && !warm.dropped, "seeded and kept", "warm");
+    check(warm.good_frame == 0, "first frame good", "warm");
+    check(warm.stable_ms == 0, "stable from the start", "warm");
+    check(warm.saves == 0, "nothing moved, nothing saved", "warm");
+
+    /* Saved at night, booted in the day */
+    {
+        model_t m;
+        video_3a_t a;
+
+        path_of(path, sizeof(path), "changed");
+        unlink(path);
+        model_init(&m, &night);
+        run(&m, &a, path, key, 10000, 1);
+        check(video_3a_load(path, key, &saved_night) == 0, "night state loads", "changed");
+    }
+    changed = boot("changed", &day, path, key);
+    path_of(path, sizeof(path), "day");
+    unlink(path);
+    cold = boot("cold day", &day, path, key);
+    check(changed.seeded && changed.dropped, "seed dropped", "changed");
+    check(changed.good_frame >= 0, "good frames after the defaults", "changed");
+    check(changed.stable_ms >= 0 &&
+          changed.stable_ms <= cold.stable_ms + VIDEO_3A_SEED_CHECK_MS + 2 * VIDEO_3A_POLL_MS,
+          "about as fast as cold", "changed");
+
+    /* What keeping the night seed would cost */
+    {
+        model_t m;
+        video_3a_t a;
+
+        model_init(&m, &day);
+        model_set_manual(&m, &saved_night);
+        model_set_auto(&m);
+        path_of(path, sizeof(path), "kept");
+        unlink(path);
+        kept = run(&m, &a, path, key, 5000, 0);
+        printf("%-10s %-8s %6d ms %6d frames\n", "night kept", "-", kept.stable_ms, kept.good_frame);
+        check(changed.good_frame < kept.good_frame, "dropping is faster than keeping", "changed");
+    }
+
+    /* Saved under a higher AE target: in the day the luma clips before it is off by VIDEO_3A_SCENE_RATIO */
+    path_of(path, sizeof(path), "clipped");
+    s = saved_night;
+    s.luma = 100;
+    check(video_3a_save(path, key, &s) == 0, "save", "clipped");
+    changed = boot("clipped", &day, path, key);
+    check(changed.seeded && changed.dropped, "seed dropped", "clipped");
+
+    /* A damaged file and a file of another sensor setup are not used */
+    path_of(path, sizeof(path), "corrupt");
+    unlink(path);
+    check(video_3a_save(path, key, &s) == 0, "save", "corrupt");
+    {
+        FILE* fp = fopen(path, "r+b");
+
+        fseek(fp, 12, SEEK_SET);
+        fputc(0x5A, fp);
+        fclose(fp);
+    }
+    corrupt = boot("corrupt", &office, path, key);
+    check(!corrupt.seeded, "not seeded", "corrupt");
+    check(video_3a_load(path, key, &s) == 0, "replaced once stable", "corrupt");
+
+    path_of(path, sizeof(path), "truncated");
+    check(video_3a_save(path, key, &s) == 0, "save", "truncated");
+    check(truncate(path, sizeof(video_3a_state_t) - 1) == 0, "truncate", "truncated");
+    check(video_3a_load(path, key, &s) != 0, "not loaded", "truncated");
+
+    path_of(path, sizeof(path), "cold");
+    other = boot("other", &office, path, video_3a_key(1, 1280, 720, 0));
+    check(!other.seeded, "not seeded", "other setup");
+
+    path_of(path, sizeof(path), "cold.tmp");
+    check(access(path, F_OK) != 0, "no temporary file left", "save");
+}
+
+typedef void (*scene_fn)(model_t* m, uint64_t ms, uint64_t len);
+
+static void sunset(model_t* m, uint64_t ms, uint64_t len)
+{
+    double t = (double)ms / len;
+
+    m->brightness = day.brightness * pow(night.brightness / day.brightness, t);
+    m->scene_ct = day.color_temp + (night.color_temp - day.color_temp) * t;
+}
+
+/* A light switched on and off every 5 s */
+static void flicker(model_t* m, uint64_t ms, uint64_t len)
+{
+    (void)len;
+    m->brightness = office.brightness * ((ms / 5000) % 2 ? 4 : 1);
+}
+
+/* A lamp switched on after 2 s */
+static void lamp(model_t* m, uint64_t ms, uint64_t len)
+{
+    (void)len;
+    m->brightness = office.brightness * (ms >= 2000 ? 5 : 1);
+}
+
+/* Runs with the scene changing for len ms, polled all along, and stops.
+ * Returns the saves; the state in the file must be the last one. */
+static uint32_t watch(const char* name, scene_fn scene, uint64_t len)
+{
+    char path[128];
+    uint32_t key = video_3a_key(1, 1920, 1080, 0);
+    model_t m;
+    video_3a_t a;
+    video_3a_isp_t isp = { model_query, model_set_manual, model_set_auto, &m };
+    video_3a_sample_t now, saved;
+    uint64_t frames = len * FPS / 1000;
+
+    path_of(path, sizeof(path), name);
+    unlink(path);
+    model_init(&m, &office);
+    scene(&m, 0, len);
+    video_3a_start(&a, &isp, path, key, 0);
+
+    for (uint64_t frame = 0, poll = 1; frame < frames; frame++) {
+        uint64_t ms = frame * 1000 / FPS;
+
+        scene(&m, ms, len);
+        if (ms >= poll * VIDEO_3A_POLL_MS) {
+            video_3a_poll(&a, ms);
+            poll++;
+        }
+        model_frame(&m);
+    }
+    video_3a_stop(&a);
+    printf("%-10s %6llu s %6u\n", name, (unsigned long long)(len / 1000), a.saves);
+
+    model_query(&m, &now);
+    check(video_3a_load(path, key, &saved) == 0, "state loads", name);
+    check(!video_3a_differs(&now, &saved, VIDEO_3A_SAVE_EXPOSURE, VIDEO_3A_SAVE_CT), "saved state is the last one", name);
+    return a.saves;
+}
+
+/* How often the flash is written while the scene changes */
+static void check_watch(void)
+{
+    const uint64_t hour = 3600 * 1000;
+    uint32_t saves;
+
+    printf("\n%-10s %8s %6s\n", "scene", "length", "saves");
+
+    saves = watch("sunset", sunset, hour);
+    check(saves > 5, "saved along", "sunset");
+    check(saves <= hour / VIDEO_3A_SAVE_MS + 1, "at most one save per VIDEO_3A_SAVE_MS", "sunset");
+
+    saves = watch("flicker", flicker, hour / 6);
+    check(saves <= hour / 6 / VIDEO_3A_SAVE_MS + 2, "at most one save per VIDEO_3A_SAVE_MS", "flicker");
+
+    /* Saved once the office is stable, the lamp is saved by the stop */
+    saves = watch("lamp", lamp, 5000);
+    check(saves == 2, "saved when stable and at stop", "lamp");
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-v]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vh")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    snprintf(dir, sizeof(dir), "/tmp/3a-check.XXXXXX");
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    check_boots();
+    check_watch();
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        printf("could not remove %s\n", dir);
+    }
+
+    printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,712 @@
+/* audio-dsp-bench - quality checks and throughput of the audio_dsp component
+ *
+ * Checks the vector kernels of components/audio_dsp against plain
+ * reference loops, and the resampler against ideal sine waves: for every
+ * pair of the supported rates, tones in the passband must come out with
+ * the given SNR, and tones that would alias when decimating must be
+ * suppressed. The FFT is checked against a direct DFT, and the log-mel
+ * spectrogram against a double precision reference with a dense filter
+ * matrix. It then times each kernel against the per-sample loops it
+ * replaces, and the log-mel front end per second of audio. Exits non-zero
+ * if any check fails.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <audio_dsp.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MIN_SNR_DB 80.0 // Passband tones
+#define MIN_REJECT_DB 80.0 // Tones above the output Nyquist frequency
+#define MAX_FFT_ERROR 1e-6 // RMS, relative to the spectrum
+#define MAX_MEL_ERROR 1e-2 // Natural log units, 0.04 dB; float rounding near the log floor
+
+static const unsigned int rates[] = { 8000, 16000, 44100, 48000 };
+#define NUM_RATES (sizeof(rates) / sizeof(rates[0]))
+
+static int failures;
+static double bench_seconds = 0.2;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check(int ok, const char* what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state >> 8;
+}
+
+static float frand(float lo, float hi)
+{
+    return lo + (hi - lo) * (rng() & 0xffffff) / (float)0x1000000;
+}
+
+/* Reference loops, written the way the callers used to convert */
+
+static int16_t ref_f32_to_s16(float x)
+{
+    float y = floorf(x * 32768.0f + 0.5f);
+
+    return y > 32767.0f ? 32767 : y < -32768.0f ? -32768 : (int16_t)y;
+}
+
+static void ref_s16_to_f32_planar(const int16_t* in, float* const* out, size_t frames, unsigned int channels)
+{
+    for (size_t i = 0; i < frames; i++)
+        for (unsigned int c = 0; c < channels; c++)
+            out[c][i] = in[i * channels + c] / 32768.0f;
+}
+
+static void ref_f32_planar_to_s16(const float* const* in, int16_t* out, size_t frames, unsigned int channels)
+{
+    for (size_t i = 0; i < frames; i++)
+        for (unsigned int c = 0; c < channels; c++)
+            out[i * channels + c] = ref_f32_to_s16(in[c][i]);
+}
+
+static void ref_mix_s16(const int16_t* in, unsigned int in_channels, int16_t* out, unsigned int out_channels, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sum = 0;
+
+        for (unsigned int c = 0; c < in_channels; c++)
+            sum += in[i * in_channels + c];
+        for (unsigned int c = 0; c < out_channels; c++) {
+            if (in_channels == out_channels || (c < in_channels && out_channels > 1))
+                out[i * out_channels + c] = in[i * in_channels + c];
+            else if (in_channels == 1)
+                out[i * out_channels + c] = in[i];
+            else
+                out[i * out_channels + c] = (int16_t)floor((double)sum / in_channels);
+        }
+    }
+}
+
+static void test_convert(void)
+{
+    enum { N = 65536 + 13 };
+    int16_t* s16 = malloc(N * 2 * sizeof(int16_t));
+    int16_t* back = malloc(N * 2 * sizeof(int16_t));
+    int16_t* want = malloc(N * 2 * sizeof(int16_t));
+    float* f32 = malloc(N * 2 * sizeof(float));
+    float* planes[2] = { malloc(N * sizeof(float)), malloc(N * sizeof(float)) };
+    float* ref_planes[2] = { malloc(N * sizeof(float)), malloc(N * sizeof(float)) };
+    int ok;
+
+    // Every S16 value survives the round trip, in every layout
+    for (size_t i = 0; i < N * 2; i++)
+        s16[i] = (int16_t)(i * 7919);
+    audio_s16_to_f32(s16, f32, N * 2);
+    audio_f32_to_s16(f32, back, N * 2);
+    check(!memcmp(s16, back, N * 2 * sizeof(int16_t)), "s16 -> f32 -> s16 round trip");
+
+    for (unsigned int channels = 1; channels <= 2; channels++) {
+        size_t frames = N - 5;
+
+        audio_s16_to_f32_planar(s16, planes, frames, channels);
+        ref_s16_to_f32_planar(s16, ref_planes, frames, channels);
+        ok = 1;
+        for (unsigned int c = 0; c < channels; c++)
+            ok &= !memcmp(planes[c], ref_planes[c], frames * sizeof(float));
+        check(ok, channels == 1 ? "s16 -> f32 planar, mono" : "s16 -> f32 planar, stereo");
+
+        audio_f32_planar_to_s16((const float* const*)planes, back, frames, channels);
+        check(!memcmp(s16, back, frames * channels * sizeof(int16_t)),
+            channels == 1 ? "f32 planar -> s16, mono" : "f32 planar -> s16, stereo");
+    }
+
+    // Rounding and saturation of arbitrary floats
+    for (size_t i = 0; i < N * 2; i++)
+        f32[i] = frand(-1.5f, 1.5f);
+    f32[0] = 1.0f;
+    f32[1] = -1.0f;
+    f32[2] = 0.5f / 32768.0f;
+    f32[3] = -0.5f / 32768.0f;
+    audio_f32_to_s16(f32, back, N * 2);
+    for (size_t i = 0; i < N * 2; i++)
+        want[i] = ref_f32_to_s16(f32[i]);
+    check(!memcmp(want, back, N * 2 * sizeof(int16_t)), "f32 -> s16 rounding and saturation");
+
+    // Interleave and deinterleave are inverses
+    {
+        int16_t* split[2] = { (int16_t*)planes[0], (int16_t*)planes[1] };
+
+        audio_s16_deinterleave(s16, split, N - 3, 2);
+        audio_s16_interleave((const int16_t* const*)split, back, N - 3, 2);
+        check(!memcmp(s16, back, (N - 3) * 2 * sizeof(int16_t)), "s16 deinterleave / interleave");
+    }
+
+    free(s16);
+    free(back);
+    free(want);
+    free(f32);
+    for (int c = 0; c < 2; c++) {
+        free(planes[c]);
+        free(ref_planes[c]);
+    }
+}
+
+static void test_mix(void)
+{
+    static const unsigned int layouts[][2] = { { 1, 2 }, { 2, 1 }, { 2, 2 }, { 1, 6 }, { 6, 1 }, { 6, 2 }, { 2, 6 } };
+    enum { FRAMES = 4099 };
+    int16_t* in = malloc(FRAMES * 6 * sizeof(int16_t));
+    int16_t* out = malloc(FRAMES * 6 * sizeof(int16_t));
+    int16_t* want = malloc(FRAMES * 6 * sizeof(int16_t));
+    char what[64];
+
+    for (size_t i = 0; i < FRAMES * 6; i++)
+        in[i] = (int16_t)rng();
+    in[0] = in[1] = -32768;
+    in[2] = in[3] = 32767;
+
+    for (size_t k = 0; k < sizeof(layouts) / sizeof(layouts[0]); k++) {
+        unsigned int from = layouts[k][0], to = layouts[k][1];
+
+        audio_mix_s16(in, from, out, to, FRAMES);
+        ref_mix_s16(in, from, want, to, FRAMES);
+        snprintf(what, sizeof(what), "mix s16 %u -> %u channels", from, to);
+        check(!memcmp(out, want, FRAMES * to * sizeof(int16_t)), what);
+    }
+
+    free(in);
+    free(out);
+    free(want);
+}
+
+/*
+ * Resample a tone and fit a sine of the same frequency to the output,
+ * away from the start. Returns the fitted amplitude, and the SNR of the
+ * fit in *snr.
+ */
+static double resample_tone(unsigned int in_rate, unsigned int out_rate, double freq, int random_blocks, double* snr)
+{
+    size_t in_len = in_rate / 2, out_cap;
+    float *in, *out;
+    audio_resampler_t* rs = audio_resampler_create(in_rate, out_rate, 1);
+    size_t produced = 0, consumed = 0, skip, n;
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, yy = 0, residual = 0, a, b, w;
+
+    if (!rs) {
+        check(0, "audio_resampler_create");
+        return 0;
+    }
+    out_cap = audio_resampler_max_out(rs, in_len);
+    in = malloc(in_len * sizeof(float));
+    out = malloc(out_cap * sizeof(float));
+    for (size_t i = 0; i < in_len; i++)
+        in[i] = (float)(0.5 * sin(2 * M_PI * freq * i / in_rate));
+
+    // Feed it in pieces of any size, or as a single block
+    while (consumed < in_len) {
+        size_t in_frames = random_blocks ? 1 + rng() % 700 : in_len;
+        size_t out_frames;
+
+        if (in_frames > in_len - consumed)
+            in_frames = in_len - consumed;
+        out_frames = audio_resampler_max_out(rs, in_frames);
+        audio_resampler_process_f32(rs, in + consumed, &in_frames, out + produced, &out_frames);
+        consumed += in_frames;
+        produced += out_frames;
+    }
+    audio_resampler_destroy(rs);
+
+    // Least squares fit of a sin + b cos past the filter's settling time
+    w = 2 * M_PI * freq / out_rate;
+    skip = produced / 4;
+    n = produced - skip * 2;
+    for (size_t i = skip; i < skip + n; i++) {
+        double s = sin(w * i), c = cos(w * i), y = out[i];
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += y * s;
+        yc += y * c;
+        yy += y * y;
+    }
+    a = (ys * cc - yc * sc) / (ss * cc - sc * sc);
+    b = (yc * ss - ys * sc) / (ss * cc - sc * sc);
+    for (size_t i = skip; i < skip + n; i++) {
+        double e = out[i] - a * sin(w * i) - b * cos(w * i);
+        residual += e * e;
+    }
+    *snr = 10 * log10((yy - residual) / (residual > 1e-30 ? residual : 1e-30));
+
+    free(in);
+    free(out);
+    return sqrt(yy / n * 2);
+}
+
+/*
+ * Streaming in pieces, with the output running full now and then, must
+ * give exactly what one call over the whole input gives. An output of
+ * audio_resampler_max_out() frames must always take all the input.
+ */
+static void test_streaming(unsigned int in_rate, unsigned int out_rate, unsigned int channels)
+{
+    size_t in_len = in_rate / 5, cap, whole, consumed = 0, produced = 0;
+    audio_resampler_t* rs = audio_resampler_create(in_rate, out_rate, channels);
+    int16_t *in, *ref, *out;
+    int all_taken = 1;
+    char what[96];
+
+    cap = audio_resampler_max_out(rs, in_len);
+    in = malloc(in_len * channels * sizeof(int16_t));
+    ref = malloc(cap * channels * sizeof(int16_t));
+    out = malloc(cap * channels * sizeof(int16_t));
+    for (size_t i = 0; i < in_len * channels; i++)
+        in[i] = (int16_t)(rng() % 20000 - 10000);
+
+    {
+        size_t in_frames = in_len;
+        whole = cap;
+        audio_resampler_process_s16(rs, in, &in_frames, ref, &whole);
+        all_taken &= in_frames == in_len;
+    }
+
+    audio_resampler_reset(rs);
+    while (consumed < in_len) {
+        size_t in_frames = 1 + rng() % 500, out_frames;
+
+        if (in_frames > in_len - consumed)
+            in_frames = in_len - consumed;
+        out_frames = rng() % 4 ? audio_resampler_max_out(rs, in_frames) : rng() % 50;
+        if (out_frames > cap - produced)
+            out_frames = cap - produced;
+        audio_resampler_process_s16(rs, in + consumed * channels, &in_frames, out + produced * channels, &out_frames);
+        consumed += in_frames;
+        produced += out_frames;
+    }
+    // Collect what the last calls had no room for
+    for (;;) {
+        size_t in_frames = 0, out_frames = cap - produced;
+
+        audio_resampler_process_s16(rs, in, &in_frames, out + produced * channels, &out_frames);
+        if (!out_frames)
+            break;
+        produced += out_frames;
+    }
+
+    snprintf(what, sizeof(what), "resampler %u->%u, %u channels, streaming", in_rate, out_rate, channels);
+    check(all_taken && produced == whole && !memcmp(ref, out, whole * channels * sizeof(int16_t)), what);
+
+    audio_resampler_destroy(rs);
+    free(in);
+    free(ref);
+    free(out);
+}
+
+static void test_resampler(void)
+{
+    static const double tones[] = { 0.05, 0.3, 0.7 }; // Of the lower Nyquist frequency
+    char what[96];
+
+    printf("%-16s %10s %10s %10s %12s\n", "rates", "snr@0.05", "snr@0.3", "snr@0.7", "reject");
+    for (size_t i = 0; i < NUM_RATES; i++) {
+        for (size_t j = 0; j < NUM_RATES; j++) {
+            unsigned int in_rate = rates[i], out_rate = rates[j];
+            double nyquist = (in_rate < out_rate ? in_rate : out_rate) / 2.0;
+            double snr[3], worst = 1e9, reject = 0;
+            char label[32];
+
+            if (in_rate == out_rate)
+                continue;
+
+            for (int t = 0; t < 3; t++) {
+                resample_tone(in_rate, out_rate, tones[t] * nyquist, t == 1, &snr[t]);
+                if (snr[t] < worst)
+                    worst = snr[t];
+            }
+
+            // A tone between the two Nyquist frequencies must not alias
+            if (out_rate < in_rate) {
+                double freq = out_rate / 2.0 * 1.05, dummy;
+
+                if (freq < in_rate / 2.0 * 0.95)
+                    reject = -20 * log10(resample_tone(in_rate, out_rate, freq, 0, &dummy) / 0.5 + 1e-12);
+            }
+
+            snprintf(label, sizeof(label), "%u->%u", in_rate, out_rate);
+            printf("%-16s %9.1f  %9.1f  %9.1f  ", label, snr[0], snr[1], snr[2]);
+            if (reject)
+                printf("%9.1f dB\n", reject);
+            else
+                printf("%12s\n", "-");
+
+            snprintf(what, sizeof(what), "resampler %s SNR %.1f dB < %.0f dB", label, worst, MIN_SNR_DB);
+            check(worst >= MIN_SNR_DB, what);
+            if (reject) {
+                snprintf(what, sizeof(what), "resampler %s rejection %.1f dB < %.0f dB", label, reject, MIN_REJECT_DB);
+                check(reject >= MIN_REJECT_DB, what);
+            }
+        }
+    }
+}
+
+/* FFT and log-mel spectrogram, against double precision references */
+
+static void ref_dft(const float* in, double* re, double* im, unsigned int n)
+{
+    for (unsigned int k = 0; k <= n / 2; k++) {
+        double sr = 0.0, si = 0.0;
+
+        for (unsigned int j = 0; j < n; j++) {
+            double a = -2.0 * M_PI * (double)((size_t)j * k % n) / n;
+
+            sr += in[j] * cos(a);
+            si += in[j] * sin(a);
+        }
+        re[k] = sr;
+        im[k] = si;
+    }
+}
+
+static void test_fft(void)
+{
+    for (unsigned int n = 4; n <= 4096; n *= 2) {
+        audio_fft_t* fft = audio_fft_create(n);
+        float* in = malloc(n * sizeof(float));
+        float* out = malloc((n + 2) * sizeof(float));
+        double* re = malloc((n / 2 + 1) * sizeof(double));
+        double* im = malloc((n / 2 + 1) * sizeof(double));
+        double err = 0.0, energy = 0.0;
+        char what[64];
+
+        for (unsigned int i = 0; i < n; i++)
+            in[i] = frand(-1.0f, 1.0f);
+        audio_fft_real(fft, in, out);
+        ref_dft(in, re, im, n);
+
+        for (unsigned int k = 0; k <= n / 2; k++) {
+            err += (out[2 * k] - re[k]) * (out[2 * k] - re[k]) + (out[2 * k + 1] - im[k]) * (out[2 * k + 1] - im[k]);
+            energy += re[k] * re[k] + im[k] * im[k];
+        }
+        snprintf(what, sizeof(what), "fft %u relative error %.2g", n, sqrt(err / energy));
+        check(sqrt(err / energy) < MAX_FFT_ERROR, what);
+
+        audio_fft_destroy(fft);
+        free(in);
+        free(out);
+        free(re);
+        free(im);
+    }
+    check(audio_fft_create(48) == NULL, "fft of a length that is not a power of two");
+}
+
+static double ref_hz_to_mel(double hz)
+{
+    return 1127.0 * log(1.0 + hz / 700.0);
+}
+
+// The whole spectrogram at once, with a dense filter matrix
+static size_t ref_log_mel(const audio_mel_config_t* c, const int16_t* in, size_t samples, double* out)
+{
+    unsigned int n = c->fft_size, bins = n / 2 + 1;
+    double lo = ref_hz_to_mel(c->fmin), hi = ref_hz_to_mel(c->fmax);
+    double step = (hi - lo) / (c->mels + 1);
+    float* frame = calloc(n, sizeof(float));
+    double* re = malloc(bins * sizeof(double));
+    double* im = malloc(bins * sizeof(double));
+    size_t frames = 0;
+
+    for (size_t start = 0; start + c->window <= samples; start += c->hop, frames++) {
+        for (unsigned int i = 0; i < c->window; i++)
+            frame[i] = (float)(in[start + i] / 32768.0 * (0.5 - 0.5 * cos(2.0 * M_PI * i / c->window)));
+        ref_dft(frame, re, im, n);
+
+        for (unsigned int f = 0; f < c->mels; f++) {
+            double sum = 0.0;
+
+            for (unsigned int b = 1; b < bins; b++) {
+                double m = ref_hz_to_mel((double)b * c->rate / n);
+                double w = fmin((m - (lo + f * step)) / step, (lo + (f + 2) * step - m) / step);
+                double p = re[b] * re[b] + im[b] * im[b];
+
+                if (w > 0.0)
+                    sum += w * (c->power ? p : sqrt(p));
+            }
+            out[frames * c->mels + f] = log(sum + c->log_offset);
+        }
+    }
+
+    free(frame);
+    free(re);
+    free(im);
+    return frames;
+}
+
+// A chirp over the band, then noise bursts, silence and a quiet tone
+static int16_t* mel_signal(unsigned int rate, size_t samples)
+{
+    int16_t* x = malloc(samples * sizeof(int16_t));
+    double phase = 0.0;
+
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)i / samples;
+        double v;
+
+        if (t < 0.4) {
+            phase += 2.0 * M_PI * (50.0 + t / 0.4 * (rate / 2.0 - 100.0)) / rate;
+            v = 0.5 * sin(phase);
+        } else if (t < 0.7) {
+            v = ((size_t)(t * 50) % 2) ? frand(-0.3f, 0.3f) : 0.0;
+        } else if (t < 0.8) {
+            v = 0.0;
+        } else {
+            v = 0.001 * sin(2.0 * M_PI * 1000.0 * i / rate);
+        }
+        x[i] = (int16_t)lrint(v * 32767.0);
+    }
+    return x;
+}
+
+static void test_mel_config(const audio_mel_config_t* c, const char* name)
+{
+    size_t samples = c->rate * 2;
+    int16_t* x = mel_signal(c->rate, samples);
+    audio_mel_t* mel = audio_mel_create(c);
+    size_t max = audio_mel_max_frames(mel, samples);
+    float* out = malloc(max * c->mels * sizeof(float));
+    float* chunked = malloc(max * c->mels * sizeof(float));
+    double* ref = malloc(max * c->mels * sizeof(double));
+    size_t frames, ref_frames, got = 0, pos = 0;
+    double worst = 0.0;
+    char what[96];
+
+    frames = audio_mel_process_s16(mel, x, samples, out);
+    ref_frames = ref_log_mel(c, x, samples, ref);
+    check(frames == ref_frames && frames == max, "log-mel frame count");
+
+    for (size_t i = 0; i < frames * c->mels; i++)
+        worst = fmax(worst, fabs(out[i] - ref[i]));
+    snprintf(what, sizeof(what), "log-mel %s differs from the reference by %.2g", name, worst);
+    check(worst < MAX_MEL_ERROR, what);
+    printf("%-24s %6zu frames, max difference %.2g\n", name, frames, worst);
+
+    // Any split of the input gives the same frames
+    audio_mel_reset(mel);
+    while (pos < samples) {
+        size_t n = rng() % (3 * c->hop);
+
+        if (n > samples - pos)
+            n = samples - pos;
+        got += audio_mel_process_s16(mel, x + pos, n, chunked + got * c->mels);
+        pos += n;
+    }
+    check(got == frames && !memcmp(out, chunked, frames * c->mels * sizeof(float)), "log-mel in pieces");
+
+    audio_mel_destroy(mel);
+    free(x);
+    free(out);
+    free(chunked);
+    free(ref);
+}
+
+static void test_mel(void)
+{
+    audio_mel_config_t c;
+
+    printf("\n");
+    audio_mel_default_config(&c);
+    test_mel_config(&c, "default (yamnet)");
+
+    c.power = 1;
+    c.log_offset = 1e-6f;
+    test_mel_config(&c, "power");
+
+    audio_mel_default_config(&c);
+    c.rate = 48000;
+    c.window = 1024;
+    c.hop = 480;
+    c.fft_size = 1024;
+    c.mels = 128;
+    c.fmin = 0.0f;
+    c.fmax = 16000.0f;
+    test_mel_config(&c, "48 kHz, 128 bands");
+
+    c.window = 0;
+    check(audio_mel_create(&c) == NULL, "log-mel with an empty window");
+}
+
+/* Throughput */
+
+#define BENCH(label, samples, expr)                                                                    \
+    do {                                                                                               \
+        double t0 = now(), t;                                                                          \
+        size_t reps = 0;                                                                               \
+        do {                                                                                           \
+            expr;                                                                                      \
+            reps++;                                                                                    \
+            t = now() - t0;                                                                            \
+        } while (t < bench_seconds);                                                                   \
+        printf("%-40s %10.1f Msamples/s\n", label, (double)(samples) * reps / t / 1e6);                \
+    } while (0)
+
+static void bench(void)
+{
+    enum { FRAMES = 4096 };
+    int16_t* s16 = malloc(FRAMES * 2 * sizeof(int16_t));
+    int16_t* s16_out = malloc(FRAMES * 2 * sizeof(int16_t));
+    float* f32 = malloc(FRAMES * 2 * sizeof(float));
+    float* planes[2] = { malloc(FRAMES * sizeof(float)), malloc(FRAMES * sizeof(float)) };
+
+    for (size_t i = 0; i < FRAMES * 2; i++)
+        s16[i] = (int16_t)rng();
+    audio_s16_to_f32(s16, f32, FRAMES * 2);
+
+    printf("\n");
+    BENCH("s16 -> f32 planar, stereo (reference)", FRAMES * 2, ref_s16_to_f32_planar(s16, planes, FRAMES, 2));
+    BENCH("s16 -> f32 planar, stereo", FRAMES * 2, audio_s16_to_f32_planar(s16, planes, FRAMES, 2));
+    BENCH("s16 -> f32 planar, mono (reference)", FRAMES, ref_s16_to_f32_planar(s16, planes, FRAMES, 1));
+    BENCH("s16 -> f32 planar, mono", FRAMES, audio_s16_to_f32_planar(s16, planes, FRAMES, 1));
+    BENCH("f32 planar -> s16, stereo (reference)", FRAMES * 2, ref_f32_planar_to_s16((const float* const*)planes, s16_out, FRAMES, 2));
+    BENCH("f32 planar -> s16, stereo", FRAMES * 2, audio_f32_planar_to_s16((const float* const*)planes, s16_out, FRAMES, 2));
+    BENCH("mix s16 stereo -> mono (reference)", FRAMES * 2, ref_mix_s16(s16, 2, s16_out, 1, FRAMES));
+    BENCH("mix s16 stereo -> mono", FRAMES * 2, audio_mix_s16(s16, 2, s16_out, 1, FRAMES));
+    BENCH("mix s16 mono -> stereo (reference)", FRAMES, ref_mix_s16(s16, 1, s16_out, 2, FRAMES));
+    BENCH("mix s16 mono -> stereo", FRAMES, audio_mix_s16(s16, 1, s16_out, 2, FRAMES));
+
+    // Resampling speed, as input samples per second and times real time
+    printf("\n%-16s %14s %12s\n", "resample s16", "Msamples/s", "x realtime");
+    for (size_t i = 0; i < NUM_RATES; i++) {
+        for (size_t j = 0; j < NUM_RATES; j++) {
+            audio_resampler_t* rs;
+            int16_t* out;
+            double t0, t;
+            size_t reps = 0, cap;
+
+            if (i == j)
+                continue;
+            rs = audio_resampler_create(rates[i], rates[j], 1);
+            cap = audio_resampler_max_out(rs, FRAMES);
+            out = malloc(cap * sizeof(int16_t));
+            t0 = now();
+            do {
+                size_t in_frames = FRAMES, out_frames = cap;
+                audio_resampler_process_s16(rs, s16, &in_frames, out, &out_frames);
+                reps++;
+                t = now() - t0;
+            } while (t < bench_seconds);
+            printf("%6u->%-9u %14.1f %12.0f\n", rates[i], rates[j], (double)FRAMES * reps / t / 1e6,
+                (double)FRAMES * reps / t / rates[i]);
+            audio_resampler_destroy(rs);
+            free(out);
+        }
+    }
+
+    // Transform time, and the CPU a log-mel front end takes per second of audio
+    printf("\n%-16s %14s\n", "real fft", "us");
+    for (unsigned int n = 256; n <= 2048; n *= 2) {
+        audio_fft_t* fft = audio_fft_create(n);
+        float* spectrum = malloc((n + 2) * sizeof(float));
+        double t0 = now(), t;
+        size_t reps = 0;
+
+        do {
+            audio_fft_real(fft, f32, spectrum);
+            reps++;
+            t = now() - t0;
+        } while (t < bench_seconds);
+        printf("%-16u %14.2f\n", n, t / reps * 1e6);
+        audio_fft_destroy(fft);
+        free(spectrum);
+    }
+
+    {
+        audio_mel_config_t c;
+        audio_mel_t* mel;
+        int16_t* x;
+        float* frames;
+        double t0, t;
+        size_t reps = 0;
+
+        audio_mel_default_config(&c);
+        mel = audio_mel_create(&c);
+        x = mel_signal(c.rate, c.rate);
+        // Streaming, so later calls also finish the window left over from the last
+        frames = malloc((c.rate / c.hop + 1) * c.mels * sizeof(float));
+        t0 = now();
+        do {
+            audio_mel_process_s16(mel, x, c.rate, frames);
+            reps++;
+            t = now() - t0;
+        } while (t < bench_seconds);
+        printf("\n%-16s %14s %12s\n", "log-mel", "ms per second", "x realtime");
+        printf("%-16s %14.3f %12.0f\n", "16 kHz, 64 mels", t / reps * 1e3, reps / t);
+        audio_mel_destroy(mel);
+        free(x);
+        free(frames);
+    }
+
+    free(s16);
+    free(s16_out);
+    free(f32);
+    free(planes[0]);
+    free(planes[1]);
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-q] [-t seconds]\n"
+           "  -q          quality checks only, no benchmarks\n"
+           "  -t seconds  time to run each benchmark (default 0.2)\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    int quality_only = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qt:h")) != -1) {
+        switch (opt) {
+        case 'q':
+            quality_only = 1;
+            break;
+        case 't':
+            bench_seconds = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    test_convert();
+    test_mix();
+    for (size_t i = 0; i < NUM_RATES; i++)
+        for (size_t j = 0; j < NUM_RATES; j++)
+            if (i != j)
+                test_streaming(rates[i], rates[j], 1 + (i + j) % 2);
+    test_resampler();
+    test_fft();
+    test_mel();
+    if (!quality_only)
+        bench();
+
+    printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
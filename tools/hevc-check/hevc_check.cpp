@@ -0,0 +1,512 @@
+/* hevc-check - H.264 / H.265 handling of camera-recorder
+ *
+ * Checks solutions/camera-recorder/nal.h, which the recorder uses to turn
+ * the frames camera-streamer writes to shared memory into MP4 samples:
+ * splitting Annex-B frames into NAL units, keeping the parameter sets,
+ * parsing the H.265 SPS, building the avcC / hvcC sample entry records and
+ * converting frames to length-prefixed samples without the parameter sets.
+ *
+ * The built-in streams are made here, bit by bit, in the layout the VENC
+ * produces: a keyframe is VPS + SPS + PPS + SEI + IDR slice, the first NAL
+ * unit with a 4-byte start code, the others with 3-byte ones. With -i the
+ * same checks run on a recorded Annex-B stream. Exits non-zero if any check
+ * fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "nal.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Writes RBSP bits and wraps them into a NAL unit
+class BitWriter {
+public:
+    void bits(uint64_t v, int n) {
+        while (n-- > 0) {
+            if ((count_ & 7) == 0) {
+                rbsp_.push_back(0);
+            }
+            if ((v >> n) & 1) {
+                rbsp_.back() |= 0x80 >> (count_ & 7);
+            }
+            count_++;
+        }
+    }
+
+    void ue(uint32_t v) {
+        int len = 0;
+        while ((v + 1) >> (len + 1)) {
+            len++;
+        }
+        bits(0, len);
+        bits(v + 1, len + 1);
+    }
+
+    // rbsp_trailing_bits, then emulation prevention
+    Bytes nal(const Bytes& header) {
+        bits(1, 1);
+        while (count_ & 7) {
+            bits(0, 1);
+        }
+        Bytes out = header;
+        int zeros = 0;
+        for (uint8_t b : rbsp_) {
+            if (zeros >= 2 && b <= 3) {
+                out.push_back(3);
+                zeros = 0;
+            }
+            zeros = b == 0 ? zeros + 1 : 0;
+            out.push_back(b);
+        }
+        return out;
+    }
+
+private:
+    Bytes rbsp_;
+    size_t count_ = 0;
+};
+
+struct SpsParams {
+    int profile_idc;
+    int tier;
+    int level_idc;
+    int max_sub_layers;
+    int chroma_format_idc;
+    int coded_width;
+    int coded_height;
+    int crop_right;  // In chroma samples
+    int crop_bottom;
+    int bit_depth_minus8;
+};
+
+static void writeProfileTierLevel(BitWriter& w, const SpsParams& p) {
+    w.bits(0, 2);                                          // general_profile_space
+    w.bits(p.tier, 1);                                     // general_tier_flag
+    w.bits(p.profile_idc, 5);                              // general_profile_idc
+    w.bits((1u << (31 - p.profile_idc)) | (p.profile_idc == 1 ? 1u << 29 : 0), 32);  // compatibility
+    w.bits(0x90, 8);                                       // progressive_source, frame_only
+    w.bits(0, 40);                                         // Rest of the constraint flags
+    w.bits(p.level_idc, 8);
+    for (int i = 0; i < p.max_sub_layers - 1; i++) {
+        w.bits(1, 1);  // sub_layer_profile_present_flag
+        w.bits(1, 1);  // sub_layer_level_present_flag
+    }
+    if (p.max_sub_layers > 1) {
+        for (int i = p.max_sub_layers - 1; i < 8; i++) {
+            w.bits(0, 2);
+        }
+    }
+    for (int i = 0; i < p.max_sub_layers - 1; i++) {
+        w.bits(p.profile_idc, 8);  // sub_layer profile space, tier, idc
+        w.bits(0x60000000, 32);
+        w.bits(0x90, 8);
+        w.bits(0, 40);
+        w.bits(p.level_idc - 3 * (p.max_sub_layers - 1 - i), 8);
+    }
+}
+
+static Bytes makeVps(const SpsParams& p) {
+    BitWriter w;
+    w.bits(0, 4);                     // vps_video_parameter_set_id
+    w.bits(3, 2);                     // base_layer_internal / available
+    w.bits(0, 6);                     // vps_max_layers_minus1
+    w.bits(p.max_sub_layers - 1, 3);  // vps_max_sub_layers_minus1
+    w.bits(1, 1);                     // vps_temporal_id_nesting_flag
+    w.bits(0xFFFF, 16);
+    writeProfileTierLevel(w, p);
+    w.bits(1, 1);  // vps_sub_layer_ordering_info_present_flag
+    for (int i = 0; i < p.max_sub_layers; i++) {
+        w.ue(1);  // max_dec_pic_buffering_minus1
+        w.ue(0);  // max_num_reorder_pics
+        w.ue(0);  // max_latency_increase_plus1
+    }
+    w.bits(0, 6);  // vps_max_layer_id
+    w.ue(0);       // vps_num_layer_sets_minus1
+    w.bits(0, 1);  // vps_timing_info_present_flag
+    w.bits(0, 1);  // vps_extension_flag
+    return w.nal({0x40, 0x01});
+}
+
+static Bytes makeSps(const SpsParams& p) {
+    BitWriter w;
+    w.bits(0, 4);                     // sps_video_parameter_set_id
+    w.bits(p.max_sub_layers - 1, 3);  // sps_max_sub_layers_minus1
+    w.bits(1, 1);                     // sps_temporal_id_nesting_flag
+    writeProfileTierLevel(w, p);
+    w.ue(0);  // sps_seq_parameter_set_id
+    w.ue(p.chroma_format_idc);
+    if (p.chroma_format_idc == 3) {
+        w.bits(0, 1);
+    }
+    w.ue(p.coded_width);
+    w.ue(p.coded_height);
+    bool crop = p.crop_right || p.crop_bottom;
+    w.bits(crop, 1);
+    if (crop) {
+        w.ue(0);
+        w.ue(p.crop_right);
+        w.ue(0);
+        w.ue(p.crop_bottom);
+    }
+    w.ue(p.bit_depth_minus8);
+    w.ue(p.bit_depth_minus8);
+    // What follows is not read by the recorder; a short plausible tail
+    w.ue(4);       // log2_max_pic_order_cnt_lsb_minus4
+    w.bits(0, 1);  // sps_sub_layer_ordering_info_present_flag
+    w.ue(1);
+    w.ue(0);
+    w.ue(0);
+    w.ue(0);       // log2_min_luma_coding_block_size_minus3
+    w.ue(3);       // log2_diff_max_min_luma_coding_block_size
+    w.ue(0);
+    w.ue(3);
+    w.ue(3);
+    w.ue(3);
+    w.bits(0, 8);  // Various flags, all off
+    return w.nal({0x42, 0x01});
+}
+
+static Bytes makePps() {
+    BitWriter w;
+    w.ue(0);  // pps_pic_parameter_set_id
+    w.ue(0);  // pps_seq_parameter_set_id
+    w.bits(0, 7);
+    w.ue(0);
+    w.ue(0);
+    w.bits(0, 16);
+    return w.nal({0x44, 0x01});
+}
+
+// A slice or SEI of the given type with a payload that needs emulation prevention
+static Bytes makeNal(nal::Codec codec, int type, size_t size, unsigned seed) {
+    BitWriter w;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        // Runs of zeros now and then, as in real slices
+        w.bits((i % 97) < 3 ? 0 : (seed >> 16) & 0xFF, 8);
+    }
+    if (codec == nal::Codec::H265) {
+        return w.nal({static_cast<uint8_t>(type << 1), 0x01});
+    }
+    return w.nal({static_cast<uint8_t>(0x60 | type)});
+}
+
+// First NAL unit with a 4-byte start code, the rest with 3-byte ones
+static Bytes annexB(const std::vector<Bytes>& nals) {
+    Bytes out;
+    for (size_t i = 0; i < nals.size(); i++) {
+        if (i == 0) {
+            out.push_back(0);
+        }
+        out.insert(out.end(), {0, 0, 1});
+        out.insert(out.end(), nals[i].begin(), nals[i].end());
+    }
+    return out;
+}
+
+static std::vector<Bytes> split(const Bytes& data) {
+    std::vector<Bytes> nals;
+    nal::forEach(data.data(), data.size(), [&](const uint8_t* n, size_t len) { nals.emplace_back(n, n + len); });
+    return nals;
+}
+
+static const SpsParams STREAMS[] = {
+    // CH0 of camera-streamer: 1080p, coded as 1088 lines and cropped
+    {1, 0, 123, 1, 1, 1920, 1088, 0, 4, 0},
+    // With temporal sub-layers, so that the sub-layer fields are skipped
+    {1, 0, 93, 3, 1, 1280, 720, 0, 0, 0},
+    // Main 10, high tier
+    {2, 1, 120, 1, 1, 640, 480, 0, 0, 2},
+    // Odd size, cropped on the right as well
+    {1, 0, 60, 1, 1, 328, 248, 2, 4, 0},
+};
+
+static void testSplit() {
+    const SpsParams& p = STREAMS[0];
+    std::vector<Bytes> nals = {makeVps(p), makeSps(p), makePps(), makeNal(nal::Codec::H265, 39, 40, 1),
+                               makeNal(nal::Codec::H265, 19, 5000, 2)};
+    Bytes frame = annexB(nals);
+    check(split(frame) == nals, "Annex-B frame splits into its NAL units");
+
+    // Trailing zero bytes belong to no NAL unit; a stray prefix is ignored
+    Bytes padded = {0xAB, 0xCD};
+    padded.insert(padded.end(), frame.begin(), frame.end());
+    padded.insert(padded.end(), {0, 0});
+    check(split(padded) == nals, "prefix and trailing zeros ignored");
+    check(split(Bytes{1, 2, 3, 4}).empty(), "no NAL units without a start code");
+}
+
+static void testSps() {
+    // The SPS has a run of zero constraint bytes, so emulation prevention
+    // bytes are always present
+    for (const SpsParams& p : STREAMS) {
+        char what[96];
+        Bytes sps = makeSps(p);
+        nal::HevcSps parsed;
+        bool ok = nal::parseHevcSps(sps.data(), sps.size(), parsed);
+        snprintf(what, sizeof(what), "SPS %dx%d parses", p.coded_width, p.coded_height);
+        check(ok, what);
+        if (!ok) {
+            continue;
+        }
+        int width  = p.coded_width - 2 * p.crop_right;
+        int height = p.coded_height - 2 * p.crop_bottom;
+        snprintf(what, sizeof(what), "SPS %dx%d fields", width, height);
+        check(parsed.profile_idc == p.profile_idc && parsed.tier_flag == p.tier && parsed.level_idc == p.level_idc &&
+                  parsed.max_sub_layers == p.max_sub_layers && parsed.chroma_format_idc == p.chroma_format_idc &&
+                  parsed.bit_depth_luma_minus8 == p.bit_depth_minus8 && parsed.width == static_cast<uint32_t>(width) &&
+                  parsed.height == static_cast<uint32_t>(height) && parsed.constraint_indicator_flags[0] == 0x90,
+              what);
+    }
+
+    // The SPS of a 1280x720 stream recorded from x265, Main profile, level 3.1
+    Bytes x265 = {0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00,
+                  0x00, 0x03, 0x00, 0x5D, 0xA0, 0x02, 0x80, 0x80, 0x2D, 0x16, 0x59, 0x59, 0xA4, 0x93,
+                  0x2B, 0xC0, 0x5A, 0x70, 0x80, 0x00, 0x01, 0xF4, 0x80, 0x00, 0x3A, 0x98, 0x04};
+    nal::HevcSps recorded;
+    check(nal::parseHevcSps(x265.data(), x265.size(), recorded) && recorded.profile_idc == 1 &&
+              recorded.level_idc == 93 && recorded.width == 1280 && recorded.height == 720 &&
+              recorded.chroma_format_idc == 1 && recorded.bit_depth_luma_minus8 == 0,
+          "SPS recorded from x265");
+
+    Bytes truncated = makeSps(STREAMS[0]);
+    truncated.resize(12);
+    nal::HevcSps parsed;
+    check(!nal::parseHevcSps(truncated.data(), truncated.size(), parsed), "truncated SPS rejected");
+}
+
+// Reads an hvcC back, independently of the builder
+static void testHvcC() {
+    for (const SpsParams& p : STREAMS) {
+        nal::ParameterSets ps;
+        Bytes frame = annexB({makeVps(p), makeSps(p), makePps(), makeNal(nal::Codec::H265, 19, 3000, 3)});
+        ps.collect(nal::Codec::H265, frame.data(), frame.size());
+        check(ps.complete(nal::Codec::H265), "VPS, SPS and PPS collected");
+
+        Bytes c = nal::buildHvcC(ps);
+        check(c.size() > 23, "hvcC built");
+        if (c.size() <= 23) {
+            continue;
+        }
+        uint32_t compat = (c[2] << 24) | (c[3] << 16) | (c[4] << 8) | c[5];
+        check(c[0] == 1, "hvcC configurationVersion");
+        check(c[1] == ((p.tier << 5) | p.profile_idc), "hvcC profile space, tier and idc");
+        check(compat >> (31 - p.profile_idc) & 1, "hvcC profile compatibility");
+        check(c[6] == 0x90 && c[12] == p.level_idc, "hvcC constraint flags and level");
+        check(c[13] == 0xF0 && c[14] == 0 && c[15] == 0xFC, "hvcC segmentation and parallelism");
+        check(c[16] == (0xFC | p.chroma_format_idc), "hvcC chromaFormat");
+        check(c[17] == (0xF8 | p.bit_depth_minus8) && c[18] == (0xF8 | p.bit_depth_minus8), "hvcC bit depths");
+        check(((c[21] >> 3) & 7) == p.max_sub_layers && (c[21] & 3) == 3, "hvcC temporal layers and 4-byte lengths");
+        check(c[22] == 3, "hvcC numOfArrays");
+
+        const Bytes* expected[] = {&ps.vps, &ps.sps, &ps.pps};
+        size_t pos = 23;
+        for (int i = 0; i < 3 && pos + 5 <= c.size(); i++) {
+            size_t len = (c[pos + 3] << 8) | c[pos + 4];
+            check(c[pos] == (0x80 | (32 + i)), "hvcC array complete and of the right type");
+            check(c[pos + 1] == 0 && c[pos + 2] == 1, "hvcC one NAL unit per array");
+            check(pos + 5 + len <= c.size() && Bytes(c.begin() + pos + 5, c.begin() + pos + 5 + len) == *expected[i],
+                  "hvcC parameter set bytes");
+            pos += 5 + len;
+        }
+        check(pos == c.size(), "hvcC length");
+    }
+
+    nal::ParameterSets incomplete;
+    incomplete.sps = makeSps(STREAMS[0]);
+    incomplete.pps = makePps();
+    check(!incomplete.complete(nal::Codec::H265) && nal::buildHvcC(incomplete).empty(), "hvcC needs a VPS");
+}
+
+static void testAvcC() {
+    Bytes sps = {0x67, 0x64, 0x00, 0x28, 0xAC, 0xD9, 0x40, 0x78, 0x02, 0x27, 0xE5, 0x84};
+    Bytes pps = {0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0};
+    Bytes frame = annexB({sps, pps, makeNal(nal::Codec::H264, 5, 2000, 4)});
+    nal::ParameterSets ps;
+    ps.collect(nal::Codec::H264, frame.data(), frame.size());
+    check(ps.complete(nal::Codec::H264) && ps.vps.empty(), "H.264 SPS and PPS collected");
+
+    Bytes expected = {1, 0x64, 0x00, 0x28, 0xFF, 0xE1, 0, static_cast<uint8_t>(sps.size())};
+    expected.insert(expected.end(), sps.begin(), sps.end());
+    expected.insert(expected.end(), {1, 0, static_cast<uint8_t>(pps.size())});
+    expected.insert(expected.end(), pps.begin(), pps.end());
+    check(nal::buildAvcC(ps) == expected, "avcC as before");
+}
+
+// What the recorder writes for each frame
+static std::vector<Bytes> samples(nal::Codec codec, const Bytes& frame, size_t& written) {
+    Bytes out(frame.size() * 2);
+    std::vector<Bytes> nals;
+    written = nal::toLengthPrefixed(codec, frame.data(), frame.size(), out.data());
+    for (size_t pos = 0; pos + 4 <= written;) {
+        size_t len = (out[pos] << 24) | (out[pos + 1] << 16) | (out[pos + 2] << 8) | out[pos + 3];
+        if (pos + 4 + len > written) {
+            break;
+        }
+        nals.emplace_back(out.begin() + pos + 4, out.begin() + pos + 4 + len);
+        pos += 4 + len;
+    }
+    return nals;
+}
+
+static void testSamples() {
+    const SpsParams& p = STREAMS[0];
+    Bytes sei = makeNal(nal::Codec::H265, 39, 40, 5);
+    Bytes idr = makeNal(nal::Codec::H265, 19, 60000, 6);
+    Bytes trail = makeNal(nal::Codec::H265, 1, 8000, 7);
+    size_t written;
+
+    std::vector<Bytes> key = samples(nal::Codec::H265, annexB({makeVps(p), makeSps(p), makePps(), sei, idr}), written);
+    check(key == std::vector<Bytes>({sei, idr}), "keyframe sample is SEI + IDR, without parameter sets");
+    check(written == 8 + sei.size() + idr.size(), "keyframe sample size");
+    check(nal::isKeyframe(nal::Codec::H265, nal::type(nal::Codec::H265, key[1].data())), "IDR is a keyframe");
+
+    std::vector<Bytes> inter = samples(nal::Codec::H265, annexB({trail}), written);
+    check(inter == std::vector<Bytes>({trail}), "P-frame sample");
+    check(!nal::isKeyframe(nal::Codec::H265, nal::type(nal::Codec::H265, trail.data())), "TRAIL_R is not a keyframe");
+
+    // An H.264 reading of the same bytes would have kept the VPS (type 0)
+    // and dropped nothing: the codec decides what a parameter set is
+    Bytes frame = annexB({makeVps(p), makeSps(p), makePps(), idr});
+    check(samples(nal::Codec::H264, frame, written).size() == 4, "H.264 rules do not apply to H.265");
+}
+
+// The recorder waits for a keyframe with complete parameter sets
+static void testStart() {
+    const SpsParams& p = STREAMS[1];
+    std::vector<Bytes> gop;
+    nal::ParameterSets ps;
+    int started = -1;
+
+    for (int i = 0; i < 3; i++) {
+        gop.push_back(annexB({makeNal(nal::Codec::H265, 1, 3000, 10 + i)}));
+    }
+    gop.push_back(annexB({makeVps(p), makeSps(p), makePps(), makeNal(nal::Codec::H265, 19, 30000, 20)}));
+    gop.push_back(annexB({makeNal(nal::Codec::H265, 1, 3000, 21)}));
+
+    for (size_t i = 0; i < gop.size() && started < 0; i++) {
+        ps.collect(nal::Codec::H265, gop[i].data(), gop[i].size());
+        if (ps.complete(nal::Codec::H265)) {
+            started = i;
+        }
+    }
+    check(started == 3, "recording starts at the first keyframe");
+}
+
+// The checks that apply to any recorded stream
+static int checkFile(const char* path, nal::Codec codec) {
+    FILE* f = fopen(path, "rb");
+    Bytes data;
+    uint8_t chunk[65536];
+    size_t n;
+
+    if (!f) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(f);
+
+    int counts[64]   = {0};
+    size_t kept_size = 0, kept = 0, total = 0;
+    nal::forEach(data.data(), data.size(), [&](const uint8_t* nal, size_t len) {
+        int t = nal::type(codec, nal);
+        counts[t]++;
+        total++;
+        if (!nal::isParameterSet(codec, t)) {
+            kept++;
+            kept_size += 4 + len;
+        }
+    });
+
+    nal::ParameterSets ps;
+    ps.collect(codec, data.data(), data.size());
+    check(ps.complete(codec), "stream has its parameter sets");
+
+    Bytes record = codec == nal::Codec::H265 ? nal::buildHvcC(ps) : nal::buildAvcC(ps);
+    check(!record.empty(), "sample entry record built");
+    if (codec == nal::Codec::H265) {
+        nal::HevcSps sps;
+        if (nal::parseHevcSps(ps.sps.data(), ps.sps.size(), sps)) {
+            printf("%s: H.265 profile %d tier %d level %.1f, %ux%u, chroma %d, %d bit, %d temporal layer(s)\n", path,
+                   sps.profile_idc, sps.tier_flag, sps.level_idc / 30.0, sps.width, sps.height, sps.chroma_format_idc,
+                   8 + sps.bit_depth_luma_minus8, sps.max_sub_layers);
+        }
+    }
+
+    Bytes out(data.size() + 4 * total + 4);
+    size_t written = nal::toLengthPrefixed(codec, data.data(), data.size(), out.data());
+    check(written == kept_size, "every NAL unit but the parameter sets kept");
+
+    printf("%s: %zu NAL units, %zu kept in samples, hvcC/avcC %zu bytes\n", path, total, kept, record.size());
+    for (int t = 0; t < 64; t++) {
+        if (counts[t]) {
+            printf("  type %2d: %d\n", t, counts[t]);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* input = nullptr;
+    nal::Codec codec  = nal::Codec::H265;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:c:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                input = optarg;
+                break;
+            case 'c':
+                if (strcmp(optarg, "h264") == 0) {
+                    codec = nal::Codec::H264;
+                } else if (strcmp(optarg, "h265") == 0) {
+                    codec = nal::Codec::H265;
+                } else {
+                    printf("unknown codec %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                printf("usage: %s [-i stream.h265|stream.h264] [-c h265|h264]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (input) {
+        if (checkFile(input, codec)) {
+            return 1;
+        }
+    } else {
+        testSplit();
+        testSps();
+        testHvcC();
+        testAvcC();
+        testSamples();
+        testStart();
+    }
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+    } else {
+        printf("all checks passed\n");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+/* logger-bench - cost of sscma-node log statements
+ *
+ * Compares the logger of solutions/sscma-node (main/logger.cpp) with the
+ * direct syslog() calls it replaces. For a disabled statement the old
+ * macros evaluated every argument and left the level check to syslog();
+ * the new ones check the level first. For an enabled statement the old
+ * macros made a system call per message in the calling thread; the new
+ * ones format into a ring that a background thread writes out.
+ *
+ * It also checks the per-module levels, that a disabled statement does
+ * not evaluate its arguments, and that every message from several
+ * threads is either written, in order, or counted as dropped. Exits
+ * non-zero if any check fails.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+
+static constexpr char TAG[] = "ma::node::server";
+
+static int failures = 0;
+static double bench_seconds = 0.5;
+static int evaluated = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Stands in for json::dump() of a typical request
+static std::string dump(int i) {
+    char buf[320];
+    evaluated++;
+    snprintf(buf, sizeof(buf),
+             "{\"name\":\"create\",\"type\":\"camera\",\"data\":{\"config\":{\"width\":1920,\"height\":1080,"
+             "\"fps\":30,\"channel\":%d,\"format\":\"h264\"},\"dependencies\":[\"model\",\"stream\",\"save\"],"
+             "\"dependents\":[]},\"id\":\"node-%08d\"}",
+             i & 3, i);
+    return buf;
+}
+
+static std::string tempFile() {
+    char path[] = "/tmp/logger-bench-XXXXXX";
+    int fd      = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return path;
+}
+
+static std::vector<std::string> readLines(const std::string& path) {
+    std::vector<std::string> lines;
+    FILE* f = fopen(path.c_str(), "r");
+    std::string line;
+    int c;
+    if (!f) {
+        return lines;
+    }
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '\n') {
+            lines.push_back(line);
+            line.clear();
+        } else {
+            line.push_back(static_cast<char>(c));
+        }
+    }
+    fclose(f);
+    return lines;
+}
+
+// The text after "LEVEL tag: " of a file sink line
+static std::string message(const std::string& line) {
+    size_t pos = line.find(": ", 24);
+    return pos == std::string::npos ? "" : line.substr(pos + 2);
+}
+
+// ns per call of fn, run in batches for bench_seconds
+template <typename F>
+static double bench(F fn) {
+    double start = now(), elapsed;
+    long calls   = 0;
+    do {
+        for (int i = 0; i < 1000; i++) {
+            fn(static_cast<int>(calls + i));
+        }
+        calls += 1000;
+        elapsed = now() - start;
+    } while (elapsed < bench_seconds);
+    return elapsed * 1e9 / calls;
+}
+
+static void testLevels() {
+    std::string path = tempFile();
+
+    check(!ma::logger::configure("info,ma::node=loud"), "invalid level rejected");
+    check(ma::logger::configure("warning,ma::node=info,ma::node::save=verbose"), "levels configured");
+    check(ma::logger::start(path.c_str()), "logger started");
+
+    MA_LOGV("ma::node::save", "save verbose");
+    MA_LOGV("ma::node::saver", "saver verbose");
+    MA_LOGI("ma::node::saver", "saver info");
+    MA_LOGD("ma::node", "node debug");
+    MA_LOGI("ma::node::camera", "camera info");
+    MA_LOGI("other", "other info");
+    MA_LOGW("other", "other warning");
+
+    // A call site follows later level changes
+    for (int i = 0; i < 3; i++) {
+        if (i == 1) {
+            ma::logger::setLevel("ma::node::camera", ma::logger::Level::Debug);
+        }
+        if (i == 2) {
+            ma::logger::setLevel("ma::node::camera", ma::logger::Level::Error);
+        }
+        MA_LOGD("ma::node::camera", "camera debug %d", i);
+    }
+
+    evaluated = 0;
+    MA_LOGV(TAG, "response: %s", dump(0).c_str());
+    check(evaluated == 0, "disabled statement does not evaluate its arguments");
+
+    ma::logger::stop();
+
+    std::vector<std::string> lines = readLines(path);
+    std::vector<std::string> expected = {"save verbose", "saver info",    "camera info",
+                                         "other warning", "camera debug 1"};
+    check(lines.size() == expected.size(), "number of messages passing the levels");
+    for (size_t i = 0; i < lines.size() && i < expected.size(); i++) {
+        check(message(lines[i]) == expected[i], "message passing the levels");
+    }
+    check(!lines.empty() && lines[0].find(" V ma::node::save: ") != std::string::npos, "file line format");
+
+    unlink(path.c_str());
+    ma::logger::configure("info");
+}
+
+// Messages from several threads, paced as in normal operation or in one burst
+static void testDelivery(bool paced) {
+    const int threads = 4, messages = 20000;
+    const char* name  = paced ? "paced" : "burst";
+    std::string path  = tempFile();
+    std::string long_text(1000, 'x');
+    std::vector<std::thread> workers;
+    uint64_t dropped = ma::logger::dropped();
+
+    ma::logger::start(path.c_str());
+    MA_LOGI(TAG, "long %s", long_text.c_str());
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([t, paced] {
+            for (int i = 0; i < messages; i++) {
+                MA_LOGI(TAG, "t%d %d", t, i);
+                if (paced && (i & 63) == 63) {
+                    usleep(1000);
+                }
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    ma::logger::stop();
+    dropped = ma::logger::dropped() - dropped;
+
+    std::vector<std::string> lines = readLines(path);
+    std::vector<int> last(threads, -1);
+    size_t received = 0;
+    bool ordered    = true;
+    check(!lines.empty() && message(lines[0]) == "long " + long_text, "long message written whole");
+    for (const auto& line : lines) {
+        int t, i;
+        if (sscanf(message(line).c_str(), "t%d %d", &t, &i) == 2 && t >= 0 && t < threads) {
+            ordered = ordered && i > last[t];
+            last[t] = i;
+            received++;
+        }
+    }
+    check(ordered, "messages of each thread in order");
+    check(received + dropped == static_cast<size_t>(threads * messages), "every message written or counted as dropped");
+    check(!paced || dropped == 0, "no drops when the writer keeps up");
+    printf("%s: %d threads x %d messages, %zu written, %llu dropped\n", name, threads, messages, received,
+           static_cast<unsigned long long>(dropped));
+
+    unlink(path.c_str());
+}
+
+static void runBench() {
+    std::string path = tempFile();
+    std::string id   = "node-00000001";
+    int fd;
+
+    printf("\n%-40s %10s\n", "disabled statement", "ns");
+    // As before: syslog() drops LOG_DEBUG by its mask, after the arguments
+    setlogmask(LOG_UPTO(LOG_INFO));
+    printf("%-40s %10.1f\n", "syslog, masked", bench([&](int i) { syslog(LOG_DEBUG, "request: %s <== %d", id.c_str(), i); }));
+    printf("%-40s %10.1f\n", "syslog, masked, with dump()",
+           bench([&](int i) { syslog(LOG_DEBUG, "request: %s <== %s", id.c_str(), dump(i).c_str()); }));
+    printf("%-40s %10.1f\n", "MA_LOGV", bench([&](int i) { MA_LOGV(TAG, "request: %s <== %d", id.c_str(), i); }));
+    printf("%-40s %10.1f\n", "MA_LOGV, with dump()",
+           bench([&](int i) { MA_LOGV(TAG, "request: %s <== %s", id.c_str(), dump(i).c_str()); }));
+
+    // Enabled: a system call per message against the ring. syslog() to
+    // /dev/log is not available on every host, so a write() per message
+    // to a file stands in for it.
+    printf("\n%-40s %10s %10s\n", "enabled statement, to a file", "short", "dump()");
+    fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+    auto direct = [&](bool long_text) {
+        return bench([&](int i) {
+            char buf[512];
+            int n = long_text ? snprintf(buf, sizeof(buf), "request: %s <== %s\n", id.c_str(), dump(i).c_str())
+                              : snprintf(buf, sizeof(buf), "create node: camera(%s) %d\n", id.c_str(), i);
+            if (write(fd, buf, n) != n) {
+                failures++;
+            }
+        });
+    };
+    double short_ns = direct(false);
+    printf("%-40s %10.1f %10.1f\n", "write() per message", short_ns, direct(true));
+    close(fd);
+
+    // Bursts of 256, paced so that the writer keeps up as in normal
+    // operation; only the time in the statements counts
+    auto ring = [&](bool long_text) {
+        uint64_t dropped = ma::logger::dropped();
+        long calls       = 0;
+        double busy      = 0;
+        ma::logger::start(path.c_str());
+        for (double end = now() + bench_seconds; now() < end; calls += 256) {
+            double t = now();
+            for (int i = 0; i < 256; i++) {
+                if (long_text) {
+                    MA_LOGI(TAG, "request: %s <== %s", id.c_str(), dump(static_cast<int>(calls) + i).c_str());
+                } else {
+                    MA_LOGI(TAG, "create node: camera(%s) %d", id.c_str(), static_cast<int>(calls) + i);
+                }
+            }
+            busy += now() - t;
+            usleep(2000);
+        }
+        ma::logger::stop();
+        check(ma::logger::dropped() == dropped, "no drops when the writer keeps up");
+        return busy * 1e9 / calls;
+    };
+    short_ns = ring(false);
+    printf("%-40s %10.1f %10.1f\n", "ring, background writer", short_ns, ring(true));
+
+    unlink(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:h")) != -1) {
+        switch (opt) {
+            case 't':
+                bench_seconds = atof(optarg);
+                break;
+            default:
+                printf("usage: %s [-t seconds]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    openlog("logger-bench", 0, LOG_USER);
+
+    testLevels();
+    testDelivery(true);
+    testDelivery(false);
+    runBench();
+
+    closelog();
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+    }
+    return failures ? 1 : 0;
+}
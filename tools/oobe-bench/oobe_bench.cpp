@@ -0,0 +1,529 @@
+/* oobe-bench - page load bytes and server CPU of the OOBE web server
+ *
+ * Serves solutions/oobe/web through mongoose on localhost in three ways:
+ * from disk as the server used to, from disk with the gzip variants the
+ * package build adds (mongoose picks those by itself), and from the
+ * in-memory asset cache. A client loads the setup page the way a browser
+ * does, index.html and what it references, first cold and then
+ * revalidating with the ETags it was given. For each way the tool reports
+ * the bytes on the wire and the server's CPU time per page load, and it
+ * checks that every response decodes to the file on disk and that the
+ * cache negotiates encodings as the client asks. Exits non-zero if any
+ * check fails.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <map>
+#include <string>
+
+#ifdef OOBE_BENCH_BROTLI
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#endif
+
+#include "asset_cache.h"
+#include "mongoose.h"
+
+// What a first visit fetches: the page, then what it and its stylesheet reference
+static const char *const s_page[] = {"/", "/css/style.css", "/js/supervisor-api.js", "/js/oobe-app.js",
+                                     "/images/blueback.jpeg"};
+#define PAGE_REQUESTS (sizeof(s_page) / sizeof(s_page[0]))
+
+// As sent by current browsers
+#define BROWSER_ACCEPT_ENCODING "gzip, deflate, br, zstd"
+
+static int failures = 0;
+static double bench_seconds = 0.5;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool read_file(const std::string &path, std::string *out) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  char buf[16384];
+  size_t n;
+
+  if (fp == NULL) return false;
+  out->clear();
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) out->append(buf, n);
+  fclose(fp);
+  return true;
+}
+
+static bool write_file(const std::string &path, const std::string &data) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  bool ok;
+
+  if (fp == NULL) return false;
+  ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  return fclose(fp) == 0 && ok;
+}
+
+/* The package build's precompression step, done with the libraries */
+
+static bool is_text(const char *path) {
+  static const char *const exts[] = {".html", ".css", ".js", ".json", ".svg"};
+  size_t n = strlen(path);
+
+  for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+    size_t m = strlen(exts[i]);
+    if (n > m && strcmp(path + n - m, exts[i]) == 0) return true;
+  }
+  return false;
+}
+
+static bool gzip_compress(const std::string &in, std::string *out) {
+  z_stream z;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, 9, Z_DEFLATED, 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+  out->resize(deflateBound(&z, in.size()));
+  z.next_in = (Bytef *) in.data();
+  z.avail_in = in.size();
+  z.next_out = (Bytef *) &(*out)[0];
+  z.avail_out = out->size();
+  bool ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+  out->resize(z.total_out);
+  deflateEnd(&z);
+  return ok;
+}
+
+static bool gzip_decompress(const std::string &in, std::string *out) {
+  z_stream z;
+  char buf[16384];
+  int ret;
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) return false;
+  z.next_in = (Bytef *) in.data();
+  z.avail_in = in.size();
+  out->clear();
+  do {
+    z.next_out = (Bytef *) buf;
+    z.avail_out = sizeof(buf);
+    ret = inflate(&z, Z_NO_FLUSH);
+    out->append(buf, sizeof(buf) - z.avail_out);
+  } while (ret == Z_OK);
+  inflateEnd(&z);
+  return ret == Z_STREAM_END;
+}
+
+#ifdef OOBE_BENCH_BROTLI
+static bool brotli_compress(const std::string &in, std::string *out) {
+  size_t n = BrotliEncoderMaxCompressedSize(in.size());
+
+  out->resize(n);
+  if (!BrotliEncoderCompress(11, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(), (const uint8_t *) in.data(), &n,
+                             (uint8_t *) &(*out)[0])) {
+    return false;
+  }
+  out->resize(n);
+  return true;
+}
+
+static bool brotli_decompress(const std::string &in, std::string *out) {
+  BrotliDecoderState *s = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+  const uint8_t *next_in = (const uint8_t *) in.data();
+  size_t avail_in = in.size();
+  BrotliDecoderResult ret;
+
+  out->clear();
+  do {
+    uint8_t buf[16384];
+    uint8_t *next_out = buf;
+    size_t avail_out = sizeof(buf);
+    ret = BrotliDecoderDecompressStream(s, &avail_in, &next_in, &avail_out, &next_out, NULL);
+    out->append((const char *) buf, sizeof(buf) - avail_out);
+  } while (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+  BrotliDecoderDestroyInstance(s);
+  return ret == BROTLI_DECODER_RESULT_SUCCESS;
+}
+#endif
+
+static std::string s_copy_src, s_copy_dst;
+
+static int copy_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+  std::string dst = s_copy_dst + (path + s_copy_src.size());
+  std::string data, packed;
+  (void) st;
+  (void) ftw;
+
+  if (type == FTW_D) return mkdir(dst.c_str(), 0755) == 0 || errno == EEXIST ? 0 : -1;
+  if (type != FTW_F) return 0;
+  if (!read_file(path, &data) || !write_file(dst, data)) return -1;
+  if (is_text(path)) {
+    if (!gzip_compress(data, &packed) || !write_file(dst + ".gz", packed)) return -1;
+#ifdef OOBE_BENCH_BROTLI
+    if (!brotli_compress(data, &packed) || !write_file(dst + ".br", packed)) return -1;
+#endif
+  }
+  return 0;
+}
+
+static bool precompress(const char *src, const char *dst) {
+  s_copy_src = src;
+  s_copy_dst = dst;
+  return nftw(src, copy_entry, 16, FTW_PHYS) == 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+  (void) st;
+  (void) type;
+  (void) ftw;
+  return remove(path);
+}
+
+/* Server, on its own thread so that its CPU time can be read */
+
+struct server {
+  struct mg_mgr mgr;
+  const char *root;
+  struct asset_cache *assets;
+  const char *extra_headers;
+  volatile bool stop;
+  pthread_t thread;
+  int port;
+};
+
+static void server_fn(struct mg_connection *c, int ev, void *ev_data) {
+  if (ev != MG_EV_HTTP_MSG) return;
+
+  struct server *s = (struct server *) c->fn_data;
+  struct mg_http_message *hm = (struct mg_http_message *) ev_data;
+
+  if (asset_cache_serve(s->assets, c, hm)) return;
+
+  struct mg_http_serve_opts opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.root_dir = s->root;
+  opts.extra_headers = s->extra_headers;
+  mg_http_serve_dir(c, hm, &opts);
+}
+
+static void *server_loop(void *arg) {
+  struct server *s = (struct server *) arg;
+  while (!s->stop) mg_mgr_poll(&s->mgr, 50);
+  return NULL;
+}
+
+static bool server_start(struct server *s, const char *root, struct asset_cache *assets, const char *extra_headers) {
+  struct mg_connection *lc;
+
+  s->root = root;
+  s->assets = assets;
+  s->extra_headers = extra_headers;
+  s->stop = false;
+  mg_mgr_init(&s->mgr);
+  lc = mg_http_listen(&s->mgr, "http://127.0.0.1:0", server_fn, s);
+  if (lc == NULL) {
+    mg_mgr_free(&s->mgr);
+    return false;
+  }
+  s->port = mg_ntohs(lc->loc.port);
+  return pthread_create(&s->thread, NULL, server_loop, s) == 0;
+}
+
+static void server_stop(struct server *s) {
+  s->stop = true;
+  pthread_join(s->thread, NULL);
+  mg_mgr_free(&s->mgr);
+}
+
+static double server_cpu(const struct server *s) {
+  clockid_t id;
+  struct timespec ts;
+
+  if (pthread_getcpuclockid(s->thread, &id) != 0 || clock_gettime(id, &ts) != 0) return 0.0;
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Client */
+
+struct response {
+  int status;
+  std::string encoding;
+  std::string etag;
+  std::string body;
+  size_t wire;  // Bytes received, headers included
+};
+
+static int connect_to(int port) {
+  struct sockaddr_in sa;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd >= 0 && connect(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static std::string header(const std::string &head, const char *name) {
+  size_t n = strlen(name), pos = 0;
+
+  while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+    pos += 2;
+    if (strncasecmp(head.c_str() + pos, name, n) == 0 && head[pos + n] == ':') {
+      size_t start = head.find_first_not_of(' ', pos + n + 1);
+      return head.substr(start, head.find("\r\n", start) - start);
+    }
+  }
+  return "";
+}
+
+static bool request(int fd, const char *method, const char *path, const char *accept_encoding, const std::string &etag,
+                    struct response *r) {
+  char req[512], buf[16384];
+  std::string in;
+  size_t end, length;
+  ssize_t n;
+
+  snprintf(req, sizeof(req), "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\n%s%s%s%s%s\r\n", method, path,
+           accept_encoding ? "Accept-Encoding: " : "", accept_encoding ? accept_encoding : "",
+           accept_encoding ? "\r\n" : "", etag.empty() ? "" : "If-None-Match: ",
+           etag.empty() ? "" : (etag + "\r\n").c_str());
+  if (send(fd, req, strlen(req), 0) != (ssize_t) strlen(req)) return false;
+
+  while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+    if ((n = recv(fd, buf, sizeof(buf), 0)) <= 0) return false;
+    in.append(buf, n);
+  }
+  std::string head = in.substr(0, end);
+  length = strcmp(method, "HEAD") == 0 ? 0 : strtoul(header(head, "Content-Length").c_str(), NULL, 10);
+  while (in.size() < end + 4 + length) {
+    if ((n = recv(fd, buf, sizeof(buf), 0)) <= 0) return false;
+    in.append(buf, n);
+  }
+
+  r->status = atoi(in.c_str() + 9);
+  r->encoding = header(head, "Content-Encoding");
+  r->etag = header(head, "ETag");
+  r->body = in.substr(end + 4, length);
+  r->wire = in.size();
+  return true;
+}
+
+static bool decode(const struct response &r, std::string *out) {
+  if (r.encoding.empty()) {
+    *out = r.body;
+    return true;
+  }
+  if (r.encoding == "gzip") return gzip_decompress(r.body, out);
+#ifdef OOBE_BENCH_BROTLI
+  if (r.encoding == "br") return brotli_decompress(r.body, out);
+#endif
+  return false;
+}
+
+static std::string source_of(const char *path) {
+  return std::string(OOBE_WEB_DIR) + (strcmp(path, "/") == 0 ? "/index.html" : path);
+}
+
+// Checks that a response is the file at path, in an encoding the client took
+static void check_response(const struct response &r, const char *path, const char *label) {
+  std::string expected, got;
+  char what[256];
+
+  snprintf(what, sizeof(what), "%s: %s", label, path);
+  check(r.status == 200 && read_file(source_of(path), &expected) && decode(r, &got) && got == expected, what);
+}
+
+struct load {
+  size_t bytes;
+  size_t not_modified;
+};
+
+// One page load on a new connection; with etags filled in, a revalidation
+static bool page_load(const struct server *s, std::map<std::string, std::string> *etags, bool revalidate,
+                      const char *label, bool verify, struct load *l) {
+  int fd = connect_to(s->port);
+  bool ok = fd >= 0;
+
+  for (size_t i = 0; ok && i < PAGE_REQUESTS; i++) {
+    struct response r;
+    std::string etag = revalidate ? (*etags)[s_page[i]] : "";
+
+    ok = request(fd, "GET", s_page[i], BROWSER_ACCEPT_ENCODING, etag, &r);
+    if (!ok) break;
+    l->bytes += r.wire;
+    if (r.status == 304) {
+      l->not_modified++;
+    } else if (verify) {
+      check_response(r, s_page[i], label);
+    }
+    if (!revalidate) (*etags)[s_page[i]] = r.etag;
+  }
+  if (fd >= 0) close(fd);
+  return ok;
+}
+
+static void run(const char *label, const char *root, struct asset_cache *assets, const char *extra_headers) {
+  struct server s;
+  std::map<std::string, std::string> etags;
+
+  if (!server_start(&s, root, assets, extra_headers)) {
+    check(false, "cannot start the server");
+    return;
+  }
+
+  printf("%-16s", label);
+  for (int revalidate = 0; revalidate < 2; revalidate++) {
+    struct load first = {0, 0}, each = {0, 0};
+    size_t loads = 0;
+    double t0, cpu0;
+    char what[128];
+
+    check(page_load(&s, &etags, revalidate, label, true, &first), "page load");
+    snprintf(what, sizeof(what), "%s: revalidation not answered with 304", label);
+    if (revalidate) check(first.not_modified == PAGE_REQUESTS, what);
+
+    t0 = now();
+    cpu0 = server_cpu(&s);
+    do {
+      if (!page_load(&s, &etags, revalidate, label, false, &each)) break;
+      loads++;
+    } while (now() - t0 < bench_seconds);
+
+    printf(" %10lu %12.1f", (unsigned long) first.bytes, loads ? (server_cpu(&s) - cpu0) / loads * 1e6 : 0.0);
+  }
+  printf("\n");
+
+  server_stop(&s);
+}
+
+static void test_negotiation(struct asset_cache *assets) {
+  struct server s;
+  int fd;
+
+  if (!server_start(&s, "/nonexistent", assets, NULL) || (fd = connect_to(s.port)) < 0) {
+    check(false, "cannot start the server");
+    return;
+  }
+
+  static const struct {
+    const char *path;
+    const char *accept_encoding;
+    const char *expect;
+  } cases[] = {
+      {"/js/oobe-app.js", NULL, ""},
+      {"/js/oobe-app.js", "gzip", "gzip"},
+      {"/js/oobe-app.js", "br;q=0, gzip", "gzip"},
+      {"/js/oobe-app.js", "GZIP;q=0.5", "gzip"},
+      {"/js/oobe-app.js", "gzip;q=0, identity", ""},
+      {"/js/oobe-app.js", "deflate", ""},
+#ifdef OOBE_BENCH_BROTLI
+      {"/js/oobe-app.js", BROWSER_ACCEPT_ENCODING, "br"},
+      {"/js/oobe-app.js", "*", "br"},
+      {"/js/oobe-app.js", "*, br;q=0", "gzip"},
+#else
+      {"/js/oobe-app.js", BROWSER_ACCEPT_ENCODING, "gzip"},
+#endif
+      {"/images/blueback.jpeg", BROWSER_ACCEPT_ENCODING, ""},
+      {"/", "gzip", "gzip"},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    struct response r, again;
+    char what[160];
+
+    snprintf(what, sizeof(what), "%s with Accept-Encoding \"%s\" should be %s", cases[i].path,
+             cases[i].accept_encoding ? cases[i].accept_encoding : "", *cases[i].expect ? cases[i].expect : "identity");
+    if (!request(fd, "GET", cases[i].path, cases[i].accept_encoding, "", &r)) {
+      check(false, what);
+      break;
+    }
+    check(r.encoding == cases[i].expect, what);
+    check_response(r, cases[i].path, "negotiation");
+
+    // The tag names the variant, so a tag for another one does not match
+    snprintf(what, sizeof(what), "%s revalidation", cases[i].path);
+    check(request(fd, "GET", cases[i].path, cases[i].accept_encoding, r.etag, &again) && again.status == 304, what);
+    if (*cases[i].expect) {
+      check(request(fd, "GET", cases[i].path, NULL, r.etag, &again) && again.status == 200, what);
+    }
+  }
+
+  struct response head, get;
+  check(request(fd, "HEAD", "/css/style.css", "gzip", "", &head) && head.status == 200 && head.body.empty() &&
+            request(fd, "GET", "/css/style.css", "gzip", "", &get) && get.etag == head.etag,
+        "HEAD of a cached file");
+
+  close(fd);
+  server_stop(&s);
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-t seconds]\n"
+         "  -t seconds  time to run each benchmark (default 0.5)\n",
+         name);
+}
+
+int main(int argc, char **argv) {
+  char dir[] = "/tmp/oobe-bench-XXXXXX";
+  struct asset_cache *assets;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:h")) != -1) {
+    switch (opt) {
+      case 't':
+        bench_seconds = atof(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  mg_log_set(MG_LL_NONE);
+
+  if (mkdtemp(dir) == NULL || rmdir(dir) != 0 || !precompress(OOBE_WEB_DIR, dir)) {
+    fprintf(stderr, "Cannot prepare %s\n", dir);
+    return 1;
+  }
+
+  assets = asset_cache_load(dir, 256 * 1024);
+  printf("cache: %lu files, %lu bytes with variants\n", (unsigned long) asset_cache_count(assets),
+         (unsigned long) asset_cache_bytes(assets));
+
+  test_negotiation(assets);
+
+  printf("\n%-16s %23s %23s\n", "", "cold load", "revalidation");
+  printf("%-16s %10s %12s %10s %12s\n", "served from", "bytes", "server us", "bytes", "server us");
+  run("disk", OOBE_WEB_DIR, NULL, NULL);
+  run("disk, .gz", dir, NULL, "Vary: Accept-Encoding\r\n");
+  run("memory", dir, assets, "Vary: Accept-Encoding\r\n");
+
+  asset_cache_free(assets);
+  nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+  printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+  return failures ? 1 : 0;
+}
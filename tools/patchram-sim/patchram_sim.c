@@ -0,0 +1,523 @@
+/* patchram-sim - brcm_patchram_plus against an emulated controller
+ *
+ * Runs the host build of solutions/brcm-patchram-plus on the slave side
+ * of a pseudo-terminal and plays a Broadcom controller on the master
+ * side. The controller keeps its own baud rate and compares it with the
+ * rate the tool has set on the terminal: bytes sent while the two differ
+ * are garbled, as on a real UART. Wire time at the current rate and a
+ * processing time per command are added before every event, so the
+ * timings reported by the tool are those of a real link.
+ *
+ * The controller checks the command sequence: the minidriver before any
+ * Write_RAM, the Write_RAM records of the HCD file in order and unchanged,
+ * Launch_RAM last, and an HCI Reset at 115200 once the new firmware has
+ * booted. It reports Num_HCI_Command_Packets from a fixed window and
+ * counts every command that arrives when the window is full.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OP_RESET 0x0c03
+#define OP_READ_LOCAL_VERSION 0x1001
+#define OP_UPDATE_BAUD_RATE 0xfc18
+#define OP_DOWNLOAD_MINIDRIVER 0xfc2e
+#define OP_WRITE_RAM 0xfc4c
+#define OP_LAUNCH_RAM 0xfc4e
+
+#define MAX_PENDING 64
+#define MAX_LOG 65536
+
+typedef struct scenario {
+    const char* name;
+    const char* args;   // Options before --patchram
+    int window;         // Num_HCI_Command_Packets
+    int max_baud;       // Above this, Update_Baud_Rate fails
+    int broken_baud;    // At this rate the controller's output is lost
+    int expect_baud;    // Rate of the download
+    int fail_record;    // This Write_RAM and those after it fail, 0 for none
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "legacy", "--no2bytes", 1, 4000000, 0, 115200 },
+    { "legacy-3M", "--no2bytes --use_baudrate_for_download --baudrate 3000000", 1, 4000000, 0, 3000000 },
+    { "fast", "--no2bytes --fast_download", 1, 4000000, 0, 3000000 },
+    { "fast-ncmd4", "--no2bytes --fast_download", 4, 4000000, 0, 3000000 },
+    { "fast-fallback", "--no2bytes --fast_download", 4, 4000000, 3000000, 2500000 },
+    { "fast-921600", "--no2bytes --fast_download", 4, 921600, 0, 921600 },
+    { "fast-fail", "--no2bytes --fast_download", 4, 4000000, 0, 3000000, 100 },
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static const struct {
+    int baud;
+    speed_t speed;
+} speeds[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+    { 921600, B921600 }, { 1000000, B1000000 }, { 1500000, B1500000 },
+    { 2000000, B2000000 }, { 2500000, B2500000 }, { 3000000, B3000000 },
+    { 3500000, B3500000 }, { 4000000, B4000000 },
+};
+
+typedef struct options {
+    const char* hcd;
+    double scale;       // Of every controller time
+    int proc_us;        // Per command
+    int boot_ms;        // After Launch_RAM
+    int verbose;
+} options_t;
+
+typedef struct command {
+    uint8_t packet[260];
+    int len;
+    int64_t rx_done_us;
+} command_t;
+
+typedef struct controller {
+    const scenario_t* s;
+    const options_t* o;
+    const uint8_t* hcd;
+    int hcd_size;
+    int hcd_pos;        // Next Write_RAM record expected
+    int fd;             // Master side
+    int baud;
+    int minidriver;
+    int launched;
+    int64_t boot_until_us;
+    int reset_after_launch;
+    int download_baud;
+    int records;        // Write_RAM commands received
+    // Host bytes not yet a whole command
+    uint8_t rx[4096 + 260];
+    int rx_len;
+    int64_t rx_free_us;
+    int64_t tx_free_us;
+    command_t pending[MAX_PENDING];
+    int num_pending;
+    int peak_pending;
+    // Counters
+    int commands;
+    int garbled;
+    int ignored;
+    int violations;
+    int errors;
+} controller_t;
+
+static int failures;
+
+static void check(int ok, const char* what, const char* scenario)
+{
+    if (!ok) {
+        printf("FAIL: %s (%s)\n", what, scenario);
+        failures++;
+    }
+}
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int host_baud(int fd)
+{
+    struct termios t;
+    size_t i;
+
+    if (tcgetattr(fd, &t) < 0)
+        return 0;
+    for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        if (speeds[i].speed == cfgetospeed(&t))
+            return speeds[i].baud;
+    }
+    return 0;
+}
+
+static int64_t wire_us(const controller_t* c, int bytes)
+{
+    return (int64_t)(bytes * 10.0 * 1e6 / c->baud * c->o->scale);
+}
+
+static void sequence_error(controller_t* c, const char* what)
+{
+    if (c->o->verbose || c->errors == 0)
+        printf("  sequence: %s\n", what);
+    c->errors++;
+}
+
+// Writes an event, garbled if the host is not at the controller's rate
+static void send_event(controller_t* c, const uint8_t* params, int len)
+{
+    uint8_t buf[260];
+    int i;
+
+    buf[0] = 0x04;
+    buf[1] = 0x0e;
+    buf[2] = (uint8_t)len;
+    memcpy(&buf[3], params, len);
+    if (host_baud(c->fd) != c->baud || c->baud == c->s->broken_baud) {
+        for (i = 0; i < len + 3; i++)
+            buf[i] ^= 0x55;
+    }
+    if (write(c->fd, buf, len + 3) != len + 3)
+        sequence_error(c, "event not written");
+}
+
+static void command_complete(controller_t* c, int opcode, int status, int ncmd)
+{
+    uint8_t params[12] = { (uint8_t)ncmd, (uint8_t)opcode, (uint8_t)(opcode >> 8), (uint8_t)status };
+    int len = 4;
+
+    if (opcode == OP_READ_LOCAL_VERSION && status == 0) {
+        static const uint8_t version[] = { 0x09, 0x00, 0x01, 0x09, 0x0f, 0x00, 0x22, 0x41 };
+
+        memcpy(&params[4], version, sizeof(version));
+        len += sizeof(version);
+    }
+    send_event(c, params, len);
+}
+
+static void handle(controller_t* c, const command_t* cmd, int ncmd)
+{
+    int opcode = cmd->packet[1] | (cmd->packet[2] << 8);
+    const uint8_t* params = &cmd->packet[4];
+    int status = 0;
+    int baud;
+    size_t i;
+
+    c->commands++;
+    switch (opcode) {
+    case OP_RESET:
+        if (c->launched) {
+            if (c->baud != 115200)
+                sequence_error(c, "reset after launch not at 115200");
+            c->reset_after_launch = 1;
+        }
+        break;
+    case OP_UPDATE_BAUD_RATE:
+        baud = params[2] | (params[3] << 8) | (params[4] << 16) | (params[5] << 24);
+        status = 0x12;
+        for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+            if (speeds[i].baud == baud && baud <= c->s->max_baud)
+                status = 0;
+        }
+        // The answer goes out at the old rate
+        command_complete(c, opcode, status, ncmd);
+        if (status == 0)
+            c->baud = baud;
+        return;
+    case OP_DOWNLOAD_MINIDRIVER:
+        if (c->launched)
+            sequence_error(c, "minidriver after launch");
+        c->minidriver = 1;
+        break;
+    case OP_WRITE_RAM:
+    case OP_LAUNCH_RAM:
+        if (!c->minidriver || c->launched) {
+            sequence_error(c, "download outside the minidriver");
+            status = 0x0c;
+            break;
+        }
+        if (c->s->fail_record && ++c->records >= c->s->fail_record) {
+            status = 0x12;
+            break;
+        }
+        if (c->hcd_pos >= c->hcd_size || cmd->len - 1 != 3 + c->hcd[c->hcd_pos + 2]
+            || memcmp(&cmd->packet[1], &c->hcd[c->hcd_pos], cmd->len - 1)) {
+            sequence_error(c, "record out of order or changed");
+            status = 0x12;
+            break;
+        }
+        if (c->hcd_pos == 0)
+            c->download_baud = c->baud;
+        c->hcd_pos += cmd->len - 1;
+        if (opcode == OP_LAUNCH_RAM) {
+            if (c->hcd_pos != c->hcd_size)
+                sequence_error(c, "launch before the last record");
+            command_complete(c, opcode, 0, ncmd);
+            c->launched = 1;
+            c->baud = 115200;
+            c->boot_until_us = now_us() + (int64_t)(c->o->boot_ms * 1000 * c->o->scale);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    command_complete(c, opcode, status, ncmd);
+}
+
+static void receive(controller_t* c, const uint8_t* data, int len)
+{
+    int64_t t = now_us();
+    command_t* cmd;
+    int n;
+
+    if (c->launched && t < c->boot_until_us) {
+        c->ignored += len;
+        return;
+    }
+    if (host_baud(c->fd) != c->baud) {
+        c->garbled += len;
+        c->rx_len = 0;
+        return;
+    }
+
+    memcpy(c->rx + c->rx_len, data, len);
+    c->rx_len += len;
+    for (;;) {
+        for (n = 0; n < c->rx_len && c->rx[n] != 0x01; n++)
+            ;
+        if (n) {
+            c->garbled += n;
+            memmove(c->rx, c->rx + n, c->rx_len - n);
+            c->rx_len -= n;
+        }
+        if (c->rx_len < 4 || c->rx_len < 4 + c->rx[3])
+            break;
+
+        n = 4 + c->rx[3];
+        if (c->num_pending >= c->s->window)
+            c->violations++;
+        if (c->num_pending == MAX_PENDING) {
+            sequence_error(c, "command queue overflow");
+        } else {
+            cmd = &c->pending[c->num_pending++];
+            memcpy(cmd->packet, c->rx, n);
+            cmd->len = n;
+            c->rx_free_us = (c->rx_free_us > t ? c->rx_free_us : t) + wire_us(c, n);
+            cmd->rx_done_us = c->rx_free_us;
+            if (c->num_pending > c->peak_pending)
+                c->peak_pending = c->num_pending;
+        }
+        memmove(c->rx, c->rx + n, c->rx_len - n);
+        c->rx_len -= n;
+    }
+}
+
+static void drain(controller_t* c)
+{
+    uint8_t buf[4096];
+    int n;
+
+    while ((n = (int)read(c->fd, buf, sizeof(buf))) > 0)
+        receive(c, buf, n);
+}
+
+// When the answer to the oldest pending command is on the wire
+static int64_t due_us(const controller_t* c)
+{
+    int64_t t = c->pending[0].rx_done_us > c->tx_free_us ? c->pending[0].rx_done_us : c->tx_free_us;
+
+    return t + (int64_t)(c->o->proc_us * c->o->scale) + wire_us(c, 7);
+}
+
+static int read_file(const char* path, uint8_t** data)
+{
+    struct stat st;
+    FILE* f = fopen(path, "rb");
+    int size = -1;
+
+    if (!f)
+        return -1;
+    if (fstat(fileno(f), &st) == 0 && (*data = malloc(st.st_size + 1)) != NULL)
+        size = (int)fread(*data, 1, st.st_size, f);
+    fclose(f);
+    return size;
+}
+
+static void print_log(const char* log, int all)
+{
+    const char* line = log;
+    const char* end;
+
+    while (*line) {
+        end = strchr(line, '\n');
+        if (!end)
+            end = line + strlen(line);
+        if (all || !strncmp(line, "Download", 8))
+            printf("  %.*s\n", (int)(end - line), line);
+        line = *end ? end + 1 : end;
+    }
+}
+
+static void run(const scenario_t* s, const options_t* o, const uint8_t* hcd, int hcd_size)
+{
+    controller_t c;
+    char cmdline[512];
+    char log[MAX_LOG];
+    int log_len = 0;
+    struct pollfd pfd[2];
+    int out[2];
+    struct timespec ts;
+    int64_t start, t;
+    int status = -1;
+    int ncmd;
+    int master;
+    int host;
+    pid_t pid;
+    int n;
+
+    memset(&c, 0, sizeof(c));
+    c.s = s;
+    c.o = o;
+    c.hcd = hcd;
+    c.hcd_size = hcd_size;
+    c.baud = 115200;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || pipe(out) < 0) {
+        check(0, "pseudo-terminal", s->name);
+        return;
+    }
+    c.fd = master;
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    snprintf(cmdline, sizeof(cmdline), "exec %s %s --patchram %s %s 2>&1", PATCHRAM_BIN, s->args, o->hcd, ptsname(master));
+    start = now_us();
+    pid = fork();
+    if (pid == 0) {
+        dup2(out[1], 1);
+        close(out[0]);
+        execl("/bin/sh", "sh", "-c", cmdline, (char*)NULL);
+        _exit(127);
+    }
+    close(out[1]);
+
+    pfd[0].fd = master;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = out[0];
+    pfd[1].events = POLLIN;
+    while (pfd[1].fd >= 0) {
+        t = c.num_pending ? due_us(&c) - now_us() : 1000000;
+        if (t < 0)
+            t = 0;
+        ts.tv_sec = t / 1000000;
+        ts.tv_nsec = t % 1000000 * 1000;
+        if (ppoll(pfd, 2, &ts, NULL) < 0 && errno != EINTR)
+            break;
+
+        if (pfd[0].revents & POLLIN)
+            drain(&c);
+        if (pfd[1].revents & (POLLIN | POLLHUP)) {
+            n = (int)read(out[0], log + log_len, MAX_LOG - 1 - log_len);
+            if (n <= 0) {
+                close(out[0]);
+                pfd[1].fd = -1;
+            } else {
+                log_len += n;
+            }
+        }
+
+        while (c.num_pending && now_us() >= due_us(&c)) {
+            // Everything the host has sent counts against the window
+            drain(&c);
+            t = due_us(&c);
+            ncmd = s->window - (c.num_pending - 1);
+            handle(&c, &c.pending[0], ncmd);
+            c.tx_free_us = t;
+            memmove(&c.pending[0], &c.pending[1], --c.num_pending * sizeof(command_t));
+        }
+    }
+    waitpid(pid, &status, 0);
+    t = now_us() - start;
+    log[log_len] = '\0';
+    host = host_baud(master);
+    close(master);
+
+    printf("%-14s %9d %6d %9.0f %8d %8d %8d\n", s->name, c.download_baud, c.peak_pending, t / 1000.0,
+        c.garbled, c.violations, c.errors);
+    print_log(log, o->verbose);
+
+    if (s->fail_record) {
+        // The tool gives up, with both sides back at the initial rate
+        check(WIFEXITED(status) && WEXITSTATUS(status) != 0, "exit status", s->name);
+        check(c.baud == 115200 && host == 115200, "controller and UART back at 115200", s->name);
+        check(c.download_baud == s->expect_baud, "download rate", s->name);
+        check(c.garbled == 0, "no bytes at the wrong rate", s->name);
+        return;
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "exit status", s->name);
+    check(c.hcd_pos == hcd_size && c.launched, "whole file downloaded and launched", s->name);
+    check(c.reset_after_launch, "reset after launch", s->name);
+    check(c.download_baud == s->expect_baud, "download rate", s->name);
+    check(c.garbled == 0, "no bytes at the wrong rate", s->name);
+    check(c.violations == 0, "no commands beyond Num_HCI_Command_Packets", s->name);
+    check(c.errors == 0, "command sequence", s->name);
+}
+
+static void usage(const char* argv0)
+{
+    printf("usage: %s [-f hcd] [-n scenario] [-s scale] [-p us] [-b ms] [-v]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    options_t o = { PATCHRAM_HCD, 1.0, 50, 50, 0 };
+    const char* only = NULL;
+    uint8_t* hcd = NULL;
+    int hcd_size;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:s:p:b:vh")) != -1) {
+        switch (opt) {
+        case 'f':
+            o.hcd = optarg;
+            break;
+        case 'n':
+            only = optarg;
+            break;
+        case 's':
+            o.scale = atof(optarg);
+            break;
+        case 'p':
+            o.proc_us = atoi(optarg);
+            break;
+        case 'b':
+            o.boot_ms = atoi(optarg);
+            break;
+        case 'v':
+            o.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    hcd_size = read_file(o.hcd, &hcd);
+    if (hcd_size <= 0) {
+        fprintf(stderr, "cannot read %s\n", o.hcd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%-14s %9s %6s %9s %8s %8s %8s\n", "scenario", "baud", "peak", "total ms", "garbled", "overrun", "errors");
+    for (i = 0; i < NUM_SCENARIOS; i++) {
+        if (!only || !strcmp(only, scenarios[i].name))
+            run(&scenarios[i], &o, hcd, hcd_size);
+    }
+
+    free(hcd);
+    if (failures)
+        printf("%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
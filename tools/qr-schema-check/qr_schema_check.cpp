@@ -0,0 +1,328 @@
+/* qr-schema-check - correctness and speed of the QR payload schemas
+ *
+ * Checks the compiled schema matcher of sscma-qrcode-reader
+ * (solutions/sscma-qrcode-reader/main/schema.cpp) against a plain
+ * reference that tests each constraint on its own with libc: strncmp
+ * for the prefix, strlen for the length, strspn for the charset and
+ * strstr for every token, as the reader did before. Payloads are
+ * generated around what each schema looks for: with and without the
+ * prefix and tokens, with tokens cut short or overlapping, at the length
+ * limits and with bytes outside the charset. Every payload is validated
+ * against every schema. The tool then reports validations per second of
+ * both on payloads the size QR codes carry. Exits non-zero if the two
+ * disagree on any payload, or if a schema never accepts or never rejects.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+
+static int failures = 0;
+static double bench_seconds = 0.5;
+static bool verbose = false;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift32, so that a seed gives the same payloads everywhere
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static unsigned pick(unsigned n) { return rng() % n; }
+
+static bool in_charset(const char *charset, unsigned char c) {
+  size_t n = strlen(charset);
+
+  for (size_t i = 0; i < n; i++) {
+    if (i + 2 < n && charset[i + 1] == '-') {
+      if ((unsigned char) charset[i] <= c && c <= (unsigned char) charset[i + 2]) {
+        return true;
+      }
+      i += 2;
+    } else if ((unsigned char) charset[i] == c) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A charset's bytes spelled out, for strspn()
+static const char *charset_bytes(const SchemaRule *rule) {
+  static std::map<const SchemaRule *, std::string> bytes;
+  std::string &s = bytes[rule];
+
+  if (s.empty()) {
+    for (int c = 1; c < 256; c++) {
+      if (in_charset(rule->charset, c)) {
+        s.append(1, (char) c);
+      }
+    }
+  }
+  return s.c_str();
+}
+
+static bool reference_validate(const char *data, const SchemaRule *rule) {
+  if (!data || !*data) {
+    return false;
+  }
+  if (!rule) {
+    return true;
+  }
+
+  size_t len = strlen(data);
+  if (rule->prefix && strncmp(data, rule->prefix, strlen(rule->prefix)) != 0) {
+    return false;
+  }
+  if (len < rule->min_len || (rule->max_len && len > rule->max_len)) {
+    return false;
+  }
+  if (rule->charset && strspn(data, charset_bytes(rule)) != len) {
+    return false;
+  }
+  for (int i = 0; i < SCHEMA_MAX_TOKENS && rule->tokens[i]; i++) {
+    if (!strstr(data, rule->tokens[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Filler bytes: mostly those a schema allows, sometimes any byte but NUL
+static void append_filler(std::string *s, const SchemaRule *rule, size_t n) {
+  static const char json[] = "{}[]:,\" abcdefghijklmnopqrstuvwxyz0123456789_-";
+
+  for (size_t i = 0; i < n; i++) {
+    unsigned r = pick(100);
+    char c;
+
+    if (r < 2) {
+      c = (char) (1 + pick(255));
+    } else if (r < 50 && rule->charset) {
+      do {
+        c = (char) (1 + pick(127));
+      } while (!in_charset(rule->charset, c));
+    } else if (r < 75) {
+      c = json[pick(sizeof(json) - 1)];
+    } else {
+      c = (char) (' ' + pick(95));
+    }
+    s->append(1, c);
+  }
+}
+
+// A payload aimed at one schema, which may or may not meet it
+static std::string make_payload(const SchemaRule *rule, const SchemaRule *rules, size_t num_rules) {
+  std::string s;
+
+  if (rule->prefix) {
+    unsigned r = pick(8);
+    if (r < 6) {
+      s = rule->prefix;
+    } else if (r == 6) {
+      s.assign(rule->prefix, 1 + pick(strlen(rule->prefix)));
+    }
+  }
+
+  // Tokens of this schema, whole or cut short, with some from the others
+  // and some overlapping themselves, e.g. "\"ty\"type\""
+  unsigned parts = pick(6);
+  for (unsigned i = 0; i < parts; i++) {
+    const SchemaRule *from = pick(3) ? rule : &rules[pick(num_rules)];
+    int n = 0;
+    while (n < SCHEMA_MAX_TOKENS && from->tokens[n]) {
+      n++;
+    }
+    append_filler(&s, rule, pick(4) ? pick(12) : pick(200));
+    if (!n) {
+      continue;
+    }
+
+    const char *token = from->tokens[pick(n)];
+    size_t len = strlen(token);
+    switch (pick(5)) {
+      case 0:
+        s.append(token, 1 + pick(len));
+        break;
+      case 1:
+        s.append(token, 1 + pick(len));
+        s.append(token);
+        break;
+      default:
+        s.append(token);
+        break;
+    }
+  }
+
+  // Pad or cut to around the length limits now and then
+  size_t target = 0;
+  switch (pick(6)) {
+    case 0:
+      target = rule->min_len ? rule->min_len + pick(3) - 1 : 0;
+      break;
+    case 1:
+      target = rule->max_len ? rule->max_len + pick(3) - 1 : 0;
+      break;
+    case 2:
+      target = s.size() + pick(3000);
+      break;
+  }
+  if (target > s.size()) {
+    append_filler(&s, rule, target - s.size());
+  } else if (target && target < s.size() && pick(2)) {
+    s.resize(target);
+  }
+  return s;
+}
+
+static void check_payloads(unsigned count) {
+  size_t num_rules;
+  const SchemaRule *rules = schema_rules(&num_rules);
+  std::vector<unsigned> accepted(num_rules), rejected(num_rules);
+  unsigned mismatches = 0;
+
+  if (reference_validate("", NULL) || schema_validate("", NULL) || !schema_validate("x", NULL)) {
+    printf("FAIL: payloads without a schema\n");
+    failures++;
+  }
+
+  for (unsigned n = 0; n < count; n++) {
+    std::string payload = make_payload(&rules[n % num_rules], rules, num_rules);
+
+    if (verbose && n < 20) {
+      printf("\"%.80s%s\" (%zu bytes):", payload.c_str(), payload.size() > 80 ? "..." : "", payload.size());
+    }
+    for (size_t i = 0; i < num_rules; i++) {
+      bool expected = reference_validate(payload.c_str(), &rules[i]);
+      bool valid = schema_validate(payload.c_str(), &rules[i]);
+
+      if (verbose && n < 20 && valid) {
+        printf(" %s", rules[i].name);
+      }
+      (expected ? accepted : rejected)[i]++;
+      if (valid != expected) {
+        if (mismatches++ < 10) {
+          printf("FAIL: %s %s \"%.80s%s\" (%zu bytes)\n", rules[i].name, valid ? "accepts" : "rejects",
+                 payload.c_str(), payload.size() > 80 ? "..." : "", payload.size());
+        }
+      }
+    }
+    if (verbose && n < 20) {
+      printf("\n");
+    }
+  }
+
+  printf("%-18s %10s %10s\n", "schema", "accepted", "rejected");
+  for (size_t i = 0; i < num_rules; i++) {
+    printf("%-18s %10u %10u\n", rules[i].name, accepted[i], rejected[i]);
+    if (!accepted[i] || !rejected[i]) {
+      printf("FAIL: %s never %s a payload\n", rules[i].name, accepted[i] ? "rejects" : "accepts");
+      failures++;
+    }
+  }
+  if (mismatches) {
+    printf("FAIL: %u of %u validations differ from the reference\n", mismatches, count * (unsigned) num_rules);
+    failures++;
+  }
+}
+
+// Validations per second of one schema over a set of payloads
+static double rate(bool (*validate)(const char *, const SchemaRule *), const SchemaRule *rule,
+                   const std::vector<std::string> &payloads) {
+  volatile unsigned valid = 0;
+  unsigned long done = 0;
+  double start = now(), elapsed;
+
+  do {
+    for (const std::string &payload : payloads) {
+      valid += validate(payload.c_str(), rule);
+    }
+    done += payloads.size();
+    elapsed = now() - start;
+  } while (elapsed < bench_seconds);
+  return done / elapsed;
+}
+
+static void bench(void) {
+  size_t num_rules;
+  const SchemaRule *rules = schema_rules(&num_rules);
+
+  printf("\n%-18s %7s %14s %14s %8s\n", "schema", "bytes", "reference/s", "compiled/s", "speedup");
+  for (size_t i = 0; i < num_rules; i++) {
+    // Payloads a QR code of version 10 to 25 holds, as the reader sees them
+    std::vector<std::string> payloads;
+    size_t bytes = 0;
+    for (int n = 0; n < 256; n++) {
+      std::string payload = make_payload(&rules[i], rules, num_rules);
+      size_t max = 150 + pick(900);
+      if (payload.size() > max) {
+        payload.resize(max);
+      }
+      bytes += payload.size();
+      payloads.push_back(payload);
+    }
+
+    double ref = rate(reference_validate, &rules[i], payloads);
+    double compiled = rate(schema_validate, &rules[i], payloads);
+    printf("%-18s %7zu %14.0f %14.0f %7.1fx\n", rules[i].name, bytes / payloads.size(), ref, compiled,
+           compiled / ref);
+  }
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-n count] [-s seed] [-t seconds] [-v]\n", name);
+  printf("  -n count    Payloads to check (default: 200000)\n");
+  printf("  -s seed     Seed of the payloads (default: 1)\n");
+  printf("  -t seconds  Time to run each benchmark, 0 to skip them (default: 0.5)\n");
+  printf("  -v          Print the validations of the first payloads\n");
+}
+
+int main(int argc, char **argv) {
+  unsigned count = 200000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:t:vh")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        rng_state = strtoul(optarg, NULL, 10) ?: 1;
+        break;
+      case 't':
+        bench_seconds = atof(optarg);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  schema_compile();
+  check_payloads(count);
+  if (bench_seconds > 0) {
+    bench();
+  }
+
+  printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+  return failures ? 1 : 0;
+}
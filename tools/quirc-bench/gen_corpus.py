@@ -0,0 +1,338 @@
+#!/usr/bin/env python3
+"""Generate a synthetic QR-code corpus for quirc-bench.
+
+Each test condition gets its own directory of 8-bit PGM images. The
+expected payloads are recorded in the PGM header comments, where
+quirc-bench picks them up to compute detection rates. Every image is
+derived only from the seed, the set name and its index, so the corpus
+can be regenerated exactly without shipping any image data.
+
+Requires the pure-Python "qrcode" package (pip install qrcode).
+"""
+
+import os
+import math
+import random
+import argparse
+
+import qrcode
+from qrcode.constants import (ERROR_CORRECT_L, ERROR_CORRECT_M,
+                              ERROR_CORRECT_Q, ERROR_CORRECT_H)
+
+# Which distortions each set applies
+SETS = {
+    'clean':       {},
+    'rotation':    {'rotate': True},
+    'perspective': {'perspective': True},
+    'blur':        {'blur': True},
+    'noise':       {'noise': True},
+    'lighting':    {'lighting': True},
+    'multi':       {'multi': True, 'rotate': True},
+    'mixed':       {'rotate': True, 'perspective': True, 'blur': True,
+                    'noise': True, 'lighting': True, 'multi': True,
+                    'clutter': True},
+    'empty':       {'empty': True, 'clutter': True, 'noise': True,
+                    'lighting': True},
+}
+
+ECC_LEVELS = [ERROR_CORRECT_L, ERROR_CORRECT_M, ERROR_CORRECT_Q,
+              ERROR_CORRECT_H]
+
+PAYLOAD_CHARS = 'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789'
+
+# Samples per pixel along each axis when rendering codes
+SUPERSAMPLE = 3
+
+
+def args_parser():
+    parser = argparse.ArgumentParser(
+        description='Generate a reproducible synthetic QR-code corpus.')
+
+    parser.add_argument('output', type=str,
+                        help='Directory to write the corpus into.')
+    parser.add_argument('--count', type=int, default=20,
+                        help='Images per set (default: 20).')
+    parser.add_argument('--seed', type=int, default=1,
+                        help='Random seed (default: 1).')
+    parser.add_argument('--size', type=str, default='640x480',
+                        help='Image size as WxH (default: 640x480).')
+    parser.add_argument('--sets', type=lambda x: x.split(','),
+                        default=list(SETS),
+                        help='Comma-separated sets to generate '
+                             '(default: %s).' % ','.join(SETS))
+
+    return parser.parse_args()
+
+
+def solve(a, b):
+    """Solve the linear system a.x = b by Gaussian elimination."""
+    n = len(b)
+    m = [row[:] + [b[i]] for i, row in enumerate(a)]
+
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(m[r][col]))
+        m[col], m[pivot] = m[pivot], m[col]
+
+        for r in range(n):
+            if r != col:
+                f = m[r][col] / m[col][col]
+                m[r] = [x - f * y for x, y in zip(m[r], m[col])]
+
+    return [m[i][n] / m[i][i] for i in range(n)]
+
+
+def homography(corners):
+    """Return the homography taking the unit square to corners, given
+    clockwise from the top left, as a 3x3 row-major list.
+    """
+    square = [(0, 0), (1, 0), (1, 1), (0, 1)]
+    a = []
+    b = []
+
+    for (u, v), (x, y) in zip(square, corners):
+        a.append([u, v, 1, 0, 0, 0, -u * x, -v * x])
+        a.append([0, 0, 0, u, v, 1, -u * y, -v * y])
+        b += [x, y]
+
+    return solve(a, b) + [1.0]
+
+
+def invert(h):
+    a, b, c, d, e, f, g, i, j = h
+    det = a * (e * j - f * i) - b * (d * j - f * g) + c * (d * i - e * g)
+
+    return [(e * j - f * i) / det, (c * i - b * j) / det,
+            (b * f - c * e) / det, (f * g - d * j) / det,
+            (a * j - c * g) / det, (c * d - a * f) / det,
+            (d * i - e * g) / det, (b * g - a * i) / det,
+            (a * e - b * d) / det]
+
+
+def make_payload(rng, name, index, k):
+    length = rng.choice([4, 16, 40, 80, 150])
+    text = ''.join(rng.choice(PAYLOAD_CHARS) for _ in range(length))
+
+    return '%s-%04d-%d-%s' % (name, index, k, text)
+
+
+def make_matrix(payload, ecc):
+    code = qrcode.QRCode(error_correction=ecc, border=4)
+    code.add_data(payload)
+    code.make(fit=True)
+
+    return code.get_matrix()
+
+
+def place_code(rng, conf, n, cell):
+    """Choose the image corners of an n-module code (quiet zone
+    included) within cell = (x0, y0, x1, y1), or return None if it
+    cannot fit at a readable module size.
+    """
+    x0, y0, x1, y1 = cell
+    room = min(x1 - x0, y1 - y0)
+
+    # Leave space for rotation and perspective to spread the corners
+    spread = 1.0
+    if conf.get('rotate'):
+        spread *= math.sqrt(2)
+    if conf.get('perspective'):
+        spread *= 1.3
+
+    max_module = min(8.0, room / (n * spread))
+    if max_module < 2.5:
+        return None
+
+    module = rng.uniform(2.5, max_module)
+    half = n * module / 2
+    angle = rng.uniform(0, 2 * math.pi) if conf.get('rotate') else 0.0
+
+    reach = half * spread
+    cx = rng.uniform(x0 + reach, x1 - reach)
+    cy = rng.uniform(y0 + reach, y1 - reach)
+
+    corners = []
+    for du, dv in [(-1, -1), (1, -1), (1, 1), (-1, 1)]:
+        if conf.get('perspective'):
+            du *= rng.uniform(0.8, 1.2)
+            dv *= rng.uniform(0.8, 1.2)
+
+        x = du * half * math.cos(angle) - dv * half * math.sin(angle)
+        y = du * half * math.sin(angle) + dv * half * math.cos(angle)
+        corners.append((cx + x, cy + y))
+
+    return corners
+
+
+def draw_code(img, w, h, matrix, corners, ink, paper):
+    n = len(matrix)
+    hinv = invert(homography(corners))
+    xs = [x for x, _ in corners]
+    ys = [y for _, y in corners]
+    offsets = [(i + 0.5) / SUPERSAMPLE for i in range(SUPERSAMPLE)]
+    weight = 1.0 / (SUPERSAMPLE * SUPERSAMPLE)
+
+    for y in range(max(0, int(min(ys))), min(h, int(max(ys)) + 2)):
+        for x in range(max(0, int(min(xs))), min(w, int(max(xs)) + 2)):
+            covered = 0
+            total = 0.0
+
+            for oy in offsets:
+                for ox in offsets:
+                    px = x + ox
+                    py = y + oy
+                    d = hinv[6] * px + hinv[7] * py + hinv[8]
+                    u = (hinv[0] * px + hinv[1] * py + hinv[2]) / d
+                    v = (hinv[3] * px + hinv[4] * py + hinv[5]) / d
+
+                    if 0 <= u < 1 and 0 <= v < 1:
+                        covered += 1
+                        total += ink if matrix[int(v * n)][int(u * n)] \
+                            else paper
+
+            if covered:
+                i = y * w + x
+                img[i] = total * weight + img[i] * (1 - covered * weight)
+
+
+def draw_clutter(rng, img, w, h):
+    """Scatter rectangles and stripes over the background, to give the
+    finder pattern search something to reject.
+    """
+    for _ in range(rng.randint(5, 20)):
+        rw = rng.randint(4, w // 4)
+        rh = rng.randint(4, h // 4)
+        rx = rng.randint(0, w - rw)
+        ry = rng.randint(0, h - rh)
+        level = rng.uniform(0, 255)
+        stripe = rng.choice([0, 0, rng.randint(2, 12)])
+
+        for y in range(ry, ry + rh):
+            for x in range(rx, rx + rw):
+                if not stripe or (x // stripe) % 2:
+                    img[y * w + x] = level
+
+
+def box_blur_line(line, r):
+    k = 2 * r + 1
+    ext = [line[0]] * r + line + [line[-1]] * r
+    sums = [0.0]
+    for v in ext:
+        sums.append(sums[-1] + v)
+
+    return [(sums[i + k] - sums[i]) / k for i in range(len(line))]
+
+
+def blur(img, w, h, r):
+    """Approximate a Gaussian blur with three box blur passes."""
+    for _ in range(3):
+        for y in range(h):
+            img[y * w:(y + 1) * w] = box_blur_line(img[y * w:(y + 1) * w], r)
+        for x in range(w):
+            img[x::w] = box_blur_line(img[x::w], r)
+
+
+def light(rng, img, w, h):
+    """Apply a linear lighting gradient with a soft spot of glare."""
+    angle = rng.uniform(0, 2 * math.pi)
+    depth = rng.uniform(0.4, 0.8)
+    gx = math.cos(angle) / w
+    gy = math.sin(angle) / h
+    sx = rng.uniform(0, w)
+    sy = rng.uniform(0, h)
+    spot = rng.uniform(0, 0.4)
+    radius2 = (rng.uniform(0.1, 0.4) * max(w, h)) ** 2
+
+    for y in range(h):
+        for x in range(w):
+            t = 0.5 + (x - w / 2) * gx + (y - h / 2) * gy
+            d2 = (x - sx) ** 2 + (y - sy) ** 2
+            gain = 1.0 - depth * t + spot * math.exp(-d2 / radius2)
+            img[y * w + x] *= gain
+
+
+def render(rng, name, index, conf, w, h):
+    """Return the image as a list of floats and its expected payloads."""
+    img = [rng.uniform(80, 170)] * (w * h)
+    payloads = []
+
+    if conf.get('clutter'):
+        draw_clutter(rng, img, w, h)
+
+    if not conf.get('empty'):
+        if conf.get('multi'):
+            cols, rows = rng.choice([(2, 1), (1, 2), (2, 2)])
+        else:
+            cols, rows = 1, 1
+
+        # One code per cell, so that codes never overlap
+        for k in range(cols * rows):
+            cell = ((k % cols) * w // cols, (k // cols) * h // rows,
+                    (k % cols + 1) * w // cols, (k // cols + 1) * h // rows)
+            ecc = rng.choice(ECC_LEVELS)
+
+            # Shorten the payload until the code fits the cell
+            for _ in range(5):
+                payload = make_payload(rng, name, index, k)
+                matrix = make_matrix(payload, ecc)
+                corners = place_code(rng, conf, len(matrix), cell)
+                if corners:
+                    break
+            else:
+                continue
+
+            ink = rng.uniform(0, 60)
+            paper = rng.uniform(190, 255)
+            draw_code(img, w, h, matrix, corners, ink, paper)
+            payloads.append(payload)
+
+    if conf.get('blur'):
+        blur(img, w, h, rng.choice([1, 1, 2]))
+
+    if conf.get('lighting'):
+        light(rng, img, w, h)
+
+    if conf.get('noise'):
+        sigma = rng.uniform(5, 25)
+        img = [v + rng.gauss(0, sigma) for v in img]
+
+    return img, payloads
+
+
+def save_pgm(path, img, w, h, comments):
+    header = 'P5\n'
+    for c in comments:
+        header += '# %s\n' % c
+    header += '%d %d\n255\n' % (w, h)
+
+    data = bytes(min(255, max(0, int(round(v)))) for v in img)
+    with open(path, 'wb') as f:
+        f.write(header.encode('ascii'))
+        f.write(data)
+
+
+def main():
+    args = args_parser()
+    w, h = (int(v) for v in args.size.lower().split('x'))
+
+    for name in args.sets:
+        if name not in SETS:
+            raise SystemExit('unknown set: %s' % name)
+
+        os.makedirs(os.path.join(args.output, name), exist_ok=True)
+
+        for index in range(args.count):
+            rng = random.Random('%d/%s/%d' % (args.seed, name, index))
+            img, payloads = render(rng, name, index, SETS[name], w, h)
+
+            comments = ['quirc-corpus seed=%d set=%s index=%d' %
+                        (args.seed, name, index),
+                        'quirc-expect %d' % len(payloads)]
+            comments += ['quirc-payload %s' % p for p in payloads]
+
+            path = os.path.join(args.output, name, '%04d.pgm' % index)
+            save_pgm(path, img, w, h, comments)
+            print(path)
+
+
+if __name__ == '__main__':
+    main()
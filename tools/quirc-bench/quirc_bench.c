@@ -0,0 +1,1203 @@
+/* quirc-bench - batch QR-code recognition benchmark
+ *
+ * Runs components/quirc over directories of PGM/PPM images on a pool
+ * of worker threads, and reports per-image identify and decode times,
+ * decode errors by type and detection rates as JSON.
+ *
+ * Images written by gen_corpus.py carry their expected payloads in
+ * header comments:
+ *
+ *     # quirc-expect <count>
+ *     # quirc-payload <text>
+ *
+ * Detection rates are computed over images which have a quirc-expect
+ * line; other images only contribute timings and decode counts.
+ *
+ * With -C, every image is scanned again by a reference decoder (one
+ * thread, unpadded rows, grids sampled in floating point, otherwise the
+ * same settings) and images whose binarised frame or codes differ are
+ * counted as mismatched.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <quirc.h>
+
+/* For the binarised frame, compared with -C, and the reference's
+ * floating-point sampling
+ */
+#include "quirc_internal.h"
+
+#define NUM_DECODE_ERRORS	(QUIRC_ERROR_DATA_UNDERFLOW + 1)
+
+/* JSON keys for quirc_decode_error_t, by value */
+static const char *const error_keys[NUM_DECODE_ERRORS] = {
+	[QUIRC_SUCCESS]			= "success",
+	[QUIRC_ERROR_INVALID_GRID_SIZE]	= "invalid_grid_size",
+	[QUIRC_ERROR_INVALID_VERSION]	= "invalid_version",
+	[QUIRC_ERROR_FORMAT_ECC]	= "format_ecc",
+	[QUIRC_ERROR_DATA_ECC]		= "data_ecc",
+	[QUIRC_ERROR_UNKNOWN_DATA_TYPE]	= "unknown_data_type",
+	[QUIRC_ERROR_DATA_OVERFLOW]	= "data_overflow",
+	[QUIRC_ERROR_DATA_UNDERFLOW]	= "data_underflow",
+};
+
+struct options {
+	int			jobs;
+	int			repeat;
+	quirc_threshold_t	threshold;
+	int			pyramid;
+	int			min_module;
+	int			threads;
+	int			pad;
+	int			compare;
+	int			verbose;
+};
+
+/* A payload, either expected or decoded. Payloads may hold any bytes. */
+struct payload {
+	char			*data;
+	int			len;
+};
+
+struct payload_list {
+	struct payload		*items;
+	int			count;
+	int			alloc;
+};
+
+struct image {
+	const char		*path;
+
+	int			w;
+	int			h;
+	uint8_t			*luma;
+
+	/* expect is -1 if the image has no quirc-expect line */
+	int			expect;
+	struct payload_list	expected;
+};
+
+struct result {
+	int			load_failed;
+	int			w;
+	int			h;
+
+	/* Fastest of the repeated runs */
+	double			identify_ms;
+	double			decode_ms;
+
+	int			grids;
+	int			decoded;
+	int			errors[NUM_DECODE_ERRORS];
+
+	int			expect;
+	int			matched;
+	struct payload_list	payloads;
+
+	/* Differs from the reference decoder (-C) */
+	int			mismatch;
+};
+
+/* Accumulated figures for a set of images (a directory), or all of
+ * them.
+ */
+struct summary {
+	const char		*name;
+
+	int			images;
+	int			load_failed;
+	int			annotated;
+
+	int			expected;
+	int			matched;
+	int			unexpected;
+	int			grids;
+	int			decoded;
+	int			errors[NUM_DECODE_ERRORS];
+	int			mismatched;
+
+	double			*identify_ms;
+	double			*decode_ms;
+	int			num_times;
+};
+
+struct bench {
+	const struct options	*opt;
+
+	char			**paths;
+	int			num_paths;
+	struct result		*results;
+
+	pthread_mutex_t		lock;
+	int			next;
+};
+
+/************************************************************************
+ * Helpers
+ */
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int payload_add(struct payload_list *list, const void *data, int len)
+{
+	struct payload *p;
+
+	if (list->count >= list->alloc) {
+		int alloc = list->alloc ? list->alloc * 2 : 4;
+		struct payload *items = realloc(list->items,
+						alloc * sizeof(*items));
+
+		if (!items)
+			return -1;
+
+		list->items = items;
+		list->alloc = alloc;
+	}
+
+	p = &list->items[list->count];
+	p->data = malloc(len + 1);
+	if (!p->data)
+		return -1;
+
+	memcpy(p->data, data, len);
+	p->data[len] = 0;
+	p->len = len;
+	list->count++;
+	return 0;
+}
+
+static void payload_free(struct payload_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->count; i++)
+		free(list->items[i].data);
+
+	free(list->items);
+	memset(list, 0, sizeof(*list));
+}
+
+/* Return the name of the directory holding path, which is used to
+ * group results by test condition.
+ */
+static char *set_name(const char *path)
+{
+	const char *end = strrchr(path, '/');
+	const char *start;
+
+	if (!end)
+		return strdup(".");
+
+	start = end;
+	while (start > path && start[-1] != '/')
+		start--;
+
+	if (start == end)
+		return strdup("/");
+
+	return strndup(start, end - start);
+}
+
+/************************************************************************
+ * PGM/PPM loading
+ */
+
+/* Parse a header comment, picking out the annotations written by
+ * gen_corpus.py.
+ */
+static int parse_comment(struct image *img, const char *text)
+{
+	static const char expect_tag[] = "quirc-expect ";
+	static const char payload_tag[] = "quirc-payload ";
+
+	if (!strncmp(text, expect_tag, sizeof(expect_tag) - 1)) {
+		img->expect = atoi(text + sizeof(expect_tag) - 1);
+		return 0;
+	}
+
+	if (!strncmp(text, payload_tag, sizeof(payload_tag) - 1)) {
+		const char *p = text + sizeof(payload_tag) - 1;
+
+		return payload_add(&img->expected, p, strlen(p));
+	}
+
+	return 0;
+}
+
+/* Read the next whitespace-separated header field, handling comments
+ * between fields. Returns -1 on a malformed header.
+ */
+static int read_field(FILE *in, struct image *img, int *value)
+{
+	char comment[1024];
+	int c;
+
+	for (;;) {
+		c = fgetc(in);
+
+		if (c == '#') {
+			int len = 0;
+
+			while ((c = fgetc(in)) != EOF && c != '\n')
+				if (len < (int)sizeof(comment) - 1)
+					comment[len++] = c;
+
+			comment[len] = 0;
+			if (parse_comment(img, comment[0] == ' ' ?
+					  comment + 1 : comment) < 0)
+				return -1;
+		} else if (!isspace(c)) {
+			break;
+		}
+	}
+
+	if (!isdigit(c))
+		return -1;
+
+	*value = 0;
+	while (isdigit(c)) {
+		if (*value > 100000)
+			return -1;
+
+		*value = *value * 10 + c - '0';
+		c = fgetc(in);
+	}
+
+	/* A single whitespace character separates the header and data */
+	return isspace(c) ? 0 : -1;
+}
+
+static int load_image(struct image *img)
+{
+	FILE *in = fopen(img->path, "rb");
+	int maxval;
+	int channels;
+	size_t size;
+	uint8_t *raw = NULL;
+	size_t i;
+	char magic[2];
+
+	if (!in)
+		return -1;
+
+	if (fread(magic, 1, 2, in) != 2 || magic[0] != 'P')
+		goto fail;
+
+	if (magic[1] == '5')
+		channels = 1;
+	else if (magic[1] == '6')
+		channels = 3;
+	else
+		goto fail;
+
+	if (read_field(in, img, &img->w) < 0 ||
+	    read_field(in, img, &img->h) < 0 ||
+	    read_field(in, img, &maxval) < 0)
+		goto fail;
+
+	if (img->w < 1 || img->h < 1 || maxval < 1 || maxval > 255)
+		goto fail;
+
+	size = (size_t)img->w * img->h;
+	img->luma = malloc(size);
+	raw = channels > 1 ? malloc(size * channels) : img->luma;
+	if (!img->luma || !raw)
+		goto fail;
+
+	if (fread(raw, channels, size, in) != size)
+		goto fail;
+
+	/* BT.601 luma */
+	if (channels > 1)
+		for (i = 0; i < size; i++) {
+			const uint8_t *px = raw + i * 3;
+
+			img->luma[i] = (77 * px[0] + 150 * px[1] +
+					29 * px[2]) >> 8;
+		}
+
+	if (maxval != 255)
+		for (i = 0; i < size; i++)
+			img->luma[i] = img->luma[i] >= maxval ? 255 :
+				img->luma[i] * 255 / maxval;
+
+	if (raw != img->luma)
+		free(raw);
+
+	fclose(in);
+	return 0;
+
+fail:
+	if (raw != img->luma)
+		free(raw);
+
+	free(img->luma);
+	img->luma = NULL;
+	fclose(in);
+	return -1;
+}
+
+/************************************************************************
+ * Collecting input files
+ */
+
+struct path_list {
+	char			**items;
+	int			count;
+	int			alloc;
+};
+
+static int path_add(struct path_list *list, const char *path)
+{
+	if (list->count >= list->alloc) {
+		int alloc = list->alloc ? list->alloc * 2 : 64;
+		char **items = realloc(list->items, alloc * sizeof(*items));
+
+		if (!items)
+			return -1;
+
+		list->items = items;
+		list->alloc = alloc;
+	}
+
+	list->items[list->count] = strdup(path);
+	if (!list->items[list->count])
+		return -1;
+
+	list->count++;
+	return 0;
+}
+
+static int is_image_name(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	return ext && (!strcasecmp(ext, ".pgm") || !strcasecmp(ext, ".ppm"));
+}
+
+static int collect(struct path_list *list, const char *path, int top)
+{
+	struct stat st;
+	DIR *dir;
+	struct dirent *ent;
+	int ret = 0;
+
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return top ? -1 : 0;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		if (top || is_image_name(path))
+			return path_add(list, path);
+
+		return 0;
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (!ret && (ent = readdir(dir))) {
+		char *child;
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		child = malloc(strlen(path) + strlen(ent->d_name) + 2);
+		if (!child) {
+			ret = -1;
+			break;
+		}
+
+		sprintf(child, "%s/%s", path, ent->d_name);
+		ret = collect(list, child, 0);
+		free(child);
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/************************************************************************
+ * Recognition
+ */
+
+static struct quirc *new_decoder(const struct options *opt)
+{
+	struct quirc *q = quirc_new();
+
+	if (!q)
+		return NULL;
+
+	if (quirc_set_threshold(q, opt->threshold) < 0 ||
+	    quirc_set_pyramid(q, opt->pyramid, opt->min_module) < 0 ||
+	    quirc_set_threads(q, opt->threads) < 0) {
+		quirc_destroy(q);
+		return NULL;
+	}
+
+	return q;
+}
+
+/* Count decoded payloads against the expected ones, each of which may
+ * be matched once.
+ */
+static int match_payloads(const struct payload_list *expected,
+			  const struct payload_list *decoded)
+{
+	char used[expected->count + 1];
+	int matched = 0;
+	int i, j;
+
+	memset(used, 0, sizeof(used));
+
+	for (i = 0; i < decoded->count; i++)
+		for (j = 0; j < expected->count; j++) {
+			const struct payload *e = &expected->items[j];
+			const struct payload *d = &decoded->items[i];
+
+			if (!used[j] && e->len == d->len &&
+			    !memcmp(e->data, d->data, d->len)) {
+				used[j] = 1;
+				matched++;
+				break;
+			}
+		}
+
+	return matched;
+}
+
+/* Copy the image into rows of w + pad bytes. The padding is filled
+ * with a pattern, so a scan that reads it gives different results.
+ */
+static uint8_t *pad_image(const struct image *img, int pad)
+{
+	const int stride = img->w + pad;
+	uint8_t *buf = malloc((size_t)stride * img->h);
+	int y, x;
+
+	if (!buf)
+		return NULL;
+
+	for (y = 0; y < img->h; y++) {
+		uint8_t *row = buf + (size_t)y * stride;
+
+		memcpy(row, img->luma + (size_t)y * img->w, img->w);
+		for (x = img->w; x < stride; x++)
+			row[x] = (x ^ y) & 1 ? 0 : 255;
+	}
+
+	return buf;
+}
+
+/* Scan the image again with the reference decoder and compare its
+ * binarised frame and codes with those of q. Returns nonzero if they
+ * differ.
+ */
+static int compare_reference(struct quirc *q, struct quirc *ref,
+			     const struct image *img)
+{
+	int count = quirc_count(q);
+	int i;
+
+	if (quirc_set_image(ref, img->luma, img->w, img->h, img->w) < 0)
+		return 1;
+
+	quirc_end(ref);
+
+	/* Thresholding differences often don't change the codes found */
+	if (q->h != ref->h || q->bitmap_stride != ref->bitmap_stride ||
+	    memcmp(q->bitmap, ref->bitmap,
+		   (size_t)q->bitmap_stride * q->h * sizeof(*q->bitmap)))
+		return 1;
+
+	if (quirc_count(ref) != count)
+		return 1;
+
+	for (i = 0; i < count; i++) {
+		struct quirc_code a, b;
+		struct quirc_data da, db;
+		quirc_decode_error_t ea, eb;
+
+		quirc_extract(q, i, &a);
+		quirc_extract(ref, i, &b);
+		if (a.size != b.size ||
+		    memcmp(a.corners, b.corners, sizeof(a.corners)) ||
+		    memcmp(a.cell_bitmap, b.cell_bitmap, sizeof(a.cell_bitmap)))
+			return 1;
+
+		ea = quirc_decode(&a, &da);
+		eb = quirc_decode(&b, &db);
+		if (ea != eb)
+			return 1;
+
+		if (!ea && (da.payload_len != db.payload_len ||
+			    memcmp(da.payload, db.payload, da.payload_len)))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void process_image(struct quirc *q, struct quirc *ref,
+			  const struct options *opt,
+			  const char *path, struct result *res)
+{
+	struct image img;
+	struct quirc_code *codes = NULL;
+	struct quirc_data *data = NULL;
+	quirc_decode_error_t *errors = NULL;
+	uint8_t *padded = NULL;
+	const uint8_t *luma;
+	int stride;
+	int run;
+	int i;
+
+	memset(&img, 0, sizeof(img));
+	img.path = path;
+	img.expect = -1;
+
+	res->expect = -1;
+	if (load_image(&img) < 0) {
+		res->load_failed = 1;
+		goto out;
+	}
+
+	res->w = img.w;
+	res->h = img.h;
+	res->expect = img.expect;
+
+	luma = img.luma;
+	stride = img.w;
+	if (opt->pad) {
+		padded = pad_image(&img, opt->pad);
+		if (!padded) {
+			res->load_failed = 1;
+			goto out;
+		}
+
+		luma = padded;
+		stride = img.w + opt->pad;
+	}
+
+	for (run = 0; run < opt->repeat; run++) {
+		double start, mid, end;
+		int count;
+
+		if (quirc_set_image(q, luma, img.w, img.h, stride) < 0) {
+			res->load_failed = 1;
+			goto out;
+		}
+
+		start = now_ms();
+		quirc_end(q);
+		mid = now_ms();
+
+		count = quirc_count(q);
+		if (!codes) {
+			codes = calloc(count + 1, sizeof(*codes));
+			data = calloc(count + 1, sizeof(*data));
+			errors = calloc(count + 1, sizeof(*errors));
+			if (!codes || !data || !errors) {
+				res->load_failed = 1;
+				goto out;
+			}
+		}
+
+		quirc_decode_all(q, codes, data, errors);
+		end = now_ms();
+
+		if (!run || mid - start < res->identify_ms)
+			res->identify_ms = mid - start;
+		if (!run || end - mid < res->decode_ms)
+			res->decode_ms = end - mid;
+
+		/* Scans are deterministic, so keep the first run's codes */
+		if (run)
+			continue;
+
+		res->grids = count;
+		for (i = 0; i < count; i++) {
+			res->errors[errors[i]]++;
+
+			if (errors[i])
+				continue;
+
+			res->decoded++;
+			if (payload_add(&res->payloads, data[i].payload,
+					data[i].payload_len) < 0) {
+				res->load_failed = 1;
+				goto out;
+			}
+		}
+	}
+
+	if (res->expect >= 0)
+		res->matched = match_payloads(&img.expected, &res->payloads);
+
+	if (ref)
+		res->mismatch = compare_reference(q, ref, &img);
+
+	if (opt->verbose)
+		fprintf(stderr, "%s: %d/%d decoded, %.3f ms%s\n", path,
+			res->decoded, res->grids,
+			res->identify_ms + res->decode_ms,
+			res->mismatch ? ", differs from reference" : "");
+
+out:
+	free(padded);
+	free(codes);
+	free(data);
+	free(errors);
+	free(img.luma);
+	payload_free(&img.expected);
+}
+
+static void *worker(void *user_data)
+{
+	struct bench *b = (struct bench *)user_data;
+	struct quirc *q = new_decoder(b->opt);
+	struct quirc *ref = NULL;
+
+	if (!q) {
+		fprintf(stderr, "couldn't allocate QR decoder\n");
+		return NULL;
+	}
+
+	if (b->opt->compare) {
+		struct options ref_opt = *b->opt;
+
+		ref_opt.threads = 1;
+		ref = new_decoder(&ref_opt);
+		if (!ref) {
+			fprintf(stderr, "couldn't allocate QR decoder\n");
+			quirc_destroy(q);
+			return NULL;
+		}
+
+		/* Check the fixed-point grid sampler against
+		 * perspective_map() on every sample
+		 */
+		ref->float_sampling = 1;
+	}
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+
+		if (i >= b->num_paths)
+			break;
+
+		process_image(q, ref, b->opt, b->paths[i], &b->results[i]);
+	}
+
+	if (ref)
+		quirc_destroy(ref);
+
+	quirc_destroy(q);
+	return NULL;
+}
+
+/************************************************************************
+ * Summaries
+ */
+
+static int summary_init(struct summary *s, const char *name, int max_images)
+{
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	s->identify_ms = calloc(max_images + 1, sizeof(double));
+	s->decode_ms = calloc(max_images + 1, sizeof(double));
+
+	return s->identify_ms && s->decode_ms ? 0 : -1;
+}
+
+static void summary_free(struct summary *s)
+{
+	free(s->identify_ms);
+	free(s->decode_ms);
+}
+
+static void summary_add(struct summary *s, const struct result *res)
+{
+	int i;
+
+	s->images++;
+	if (res->load_failed) {
+		s->load_failed++;
+		return;
+	}
+
+	s->grids += res->grids;
+	s->decoded += res->decoded;
+	s->mismatched += res->mismatch;
+	for (i = 1; i < NUM_DECODE_ERRORS; i++)
+		s->errors[i] += res->errors[i];
+
+	if (res->expect >= 0) {
+		s->annotated++;
+		s->expected += res->expect;
+		s->matched += res->matched;
+		s->unexpected += res->decoded - res->matched;
+	}
+
+	s->identify_ms[s->num_times] = res->identify_ms;
+	s->decode_ms[s->num_times] = res->decode_ms;
+	s->num_times++;
+}
+
+/************************************************************************
+ * JSON output
+ */
+
+static void json_string(FILE *out, const char *s, int len)
+{
+	int i;
+
+	fputc('"', out);
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void json_rate(FILE *out, int num, int den)
+{
+	if (den)
+		fprintf(out, "%.4f", (double)num / den);
+	else
+		fputs("null", out);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void json_times(FILE *out, double *times, int count)
+{
+	double total = 0;
+	int i;
+
+	if (!count) {
+		fputs("null", out);
+		return;
+	}
+
+	qsort(times, count, sizeof(*times), compare_doubles);
+	for (i = 0; i < count; i++)
+		total += times[i];
+
+	fprintf(out, "{\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, "
+		"\"max\": %.3f, \"total\": %.3f}",
+		total / count, times[count / 2],
+		times[(count * 95 - 1) / 100], times[count - 1], total);
+}
+
+static void json_errors(FILE *out, const int *errors)
+{
+	const char *sep = "";
+	int i;
+
+	fputc('{', out);
+	for (i = 1; i < NUM_DECODE_ERRORS; i++) {
+		if (!errors[i])
+			continue;
+
+		fprintf(out, "%s\"%s\": %d", sep, error_keys[i], errors[i]);
+		sep = ", ";
+	}
+	fputc('}', out);
+}
+
+static void json_summary(FILE *out, struct summary *s, const char *indent)
+{
+	fprintf(out, "{\n%s  \"images\": %d,\n", indent, s->images);
+	fprintf(out, "%s  \"load_failed\": %d,\n", indent, s->load_failed);
+	fprintf(out, "%s  \"annotated\": %d,\n", indent, s->annotated);
+	fprintf(out, "%s  \"expected\": %d,\n", indent, s->expected);
+	fprintf(out, "%s  \"matched\": %d,\n", indent, s->matched);
+	fprintf(out, "%s  \"unexpected\": %d,\n", indent, s->unexpected);
+	fprintf(out, "%s  \"grids\": %d,\n", indent, s->grids);
+	fprintf(out, "%s  \"decoded\": %d,\n", indent, s->decoded);
+	fprintf(out, "%s  \"mismatched\": %d,\n", indent, s->mismatched);
+
+	fprintf(out, "%s  \"detection_rate\": ", indent);
+	json_rate(out, s->matched, s->expected);
+	fprintf(out, ",\n%s  \"decode_rate\": ", indent);
+	json_rate(out, s->decoded, s->grids);
+
+	fprintf(out, ",\n%s  \"errors\": ", indent);
+	json_errors(out, s->errors);
+	fprintf(out, ",\n%s  \"identify_ms\": ", indent);
+	json_times(out, s->identify_ms, s->num_times);
+	fprintf(out, ",\n%s  \"decode_ms\": ", indent);
+	json_times(out, s->decode_ms, s->num_times);
+	fprintf(out, "\n%s}", indent);
+}
+
+static void json_image(FILE *out, const char *path, const char *set,
+		       const struct result *res)
+{
+	int i;
+
+	fputs("    {\"path\": ", out);
+	json_string(out, path, strlen(path));
+	fputs(", \"set\": ", out);
+	json_string(out, set, strlen(set));
+
+	if (res->load_failed) {
+		fputs(", \"load_failed\": true}", out);
+		return;
+	}
+
+	fprintf(out, ", \"width\": %d, \"height\": %d, "
+		"\"identify_ms\": %.3f, \"decode_ms\": %.3f, "
+		"\"grids\": %d, \"decoded\": %d",
+		res->w, res->h, res->identify_ms, res->decode_ms,
+		res->grids, res->decoded);
+
+	if (res->expect >= 0)
+		fprintf(out, ", \"expected\": %d, \"matched\": %d",
+			res->expect, res->matched);
+
+	if (res->mismatch)
+		fputs(", \"mismatch\": true", out);
+
+	fputs(", \"errors\": ", out);
+	json_errors(out, res->errors);
+
+	fputs(", \"payloads\": [", out);
+	for (i = 0; i < res->payloads.count; i++) {
+		if (i)
+			fputs(", ", out);
+
+		json_string(out, res->payloads.items[i].data,
+			    res->payloads.items[i].len);
+	}
+	fputs("]}", out);
+}
+
+/* Returns -1 if the report couldn't be written, or 1 if it was but
+ * some images differed from the reference decoder.
+ */
+static int report(FILE *out, const struct bench *b, double wall_ms)
+{
+	const struct options *opt = b->opt;
+	char **sets;
+	struct summary total;
+	struct summary *per_set;
+	int num_sets = 0;
+	int ret = -1;
+	int i, j;
+
+	sets = calloc(b->num_paths + 1, sizeof(*sets));
+	per_set = calloc(b->num_paths + 1, sizeof(*per_set));
+	if (!sets || !per_set || summary_init(&total, "all",
+					      b->num_paths) < 0)
+		goto out;
+
+	for (i = 0; i < b->num_paths; i++)
+		sets[i] = set_name(b->paths[i]);
+
+	/* Paths are sorted, so each set's images are contiguous */
+	for (i = 0; i < b->num_paths; i++) {
+		if (!num_sets || strcmp(per_set[num_sets - 1].name, sets[i])) {
+			if (summary_init(&per_set[num_sets], sets[i],
+					 b->num_paths) < 0)
+				goto out;
+
+			num_sets++;
+		}
+
+		summary_add(&per_set[num_sets - 1], &b->results[i]);
+		summary_add(&total, &b->results[i]);
+	}
+
+	fprintf(out, "{\n  \"quirc_version\": \"%s\",\n", quirc_version());
+	fprintf(out, "  \"config\": {\"jobs\": %d, \"repeat\": %d, "
+		"\"threshold\": \"%s\", \"pyramid\": %d, "
+		"\"min_module\": %d, \"threads\": %d, \"pad\": %d, "
+		"\"compare\": %s},\n",
+		opt->jobs, opt->repeat,
+		opt->threshold == QUIRC_THRESHOLD_ADAPTIVE ?
+		"adaptive" : "otsu",
+		opt->pyramid, opt->min_module, opt->threads, opt->pad,
+		opt->compare ? "true" : "false");
+	fprintf(out, "  \"wall_ms\": %.3f,\n", wall_ms);
+
+	fputs("  \"images\": [\n", out);
+	for (i = 0; i < b->num_paths; i++) {
+		json_image(out, b->paths[i], sets[i], &b->results[i]);
+		fputs(i + 1 < b->num_paths ? ",\n" : "\n", out);
+	}
+	fputs("  ],\n", out);
+
+	fputs("  \"sets\": {", out);
+	for (i = 0; i < num_sets; i++) {
+		fputs(i ? ",\n    " : "\n    ", out);
+		json_string(out, per_set[i].name, strlen(per_set[i].name));
+		fputs(": ", out);
+		json_summary(out, &per_set[i], "    ");
+	}
+	fputs(num_sets ? "\n  },\n" : "},\n", out);
+
+	fputs("  \"summary\": ", out);
+	json_summary(out, &total, "  ");
+	fputs("\n}\n", out);
+
+	ret = ferror(out) ? -1 : 0;
+	if (!ret && total.mismatched) {
+		fprintf(stderr, "%d images differ from the reference decoder\n",
+			total.mismatched);
+		ret = 1;
+	}
+
+out:
+	for (j = 0; j < num_sets; j++)
+		summary_free(&per_set[j]);
+
+	summary_free(&total);
+	if (sets)
+		for (i = 0; i < b->num_paths; i++)
+			free(sets[i]);
+
+	free(sets);
+	free(per_set);
+	return ret;
+}
+
+/************************************************************************
+ * Command line
+ */
+
+static void usage(const char *progname)
+{
+	printf("Usage: %s [options] <dir|image> ...\n\n"
+	       "Options:\n"
+	       "  -j jobs          Images processed in parallel "
+	       "(default: online CPUs)\n"
+	       "  -r repeat        Runs per image; the fastest is reported "
+	       "(default: 1)\n"
+	       "  -a               Use adaptive thresholding\n"
+	       "  -p factor[:min]  Coarse-to-fine pyramid factor and "
+	       "minimum module size\n"
+	       "  -T threads       Threads per decoder (default: 1)\n"
+	       "  -S pad           Pad each image row by pad bytes\n"
+	       "  -C               Compare with a single-threaded decoder "
+	       "on unpadded rows\n"
+	       "  -o file          Write the JSON report to file\n"
+	       "  -v               Log each image to stderr\n"
+	       "  -h               Show this help\n",
+	       progname);
+}
+
+int main(int argc, char **argv)
+{
+	struct options opt;
+	struct path_list paths;
+	struct bench b;
+	pthread_t *threads = NULL;
+	const char *out_path = NULL;
+	FILE *out = stdout;
+	double start;
+	int num_threads = 0;
+	int ret = 1;
+	int i;
+	int c;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	opt.repeat = 1;
+	opt.threshold = QUIRC_THRESHOLD_OTSU;
+	opt.pyramid = 1;
+	opt.min_module = 1;
+	opt.threads = 1;
+
+	while ((c = getopt(argc, argv, "j:r:ap:T:S:Co:vh")) >= 0)
+		switch (c) {
+		case 'j':
+			opt.jobs = atoi(optarg);
+			break;
+
+		case 'r':
+			opt.repeat = atoi(optarg);
+			break;
+
+		case 'a':
+			opt.threshold = QUIRC_THRESHOLD_ADAPTIVE;
+			break;
+
+		case 'p':
+			opt.pyramid = atoi(optarg);
+			if (strchr(optarg, ':'))
+				opt.min_module = atoi(strchr(optarg, ':') + 1);
+			break;
+
+		case 'T':
+			opt.threads = atoi(optarg);
+			break;
+
+		case 'S':
+			opt.pad = atoi(optarg);
+			break;
+
+		case 'C':
+			opt.compare = 1;
+			break;
+
+		case 'o':
+			out_path = optarg;
+			break;
+
+		case 'v':
+			opt.verbose = 1;
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return 0;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (opt.jobs < 1)
+		opt.jobs = 1;
+	if (opt.repeat < 1)
+		opt.repeat = 1;
+	if (opt.pad < 0)
+		opt.pad = 0;
+
+	/* Check the decoder settings once, up front */
+	{
+		struct quirc *q = new_decoder(&opt);
+
+		if (!q) {
+			fprintf(stderr, "invalid decoder settings\n");
+			return 1;
+		}
+
+		quirc_destroy(q);
+	}
+
+	memset(&paths, 0, sizeof(paths));
+	for (i = optind; i < argc; i++)
+		if (collect(&paths, argv[i], 1) < 0)
+			goto out_paths;
+
+	qsort(paths.items, paths.count, sizeof(*paths.items), compare_paths);
+	if (opt.jobs > paths.count)
+		opt.jobs = paths.count ? paths.count : 1;
+
+	memset(&b, 0, sizeof(b));
+	b.opt = &opt;
+	b.paths = paths.items;
+	b.num_paths = paths.count;
+	b.results = calloc(paths.count + 1, sizeof(*b.results));
+	threads = calloc(opt.jobs, sizeof(*threads));
+	if (!b.results || !threads) {
+		perror("calloc");
+		goto out_results;
+	}
+
+	pthread_mutex_init(&b.lock, NULL);
+
+	start = now_ms();
+	for (i = 0; i < opt.jobs; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &b))
+			break;
+
+		num_threads++;
+	}
+
+	if (!num_threads) {
+		fprintf(stderr, "couldn't start worker threads\n");
+		goto out_lock;
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (b.next < b.num_paths) {
+		fprintf(stderr, "not all images were processed\n");
+		goto out_lock;
+	}
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+			goto out_lock;
+		}
+	}
+
+	ret = report(out, &b, now_ms() - start);
+	if (ret < 0) {
+		fprintf(stderr, "failed to write report\n");
+		ret = 1;
+	}
+
+	if (out != stdout)
+		fclose(out);
+
+out_lock:
+	pthread_mutex_destroy(&b.lock);
+out_results:
+	for (i = 0; i < b.num_paths; i++)
+		payload_free(&b.results[i].payloads);
+
+	free(b.results);
+	free(threads);
+out_paths:
+	for (i = 0; i < paths.count; i++)
+		free(paths.items[i]);
+
+	free(paths.items);
+	return ret;
+}
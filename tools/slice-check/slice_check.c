@@ -0,0 +1,399 @@
+/* slice-check - frame boundaries and latency of streams sent in slices
+ *
+ * First checks components/sophgo/video's slice tracker the way
+ * camera-streamer uses it: frames are cut into slices and the slices into
+ * one or two GetStream calls, fed through the tracker and put
+ * back together, including when the last slice of a frame never comes and
+ * when the encoder never flags one.
+ *
+ * Then models the time from capture to the socket and to the client for
+ * whole frames, which go through the VENC link list and its consume
+ * thread, and for slices, which the encoder thread hands out directly.
+ * The encoder outputs slice i of n at (i + 1) / n of the encode time, and
+ * the client's link sends one message after another at its rate.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <video_slice.h>
+
+#define FPS             30
+#define GOP             60
+#define FRAMES          (20 * FPS)
+#define PIPE_MS         10.0    // Sensor to encoder: ISP and VPSS, the same for both
+#define LLIST_POLL_MS   5.0     // Consume thread sleep when the list is empty
+#define MG_POLL_MS      10.0    // camera-streamer mg_mgr_poll() timeout
+#define HANDOFF_MS      0.2     // Callback, queue and wakeup
+#define COPY_MB_S       200.0   // Link list copy of a frame
+#define SLICE_OVERHEAD  0.01    // Slice headers, share of the frame per extra slice
+
+typedef struct scenario {
+    const char* name;
+    const char* description;
+    int kbps;           // Stream bitrate
+    double encode_ms;   // Encode time of a frame
+    int link_kbps;      // Client link
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "1080p", "CH0, 4 Mbit/s, 20 ms to encode, 20 Mbit/s link", 4000, 20, 20000 },
+    { "720p", "CH1, 2 Mbit/s, 10 ms to encode, 20 Mbit/s link", 2000, 10, 20000 },
+    { "slow", "CH0 on a 6 Mbit/s link", 4000, 20, 6000 },
+};
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef enum {
+    MODE_FRAMES,        // Whole frames through the link list, sent at the next poll
+    MODE_WAKEUP,        // Whole frames through the link list, poll woken up
+    MODE_SLICES,        // Slices from the encoder thread, poll woken up
+    MODE_COUNT
+} delivery_t;
+
+static const char* mode_names[MODE_COUNT] = { "frames", "wakeup", "slices" };
+
+typedef struct result {
+    double first_p50;       // Capture to the first slice at the socket
+    double socket_p50, socket_p95;  // Capture to the last slice at the socket
+    double client_p50, client_p95;  // Capture to the last byte at the client
+    double bytes;
+} result_t;
+
+static int failures;
+static int verbose;
+
+static void check(int ok, const char* what, const char* where)
+{
+    if (!ok) {
+        printf("FAIL: %s (%s)\n", what, where);
+        failures++;
+    }
+}
+
+static uint64_t rng_state;
+
+static double urand(void)
+{
+    rng_state = rng_state * 6364136223846793005ull + 1442695040888963407ull;
+    return ((rng_state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double* v, int n, double p)
+{
+    qsort(v, n, sizeof(*v), compare_double);
+    return v[(int)(p * (n - 1) + 0.5)];
+}
+
+/* Rows */
+
+static void test_rows(void)
+{
+    check(video_slice_rows(1080, VIDEO_SLICE_H264_ROW, 1) == 68, "1080p is 68 macroblock rows", "rows");
+    check(video_slice_rows(1080, VIDEO_SLICE_H264_ROW, 4) == 17, "1080p in 4 slices of 17 rows", "rows");
+    check(video_slice_rows(720, VIDEO_SLICE_H264_ROW, 3) == 15, "720p in 3 slices of 15 rows", "rows");
+    check(video_slice_rows(1080, VIDEO_SLICE_H265_ROW, 4) == 5, "1080p in 4 slices of 5 CTU rows", "rows");
+    check(video_slice_rows(64, VIDEO_SLICE_H265_ROW, 8) == 1, "at least one row per slice", "rows");
+    check(video_slice_rows(480, VIDEO_SLICE_H264_ROW, 0) == 30, "0 slices is one slice", "rows");
+}
+
+/* Reassembly */
+
+#define MAX_FRAME       4096
+
+typedef struct assembler {
+    video_slice_tracker_t tracker;
+    uint8_t data[MAX_FRAME];
+    uint32_t len;
+    // Frames sent, which must come out whole and in order
+    const uint8_t (*frames)[MAX_FRAME];
+    const uint32_t* lens;
+    const uint64_t* pts;
+    int next;
+    int bad;
+} assembler_t;
+
+// A frame is out: the next frame sent, or its start if its last slice never came
+static void assembled(assembler_t* a, uint64_t pts, int terminated)
+{
+    int f = a->next++;
+
+    if (a->len != a->tracker.last_size || pts != a->pts[f] || a->len > a->lens[f] ||
+        (terminated && a->len != a->lens[f]) || memcmp(a->data, a->frames[f], a->len) != 0)
+        a->bad++;
+    a->len = 0;
+}
+
+// One GetStream call: packs of one slice or of several, all of the same frame
+static void add_stream(assembler_t* a, const uint8_t* data, uint32_t len, uint64_t pts, int last)
+{
+    uint64_t open_pts = a->tracker.pts;
+
+    if (video_slice_begin(&a->tracker, pts) & VIDEO_SLICE_CLOSED)
+        assembled(a, open_pts, 0);
+    // Slices of different frames run together
+    if (a->len + len > MAX_FRAME) {
+        a->bad++;
+        a->len = 0;
+    }
+    memcpy(a->data + a->len, data, len);
+    a->len += len;
+    if (video_slice_end(&a->tracker, len, last) & VIDEO_SLICE_END)
+        assembled(a, pts, 1);
+}
+
+typedef struct cut {
+    int slices;         // Slices per frame
+    double lose;        // Chance that the rest of a frame is lost after a slice
+    int no_end;         // The encoder never flags the last slice
+    int repeat_pts;     // Every other frame has the PTS of the one before
+} cut_t;
+
+static void run_reassembly(const char* name, const cut_t* cut, unsigned int seed)
+{
+    static uint8_t frames[64][MAX_FRAME];
+    uint32_t lens[64];
+    uint64_t pts[64];
+    int count = 64;
+    int lost = 0;
+    assembler_t a;
+
+    rng_state = seed;
+    for (int f = 0; f < count; f++) {
+        lens[f] = 200 + (uint32_t)(urand() * (MAX_FRAME - 200));
+        for (uint32_t i = 0; i < lens[f]; i++)
+            frames[f][i] = (uint8_t)(urand() * 256);
+        pts[f] = 1000000 + (uint64_t)(cut->repeat_pts ? f / 2 : f) * 33333;
+    }
+
+    memset(&a, 0, sizeof(a));
+    video_slice_tracker_init(&a.tracker);
+    a.frames = (const uint8_t (*)[MAX_FRAME])frames;
+    a.lens = lens;
+    a.pts = pts;
+
+    for (int f = 0; f < count; f++) {
+        uint32_t offset = 0;
+        for (int s = 0; s < cut->slices; s++) {
+            uint32_t end = s == cut->slices - 1 ? lens[f] : lens[f] * (s + 1) / cut->slices;
+            int last = (s == cut->slices - 1) && !cut->no_end;
+            // Send the slice in one or two calls
+            uint32_t split = offset + (end - offset) * (urand() < 0.3 ? 1 : 2) / 2;
+            if (split > offset && split < end) {
+                add_stream(&a, frames[f] + offset, split - offset, pts[f], 0);
+                offset = split;
+            }
+            add_stream(&a, frames[f] + offset, end - offset, pts[f], last);
+            offset = end;
+            if (s < cut->slices - 1 && urand() < cut->lose) {
+                lost++;
+                break;
+            }
+        }
+    }
+
+    int open = a.tracker.open;
+    int expect_frames = count - open;
+    int expect_unterminated = cut->no_end ? count - 1 : lost - (open && !cut->no_end);
+
+    if (verbose)
+        printf("%-12s %4u frames %4u unterminated %4d lost %d bad\n", name, a.tracker.frames, a.tracker.unterminated,
+            lost, a.bad);
+    check(a.bad == 0 && a.next == expect_frames, "frames put back together", name);
+    check(a.tracker.frames == (uint32_t)expect_frames, "frames closed", name);
+    check(a.tracker.unterminated == (uint32_t)expect_unterminated, "frames without a last slice", name);
+}
+
+static void test_reassembly(unsigned int seed)
+{
+    const cut_t whole = { 1, 0, 0, 0 };
+    const cut_t sliced = { 4, 0, 0, 0 };
+    const cut_t lossy = { 4, 0.1, 0, 0 };
+    const cut_t no_end = { 4, 0, 1, 0 };
+    const cut_t repeated = { 8, 0, 0, 1 };
+    video_slice_tracker_t t;
+
+    run_reassembly("whole", &whole, seed);
+    run_reassembly("sliced", &sliced, seed);
+    run_reassembly("lossy", &lossy, seed);
+    run_reassembly("no end", &no_end, seed);
+    run_reassembly("same pts", &repeated, seed);
+
+    // A new PTS starts a frame, the same one continues it
+    video_slice_tracker_init(&t);
+    check(video_slice_begin(&t, 1) == VIDEO_SLICE_START, "first slice starts a frame", "tracker");
+    video_slice_end(&t, 10, 0);
+    check(video_slice_begin(&t, 1) == 0, "same PTS continues the frame", "tracker");
+    check(video_slice_end(&t, 20, 1) == VIDEO_SLICE_END && t.last_size == 30 && t.last_slices == 2,
+        "last slice ends the frame", "tracker");
+    check(video_slice_begin(&t, 1) == VIDEO_SLICE_START, "a slice after the end starts a frame", "tracker");
+    video_slice_end(&t, 5, 0);
+    check(video_slice_begin(&t, 2) == (VIDEO_SLICE_START | VIDEO_SLICE_CLOSED) && t.last_size == 5,
+        "new PTS closes an open frame", "tracker");
+}
+
+/* Latency */
+
+typedef struct link {
+    double free_ms;     // The link is busy sending until then
+    double kbps;
+} link_t;
+
+// A message is handed to the socket at ms and the link sends it after the ones before
+static double link_send(link_t* l, double ms, double bytes)
+{
+    double start = ms > l->free_ms ? ms : l->free_ms;
+
+    l->free_ms = start + bytes * 8 / l->kbps;
+    return l->free_ms;
+}
+
+static void simulate(const scenario_t* sc, delivery_t mode, int slices, unsigned int seed, result_t* r)
+{
+    static double first[FRAMES], socket[FRAMES], client[FRAMES];
+    double frame_bytes = sc->kbps * 1000.0 / 8 / FPS;
+    double encoder_free = 0;
+    link_t l = { 0, sc->link_kbps };
+    int n = mode == MODE_SLICES ? slices : 1;
+
+    // The same frames in every mode
+    rng_state = seed;
+    memset(r, 0, sizeof(*r));
+    for (int f = 0; f < FRAMES; f++) {
+        double capture = f * 1000.0 / FPS;
+        double key = (f % GOP == 0) ? 8 : 1;
+        double bytes = frame_bytes * key * (0.7 + 0.6 * urand()) * (1 + SLICE_OVERHEAD * (n - 1));
+        double encode = sc->encode_ms * (0.9 + 0.2 * urand()) * (key > 1 ? 1.3 : 1);
+        double llist_phase = urand() * LLIST_POLL_MS;
+        double poll_phase = urand() * MG_POLL_MS;
+        double start = capture + PIPE_MS > encoder_free ? capture + PIPE_MS : encoder_free;
+        double weights[VIDEO_SLICES_MAX], total = 0;
+
+        encoder_free = start + encode;
+        r->bytes += bytes;
+
+        if (mode != MODE_SLICES) {
+            double ms = start + encode + bytes / (COPY_MB_S * 1000) + llist_phase + HANDOFF_MS;
+            if (mode == MODE_FRAMES)
+                ms += poll_phase;
+            first[f] = socket[f] = ms - capture;
+            client[f] = link_send(&l, ms, bytes) - capture;
+            continue;
+        }
+
+        // Slices differ in size with the detail in their band
+        for (int s = 0; s < n; s++)
+            total += weights[s] = 0.5 + urand();
+        for (int s = 0; s < n; s++) {
+            double ms = start + encode * (s + 1) / n + HANDOFF_MS;
+            double end = link_send(&l, ms, bytes * weights[s] / total);
+            if (s == 0)
+                first[f] = ms - capture;
+            socket[f] = ms - capture;
+            client[f] = end - capture;
+        }
+    }
+
+    r->first_p50 = percentile(first, FRAMES, 0.5);
+    r->socket_p50 = percentile(socket, FRAMES, 0.5);
+    r->socket_p95 = percentile(socket, FRAMES, 0.95);
+    r->client_p50 = percentile(client, FRAMES, 0.5);
+    r->client_p95 = percentile(client, FRAMES, 0.95);
+}
+
+static void print_header(void)
+{
+    printf("\n%-8s %-7s %6s %10s %10s %10s %10s %10s\n", "case", "mode", "slices", "first p50", "socket p50",
+        "socket p95", "client p50", "client p95");
+}
+
+static void run_scenario(const scenario_t* sc, int slices, unsigned int seed)
+{
+    result_t r[MODE_COUNT];
+
+    for (int m = 0; m < MODE_COUNT; m++) {
+        simulate(sc, (delivery_t)m, slices, seed, &r[m]);
+        printf("%-8s %-7s %6d %7.1f ms %7.1f ms %7.1f ms %7.1f ms %7.1f ms\n", m == 0 ? sc->name : "", mode_names[m],
+            m == MODE_SLICES ? slices : 1, r[m].first_p50, r[m].socket_p50, r[m].socket_p95, r[m].client_p50,
+            r[m].client_p95);
+    }
+
+    // The link list hop and the poll are gone
+    check(r[MODE_SLICES].socket_p50 < r[MODE_FRAMES].socket_p50 - LLIST_POLL_MS / 2, "frame at the socket sooner",
+        sc->name);
+    check(r[MODE_SLICES].socket_p95 < r[MODE_FRAMES].socket_p95, "fewer late frames at the socket", sc->name);
+    check(r[MODE_WAKEUP].socket_p50 < r[MODE_FRAMES].socket_p50, "wakeup sends whole frames sooner", sc->name);
+    if (slices < 2)
+        return;
+
+    // The top of the frame leaves after its own band is encoded
+    check(r[MODE_SLICES].first_p50 < PIPE_MS + sc->encode_ms * 1.1 / slices + 1, "first slice after its band",
+        sc->name);
+    // Sending overlaps encoding, so the client has the frame sooner than with wakeups alone
+    check(r[MODE_SLICES].client_p50 < r[MODE_WAKEUP].client_p50, "frame at the client sooner", sc->name);
+    check(r[MODE_SLICES].client_p95 < r[MODE_FRAMES].client_p95, "fewer late frames at the client", sc->name);
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-c case] [-n slices] [-s seed] [-v]\n", name);
+    printf("Cases:\n");
+    for (size_t i = 0; i < NUM_SCENARIOS; i++)
+        printf("  %-8s %s\n", scenarios[i].name, scenarios[i].description);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = NULL;
+    int slices = 4;
+    unsigned int seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:s:vh")) != -1) {
+        switch (opt) {
+        case 'c':
+            name = optarg;
+            break;
+        case 'n':
+            slices = atoi(optarg);
+            break;
+        case 's':
+            seed = (unsigned int)atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (slices < 1 || slices > VIDEO_SLICES_MAX) {
+        fprintf(stderr, "slices must be 1 to %d\n", VIDEO_SLICES_MAX);
+        return 1;
+    }
+
+    if (!name) {
+        test_rows();
+        test_reassembly(seed);
+    }
+
+    print_header();
+    for (size_t i = 0; i < NUM_SCENARIOS; i++) {
+        if (name && strcmp(name, scenarios[i].name))
+            continue;
+        run_scenario(&scenarios[i], slices, seed);
+    }
+
+    printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,558 @@
+/* talkback-sim - the talkback jitter buffer under simulated networks
+ *
+ * Packetises a recording (or a synthetic speech-like signal) the way a
+ * talkback client does, delays, bunches and drops the packets according
+ * to a network profile, and plays them through components/talkback. By
+ * default time is simulated, so a run is quick and repeatable, and the
+ * results of every profile are checked against loose bounds; with -R
+ * the packets are sent in real time to the playout thread, which writes
+ * a WAV file or plays on an ALSA device such as "null".
+ *
+ * Latency is mouth to speaker: from the capture of a sample at the
+ * sender to the moment the device plays it, so it includes the packet
+ * duration, the network, the jitter buffer and the device buffer.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <talkback.h>
+
+typedef struct profile {
+    const char* name;
+    int stream;         // In order, as over a WebSocket; otherwise datagrams
+    double base_ms;     // Minimum one-way delay
+    double jitter_ms;   // Mean of the exponential delay variation
+    double spike_rate;  // Delay spikes per second, e.g. retransmissions
+    double spike_ms;
+    double loss;        // Datagram loss rate, in bursts of burst packets
+    double burst;
+    // Bounds checked in simulated time
+    double max_concealed;
+    double max_p95_ms;
+} profile_t;
+
+static const profile_t profiles[] = {
+    { "lan", 1, 1, 0.5, 0, 0, 0, 1, 0.005, 60 },
+    { "wifi", 1, 4, 6, 0.5, 60, 0, 1, 0.05, 150 },
+    { "cellular", 1, 35, 15, 0.2, 220, 0, 1, 0.06, 450 },
+    { "lossy", 0, 20, 10, 0, 0, 0.03, 2, 0.09, 150 },
+};
+#define NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+typedef struct packet {
+    uint64_t arrival_us;
+    size_t size;
+    uint8_t* data;
+} packet_t;
+
+typedef struct options {
+    unsigned int rate;      // Playout
+    unsigned int period_ms;
+    unsigned int packet_ms;
+    int codec;
+    int realtime;
+    const char* device;
+    const char* output;
+    unsigned int seed;
+} options_t;
+
+static int failures;
+
+static void check(int ok, const char* what, const char* profile)
+{
+    if (!ok) {
+        printf("FAIL: %s (%s)\n", what, profile);
+        failures++;
+    }
+}
+
+static uint64_t rng_state;
+
+static double urand(void)
+{
+    rng_state = rng_state * 6364136223846793005ull + 1442695040888963407ull;
+    return ((rng_state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int compare_arrival(const void* a, const void* b)
+{
+    const packet_t* x = a;
+    const packet_t* y = b;
+
+    return x->arrival_us < y->arrival_us ? -1 : x->arrival_us > y->arrival_us;
+}
+
+/* Signals */
+
+static int16_t* read_wav(const char* path, unsigned int* rate, unsigned int* channels, size_t* frames)
+{
+    FILE* f = fopen(path, "rb");
+    uint8_t h[12], chunk[8], fmt[16];
+    int16_t* data = NULL;
+    int have_fmt = 0;
+
+    if (!f || fread(h, 1, 12, f) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4))
+        goto fail;
+
+    while (fread(chunk, 1, 8, f) == 8) {
+        uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+
+        if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+            if (fread(fmt, 1, 16, f) != 16)
+                goto fail;
+            fseek(f, size - 16 + (size & 1), SEEK_CUR);
+            if ((fmt[0] | fmt[1] << 8) != 1 || (fmt[14] | fmt[15] << 8) != 16)
+                goto fail;
+            *channels = fmt[2] | fmt[3] << 8;
+            *rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (uint32_t)fmt[7] << 24;
+            have_fmt = 1;
+        } else if (!memcmp(chunk, "data", 4) && have_fmt) {
+            *frames = size / 2 / *channels;
+            data = malloc(*frames * *channels * sizeof(*data));
+            if (!data || fread(data, 2, *frames * *channels, f) != *frames * *channels)
+                goto fail;
+            fclose(f);
+            return data;
+        } else {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+
+fail:
+    fprintf(stderr, "cannot read %s as 16-bit PCM WAV\n", path);
+    free(data);
+    if (f)
+        fclose(f);
+    return NULL;
+}
+
+static int write_wav(const char* path, const int16_t* data, size_t frames, unsigned int rate)
+{
+    FILE* f = fopen(path, "wb");
+    uint32_t bytes = (uint32_t)frames * 2;
+    uint8_t h[44] = { 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0 };
+
+    if (!f) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        h[4 + i] = (uint8_t)((36 + bytes) >> (8 * i));
+        h[24 + i] = (uint8_t)(rate >> (8 * i));
+        h[28 + i] = (uint8_t)((rate * 2) >> (8 * i));
+        h[40 + i] = (uint8_t)(bytes >> (8 * i));
+    }
+    h[32] = 2;
+    h[34] = 16;
+    memcpy(h + 36, "data", 4);
+    fwrite(h, 1, sizeof(h), f);
+    fwrite(data, 2, frames, f);
+    fclose(f);
+    return 0;
+}
+
+// Syllables of gliding harmonic tones between pauses, with a noise floor
+static int16_t* synth_speech(unsigned int rate, double seconds, size_t* frames)
+{
+    int16_t* out;
+    size_t i = 0;
+
+    *frames = (size_t)(rate * seconds);
+    out = calloc(*frames, sizeof(*out));
+    if (!out)
+        return NULL;
+
+    while (i < *frames) {
+        size_t len = (size_t)(rate * (0.15 + 0.25 * urand()));
+        size_t gap = (size_t)(rate * (0.05 + 0.35 * urand()));
+        double f0 = 100 + 150 * urand();
+        double glide = (urand() - 0.5) * 0.6;
+        double phase = 0;
+
+        for (size_t j = 0; j < len && i < *frames; j++, i++) {
+            double t = (double)j / len;
+            double env = 0.5 - 0.5 * cos(2 * M_PI * t);
+            double f = f0 * (1 + glide * t);
+            double s = 0;
+
+            phase += 2 * M_PI * f / rate;
+            for (int h = 1; h * f < rate / 2 && h <= 20; h++)
+                s += sin(h * phase) / h;
+            out[i] = (int16_t)(env * 6000 * s + 30 * (urand() - 0.5));
+        }
+        for (size_t j = 0; j < gap && i < *frames; j++, i++)
+            out[i] = (int16_t)(30 * (urand() - 0.5));
+    }
+    return out;
+}
+
+/* Network */
+
+static packet_t* packetise(const profile_t* p, const options_t* o, const int16_t* pcm, size_t frames,
+    unsigned int rate, unsigned int channels, uint64_t start_us, size_t* count)
+{
+    size_t step = rate * o->packet_ms / 1000;
+    size_t n = (frames + step - 1) / step;
+    packet_t* packets = calloc(n, sizeof(*packets));
+    uint8_t* payload = malloc(step * channels * 2);
+    uint64_t last_arrival = 0;
+    int bad = 0;
+    size_t kept = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        size_t len = frames - k * step < step ? frames - k * step : step;
+        uint64_t capture_us = start_us + (uint64_t)k * step * 1000000 / rate;
+        uint64_t send_us = capture_us + (uint64_t)len * 1000000 / rate;
+        double delay_ms = p->base_ms - p->jitter_ms * log(urand());
+        talkback_packet_t pkt = {
+            .codec = (uint8_t)o->codec,
+            .channels = (uint8_t)channels,
+            .seq = (uint16_t)k,
+            .rate = rate,
+            .timestamp = (uint32_t)(k * step),
+            .capture_us = capture_us,
+            .payload = payload,
+        };
+
+        if (p->spike_rate > 0 && urand() < p->spike_rate * o->packet_ms / 1000)
+            delay_ms += p->spike_ms * (0.5 + urand());
+
+        // Gilbert model: losses come in bursts of burst packets on average
+        if (p->loss > 0) {
+            bad = bad ? urand() > 1 / p->burst : urand() < p->loss / (p->burst * (1 - p->loss));
+            if (bad)
+                continue;
+        }
+
+        pkt.size = (uint16_t)talkback_encode(o->codec, pcm + k * step * channels, len * channels, payload);
+        packets[kept].arrival_us = send_us + (uint64_t)(delay_ms * 1000);
+        if (p->stream) {
+            // No overtaking on a stream; a late packet holds back the rest
+            if (packets[kept].arrival_us < last_arrival)
+                packets[kept].arrival_us = last_arrival;
+            last_arrival = packets[kept].arrival_us;
+        }
+        packets[kept].data = malloc(TALKBACK_HEADER_SIZE + pkt.size);
+        packets[kept].size = talkback_packet_write(&pkt, packets[kept].data, TALKBACK_HEADER_SIZE + pkt.size);
+        kept++;
+    }
+
+    free(payload);
+    qsort(packets, kept, sizeof(*packets), compare_arrival);
+    *count = kept;
+    return packets;
+}
+
+static void free_packets(packet_t* packets, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(packets[i].data);
+    free(packets);
+}
+
+// Streams are fed in pieces that split packets, as a socket would deliver them
+static void deliver(talkback_t* tb, const packet_t* pkt, int stream, uint64_t now_us)
+{
+    size_t pos = 0;
+
+    while (stream && pos < pkt->size) {
+        size_t n = 1 + (size_t)(urand() * pkt->size);
+
+        if (n > pkt->size - pos)
+            n = pkt->size - pos;
+        talkback_feed(tb, pkt->data + pos, n, now_us);
+        pos += n;
+    }
+    if (!stream) {
+        talkback_packet_t parsed;
+
+        talkback_packet_parse(pkt->data, pkt->size, &parsed);
+        talkback_push(tb, &parsed, now_us);
+    }
+}
+
+static void print_stats(const char* name, const talkback_stats_t* s, double p50, double p95, unsigned int rate)
+{
+    double total = (double)(s->frames + s->concealed);
+
+    printf("%-10s %6llu %5llu %5llu %8.2f%% %7.0f %7.0f %7.1f %7.1f %7.1f %7.1f\n", name,
+        (unsigned long long)s->packets, (unsigned long long)s->late, (unsigned long long)s->lost,
+        total > 0 ? 100.0 * s->concealed / total : 0.0,
+        1000.0 * s->stretched / rate, 1000.0 * s->shrunk / rate, s->target_ms, p50, p95, s->latency_max_ms);
+}
+
+static void print_header(void)
+{
+    printf("%-10s %6s %5s %5s %9s %7s %7s %7s %7s %7s %7s\n", "profile", "pkts", "late", "lost",
+        "concealed", "str ms", "shr ms", "target", "p50", "p95", "max");
+}
+
+static talkback_t* create(const options_t* o)
+{
+    talkback_config_t config;
+
+    talkback_default_config(&config);
+    config.rate = o->rate;
+    config.period_ms = o->period_ms;
+    config.device = o->device;
+    config.file = o->device ? NULL : o->output;
+    return talkback_create(&config);
+}
+
+/* Simulated time: the device pulls a period, then packets that arrived during it are delivered */
+static void simulate(const profile_t* p, const options_t* o, const int16_t* pcm, size_t frames,
+    unsigned int rate, unsigned int channels)
+{
+    const uint64_t start_us = 1700000000000000ull;
+    size_t period = o->rate * o->period_ms / 1000;
+    uint64_t period_us = (uint64_t)o->period_ms * 1000;
+    size_t count, next = 0, pulls, played = 0;
+    packet_t* packets = packetise(p, o, pcm, frames, rate, channels, start_us, &count);
+    talkback_t* tb = create(o);
+    talkback_stats_t stats;
+    uint64_t last_frames = 0;
+    double* latency;
+    size_t samples = 0;
+    int16_t* out;
+
+    if (!tb) {
+        fprintf(stderr, "cannot create talkback\n");
+        exit(1);
+    }
+
+    pulls = (size_t)((packets[count - 1].arrival_us - start_us) / period_us) + 100;
+    out = malloc(pulls * period * sizeof(*out));
+    latency = malloc(pulls * sizeof(*latency));
+
+    for (size_t i = 0; i < pulls; i++) {
+        uint64_t now_us = start_us + i * period_us;
+
+        for (; next < count && packets[next].arrival_us <= now_us; next++)
+            deliver(tb, &packets[next], p->stream, packets[next].arrival_us);
+
+        // A device with two periods queued when it asks for the next
+        talkback_pull(tb, out + played, period, now_us, period_us);
+        played += period;
+
+        talkback_get_stats(tb, &stats);
+        if (stats.frames != last_frames && stats.latency_ms > 0)
+            latency[samples++] = stats.latency_ms;
+        last_frames = stats.frames;
+    }
+
+    qsort(latency, samples, sizeof(*latency), compare_double);
+    double p50 = samples ? latency[samples / 2] : 0;
+    double p95 = samples ? latency[(size_t)(samples * 0.95)] : 0;
+    double total = (double)(stats.frames + stats.concealed);
+
+    print_stats(p->name, &stats, p50, p95, rate);
+    check(stats.packets > 0 && samples > 0, "no audio played", p->name);
+    check(total > 0 && stats.concealed / total <= p->max_concealed, "too much concealment", p->name);
+    // The bounds are for 20 ms packets and a 10 ms period, the defaults
+    check(p95 <= p->max_p95_ms + o->packet_ms - 20.0 + 2.0 * o->period_ms - 20.0, "95th percentile latency too high",
+        p->name);
+
+    if (o->output)
+        write_wav(o->output, out, played, o->rate);
+
+    talkback_destroy(tb);
+    free_packets(packets, count);
+    free(out);
+    free(latency);
+}
+
+static void sleep_until(uint64_t us)
+{
+    uint64_t now = talkback_now_us();
+
+    if (us > now) {
+        struct timespec ts = { (time_t)((us - now) / 1000000), (long)((us - now) % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* Real time: the playout thread runs on its own and packets are sent when they arrive */
+static void realtime(const profile_t* p, const options_t* o, const int16_t* pcm, size_t frames,
+    unsigned int rate, unsigned int channels)
+{
+    uint64_t start_us = talkback_now_us() + 100000;
+    size_t count;
+    packet_t* packets = packetise(p, o, pcm, frames, rate, channels, start_us, &count);
+    talkback_t* tb = create(o);
+    talkback_stats_t stats;
+
+    if (!tb || talkback_start(tb)) {
+        fprintf(stderr, "cannot start talkback\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sleep_until(packets[i].arrival_us);
+        deliver(tb, &packets[i], p->stream, talkback_now_us());
+    }
+    sleep_until(talkback_now_us() + 1000000);
+    talkback_stop(tb);
+
+    talkback_get_stats(tb, &stats);
+    printf("%s: %llu packets, %llu late, %llu lost, %.2f%% concealed, %.0f ms stretched, %.0f ms shrunk\n",
+        p->name, (unsigned long long)stats.packets, (unsigned long long)stats.late,
+        (unsigned long long)stats.lost, 100.0 * stats.concealed / (stats.frames + stats.concealed + 1),
+        1000.0 * stats.stretched / rate, 1000.0 * stats.shrunk / rate);
+    printf("latency min %.1f mean %.1f max %.1f ms, target %.1f ms, device %.1f ms, %llu xruns\n",
+        stats.latency_min_ms, stats.latency_mean_ms, stats.latency_max_ms, stats.target_ms, stats.device_ms,
+        (unsigned long long)stats.xruns);
+
+    talkback_destroy(tb);
+    free_packets(packets, count);
+}
+
+/* Codec and framing checks */
+
+static void test_codecs(void)
+{
+    int16_t in[65536], out[65536];
+    uint8_t enc[131072];
+
+    for (int i = 0; i < 65536; i++)
+        in[i] = (int16_t)(i - 32768);
+
+    for (int codec = TALKBACK_CODEC_L16; codec <= TALKBACK_CODEC_PCMA; codec++) {
+        size_t n = talkback_encode(codec, in, 65536, enc);
+        talkback_packet_t pkt = { .codec = (uint8_t)codec, .channels = 1, .rate = 8000, .payload = enc };
+        uint8_t* buf = malloc(TALKBACK_HEADER_SIZE + 65535);
+        int worst = 0;
+
+        // Decode through a whole packet, in chunks of at most 65535 bytes
+        for (size_t pos = 0; pos < n; pos += pkt.size) {
+            talkback_packet_t parsed;
+            size_t len;
+
+            pkt.size = (uint16_t)(n - pos > 65534 ? 65534 : n - pos);
+            pkt.payload = enc + pos;
+            len = talkback_packet_write(&pkt, buf, TALKBACK_HEADER_SIZE + 65535);
+            check(talkback_packet_parse(buf, len, &parsed) == (int)len, "packet round trip", "codec");
+            check(talkback_packet_parse(buf, len - 1, &parsed) == 0, "partial packet", "codec");
+        }
+        free(buf);
+
+        // The G.711 quantisation step grows with the level
+        talkback_decode(codec, enc, n, out);
+        for (int i = 0; i < 65536; i++) {
+            int err = abs(out[i] - in[i]);
+
+            if (err * 16 > abs(in[i]) + 128 && err > worst)
+                worst = err;
+        }
+        check(worst == 0, "G.711 quantisation error", codec == 0 ? "l16" : codec == 1 ? "pcmu" : "pcma");
+        if (codec == TALKBACK_CODEC_L16)
+            check(!memcmp(in, out, sizeof(in)), "L16 round trip", "l16");
+    }
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [options]\n"
+           "  -p profile  lan, wifi, cellular or lossy (default: all, checked)\n"
+           "  -i file     16-bit PCM WAV to send (default: synthetic speech)\n"
+           "  -o file     WAV file to write the playout to\n"
+           "  -c codec    l16, pcmu or pcma (default l16)\n"
+           "  -f ms       packet duration (default 20)\n"
+           "  -P ms       device period (default 10)\n"
+           "  -r rate     playout rate (default 16000)\n"
+           "  -s seed     network randomness (default 1)\n"
+           "  -R          real time, through the playout thread\n"
+           "  -d device   ALSA device for -R, e.g. null (default: the -o file)\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    options_t o = { 16000, 10, 20, TALKBACK_CODEC_L16, 0, NULL, NULL, 1 };
+    const char* profile = NULL;
+    const char* input = NULL;
+    unsigned int rate = 16000, channels = 1;
+    size_t frames;
+    int16_t* pcm;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:i:o:c:f:P:r:s:Rd:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            profile = optarg;
+            break;
+        case 'i':
+            input = optarg;
+            break;
+        case 'o':
+            o.output = optarg;
+            break;
+        case 'c':
+            o.codec = !strcmp(optarg, "pcmu") ? TALKBACK_CODEC_PCMU : !strcmp(optarg, "pcma") ? TALKBACK_CODEC_PCMA : TALKBACK_CODEC_L16;
+            break;
+        case 'f':
+            o.packet_ms = (unsigned int)atoi(optarg);
+            break;
+        case 'P':
+            o.period_ms = (unsigned int)atoi(optarg);
+            break;
+        case 'r':
+            o.rate = (unsigned int)atoi(optarg);
+            break;
+        case 's':
+            o.seed = (unsigned int)atoi(optarg);
+            break;
+        case 'R':
+            o.realtime = 1;
+            break;
+        case 'd':
+            o.device = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (o.realtime && !profile)
+        profile = "wifi";
+    if (o.realtime && !o.device && !o.output) {
+        fprintf(stderr, "-R needs -o or -d\n");
+        return 1;
+    }
+
+    rng_state = o.seed;
+    pcm = input ? read_wav(input, &rate, &channels, &frames) : synth_speech(rate, 20, &frames);
+    if (!pcm)
+        return 1;
+
+    if (!profile)
+        test_codecs();
+
+    if (!o.realtime)
+        print_header();
+    for (size_t i = 0; i < NUM_PROFILES; i++) {
+        if (profile && strcmp(profile, profiles[i].name))
+            continue;
+        rng_state = o.seed;
+        if (o.realtime)
+            realtime(&profiles[i], &o, pcm, frames, rate, channels);
+        else
+            simulate(&profiles[i], &o, pcm, frames, rate, channels);
+    }
+
+    free(pcm);
+    printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
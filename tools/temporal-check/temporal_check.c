@@ -0,0 +1,459 @@
+/* temporal-check - per-client temporal layer selection under throughput traces
+ *
+ * Generates a layered stream the way the VENC codes it with temporal
+ * layers: a keyframe every GOP, then a base frame every 2^(layers-1)
+ * frames and enhance frames that reference only the base frame before
+ * them. The stream is sent to a simulated WebSocket client through
+ * components/sophgo/video's layer selector, and the client's send buffer
+ * drains at the rate of a throughput trace. Time is simulated in steps
+ * of 1 ms, so a run is quick and repeatable.
+ *
+ * Every frame the client gets must decode: its reference must have been
+ * sent and decoded too. Each trace is then checked for freezes, keyframe
+ * waits and how soon all layers come back, and compared with the same
+ * stream without layers, which can only wait for the next keyframe.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <video_temporal.h>
+
+#define FPS             30
+#define GOP             50
+#define P_BYTES         6000    // Average P frame, about 1.4 Mbit/s at 30fps
+#define KEY_BYTES       (8 * P_BYTES)
+#define BASE_WEIGHT     1.5     // A base frame references a frame further back
+
+typedef struct segment {
+    int ms;
+    double rate;    // Throughput, in multiples of the stream bitrate
+} segment_t;
+
+typedef struct trace {
+    const char* name;
+    const char* description;
+    segment_t segments[8];
+    double jitter;  // Random throughput changes every 500 ms, +/- this share
+    // Bounds with layers. Freezes include sending a keyframe at the trace's rate.
+    int max_freeze_ms;
+    int keyframe_waits;     // Expected: 0 none, 1 at least one
+    int recover_ms;         // From the end of the last slow segment to all layers
+} trace_t;
+
+static const trace_t traces[] = {
+    { "steady", "2x the bitrate", { { 60000, 2 } }, 0, 200, 0, 0 },
+    { "dip", "2x, 0.5x for 20 s, 2x", { { 10000, 2 }, { 20000, 0.5 }, { 30000, 2 } }, 0, 550, 0, 12000 },
+    { "half", "2x, 0.7x for 20 s, 2x", { { 10000, 2 }, { 20000, 0.7 }, { 30000, 2 } }, 0, 400, 0, 12000 },
+    { "outage", "2x, 0.02x for 4 s, 2x", { { 10000, 2 }, { 4000, 0.02 }, { 46000, 2 } }, 0, 6000, 1, 12000 },
+    { "wifi", "1.1x +/- 60% every 500 ms", { { 60000, 1.1 } }, 0.6, 600, 0, 0 },
+};
+#define NUM_TRACES (sizeof(traces) / sizeof(traces[0]))
+
+typedef struct frame {
+    uint64_t capture_ms;
+    uint32_t size;
+    uint8_t temporal_id;
+    int keyframe;
+    int lost;           // Coded, but never handed to the transport
+    int ref;            // Index of the referenced frame, -1 for a keyframe
+    int sent;
+    int decoded;
+    uint64_t end;       // Byte offset of its end in the client's stream
+    uint64_t shown_ms;  // Delivered and decoded
+} frame_t;
+
+typedef struct result {
+    uint32_t sent, shed, dropped, keyframe_waits;
+    int undecodable;
+    int max_freeze_ms;
+    int worst_fps;          // Fewest frames shown in a second
+    int recover_ms;         // -1 if all layers did not come back
+    double p95_delay_ms;    // Capture to shown
+} result_t;
+
+static int failures;
+static int verbose;
+
+static void check(int ok, const char* what, const char* trace, int layers)
+{
+    if (!ok) {
+        printf("FAIL: %s (%s, %d layers)\n", what, trace, layers);
+        failures++;
+    }
+}
+
+static uint64_t rng_state;
+
+static double urand(void)
+{
+    rng_state = rng_state * 6364136223846793005ull + 1442695040888963407ull;
+    return ((rng_state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Stream */
+
+static int trace_ms(const trace_t* t)
+{
+    int ms = 0;
+
+    for (int i = 0; i < 8 && t->segments[i].ms; i++)
+        ms += t->segments[i].ms;
+    return ms;
+}
+
+static double trace_rate(const trace_t* t, int ms)
+{
+    for (int i = 0; i < 8 && t->segments[i].ms; i++) {
+        if (ms < t->segments[i].ms)
+            return t->segments[i].rate;
+        ms -= t->segments[i].ms;
+    }
+    return 0;
+}
+
+// End of the last segment slower than the bitrate
+static int trace_slow_end(const trace_t* t)
+{
+    int ms = 0, end = -1;
+
+    for (int i = 0; i < 8 && t->segments[i].ms; i++) {
+        ms += t->segments[i].ms;
+        if (t->segments[i].rate < 1)
+            end = ms;
+    }
+    return end;
+}
+
+// Frames in the order and with the references of the VENC with layers.
+// With lose set, a top layer frame of every third GOP never reaches the
+// transport, as when the VENC thread skips an oversized P frame.
+static frame_t* make_stream(int layers, int count, int lose)
+{
+    frame_t* frames = calloc(count, sizeof(*frames));
+    video_temporal_position_t position = { 0 };
+    int base = -1;
+
+    for (int k = 0; k < count; k++) {
+        frame_t* f = &frames[k];
+        uint8_t layer = video_temporal_id(layers, k % GOP);
+
+        f->capture_ms = 1000 + (uint64_t)k * 1000 / FPS;
+        f->keyframe = k % GOP == 0;
+        f->lost = lose && layers > 1 && k % (3 * GOP) == GOP + 9;
+        if (!f->lost)
+            f->temporal_id = video_temporal_next(layers, &position, f->keyframe, f->capture_ms * 1000);
+        if (f->keyframe) {
+            f->size = KEY_BYTES;
+            f->ref = -1;
+        } else {
+            f->size = P_BYTES * (0.7 + 0.6 * urand()) * (layer == 0 && layers > 1 ? BASE_WEIGHT : 1);
+            f->ref = base;
+        }
+        if (layer == 0)
+            base = k;
+    }
+    return frames;
+}
+
+/* Client */
+
+static void simulate(const trace_t* t, int layers, int lose, unsigned int seed, result_t* r)
+{
+    int duration = trace_ms(t);
+    int count = duration * FPS / 1000;
+    frame_t* frames;
+    video_temporal_selector_t selector;
+    double bitrate = 0, rate, drained = 0, jitter = 1;
+    uint64_t queued = 0, last_shown = 0;
+    int next = 0, shown_next = 0, shown_in_second = 0, last_slow_shed = -1;
+    double* delays;
+    size_t delay_count = 0;
+
+    rng_state = seed;
+    frames = make_stream(layers, count, lose);
+    delays = calloc(count, sizeof(*delays));
+    for (int k = 0; k < count; k++)
+        bitrate += frames[k].size;
+    bitrate /= duration;    // Bytes per ms
+
+    memset(r, 0, sizeof(*r));
+    r->worst_fps = FPS;
+    video_temporal_selector_init(&selector, layers);
+
+    for (int ms = 0; ms < duration; ms++) {
+        uint64_t now = 1000 + ms;
+
+        if (t->jitter > 0 && ms % 500 == 0)
+            jitter = 1 + t->jitter * (2 * urand() - 1);
+        rate = trace_rate(t, ms) * jitter * bitrate;
+
+        // Frames captured in this ms go to the selector with the backlog
+        while (next < count && frames[next].capture_ms <= now) {
+            frame_t* f = &frames[next];
+            size_t backlog = (size_t)(queued - (uint64_t)drained);
+
+            if (f->lost) {
+                next++;
+                continue;
+            }
+            f->sent = video_temporal_select(&selector, f->temporal_id, f->keyframe, f->size, backlog, now);
+            if (f->sent) {
+                queued += f->size;
+                f->end = queued;
+                f->decoded = f->keyframe || (f->ref >= 0 && frames[f->ref].decoded);
+                if (!f->decoded)
+                    r->undecodable++;
+            } else {
+                last_slow_shed = ms;
+            }
+            if (verbose && f->sent && f->temporal_id == 0)
+                printf("  %6.2f s  max layer %d  backlog %6zu\n", ms / 1000.0, selector.max_id, backlog);
+            next++;
+        }
+
+        drained += rate;
+        if (drained > queued)
+            drained = (double)queued;
+
+        // Frames fully sent are shown, if they decode
+        while (shown_next < next && (!frames[shown_next].sent || frames[shown_next].end <= (uint64_t)drained)) {
+            frame_t* f = &frames[shown_next++];
+
+            if (!f->sent || !f->decoded)
+                continue;
+            f->shown_ms = now;
+            delays[delay_count++] = (double)(now - f->capture_ms);
+            if (last_shown && (int)(now - last_shown) > r->max_freeze_ms)
+                r->max_freeze_ms = (int)(now - last_shown);
+            last_shown = now;
+            shown_in_second++;
+        }
+        if (ms % 1000 == 999) {
+            if (ms >= 1000 && ms < duration - 1000 && shown_in_second < r->worst_fps)
+                r->worst_fps = shown_in_second;
+            shown_in_second = 0;
+        }
+    }
+
+    r->sent = selector.sent;
+    r->shed = selector.shed;
+    r->dropped = selector.dropped;
+    r->keyframe_waits = selector.keyframe_waits;
+    // Time from the end of the slow part to the last frame shed below the top layer
+    {
+        int slow_end = trace_slow_end(t);
+        r->recover_ms = 0;
+        if (slow_end >= 0)
+            r->recover_ms = last_slow_shed < slow_end ? 0 : last_slow_shed - slow_end;
+        if (last_slow_shed >= duration - 1000)
+            r->recover_ms = -1;
+    }
+    qsort(delays, delay_count, sizeof(*delays), compare_double);
+    r->p95_delay_ms = delay_count ? delays[delay_count * 95 / 100] : 0;
+
+    free(delays);
+    free(frames);
+}
+
+/* Checks */
+
+static void test_ids(void)
+{
+    static const uint8_t three[] = { 0, 2, 1, 2, 0, 2, 1, 2 };
+    video_temporal_position_t position = { 0 };
+    int counts[VIDEO_TEMPORAL_LAYERS_MAX] = { 0 };
+
+    for (int i = 0; i < 8; i++)
+        check(video_temporal_id(3, i) == three[i], "3-layer ids run 0 2 1 2", "ids", 3);
+    for (int i = 0; i < 8; i++)
+        check(video_temporal_id(2, i) == (i & 1), "2-layer ids run 0 1", "ids", 2);
+    for (int i = 0; i < 8; i++)
+        check(video_temporal_id(1, i) == 0 && video_temporal_id(0, i) == 0, "no layers, all base", "ids", 1);
+
+    // A keyframe starts the pattern again, whatever the GOP
+    for (int k = 0; k < 3 * GOP; k++) {
+        uint8_t id = video_temporal_next(3, &position, k % GOP == 0, 1000000 + (uint64_t)k * 1000000 / FPS);
+
+        if (k % GOP == 0)
+            check(id == 0, "keyframes are base layer", "ids", 3);
+        check(id == video_temporal_id(3, k % GOP), "position counted from the keyframe", "ids", 3);
+    }
+
+    // A frame lost before the transport leaves the position unknown: base
+    // layer up to the next keyframe, then the pattern again
+    memset(&position, 0, sizeof(position));
+    for (int k = 0; k < 2 * GOP; k++) {
+        if (k == 9)
+            continue;
+        uint8_t id = video_temporal_next(3, &position, k % GOP == 0, 1000000 + (uint64_t)k * 1000000 / FPS);
+
+        if (k > 9 && k < GOP)
+            check(id == 0, "base layer after a lost frame", "ids", 3);
+        else
+            check(id == video_temporal_id(3, k % GOP), "position counted again from the keyframe", "ids", 3);
+    }
+
+    // A lower frame rate is taken for lost frames for a few frames only
+    memset(&position, 0, sizeof(position));
+    for (int k = 0; k < GOP; k++) {
+        uint64_t ms = k < 10 ? (uint64_t)k * 1000 / FPS : (10 + (uint64_t)(k - 10) * 2) * 1000 / FPS;
+        uint8_t id = video_temporal_next(3, &position, k == 0, 1000000 + ms * 1000);
+
+        if (k == 11)
+            check(id == 0, "a lower frame rate looks like a lost frame", "ids", 3);
+    }
+    check(position.interval > 1000000 / FPS * 3 / 2, "the interval follows a lower frame rate", "ids", 3);
+
+    // 7.5, 15 and 30fps from layers 0, 0-1 and 0-2
+    for (int k = 0; k < 4 * FPS; k++)
+        counts[video_temporal_id(3, k)]++;
+    check(counts[0] == 30 && counts[0] + counts[1] == 60 && counts[0] + counts[1] + counts[2] == 120,
+        "3 layers at 7.5/15/30fps", "ids", 3);
+}
+
+static void test_selector(void)
+{
+    video_temporal_selector_t s;
+    uint64_t now = 1000;
+
+    // An uncongested client gets everything
+    video_temporal_selector_init(&s, 3);
+    for (int k = 0; k < 100; k++)
+        check(video_temporal_select(&s, video_temporal_id(3, k % GOP), k % GOP == 0, 1000, 0, now += 33),
+            "all frames sent without backlog", "selector", 3);
+
+    // A backlog sheds the top layer first, one layer per hold time
+    video_temporal_selector_init(&s, 3);
+    video_temporal_select(&s, 0, 1, 8000, 0, now += 33);
+    video_temporal_select(&s, 2, 0, 1000, 0, now += 33);
+    check(!video_temporal_select(&s, 2, 0, 1000, 20000, now += 33) && s.max_id == 1, "top layer shed first",
+        "selector", 3);
+    check(video_temporal_select(&s, 1, 0, 1000, 20000, now += 33) && s.max_id == 1, "one layer per hold time",
+        "selector", 3);
+    now += VIDEO_TEMPORAL_SHED_HOLD_MS;
+    check(video_temporal_select(&s, 0, 0, 1000, 20000, now) && s.max_id == 0, "base layer kept", "selector", 3);
+
+    // Layers come back one at a time, at a base frame, once the backlog stayed clear
+    now += 33;
+    for (int i = 0; i < 4; i++)
+        check(!video_temporal_select(&s, 1 + (i & 1), 0, 1000, 0, now += 33) || s.max_id > 0,
+            "no layer added before the clear time", "selector", 3);
+    now += VIDEO_TEMPORAL_RECOVER_MS;
+    check(!video_temporal_select(&s, 2, 0, 1000, 0, now), "not added in the middle of a period", "selector", 3);
+    check(video_temporal_select(&s, 0, 0, 1000, 0, now += 33) && s.max_id == 1, "one layer added at a base frame",
+        "selector", 3);
+
+    // Without the base layer only a keyframe helps
+    video_temporal_selector_init(&s, 1);
+    video_temporal_select(&s, 0, 0, 1000, 0, now += 33);
+    check(!video_temporal_select(&s, 0, 0, 1000, 1000 * (VIDEO_TEMPORAL_DROP_FRAMES + 1), now += 33)
+        && s.need_keyframe, "base layer dropped over the limit", "selector", 1);
+    check(!video_temporal_select(&s, 0, 0, 1000, 0, now += 33), "waits for a keyframe", "selector", 1);
+    check(video_temporal_select(&s, 0, 1, 8000, 0, now += 33) && !s.need_keyframe, "resumes at a keyframe",
+        "selector", 1);
+}
+
+static void print_header(void)
+{
+    printf("\n%-8s %6s %7s %6s %6s %6s %8s %8s %9s\n", "trace", "layers", "sent", "shed", "drop", "waits",
+        "freeze", "min fps", "p95 ms");
+}
+
+static void run_trace(const trace_t* t, int layers, unsigned int seed)
+{
+    result_t with, without, lost;
+
+    simulate(t, layers, 0, seed, &with);
+    simulate(t, 1, 0, seed, &without);
+    simulate(t, layers, 1, seed, &lost);
+
+    printf("%-8s %6d %7u %6u %6u %6u %6d ms %8d %9.0f\n", t->name, layers, with.sent, with.shed, with.dropped,
+        with.keyframe_waits, with.max_freeze_ms, with.worst_fps, with.p95_delay_ms);
+    printf("%-8s %6d %7u %6u %6u %6u %6d ms %8d %9.0f\n", "", 1, without.sent, without.shed, without.dropped,
+        without.keyframe_waits, without.max_freeze_ms, without.worst_fps, without.p95_delay_ms);
+
+    check(with.undecodable == 0 && without.undecodable == 0, "every frame sent decodes", t->name, layers);
+    check(lost.undecodable == 0, "every frame sent decodes with lost frames", t->name, layers);
+    if (layers < 3)
+        return;
+
+    check(with.max_freeze_ms <= t->max_freeze_ms, "longest freeze", t->name, layers);
+    if (t->keyframe_waits)
+        check(with.keyframe_waits > 0, "waits for a keyframe in an outage", t->name, layers);
+    else
+        check(with.keyframe_waits == 0, "no keyframe waits", t->name, layers);
+    if (t->recover_ms)
+        check(with.recover_ms >= 0 && with.recover_ms <= t->recover_ms, "all layers back in time", t->name, layers);
+    else
+        check(with.shed == 0 || t->jitter > 0, "nothing shed", t->name, layers);
+    if (without.keyframe_waits > 0)
+        check(with.max_freeze_ms < without.max_freeze_ms, "shorter freezes than without layers", t->name, layers);
+    if (with.shed > 0 && !t->keyframe_waits)
+        check(with.p95_delay_ms < without.p95_delay_ms, "lower delay than without layers", t->name, layers);
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-t trace] [-l layers] [-s seed] [-v]\n", name);
+    printf("Traces:\n");
+    for (size_t i = 0; i < NUM_TRACES; i++)
+        printf("  %-8s %s\n", traces[i].name, traces[i].description);
+}
+
+int main(int argc, char** argv)
+{
+    const char* trace = NULL;
+    int layers = 3;
+    unsigned int seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:l:s:vh")) != -1) {
+        switch (opt) {
+        case 't':
+            trace = optarg;
+            break;
+        case 'l':
+            layers = atoi(optarg);
+            break;
+        case 's':
+            seed = (unsigned int)atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (layers < 1 || layers > VIDEO_TEMPORAL_LAYERS_MAX) {
+        fprintf(stderr, "layers must be 1 to %d\n", VIDEO_TEMPORAL_LAYERS_MAX);
+        return 1;
+    }
+
+    if (!trace) {
+        test_ids();
+        test_selector();
+    }
+
+    print_header();
+    for (size_t i = 0; i < NUM_TRACES; i++) {
+        if (trace && strcmp(trace, traces[i].name))
+            continue;
+        run_trace(&traces[i], layers, seed);
+    }
+
+    printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,666 @@
+/* vad-check - audio levels, voice gating and what the gating saves
+ *
+ * Checks measureAudioLevel() of sscma-node
+ * (solutions/sscma-node/main/node/audio_level.cpp) against a double
+ * precision reference, on random buffers and on the cases its vector pass
+ * has to get right: lengths around the vector width, full scale, and a
+ * buffer long enough to fold the 16-bit crossing counters. It then replays
+ * the camera's audio delivery, AudioGate, with frames that keep their
+ * reference counts: consumers that take all audio, only active audio, and
+ * active audio with comfort noise, chunks that nobody receives, and
+ * message boxes that are full. Each consumer must get the chunks its
+ * option calls for, pre-roll included, and every frame must end with no
+ * references. Finally it runs VoiceDetector over a synthetic recording,
+ * room noise and hum with speech-like bursts a quarter of the time, and
+ * reports the audio bytes that gating saves, the speech chunks it misses,
+ * and the cost per chunk. Exits non-zero if any check fails.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "audio_level.h"
+
+using ma::node::AUDIO_ACTIVE_ONLY;
+using ma::node::AUDIO_ALL;
+using ma::node::AUDIO_COMFORT_NOISE;
+using ma::node::AudioGate;
+using ma::node::AudioLevel;
+using ma::node::measureAudioLevel;
+using ma::node::VoiceDetector;
+
+#define RATE 16000
+
+#define MAX_RMS_ERROR  1e-3  // dB; float sums of up to 64 k squares
+#define MAX_PEAK_ERROR 1e-4  // dB; float log10
+#define MAX_MISSED     0.02  // Of speech chunks, at the quieter noise level
+
+static int failures         = 0;
+static double bench_seconds = 0.2;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// xorshift32, so that a seed gives the same audio everywhere
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double frand(double lo, double hi) {
+    return lo + (hi - lo) * (rng() >> 8) / (double)(1 << 24);
+}
+
+// Roughly Gaussian, unit variance
+static double noise(void) {
+    return (frand(-1, 1) + frand(-1, 1) + frand(-1, 1) + frand(-1, 1)) * sqrt(0.75);
+}
+
+static int16_t clip(double x) {
+    x = floor(x + 0.5);
+    return x > 32767 ? 32767 : x < -32768 ? -32768 : (int16_t)x;
+}
+
+/* Levels */
+
+static double refDbfs(double amplitude) {
+    if (amplitude <= 0) {
+        return -100.0;
+    }
+    return fmax(-100.0, 20 * log10(amplitude / 32768.0));
+}
+
+static void refLevel(const int16_t* samples, size_t count, double* rms, double* peak, double* zcr) {
+    double energy = 0;
+    int hi        = 0;
+    size_t cross  = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        energy += (double)samples[i] * samples[i];
+        hi = std::max(hi, abs(samples[i]));
+        if (i > 0) {
+            cross += (samples[i] < 0) != (samples[i - 1] < 0);
+        }
+    }
+    *rms  = count ? refDbfs(sqrt(energy / count)) : -100.0;
+    *peak = refDbfs(hi);
+    *zcr  = count > 1 ? (double)cross / (count - 1) : 0.0;
+}
+
+static void fillBuffer(int16_t* samples, size_t count, int kind) {
+    double amplitude = pow(10, frand(-4, 0)) * 32768;
+    double step      = frand(0.001, 3.0);
+
+    for (size_t i = 0; i < count; i++) {
+        switch (kind) {
+            case 0:  // Full scale
+                samples[i] = (int16_t)rng();
+                break;
+            case 1:  // Noise at any level
+                samples[i] = clip(noise() * amplitude / 4);
+                break;
+            case 2:  // Tone
+                samples[i] = clip(amplitude * sin(step * i));
+                break;
+            case 3:  // Near silence, crossing zero often
+                samples[i] = (int16_t)(rng() % 7) - 3;
+                break;
+            case 4:  // Extremes
+                samples[i] = i % 2 ? 32767 : -32768;
+                break;
+            default:  // Constant
+                samples[i] = -32768;
+                break;
+        }
+    }
+}
+
+static void checkLevel(const int16_t* samples, size_t count, double* max_rms, double* max_peak, double* max_zcr) {
+    AudioLevel level;
+    double rms, peak, zcr;
+
+    measureAudioLevel(samples, count, &level);
+    refLevel(samples, count, &rms, &peak, &zcr);
+    *max_rms  = fmax(*max_rms, fabs(level.rms - rms));
+    *max_peak = fmax(*max_peak, fabs(level.peak - peak));
+    *max_zcr  = fmax(*max_zcr, fabs(level.zcr - zcr));
+}
+
+static void testLevels(int buffers) {
+    static const size_t edges[] = {0, 1, 2, 7, 8, 9, 15, 16, 17, 63, 64, 65};
+    std::vector<int16_t> samples(8 * 32767 * 2 + 100);
+    double max_rms = 0, max_peak = 0, max_zcr = 0;
+    char what[128];
+
+    for (size_t count : edges) {
+        for (int kind = 0; kind < 6; kind++) {
+            fillBuffer(samples.data(), count, kind);
+            checkLevel(samples.data(), count, &max_rms, &max_peak, &max_zcr);
+        }
+    }
+    for (int n = 0; n < buffers; n++) {
+        size_t count = rng() % 4000;
+        fillBuffer(samples.data(), count, rng() % 6);
+        checkLevel(samples.data(), count, &max_rms, &max_peak, &max_zcr);
+    }
+
+    // A crossing at every sample overflows 16-bit counters unless they
+    // are folded in time; also start the vector pass at an odd offset
+    fillBuffer(samples.data(), samples.size(), 4);
+    checkLevel(samples.data(), samples.size(), &max_rms, &max_peak, &max_zcr);
+    checkLevel(samples.data() + 1, samples.size() - 1, &max_rms, &max_peak, &max_zcr);
+    fillBuffer(samples.data(), samples.size(), 3);
+    checkLevel(samples.data(), samples.size(), &max_rms, &max_peak, &max_zcr);
+
+    printf("levels: %d buffers, max error rms %.6f dB, peak %.6f dB, zcr %.2g\n", buffers, max_rms, max_peak, max_zcr);
+    snprintf(what, sizeof(what), "rms within %g dB of the reference", MAX_RMS_ERROR);
+    check(max_rms <= MAX_RMS_ERROR, what);
+    snprintf(what, sizeof(what), "peak within %g dB of the reference", MAX_PEAK_ERROR);
+    check(max_peak <= MAX_PEAK_ERROR, what);
+    check(max_zcr <= 1e-6, "zero-crossing rate matches the reference");
+}
+
+/* Synthetic recording */
+
+struct Recording {
+    std::vector<int16_t> samples;
+    std::vector<bool> speech;  // Per sample, inside a syllable
+};
+
+// Room noise, a low-passed hiss, with mains hum 6 dB below it; and, a
+// quarter of the time, utterances of voiced syllables (harmonics of a
+// gliding pitch) and fricatives (high-passed noise), at -35 to -20 dBFS
+static Recording record(double seconds, double noise_dbfs, bool talk) {
+    const size_t count     = seconds * RATE;
+    const double noise_amp = pow(10, noise_dbfs / 20) * 32768;
+    Recording rec;
+    std::vector<double> x(count);
+    double lp = 0;
+
+    // The same speech at every noise level
+    rng_state = 1;
+
+    for (size_t i = 0; i < count; i++) {
+        lp   = 0.7 * lp + 0.3 * noise();
+        x[i] = noise_amp * (lp * 1.8 + 0.5 * sin(2 * M_PI * 50 * i / RATE) + 0.2 * sin(2 * M_PI * 150 * i / RATE));
+    }
+    rec.speech.assign(count, false);
+
+    size_t i = (size_t)(frand(1.0, 3.0) * RATE);
+    while (talk && i < count) {
+        size_t end       = std::min(count, i + (size_t)(frand(0.5, 2.5) * RATE));
+        double level     = 32768 * pow(10, frand(-35, -20) / 20);
+        double f0        = frand(100, 220);
+        double phase     = 0;
+        double prev      = 0;
+        size_t utterance = i;
+
+        while (i < end) {
+            bool fricative = rng() % 4 == 0;
+            size_t len     = (size_t)(frand(fricative ? 0.08 : 0.12, fricative ? 0.15 : 0.3) * RATE);
+            len            = std::min(len, count - i);
+            for (size_t k = 0; k < len; k++) {
+                double env = sin(M_PI * k / len);
+                double s   = 0;
+                if (fricative) {
+                    double n = noise();
+                    s        = 1.5 * (n - prev);
+                    prev     = n;
+                } else {
+                    phase += 2 * M_PI * f0 * (1 + 0.2 * k / len) / RATE;
+                    for (int h = 1; h <= 20; h++) {
+                        s += sin(h * phase) / h;
+                    }
+                }
+                x[i + k] += level * env * s;
+                rec.speech[i + k] = env > 0.2;
+            }
+            i += len + (size_t)(frand(0.02, 0.15) * RATE);
+        }
+        // Twice the utterance's length in silence, on average
+        i += (size_t)((i - utterance) * frand(1.5, 2.5));
+    }
+
+    rec.samples.resize(count);
+    for (size_t k = 0; k < count; k++) {
+        rec.samples[k] = clip(x[k]);
+    }
+    return rec;
+}
+
+// Runs the detector over the recording, chunk by chunk
+static std::vector<AudioLevel> detect(const Recording& rec, size_t chunk, float margin) {
+    VoiceDetector vad;
+    std::vector<AudioLevel> levels;
+
+    vad.setMargin(margin);
+    for (size_t i = 0; i + chunk <= rec.samples.size(); i += chunk) {
+        AudioLevel level;
+        vad.process(rec.samples.data() + i, chunk, chunk * 1000 / RATE, &level);
+        levels.push_back(level);
+    }
+    return levels;
+}
+
+/* Delivery */
+
+// Activity that changes at any chunk, unlike the detector's, which holds
+// it for the hangover; quiet chunks are steady, so that sid frames come
+// from the timer and the transitions
+static std::vector<AudioLevel> randomLevels(size_t count) {
+    std::vector<AudioLevel> levels(count);
+    bool active = false;
+
+    for (AudioLevel& level : levels) {
+        active       = rng() % 3 == 0 ? !active : active;
+        level.rms    = active ? frand(-40, -20) : -60;
+        level.peak   = level.rms + 10;
+        level.zcr    = 0;
+        level.active = active;
+    }
+    return levels;
+}
+
+// Stands in for audioFrame, with its reference counting; frames are kept
+// after their last release, so that a release too many is seen
+struct TestFrame {
+    static std::vector<TestFrame*> all;
+    static int over_released;
+
+    TestFrame() {
+        all.push_back(this);
+    }
+    void ref(int n = 1) {
+        refs += n;
+    }
+    void release() {
+        if (freed || refs <= 0) {
+            over_released++;
+            return;
+        }
+        freed = --refs == 0;
+    }
+
+    int chn           = 0;
+    int64_t timestamp = 0;  // Chunk number
+    AudioLevel level  = {};
+    bool sid          = false;
+    size_t size       = 0;
+    int refs          = 0;
+    bool freed        = false;
+};
+
+std::vector<TestFrame*> TestFrame::all;
+int TestFrame::over_released = 0;
+
+struct Consumer {
+    std::deque<TestFrame*> queue;
+    std::vector<int64_t> chunks;  // Chunk numbers handed over
+    std::vector<int64_t> sids;    // Chunks that brought a sid frame
+    size_t bytes = 0;
+};
+
+struct Replay {
+    std::vector<Consumer> consumers;
+    std::vector<int64_t> pushed;  // Chunks with consumers, the others were dropped
+    size_t total_bytes = 0;
+};
+
+// Replays the camera's delivery of the chunks to consumers with the given
+// options. Consumer i holds a frame for i chunks before releasing it,
+// every 13th hand-over finds a full message box, and with skip every 11th
+// chunk and the chunks in every fifth second have no consumers at all
+static Replay replay(const std::vector<AudioLevel>& levels, size_t chunk, const std::vector<int>& options, size_t count, bool skip) {
+    const int duration = chunk * 1000 / RATE;
+    Replay r;
+    size_t handovers = 0;
+
+    r.consumers.resize(count);
+    {
+        AudioGate<TestFrame> gate;
+
+        for (size_t k = 0; k < levels.size(); k++) {
+            if (skip && (k % 11 == 10 || (k * duration / 1000) % 5 == 4)) {
+                gate.drop(levels[k].active);
+                continue;
+            }
+
+            TestFrame* frame = new TestFrame();
+            frame->timestamp = k;
+            frame->level     = levels[k];
+            frame->size      = chunk * sizeof(int16_t);
+            r.pushed.push_back(k);
+            r.total_bytes += frame->size;
+            gate.push(frame, options, count, duration, [&](TestFrame* f, size_t i) {
+                Consumer& c = r.consumers[i];
+                if (f->sid) {
+                    c.sids.push_back(f->timestamp);
+                } else {
+                    c.chunks.push_back(f->timestamp);
+                    c.bytes += f->size;
+                }
+                if (++handovers % 13 == 0) {
+                    f->release();
+                } else {
+                    c.queue.push_back(f);
+                }
+            });
+
+            for (size_t i = 0; i < count; i++) {
+                Consumer& c = r.consumers[i];
+                while (c.queue.size() > i) {
+                    c.queue.front()->release();
+                    c.queue.pop_front();
+                }
+            }
+        }
+        gate.drop(false);
+    }
+
+    for (Consumer& c : r.consumers) {
+        for (TestFrame* f : c.queue) {
+            f->release();
+        }
+        c.queue.clear();
+    }
+    return r;
+}
+
+// The chunks a consumer with the option should have been handed
+static std::vector<int64_t> expectedChunks(const std::vector<AudioLevel>& levels, const std::vector<int64_t>& pushed, int option) {
+    std::vector<bool> was_pushed(levels.size(), false);
+    std::vector<int64_t> chunks;
+
+    for (int64_t k : pushed) {
+        was_pushed[k] = true;
+    }
+    for (int64_t k : pushed) {
+        if (!(option & AUDIO_ACTIVE_ONLY)) {
+            chunks.push_back(k);
+        } else if (levels[k].active) {
+            if (k > 0 && was_pushed[k - 1] && !levels[k - 1].active) {
+                chunks.push_back(k - 1);
+            }
+            chunks.push_back(k);
+        }
+    }
+    return chunks;
+}
+
+static void checkSids(const std::vector<AudioLevel>& levels, const std::vector<int64_t>& pushed, const Consumer& c, size_t chunk,
+                      const char* name) {
+    const size_t duration = chunk * 1000 / RATE;
+    const size_t interval = (1000 + duration - 1) / duration;
+    size_t next = 0, since = interval;
+    bool ok     = true;
+
+    for (int64_t k : pushed) {
+        bool sent = next < c.sids.size() && c.sids[next] == k;
+        next += sent;
+        if (levels[k].active) {
+            ok &= !sent;
+        } else {
+            // At the start of silence, and at least every second
+            ok &= sent || (!(k > 0 && levels[k - 1].active) && since < interval);
+        }
+        since = sent ? 1 : since + 1;
+    }
+    ok &= next == c.sids.size();
+
+    std::string what = std::string(name) + ": sid frames at the start of silence and every second, never in speech";
+    check(ok, what.c_str());
+}
+
+static void testDelivery(const std::vector<AudioLevel>& levels, size_t chunk, const char* source) {
+    static const struct {
+        const char* name;
+        std::vector<int> options;
+        size_t consumers;
+        bool skip;
+    } cases[] = {
+        {"all", {AUDIO_ALL}, 1, false},
+        {"active", {AUDIO_ACTIVE_ONLY}, 1, false},
+        {"comfort", {AUDIO_ACTIVE_ONLY | AUDIO_COMFORT_NOISE}, 1, false},
+        {"mixed", {AUDIO_ALL, AUDIO_ACTIVE_ONLY, AUDIO_ACTIVE_ONLY | AUDIO_COMFORT_NOISE, AUDIO_ACTIVE_ONLY}, 4, false},
+        {"mixed, gaps", {AUDIO_ACTIVE_ONLY | AUDIO_COMFORT_NOISE, AUDIO_ALL, AUDIO_ACTIVE_ONLY}, 3, true},
+        {"short options", {AUDIO_ACTIVE_ONLY}, 3, true},
+    };
+
+    for (const auto& t : cases) {
+        Replay r = replay(levels, chunk, t.options, t.consumers, t.skip);
+        bool ok  = true;
+
+        for (size_t i = 0; i < t.consumers; i++) {
+            int option = i < t.options.size() ? t.options[i] : AUDIO_ALL;
+            ok &= r.consumers[i].chunks == expectedChunks(levels, r.pushed, option);
+            if (option & AUDIO_COMFORT_NOISE) {
+                checkSids(levels, r.pushed, r.consumers[i], chunk, t.name);
+            } else {
+                ok &= r.consumers[i].sids.empty();
+            }
+        }
+        std::string what = std::string(t.name) + ": each consumer gets the chunks its option calls for";
+        check(ok, what.c_str());
+
+        size_t live = 0;
+        for (TestFrame* f : TestFrame::all) {
+            live += !f->freed;
+            delete f;
+        }
+        TestFrame::all.clear();
+        printf("delivery %-8s %-14s %zu chunks, %zu consumers: %zu frames left with references, %d released too often\n", source,
+               t.name, levels.size(), t.consumers, live, TestFrame::over_released);
+        what = std::string(t.name) + ": every frame released exactly once per reference";
+        check(live == 0 && TestFrame::over_released == 0, what.c_str());
+        TestFrame::over_released = 0;
+    }
+}
+
+/* Savings */
+
+// Bytes a consumer of active audio gets, pre-roll included, and the
+// speech chunks it misses; a chunk is speech when a quarter of it is
+static void testSavings(size_t chunk) {
+    static const struct {
+        double noise_dbfs;
+        float margin;
+    } cases[] = {{-55, 9}, {-42, 9}, {-42, 6}};
+
+    for (const auto& t : cases) {
+        Recording rec                  = record(120, t.noise_dbfs, true);
+        std::vector<AudioLevel> levels = detect(rec, chunk, t.margin);
+        Replay r                       = replay(levels, chunk, {AUDIO_ACTIVE_ONLY}, 1, false);
+        std::vector<bool> delivered(levels.size(), false);
+        size_t speech = 0, missed = 0;
+
+        for (int64_t k : r.consumers[0].chunks) {
+            delivered[k] = true;
+        }
+        for (size_t k = 0; k < levels.size(); k++) {
+            size_t n = 0;
+            for (size_t i = k * chunk; i < (k + 1) * chunk; i++) {
+                n += rec.speech[i];
+            }
+            if (n * 4 >= chunk) {
+                speech++;
+                missed += !delivered[k];
+            }
+        }
+        for (TestFrame* f : TestFrame::all) {
+            delete f;
+        }
+        TestFrame::all.clear();
+
+        double saved = 1.0 - (double)r.consumers[0].bytes / r.total_bytes;
+        printf("noise %.0f dBFS, margin %.0f dB: %.1f%% of speech chunks, %.1f%% of bytes saved, %zu of %zu speech chunks missed (%.1f%%)\n",
+               t.noise_dbfs, t.margin, 100.0 * speech / levels.size(), 100 * saved, missed, speech, 100.0 * missed / speech);
+        if (t.noise_dbfs == -55) {
+            char what[128];
+            snprintf(what, sizeof(what), "at most %.0f%% of speech missed at %.0f dBFS noise", 100 * MAX_MISSED, t.noise_dbfs);
+            check(missed <= MAX_MISSED * speech, what);
+            check(saved > 0.5, "half of the bytes saved with speech a quarter of the time");
+        }
+    }
+
+    for (double noise_dbfs : {-55.0, -42.0}) {
+        Recording rec                  = record(60, noise_dbfs, false);
+        std::vector<AudioLevel> levels = detect(rec, chunk, 9);
+        size_t active                  = 0;
+
+        for (const AudioLevel& level : levels) {
+            active += level.active;
+        }
+        printf("noise %.0f dBFS only, %zu chunks: %zu active\n", noise_dbfs, levels.size(), active);
+        check(active == 0, "no activity in noise alone");
+    }
+}
+
+/* Cost */
+
+static void bench(size_t chunk) {
+    Recording rec   = record(10, -50, true);
+    size_t chunks   = rec.samples.size() / chunk;
+    volatile double sink = 0;
+    double t0, elapsed;
+    size_t n;
+
+    printf("\ncost per %zu-sample chunk:\n", chunk);
+
+    n  = 0;
+    t0 = now();
+    do {
+        double rms, peak, zcr;
+        refLevel(rec.samples.data() + n % chunks * chunk, chunk, &rms, &peak, &zcr);
+        sink = sink + rms;
+        n++;
+    } while ((elapsed = now() - t0) < bench_seconds);
+    printf("  double reference      %8.0f ns\n", elapsed / n * 1e9);
+
+    n  = 0;
+    t0 = now();
+    do {
+        AudioLevel level;
+        measureAudioLevel(rec.samples.data() + n % chunks * chunk, chunk, &level);
+        sink = sink + level.rms;
+        n++;
+    } while ((elapsed = now() - t0) < bench_seconds);
+    printf("  measureAudioLevel     %8.0f ns\n", elapsed / n * 1e9);
+
+    VoiceDetector vad;
+    n  = 0;
+    t0 = now();
+    do {
+        AudioLevel level;
+        vad.process(rec.samples.data() + n % chunks * chunk, chunk, chunk * 1000 / RATE, &level);
+        sink = sink + level.active;
+        n++;
+    } while ((elapsed = now() - t0) < bench_seconds);
+    printf("  VoiceDetector         %8.0f ns\n", elapsed / n * 1e9);
+
+    // Delivery to three consumers that release at once, without the copy
+    std::vector<AudioLevel> levels = detect(rec, chunk, 9);
+    std::vector<int> options       = {AUDIO_ALL, AUDIO_ACTIVE_ONLY, AUDIO_ACTIVE_ONLY | AUDIO_COMFORT_NOISE};
+    {
+        AudioGate<TestFrame> gate;
+        n  = 0;
+        t0 = now();
+        do {
+            TestFrame* frame = new TestFrame();
+            frame->level     = levels[n % levels.size()];
+            gate.push(frame, options, options.size(), chunk * 1000 / RATE, [](TestFrame* f, size_t) { f->release(); });
+            n++;
+            if (TestFrame::all.size() >= 4096) {
+                // Keep the pre-roll, which the gate still holds
+                for (TestFrame*& f : TestFrame::all) {
+                    if (f->freed) {
+                        delete f;
+                        f = nullptr;
+                    }
+                }
+                TestFrame::all.erase(std::remove(TestFrame::all.begin(), TestFrame::all.end(), nullptr), TestFrame::all.end());
+            }
+        } while ((elapsed = now() - t0) < bench_seconds);
+        printf("  AudioGate, 3 consumers %7.0f ns\n", elapsed / n * 1e9);
+    }
+    for (TestFrame* f : TestFrame::all) {
+        delete f;
+    }
+    TestFrame::all.clear();
+    (void)sink;
+}
+
+static void usage(const char* name) {
+    printf("Usage: %s [-c samples] [-n buffers] [-q] [-t seconds]\n", name);
+    printf("  -c samples  Samples per chunk (default: 1600, 100 ms)\n");
+    printf("  -n buffers  Random buffers for the level check (default: 20000)\n");
+    printf("  -q          Checks only, no benchmarks\n");
+    printf("  -t seconds  Time to run each benchmark (default: 0.2)\n");
+}
+
+int main(int argc, char** argv) {
+    size_t chunk      = RATE / 10;
+    int buffers       = 20000;
+    bool quality_only = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:qt:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                chunk = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                buffers = atoi(optarg);
+                break;
+            case 'q':
+                quality_only = true;
+                break;
+            case 't':
+                bench_seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (chunk < RATE / 100 || chunk > RATE) {
+        fprintf(stderr, "chunk must be 10 ms to 1 s of samples\n");
+        return 1;
+    }
+
+    testLevels(buffers);
+
+    Recording rec = record(120, -50, true);
+    testDelivery(detect(rec, chunk, 9), chunk, "detector");
+    testDelivery(randomLevels(2000), chunk, "random");
+
+    testSavings(chunk);
+    if (!quality_only) {
+        bench(chunk);
+    }
+
+    printf("\n%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}